@@ -64,9 +64,8 @@ async_network_destructor(void)
     pthread_mutex_destroy(&lock);
 }
 
-static
 int32_t
-get_pp_errno(void)
+async_network_get_pp_errno(void)
 {
     int retval = PP_ERROR_FAILED;
     switch (errno) {
@@ -166,7 +165,7 @@ handle_tcp_connect_stage4(int sock, short event_flags, void *arg)
 
     // no addresses left, fail gracefully
     trace_warning("%s, connection failed to all addresses\n", __func__);
-    ppb_core_call_on_main_thread(0, task->callback, get_pp_errno());
+    ppb_core_call_on_main_thread(0, task->callback, async_network_get_pp_errno());
     pp_resource_release(task->resource);
     free(task->addr);
     task_destroy(task);
@@ -199,7 +198,7 @@ handle_tcp_connect_stage3(struct async_network_task_s *task)
 
     if (res != 0 && errno != EINPROGRESS) {
         trace_error("%s, res = %d, errno = %d\n", __func__, res, errno);
-        ppb_core_call_on_main_thread(0, task->callback, get_pp_errno());
+        ppb_core_call_on_main_thread(0, task->callback, async_network_get_pp_errno());
         free(task->addr);
         task_destroy(task);
         return;
@@ -282,76 +281,6 @@ handle_tcp_connect_with_net_address(struct async_network_task_s *task)
     }
 }
 
-static
-void
-handle_tcp_read_stage2(int sock, short event_flags, void *arg)
-{
-    struct async_network_task_s *task = arg;
-    int32_t retval;
-
-    retval = recv(sock, task->buffer, task->bufsize, 0);
-    if (retval < 0)
-        retval = get_pp_errno();
-    else if (retval == 0) {
-        struct pp_tcp_socket_s *ts = pp_resource_acquire(task->resource, PP_RESOURCE_TCP_SOCKET);
-        if (ts) {
-            ts->seen_eof = 1;
-            pp_resource_release(task->resource);
-        }
-    }
-
-    ppb_core_call_on_main_thread(0, task->callback, retval);
-    task_destroy(task);
-}
-
-static
-void
-handle_tcp_read_stage1(struct async_network_task_s *task)
-{
-    struct pp_tcp_socket_s *ts = pp_resource_acquire(task->resource, PP_RESOURCE_TCP_SOCKET);
-    if (!ts) {
-        trace_error("%s, bad resource\n", __func__);
-        task_destroy(task);
-        return;
-    }
-
-    struct event *ev = event_new(event_b, ts->sock, EV_READ, handle_tcp_read_stage2, task);
-    pp_resource_release(task->resource);
-    add_event_mapping(task, ev);
-    event_add(ev, NULL);
-}
-
-static
-void
-handle_tcp_write_stage2(int sock, short event_flags, void *arg)
-{
-    struct async_network_task_s *task = arg;
-
-    int32_t retval = send(sock, task->buffer, task->bufsize, 0);
-    if (retval < 0)
-        retval = get_pp_errno();
-
-    ppb_core_call_on_main_thread(0, task->callback, retval);
-    task_destroy(task);
-}
-
-static
-void
-handle_tcp_write_stage1(struct async_network_task_s *task)
-{
-    struct pp_tcp_socket_s *ts = pp_resource_acquire(task->resource, PP_RESOURCE_TCP_SOCKET);
-    if (!ts) {
-        trace_error("%s, bad resource\n", __func__);
-        task_destroy(task);
-        return;
-    }
-
-    struct event *ev = event_new(event_b, ts->sock, EV_WRITE, handle_tcp_write_stage2, task);
-    pp_resource_release(task->resource);
-    add_event_mapping(task, ev);
-    event_add(ev, NULL);
-}
-
 static
 void
 handle_tcp_disconnect_stage2(int sock, short event_flags, void *arg)
@@ -359,6 +288,9 @@ handle_tcp_disconnect_stage2(int sock, short event_flags, void *arg)
     struct async_network_task_s *task = arg;
     GHashTableIter iter;
     gpointer key, val;
+    GArray *ccbs = g_array_new(FALSE, FALSE, sizeof(struct PP_CompletionCallback));
+    GArray *results = g_array_new(FALSE, FALSE, sizeof(int32_t));
+    const int32_t aborted = PP_ERROR_ABORTED;
 
     pthread_mutex_lock(&lock);
     g_hash_table_iter_init(&iter, tasks_ht);
@@ -367,12 +299,19 @@ handle_tcp_disconnect_stage2(int sock, short event_flags, void *arg)
         if (cur->resource == task->resource) {
             g_hash_table_iter_remove(&iter);
             event_free(cur->event);
-            ppb_core_call_on_main_thread(0, cur->callback, PP_ERROR_ABORTED);
+            g_array_append_val(ccbs, cur->callback);
+            g_array_append_val(results, aborted);
             g_slice_free(struct async_network_task_s, cur);
         }
     }
     pthread_mutex_unlock(&lock);
 
+    // all pending operations of the socket are aborted with a single main loop wakeup
+    ppb_core_call_on_main_thread_batch((struct PP_CompletionCallback *)ccbs->data,
+                                       (int32_t *)results->data, ccbs->len);
+    g_array_free(ccbs, TRUE);
+    g_array_free(results, TRUE);
+
     close(task->sock);
     task_destroy(task);
 }
@@ -420,11 +359,5 @@ async_network_task_push(struct async_network_task_s *task)
     case ASYNC_NETWORK_TCP_DISCONNECT:
         handle_tcp_disconnect_stage1(task);
         break;
-    case ASYNC_NETWORK_TCP_READ:
-        handle_tcp_read_stage1(task);
-        break;
-    case ASYNC_NETWORK_TCP_WRITE:
-        handle_tcp_write_stage1(task);
-        break;
     }
 }
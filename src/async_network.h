@@ -35,8 +35,6 @@ enum async_network_task_type_e {
     ASYNC_NETWORK_TCP_CONNECT,
     ASYNC_NETWORK_TCP_CONNECT_WITH_NETADDRESS,
     ASYNC_NETWORK_TCP_DISCONNECT,
-    ASYNC_NETWORK_TCP_READ,
-    ASYNC_NETWORK_TCP_WRITE,
 };
 
 struct async_network_task_s {
@@ -47,8 +45,6 @@ struct async_network_task_s {
     char                           *host;
     uint16_t                        port;
     struct PP_NetAddress_Private    netaddr;
-    char                           *buffer;
-    int32_t                         bufsize;
     int                             sock;
 
     // private fields
@@ -65,4 +61,8 @@ async_network_task_push(struct async_network_task_s *task);
 struct async_network_task_s *
 async_network_task_create(void);
 
+/// converts errno of failed socket call to PP_ERROR_* code
+int32_t
+async_network_get_pp_errno(void);
+
 #endif // FPP_ASYNC_NETWORK_H
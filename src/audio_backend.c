@@ -0,0 +1,52 @@
+/*
+ * Copyright © 2013-2014  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "audio_backend.h"
+#include "config.h"
+#include "trace.h"
+#include <string.h>
+
+
+static const struct audio_backend_s *backends[] = {
+    &audio_backend_alsa,
+    &audio_backend_null,
+    &audio_backend_wav,
+};
+
+const struct audio_backend_s *
+audio_backend_get(void)
+{
+    const char *name = config.audio_backend;
+    if (!name)
+        return backends[0];
+
+    for (unsigned int k = 0; k < sizeof(backends) / sizeof(backends[0]); k ++) {
+        if (strcmp(backends[k]->name, name) == 0)
+            return backends[k];
+    }
+
+    trace_warning("%s, unknown audio backend \"%s\", using \"%s\"\n", __func__, name,
+                  backends[0]->name);
+    return backends[0];
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright © 2013-2014  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef FPP_AUDIO_BACKEND_H
+#define FPP_AUDIO_BACKEND_H
+
+#include <stdint.h>
+#include "audio_resampler.h"
+
+
+/// Audio output backends. All streams are interleaved stereo, in one of audio_format_e sample
+/// formats. Stream is driven from a single thread; backends need no locking of their own.
+
+struct audio_stream_s;
+
+struct audio_backend_s {
+    const char     *name;
+
+    /// opens playback stream. |sample_rate|, |format|, and |period_frames| are requested
+    /// values, backend replaces them with what it actually uses. Returns NULL on failure
+    struct audio_stream_s  *(*open)(unsigned int *sample_rate, enum audio_format_e *format,
+                                    unsigned int *period_frames);
+
+    /// waits until at least one period can be written, or |timeout_ms| passes. Returns number
+    /// of frames that can be written without blocking, or negative error code. Errors are
+    /// recovered from by backend itself, so caller should just try again
+    int                     (*wait_avail)(struct audio_stream_s *s, int timeout_ms);
+
+    /// returns number of frames written, or negative error code
+    int                     (*write)(struct audio_stream_s *s, const void *data, int frames);
+
+    /// optional zero-copy alternative to write(). Gives pointer to contiguous part of device
+    /// buffer, at most |frames| frames long, and updates |frames| to its length. Returns
+    /// -ENOSYS if stream can't be accessed that way, other negative codes are errors as above
+    int                     (*mmap_begin)(struct audio_stream_s *s, void **area, int *frames);
+
+    /// hands |frames| frames from area returned by mmap_begin() over to device
+    int                     (*mmap_commit)(struct audio_stream_s *s, int frames);
+
+    /// number of frames written, but not yet played
+    int64_t                 (*get_delay)(struct audio_stream_s *s);
+
+    void                    (*close)(struct audio_stream_s *s);
+};
+
+extern const struct audio_backend_s audio_backend_alsa;
+extern const struct audio_backend_s audio_backend_null;
+extern const struct audio_backend_s audio_backend_wav;
+
+/// returns backend selected by "audio_backend" configuration option
+const struct audio_backend_s *
+audio_backend_get(void);
+
+#endif // FPP_AUDIO_BACKEND_H
@@ -0,0 +1,231 @@
+/*
+ * Copyright © 2013-2014  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "audio_backend.h"
+#include "config.h"
+#include "trace.h"
+#include "eintr_retry.h"
+#include <asoundlib.h>
+#include <errno.h>
+#include <glib.h>
+
+
+struct audio_stream_s {
+    snd_pcm_t          *ph;
+    int                 mmap;           ///< opened with mmap access
+    snd_pcm_uframes_t   mmap_offset;    ///< from the last snd_pcm_mmap_begin()
+};
+
+static
+snd_pcm_format_t
+alsa_format(enum audio_format_e format)
+{
+    switch (format) {
+    case AUDIO_FORMAT_S32:      return SND_PCM_FORMAT_S32_LE;
+    case AUDIO_FORMAT_FLOAT:    return SND_PCM_FORMAT_FLOAT_LE;
+    case AUDIO_FORMAT_S16:
+    default:                    return SND_PCM_FORMAT_S16_LE;
+    }
+}
+
+static
+struct audio_stream_s *
+alsa_open(unsigned int *sample_rate, enum audio_format_e *format, unsigned int *period_frames)
+{
+    struct audio_stream_s *s = g_slice_alloc0(sizeof(*s));
+    snd_pcm_hw_params_t *hw_params = NULL;
+    snd_pcm_sw_params_t *sw_params = NULL;
+
+#define CHECK_A(funcname, params)                                                       \
+    do {                                                                                \
+        int errcode___ = funcname params;                                               \
+        if (errcode___ < 0) {                                                           \
+            trace_error("%s, " #funcname ", %s\n", __func__, snd_strerror(errcode___)); \
+            goto err;                                                                   \
+        }                                                                               \
+    } while (0)
+
+    CHECK_A(snd_pcm_open, (&s->ph, "default", SND_PCM_STREAM_PLAYBACK, 0));
+    CHECK_A(snd_pcm_hw_params_malloc, (&hw_params));
+    CHECK_A(snd_pcm_hw_params_any, (s->ph, hw_params));
+
+    // mmap lets samples go straight into device buffer, but not all devices support it
+    if (snd_pcm_hw_params_set_access(s->ph, hw_params, SND_PCM_ACCESS_MMAP_INTERLEAVED) == 0) {
+        s->mmap = 1;
+    } else {
+        CHECK_A(snd_pcm_hw_params_set_access,
+                (s->ph, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED));
+    }
+
+    // requested format first, then whatever else device may take
+    const enum audio_format_e formats[] = { *format, AUDIO_FORMAT_S16, AUDIO_FORMAT_FLOAT,
+                                            AUDIO_FORMAT_S32 };
+    unsigned int k;
+    for (k = 0; k < sizeof(formats) / sizeof(formats[0]); k ++) {
+        if (snd_pcm_hw_params_test_format(s->ph, hw_params, alsa_format(formats[k])) == 0)
+            break;
+    }
+    if (k == sizeof(formats) / sizeof(formats[0])) {
+        trace_error("%s, no supported sample format\n", __func__);
+        goto err;
+    }
+    *format = formats[k];
+    CHECK_A(snd_pcm_hw_params_set_format, (s->ph, hw_params, alsa_format(*format)));
+
+    if (config.audio_resampler_quality >= 0) {
+        // rate conversion is done in-process, device should run at its native rate
+        CHECK_A(snd_pcm_hw_params_set_rate_resample, (s->ph, hw_params, 0));
+    }
+    CHECK_A(snd_pcm_hw_params_set_rate_near, (s->ph, hw_params, sample_rate, 0));
+    CHECK_A(snd_pcm_hw_params_set_channels, (s->ph, hw_params, 2));
+
+    snd_pcm_uframes_t period_size = *period_frames;
+    int dir = 1;
+    CHECK_A(snd_pcm_hw_params_set_period_size_near, (s->ph, hw_params, &period_size, &dir));
+
+    snd_pcm_uframes_t buffer_size = 4 * period_size;
+    CHECK_A(snd_pcm_hw_params_set_buffer_size_near, (s->ph, hw_params, &buffer_size));
+    CHECK_A(snd_pcm_hw_params, (s->ph, hw_params));
+
+    dir = 0;
+    CHECK_A(snd_pcm_hw_params_get_period_size, (hw_params, &period_size, &dir));
+    *period_frames = period_size;
+
+    CHECK_A(snd_pcm_sw_params_malloc, (&sw_params));
+    CHECK_A(snd_pcm_sw_params_current, (s->ph, sw_params));
+    CHECK_A(snd_pcm_sw_params, (s->ph, sw_params));
+    CHECK_A(snd_pcm_prepare, (s->ph));
+
+#undef CHECK_A
+
+    snd_pcm_hw_params_free(hw_params);
+    snd_pcm_sw_params_free(sw_params);
+    return s;
+
+err:
+    if (hw_params)
+        snd_pcm_hw_params_free(hw_params);
+    if (sw_params)
+        snd_pcm_sw_params_free(sw_params);
+    if (s->ph)
+        snd_pcm_close(s->ph);
+    g_slice_free1(sizeof(*s), s);
+    return NULL;
+}
+
+static
+int
+alsa_wait_avail(struct audio_stream_s *s, int timeout_ms)
+{
+    snd_pcm_wait(s->ph, timeout_ms);
+    snd_pcm_sframes_t avail = snd_pcm_avail(s->ph);
+    if (avail < 0) {
+        trace_warning("%s, snd_pcm_avail error %d\n", __func__, (int)avail);
+        RETRY_ON_EINTR(snd_pcm_recover(s->ph, avail, 1));
+    }
+    return avail;
+}
+
+static
+int
+alsa_write(struct audio_stream_s *s, const void *data, int frames)
+{
+    snd_pcm_sframes_t written = s->mmap ? snd_pcm_mmap_writei(s->ph, data, frames)
+                                        : snd_pcm_writei(s->ph, data, frames);
+    if (written < 0) {
+        trace_warning("%s, snd_pcm_writei error %d\n", __func__, (int)written);
+        RETRY_ON_EINTR(snd_pcm_recover(s->ph, written, 1));
+    }
+    return written;
+}
+
+static
+int
+alsa_mmap_begin(struct audio_stream_s *s, void **area, int *frames)
+{
+    if (!s->mmap)
+        return -ENOSYS;
+
+    const snd_pcm_channel_area_t *areas;
+    snd_pcm_uframes_t frame_cnt = *frames;
+    int err = snd_pcm_mmap_begin(s->ph, &areas, &s->mmap_offset, &frame_cnt);
+    if (err < 0) {
+        trace_warning("%s, snd_pcm_mmap_begin error %d\n", __func__, err);
+        RETRY_ON_EINTR(snd_pcm_recover(s->ph, err, 1));
+        return err;
+    }
+
+    // interleaved, so the first channel area describes whole frames
+    *area = (char *)areas[0].addr + areas[0].first / 8 + s->mmap_offset * areas[0].step / 8;
+    *frames = frame_cnt;
+    return 0;
+}
+
+static
+int
+alsa_mmap_commit(struct audio_stream_s *s, int frames)
+{
+    snd_pcm_sframes_t committed = snd_pcm_mmap_commit(s->ph, s->mmap_offset, frames);
+    if (committed < 0 || committed != frames) {
+        int err = committed < 0 ? (int)committed : -EPIPE;
+        trace_warning("%s, snd_pcm_mmap_commit error %d\n", __func__, err);
+        RETRY_ON_EINTR(snd_pcm_recover(s->ph, err, 1));
+        return err;
+    }
+
+    // unlike snd_pcm_writei(), commit doesn't always start the stream
+    if (snd_pcm_state(s->ph) == SND_PCM_STATE_PREPARED)
+        snd_pcm_start(s->ph);
+
+    return committed;
+}
+
+static
+int64_t
+alsa_get_delay(struct audio_stream_s *s)
+{
+    snd_pcm_sframes_t delay;
+    if (snd_pcm_delay(s->ph, &delay) < 0)
+        return 0;
+    return MAX(delay, 0);
+}
+
+static
+void
+alsa_close(struct audio_stream_s *s)
+{
+    snd_pcm_close(s->ph);
+    g_slice_free1(sizeof(*s), s);
+}
+
+const struct audio_backend_s audio_backend_alsa = {
+    .name =         "alsa",
+    .open =         alsa_open,
+    .wait_avail =   alsa_wait_avail,
+    .write =        alsa_write,
+    .mmap_begin =   alsa_mmap_begin,
+    .mmap_commit =  alsa_mmap_commit,
+    .get_delay =    alsa_get_delay,
+    .close =        alsa_close,
+};
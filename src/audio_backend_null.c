@@ -0,0 +1,274 @@
+/*
+ * Copyright © 2013-2014  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Sinks which play nothing. Both consume data at the pace a real device would, using monotonic
+// clock, so audio callback timing stays realistic without sound hardware. "wav" sink also
+// saves everything it gets into a WAV file.
+
+#include "audio_backend.h"
+#include "config.h"
+#include "trace.h"
+#include "eintr_retry.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <glib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#define BUFFER_PERIODS      4
+#define WAV_PCM_HEADER_SIZE     44
+#define WAV_FLOAT_HEADER_SIZE   58  ///< non-PCM formats need cbSize in "fmt " and "fact" chunk
+#define WAV_MAX_HEADER_SIZE     WAV_FLOAT_HEADER_SIZE
+
+struct audio_stream_s {
+    unsigned int    sample_rate;
+    enum audio_format_e format;
+    unsigned int    frame_size;
+    unsigned int    period_frames;
+    int64_t         buffer_frames;
+    struct timespec start;          ///< when first of |written| frames started to play
+    int64_t         written;        ///< frames written since |start|
+    int             fd;             ///< WAV file, or -1
+    unsigned int    header_size;    ///< size of WAV header, data goes right after it
+    uint64_t        data_bytes;     ///< bytes written to WAV file
+};
+
+static
+int64_t
+elapsed_ns(const struct timespec *since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * (int64_t)1000000000 + (now.tv_nsec - since->tv_nsec);
+}
+
+/// frames written, but not yet "played"
+static
+int64_t
+get_queued(struct audio_stream_s *s)
+{
+    if (s->written == 0)
+        return 0;
+
+    int64_t played = elapsed_ns(&s->start) * s->sample_rate / 1000000000;
+    int64_t queued = s->written - played;
+    if (queued < 0) {
+        // underrun; playback restarts on next write, the same way it does on a device
+        s->written = 0;
+        return 0;
+    }
+    return queued;
+}
+
+static
+void
+put_le(uint8_t *p, uint32_t value, int size)
+{
+    for (int k = 0; k < size; k ++)
+        p[k] = (value >> (8 * k)) & 0xff;
+}
+
+/// fills |s->header_size| bytes of |hdr|
+static
+void
+fill_wav_header(uint8_t *hdr, struct audio_stream_s *s)
+{
+    const int is_float = (s->format == AUDIO_FORMAT_FLOAT);
+    const uint32_t data_size = MIN(s->data_bytes, UINT32_MAX - s->header_size);
+    uint8_t *p = hdr;
+
+    memcpy(p + 0, "RIFF", 4);
+    put_le(p + 4, data_size + s->header_size - 8, 4);
+    memcpy(p + 8, "WAVEfmt ", 8);
+    put_le(p + 16, is_float ? 18 : 16, 4);                      // fmt chunk size
+    put_le(p + 20, is_float ? 3 : 1, 2);                        // IEEE float or PCM
+    put_le(p + 22, 2, 2);                                       // channels
+    put_le(p + 24, s->sample_rate, 4);
+    put_le(p + 28, s->sample_rate * s->frame_size, 4);          // byte rate
+    put_le(p + 32, s->frame_size, 2);                           // block align
+    put_le(p + 34, s->frame_size / 2 * 8, 2);                   // bits per sample
+    p += 36;
+
+    if (is_float) {
+        put_le(p, 0, 2);                                        // cbSize
+        memcpy(p + 2, "fact", 4);
+        put_le(p + 6, 4, 4);
+        put_le(p + 10, data_size / s->frame_size, 4);           // frames per channel
+        p += 14;
+    }
+
+    memcpy(p, "data", 4);
+    put_le(p + 4, data_size, 4);
+}
+
+static
+int
+write_all(int fd, const void *data, size_t len, off_t ofs)
+{
+    while (len > 0) {
+        ssize_t ret = RETRY_ON_EINTR(pwrite(fd, data, len, ofs));
+        if (ret < 0)
+            return -1;
+        data = (const char *)data + ret;
+        len -= ret;
+        ofs += ret;
+    }
+    return 0;
+}
+
+static
+struct audio_stream_s *
+do_open(unsigned int *sample_rate, enum audio_format_e *format, unsigned int *period_frames,
+        int with_file)
+{
+    struct audio_stream_s *s = g_slice_alloc0(sizeof(*s));
+    s->sample_rate = *sample_rate;
+    s->format = *format;
+    s->frame_size = 2 * audio_format_sample_size(*format);
+    s->period_frames = MAX(*period_frames, 1);
+    s->buffer_frames = BUFFER_PERIODS * s->period_frames;
+    s->fd = -1;
+    s->header_size = (s->format == AUDIO_FORMAT_FLOAT) ? WAV_FLOAT_HEADER_SIZE
+                                                       : WAV_PCM_HEADER_SIZE;
+    *period_frames = s->period_frames;
+
+    if (!with_file)
+        return s;
+
+    static int file_seq = 0;
+    char *fname = g_strdup_printf("%s-%d-%d.wav", config.audio_wav_path, (int)getpid(),
+                                  __atomic_fetch_add(&file_seq, 1, __ATOMIC_RELAXED));
+    s->fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (s->fd < 0) {
+        trace_error("%s, can't open %s, %s\n", __func__, fname, strerror(errno));
+        g_free(fname);
+        g_slice_free1(sizeof(*s), s);
+        return NULL;
+    }
+
+    uint8_t hdr[WAV_MAX_HEADER_SIZE];
+    fill_wav_header(hdr, s);
+    if (write_all(s->fd, hdr, s->header_size, 0) != 0)
+        trace_warning("%s, can't write to %s, %s\n", __func__, fname, strerror(errno));
+
+    trace_info("%s, writing audio to %s\n", __func__, fname);
+    g_free(fname);
+    return s;
+}
+
+static
+struct audio_stream_s *
+null_open(unsigned int *sample_rate, enum audio_format_e *format, unsigned int *period_frames)
+{
+    return do_open(sample_rate, format, period_frames, 0);
+}
+
+static
+struct audio_stream_s *
+wav_open(unsigned int *sample_rate, enum audio_format_e *format, unsigned int *period_frames)
+{
+    return do_open(sample_rate, format, period_frames, 1);
+}
+
+static
+int
+null_wait_avail(struct audio_stream_s *s, int timeout_ms)
+{
+    int64_t avail = s->buffer_frames - get_queued(s);
+    if (avail >= s->period_frames)
+        return avail;
+
+    // sleep until enough frames are played to free one period
+    int64_t sleep_ns = (s->period_frames - avail) * (int64_t)1000000000 / s->sample_rate;
+    sleep_ns = MIN(sleep_ns, (int64_t)timeout_ms * 1000000);
+
+    struct timespec t = { .tv_sec = sleep_ns / 1000000000, .tv_nsec = sleep_ns % 1000000000 };
+    while (clock_nanosleep(CLOCK_MONOTONIC, 0, &t, &t) == EINTR) {
+        // continue sleeping for the remaining time
+    }
+
+    return s->buffer_frames - get_queued(s);
+}
+
+static
+int
+null_write(struct audio_stream_s *s, const void *data, int frames)
+{
+    frames = MIN(frames, s->buffer_frames - get_queued(s));
+    if (frames <= 0)
+        return 0;
+
+    if (s->written == 0)
+        clock_gettime(CLOCK_MONOTONIC, &s->start);
+    s->written += frames;
+
+    if (s->fd >= 0) {
+        size_t len = (size_t)frames * s->frame_size;
+        if (write_all(s->fd, data, len, s->header_size + s->data_bytes) == 0)
+            s->data_bytes += len;
+    }
+
+    return frames;
+}
+
+static
+int64_t
+null_get_delay(struct audio_stream_s *s)
+{
+    return get_queued(s);
+}
+
+static
+void
+null_close(struct audio_stream_s *s)
+{
+    if (s->fd >= 0) {
+        // now sizes are known
+        uint8_t hdr[WAV_MAX_HEADER_SIZE];
+        fill_wav_header(hdr, s);
+        write_all(s->fd, hdr, s->header_size, 0);
+        close(s->fd);
+    }
+    g_slice_free1(sizeof(*s), s);
+}
+
+const struct audio_backend_s audio_backend_null = {
+    .name =         "null",
+    .open =         null_open,
+    .wait_avail =   null_wait_avail,
+    .write =        null_write,
+    .get_delay =    null_get_delay,
+    .close =        null_close,
+};
+
+const struct audio_backend_s audio_backend_wav = {
+    .name =         "wav",
+    .open =         wav_open,
+    .wait_avail =   null_wait_avail,
+    .write =        null_write,
+    .get_delay =    null_get_delay,
+    .close =        null_close,
+};
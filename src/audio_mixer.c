@@ -0,0 +1,394 @@
+/*
+ * Copyright © 2013-2014  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "audio_mixer.h"
+#include "audio_backend.h"
+#include "audio_resampler.h"
+#include "config.h"
+#include "trace.h"
+#include <errno.h>
+#include <glib.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+// length of gain ramps, applied on every change, including source addition and removal
+#define FADE_MS             5
+#define REMOVE_TIMEOUT_MS   2000
+
+struct audio_mixer_s {
+    pthread_mutex_t                 open_lock;  ///< serializes acquire and release
+    pthread_mutex_t                 lock;
+    pthread_cond_t                  cond;       ///< sources added or removed
+    int                             refcount;
+    const struct audio_backend_s   *backend;
+    struct audio_stream_s          *stream;
+    unsigned int                    rate;
+    enum audio_format_e             format;
+    unsigned int                    frame_size; ///< of device frame
+    unsigned int                    period;
+    float                           ramp_step;  ///< gain change per frame
+    GList                          *sources;    ///< protected by |lock|
+    float                          *mix;        ///< sum of all sources, |period| frames
+    float                          *tmp;        ///< single source data, |period| frames
+    void                           *device_buffer;
+    pthread_t                       thread;
+    int                             shutdown;
+    int64_t                         delay;
+    uint64_t                        xruns;
+};
+
+static struct audio_mixer_s mixer = {
+    .open_lock = PTHREAD_MUTEX_INITIALIZER,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+
+static
+void
+do_initialize(void)
+{
+    // remove timeout must not depend on wall clock adjustments
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&mixer.cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+static
+enum audio_format_e
+get_configured_format(void)
+{
+    const char *name = config.audio_output_format;
+
+    if (!name || strcmp(name, "s16") == 0)
+        return AUDIO_FORMAT_S16;
+    if (strcmp(name, "s32") == 0)
+        return AUDIO_FORMAT_S32;
+    if (strcmp(name, "float") == 0)
+        return AUDIO_FORMAT_FLOAT;
+
+    trace_warning("%s, unknown audio format \"%s\", using \"s16\"\n", __func__, name);
+    return AUDIO_FORMAT_S16;
+}
+
+// Sums |frames| frames of every source into |m->mix|. Sum is kept in float, so it can't
+// overflow; clipping happens only once, on conversion to device format. Should be called
+// with |m->lock| held.
+static
+void
+mix_sources(struct audio_mixer_s *m, size_t frames)
+{
+    GList *next;
+
+    memset(m->mix, 0, frames * AUDIO_MIXER_FRAME_SIZE);
+
+    for (GList *l = m->sources; l != NULL; l = next) {
+        struct audio_mixer_source_s *src = l->data;
+        size_t fill = spsc_ring_readable(src->ring) / AUDIO_MIXER_FRAME_SIZE;
+
+        next = l->next;
+        if (!src->primed && !src->removing) {
+            if (fill < src->watermark)
+                continue;
+            src->primed = 1;
+        }
+
+        if (src->primed && !src->removing && fill < src->min_fill)
+            __atomic_store_n(&src->min_fill, fill, __ATOMIC_RELAXED);
+
+        size_t got = spsc_ring_read(src->ring, m->tmp, frames * AUDIO_MIXER_FRAME_SIZE) /
+                     AUDIO_MIXER_FRAME_SIZE;
+        if (got < frames && src->primed && !src->removing)
+            __atomic_add_fetch(&src->underruns, 1, __ATOMIC_RELAXED);
+
+        float target = src->removing ? 0.0f : src->gain;
+        float g = src->cur_gain;
+        for (size_t k = 0; k < got; k ++) {
+            if (g < target)
+                g = MIN(g + m->ramp_step, target);
+            else if (g > target)
+                g = MAX(g - m->ramp_step, target);
+            m->mix[2 * k + 0] += g * m->tmp[2 * k + 0];
+            m->mix[2 * k + 1] += g * m->tmp[2 * k + 1];
+        }
+
+        // signal is cut anyway when ring runs dry; fade in again once data is back
+        src->cur_gain = (got < frames) ? 0.0f : g;
+
+        if (src->removing && src->cur_gain == 0.0f) {
+            m->sources = g_list_delete_link(m->sources, l);
+            src->removed = 1;
+            pthread_cond_broadcast(&m->cond);
+        }
+    }
+}
+
+static
+void
+count_xrun(struct audio_mixer_s *m, int *error_cnt)
+{
+    __atomic_add_fetch(&m->xruns, 1, __ATOMIC_RELAXED);
+    *error_cnt += 1;
+    if (*error_cnt >= 5)
+        trace_error("%s, too many audio output errors\n", __func__);
+}
+
+static
+void *
+mixer_thread(void *p)
+{
+    struct audio_mixer_s *m = p;
+    int use_mmap = (m->backend->mmap_begin != NULL);
+    int error_cnt = 0;
+
+    pthread_mutex_lock(&m->lock);
+    while (!m->shutdown) {
+        if (!m->sources) {
+            // device is left to drain while nothing plays; a few underruns are expected
+            // once it's fed again
+            pthread_cond_wait(&m->cond, &m->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&m->lock);
+
+        int frame_count = m->backend->wait_avail(m->stream, 1000);
+        if (frame_count < 0) {
+            count_xrun(m, &error_cnt);
+            goto next;
+        }
+
+        frame_count = MIN(frame_count, (int)m->period);
+        if (frame_count == 0)
+            goto next;
+
+        void *area = m->device_buffer;
+        if (use_mmap) {
+            int err = m->backend->mmap_begin(m->stream, &area, &frame_count);
+            if (err == -ENOSYS) {
+                use_mmap = 0;
+                area = m->device_buffer;
+            } else if (err < 0) {
+                count_xrun(m, &error_cnt);
+                goto next;
+            }
+        }
+
+        pthread_mutex_lock(&m->lock);
+        mix_sources(m, frame_count);
+        pthread_mutex_unlock(&m->lock);
+
+        audio_format_from_float(m->mix, 2 * frame_count, m->format, area);
+
+        int written = use_mmap ? m->backend->mmap_commit(m->stream, frame_count)
+                               : m->backend->write(m->stream, area, frame_count);
+        if (written < 0) {
+            count_xrun(m, &error_cnt);
+            goto next;
+        }
+
+        __atomic_store_n(&m->delay, m->backend->get_delay(m->stream), __ATOMIC_RELAXED);
+        error_cnt = 0;
+next:
+        pthread_mutex_lock(&m->lock);
+    }
+    pthread_mutex_unlock(&m->lock);
+
+    return NULL;
+}
+
+static
+void
+close_output(struct audio_mixer_s *m)
+{
+    if (m->stream)
+        m->backend->close(m->stream);
+    m->stream = NULL;
+    free(m->mix);
+    free(m->tmp);
+    free(m->device_buffer);
+    m->mix = NULL;
+    m->tmp = NULL;
+    m->device_buffer = NULL;
+}
+
+static
+int
+open_output(struct audio_mixer_s *m, unsigned int rate, unsigned int period_frames)
+{
+    m->rate = config.audio_output_rate > 0 ? config.audio_output_rate : rate;
+    m->format = get_configured_format();
+    period_frames = CLAMP(period_frames,
+                          (long long)config.audio_buffer_min_ms * m->rate / 1000,
+                          (long long)config.audio_buffer_max_ms * m->rate / 1000);
+
+    m->backend = audio_backend_get();
+    m->stream = m->backend->open(&m->rate, &m->format, &period_frames);
+    if (!m->stream) {
+        trace_error("%s, can't open %s audio output\n", __func__, m->backend->name);
+        return -1;
+    }
+
+    m->period = period_frames;
+    m->frame_size = 2 * audio_format_sample_size(m->format);
+    m->ramp_step = 1000.0f / (FADE_MS * m->rate);
+    m->mix = malloc(m->period * AUDIO_MIXER_FRAME_SIZE);
+    m->tmp = malloc(m->period * AUDIO_MIXER_FRAME_SIZE);
+    m->device_buffer = malloc(m->period * m->frame_size);
+    if (!m->mix || !m->tmp || !m->device_buffer) {
+        trace_error("%s, can't allocate mixer buffers\n", __func__);
+        close_output(m);
+        return -1;
+    }
+
+    m->shutdown = 0;
+    if (pthread_create(&m->thread, NULL, mixer_thread, m) != 0) {
+        trace_error("%s, can't create mixer thread\n", __func__);
+        close_output(m);
+        return -1;
+    }
+
+    trace_info("%s, %s output at %u Hz, format %d, period %u frames\n", __func__,
+               m->backend->name, m->rate, m->format, m->period);
+    return 0;
+}
+
+unsigned int
+audio_mixer_acquire(unsigned int rate, unsigned int period_frames)
+{
+    unsigned int ret = 0;
+
+    pthread_once(&init_once, do_initialize);
+    pthread_mutex_lock(&mixer.open_lock);
+    if (mixer.refcount > 0 || open_output(&mixer, rate, period_frames) == 0) {
+        mixer.refcount ++;
+        ret = mixer.rate;
+    }
+    pthread_mutex_unlock(&mixer.open_lock);
+
+    return ret;
+}
+
+void
+audio_mixer_release(void)
+{
+    pthread_mutex_lock(&mixer.open_lock);
+    mixer.refcount --;
+    if (mixer.refcount > 0) {
+        pthread_mutex_unlock(&mixer.open_lock);
+        return;
+    }
+
+    pthread_mutex_lock(&mixer.lock);
+    mixer.shutdown = 1;
+    pthread_cond_broadcast(&mixer.cond);
+    pthread_mutex_unlock(&mixer.lock);
+    pthread_join(mixer.thread, NULL);
+
+    if (mixer.xruns > 0)
+        trace_info("%s, %" PRIu64 " output errors\n", __func__, mixer.xruns);
+    close_output(&mixer);
+    mixer.xruns = 0;
+    mixer.delay = 0;
+    pthread_mutex_unlock(&mixer.open_lock);
+}
+
+void
+audio_mixer_add_source(struct audio_mixer_source_s *src)
+{
+    char buf[1024];
+
+    // mixer is not reading the ring yet, so it's safe to drain it from here
+    while (spsc_ring_read(src->ring, buf, sizeof(buf)) > 0) {
+    }
+
+    src->cur_gain = 0.0f;
+    src->primed = 0;
+    src->removing = 0;
+    src->removed = 0;
+    src->min_fill = src->watermark;
+
+    pthread_once(&init_once, do_initialize);
+    pthread_mutex_lock(&mixer.lock);
+    mixer.sources = g_list_append(mixer.sources, src);
+    pthread_cond_broadcast(&mixer.cond);
+    pthread_mutex_unlock(&mixer.lock);
+}
+
+void
+audio_mixer_remove_source(struct audio_mixer_source_s *src)
+{
+    struct timespec deadline;
+
+    pthread_once(&init_once, do_initialize);
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += REMOVE_TIMEOUT_MS / 1000;
+    deadline.tv_nsec += (REMOVE_TIMEOUT_MS % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&mixer.lock);
+    if (!g_list_find(mixer.sources, src)) {
+        pthread_mutex_unlock(&mixer.lock);
+        return;
+    }
+
+    src->removing = 1;
+    while (!src->removed) {
+        if (pthread_cond_timedwait(&mixer.cond, &mixer.lock, &deadline) == ETIMEDOUT) {
+            // output is stuck; drop source without fading
+            trace_warning("%s, mixer didn't release source in time\n", __func__);
+            mixer.sources = g_list_remove(mixer.sources, src);
+            src->removed = 1;
+        }
+    }
+    pthread_mutex_unlock(&mixer.lock);
+}
+
+void
+audio_mixer_set_gain(struct audio_mixer_source_s *src, float gain)
+{
+    pthread_mutex_lock(&mixer.lock);
+    src->gain = MAX(gain, 0.0f);
+    pthread_mutex_unlock(&mixer.lock);
+}
+
+int64_t
+audio_mixer_get_delay(void)
+{
+    return __atomic_load_n(&mixer.delay, __ATOMIC_RELAXED);
+}
+
+uint64_t
+audio_mixer_get_xruns(void)
+{
+    return __atomic_load_n(&mixer.xruns, __ATOMIC_RELAXED);
+}
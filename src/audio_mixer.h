@@ -0,0 +1,80 @@
+/*
+ * Copyright © 2013-2014  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef FPP_AUDIO_MIXER_H
+#define FPP_AUDIO_MIXER_H
+
+#include <stdint.h>
+#include "spsc_ring.h"
+
+
+/// Process-wide software mixer. It owns the only output stream and a thread which sums all
+/// playing sources into it. Sources supply interleaved stereo float frames at mixer rate
+/// through their own SPSC rings. Gain changes, as well as adding and removing sources, are
+/// applied with a short linear ramp, so they never click.
+
+#define AUDIO_MIXER_FRAME_SIZE      (2 * sizeof(float))
+
+struct audio_mixer_source_s {
+    struct spsc_ring_s *ring;       ///< filled by source's owner, drained by mixer
+    uint32_t            watermark;  ///< frames to accumulate before source becomes audible
+    float               gain;       ///< target gain, see audio_mixer_set_gain()
+    float               cur_gain;   ///< gain applied at the moment, ramps towards |gain|
+    int                 primed;     ///< watermark was reached
+    int                 removing;   ///< fading out before removal
+    int                 removed;
+    uint64_t            underruns;  ///< ring ran dry while source was playing
+    uint32_t            min_fill;   ///< lowest ring fill seen by mixer, in frames
+};
+
+/// takes reference to the mixer, opening output stream on the first call. |rate| and
+/// |period_frames| are only used to open the stream. Returns mixer rate, or 0 on failure
+unsigned int
+audio_mixer_acquire(unsigned int rate, unsigned int period_frames);
+
+/// drops reference; output stream is closed with the last one
+void
+audio_mixer_release(void);
+
+/// starts mixing |src|; stale frames left in its ring are dropped. Source fades in after
+/// its ring is filled up to the watermark
+void
+audio_mixer_add_source(struct audio_mixer_source_s *src);
+
+/// fades |src| out and removes it. Blocks until mixer doesn't touch |src| anymore
+void
+audio_mixer_remove_source(struct audio_mixer_source_s *src);
+
+void
+audio_mixer_set_gain(struct audio_mixer_source_s *src, float gain);
+
+/// frames written to output stream, but not yet played
+int64_t
+audio_mixer_get_delay(void);
+
+/// number of errors reported by output stream
+uint64_t
+audio_mixer_get_xruns(void);
+
+#endif // FPP_AUDIO_MIXER_H
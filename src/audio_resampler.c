@@ -0,0 +1,308 @@
+/*
+ * Copyright © 2013-2014  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "audio_resampler.h"
+#include <glib.h>
+#include <math.h>
+#include <string.h>
+
+
+#define MAX_PHASES      1024
+
+// filter is evaluated four taps at a time; GCC vector extensions map these to SSE or NEON
+typedef float v4sf __attribute__((vector_size(16)));
+
+struct audio_resampler_s {
+    enum audio_format_e format;
+    int                 passthrough;    ///< rates are equal, only format is converted
+    unsigned int        L;              ///< interpolation factor, number of filter phases
+    unsigned int        M;              ///< decimation factor
+    int                 taps;           ///< filter length, multiple of 4
+    float              *coeffs;         ///< |L| phases, |taps| coefficients each
+    float              *buf[2];         ///< input, deinterleaved
+    size_t              buf_len;        ///< frames in |buf|
+    size_t              buf_size;       ///< frames |buf| can hold
+    size_t              pos;            ///< input frame nearest to next output frame, from left
+    unsigned int        phase;          ///< fractional part of the input position, in 1/L units
+};
+
+size_t
+audio_format_sample_size(enum audio_format_e format)
+{
+    switch (format) {
+    case AUDIO_FORMAT_S32:      return sizeof(int32_t);
+    case AUDIO_FORMAT_FLOAT:    return sizeof(float);
+    case AUDIO_FORMAT_S16:
+    default:                    return sizeof(int16_t);
+    }
+}
+
+void
+audio_format_from_float(const float *in, size_t samples, enum audio_format_e format, void *out)
+{
+    switch (format) {
+    case AUDIO_FORMAT_S16:
+        for (size_t k = 0; k < samples; k ++)
+            ((int16_t *)out)[k] = lrintf(CLAMP(in[k] * 32768.0f, -32768.0f, 32767.0f));
+        break;
+    case AUDIO_FORMAT_S32:
+        for (size_t k = 0; k < samples; k ++)
+            ((int32_t *)out)[k] = lrintf(CLAMP(in[k] * 2147483648.0f, -2147483648.0f,
+                                               2147483520.0f));
+        break;
+    case AUDIO_FORMAT_FLOAT:
+        for (size_t k = 0; k < samples; k ++)
+            ((float *)out)[k] = CLAMP(in[k], -1.0f, 1.0f);
+        break;
+    }
+}
+
+static
+unsigned int
+gcd(unsigned int a, unsigned int b)
+{
+    while (b != 0) {
+        unsigned int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/// |d| is distance from output position to input sample, in input samples, |half| is half of
+/// the filter length, and |fc| is cutoff relative to input Nyquist frequency
+static
+double
+kernel(double d, int half, double fc, int quality)
+{
+    if (quality == AUDIO_RESAMPLER_QUALITY_LINEAR)
+        return MAX(0.0, 1.0 - fabs(d));
+
+    if (fabs(d) >= half)
+        return 0.0;
+
+    double x = M_PI * fc * d;
+    double sinc = (fabs(x) < 1e-9) ? 1.0 : sin(x) / x;
+    // Blackman window
+    double w = 0.42 + 0.5 * cos(M_PI * d / half) + 0.08 * cos(2 * M_PI * d / half);
+    return fc * sinc * w;
+}
+
+struct audio_resampler_s *
+audio_resampler_new(unsigned int in_rate, unsigned int out_rate, enum audio_format_e out_format,
+                    int quality)
+{
+    struct audio_resampler_s *r = g_slice_alloc0(sizeof(*r));
+    unsigned int g = gcd(in_rate, out_rate);
+
+    r->format = out_format;
+    r->L = out_rate / g;
+    r->M = in_rate / g;
+    r->passthrough = (r->L == r->M);
+    if (r->passthrough)
+        return r;
+
+    if (r->L > MAX_PHASES) {
+        // unusual rates; approximate ratio, pitch error stays well below audible
+        r->M = MAX(1, (unsigned int)((double)r->M * MAX_PHASES / r->L + 0.5));
+        r->L = MAX_PHASES;
+    }
+
+    // when downsampling, cutoff moves down and filter gets proportionally longer
+    double fc = MIN(1.0, (double)r->L / r->M);
+    int taps;
+    switch (quality) {
+    case AUDIO_RESAMPLER_QUALITY_LINEAR:
+        taps = 4;   // outer two are zero
+        fc = 1.0;
+        break;
+    case AUDIO_RESAMPLER_QUALITY_HIGH:
+        taps = 48;
+        break;
+    default:
+        quality = AUDIO_RESAMPLER_QUALITY_MEDIUM;
+        taps = 16;
+        break;
+    }
+    taps = ((int)ceil(taps / fc) + 3) & ~3;
+    r->taps = taps;
+
+    const int half = taps / 2;
+    r->coeffs = g_malloc(sizeof(float) * r->L * taps);
+    for (unsigned int p = 0; p < r->L; p ++) {
+        const double frac = (double)p / r->L;
+        float *c = r->coeffs + p * taps;
+        double sum = 0;
+
+        for (int j = 0; j < taps; j ++) {
+            double v = kernel(j - (half - 1) - frac, half, fc, quality);
+            c[j] = v;
+            sum += v;
+        }
+        // unity gain at DC for every phase
+        for (int j = 0; j < taps; j ++)
+            c[j] /= sum;
+    }
+
+    // history of zeros, so the first output frame lines up with the first input frame
+    r->buf_size = 4096;
+    r->buf[0] = g_malloc0(sizeof(float) * r->buf_size);
+    r->buf[1] = g_malloc0(sizeof(float) * r->buf_size);
+    r->buf_len = half - 1;
+    r->pos = half - 1;
+    r->phase = 0;
+
+    return r;
+}
+
+void
+audio_resampler_free(struct audio_resampler_s *r)
+{
+    if (!r)
+        return;
+    g_free(r->coeffs);
+    g_free(r->buf[0]);
+    g_free(r->buf[1]);
+    g_slice_free1(sizeof(*r), r);
+}
+
+size_t
+audio_resampler_max_output(struct audio_resampler_s *r, size_t in_frames)
+{
+    if (r->passthrough)
+        return in_frames;
+    // less than |taps| frames may be pending from previous calls
+    return (in_frames + r->taps) * r->L / r->M + 1;
+}
+
+static inline
+float
+dot_product(const float *a, const float *b, int n)
+{
+    v4sf acc = {0, 0, 0, 0};
+
+    for (int k = 0; k < n; k += 4) {
+        v4sf x, y;
+        memcpy(&x, a + k, sizeof(x));
+        memcpy(&y, b + k, sizeof(y));
+        acc += x * y;
+    }
+    return acc[0] + acc[1] + acc[2] + acc[3];
+}
+
+/// stores frame of two samples, which are in the 16-bit range, but not yet rounded or clipped
+static inline
+void
+store_frame(enum audio_format_e format, void *out, size_t idx, float left, float right)
+{
+    switch (format) {
+    case AUDIO_FORMAT_S16:
+        ((int16_t *)out)[2 * idx + 0] = lrintf(CLAMP(left, -32768.0f, 32767.0f));
+        ((int16_t *)out)[2 * idx + 1] = lrintf(CLAMP(right, -32768.0f, 32767.0f));
+        break;
+    case AUDIO_FORMAT_S32:
+        // 2147483520 is the largest float below 2^31
+        ((int32_t *)out)[2 * idx + 0] = lrintf(CLAMP(left * 65536.0f, -2147483648.0f,
+                                                     2147483520.0f));
+        ((int32_t *)out)[2 * idx + 1] = lrintf(CLAMP(right * 65536.0f, -2147483648.0f,
+                                                     2147483520.0f));
+        break;
+    case AUDIO_FORMAT_FLOAT:
+        ((float *)out)[2 * idx + 0] = left * (1.0f / 32768.0f);
+        ((float *)out)[2 * idx + 1] = right * (1.0f / 32768.0f);
+        break;
+    }
+}
+
+static
+size_t
+convert_format(struct audio_resampler_s *r, const int16_t *in, size_t in_frames, void *out)
+{
+    switch (r->format) {
+    case AUDIO_FORMAT_S16:
+        memcpy(out, in, in_frames * 2 * sizeof(int16_t));
+        break;
+    case AUDIO_FORMAT_S32:
+        for (size_t k = 0; k < 2 * in_frames; k ++)
+            ((int32_t *)out)[k] = (int32_t)in[k] * 65536;
+        break;
+    case AUDIO_FORMAT_FLOAT:
+        for (size_t k = 0; k < 2 * in_frames; k ++)
+            ((float *)out)[k] = in[k] * (1.0f / 32768.0f);
+        break;
+    }
+    return in_frames;
+}
+
+size_t
+audio_resampler_process(struct audio_resampler_s *r, const int16_t *in, size_t in_frames,
+                        void *out)
+{
+    if (r->passthrough)
+        return convert_format(r, in, in_frames, out);
+
+    if (r->buf_len + in_frames > r->buf_size) {
+        while (r->buf_len + in_frames > r->buf_size)
+            r->buf_size *= 2;
+        r->buf[0] = g_realloc(r->buf[0], sizeof(float) * r->buf_size);
+        r->buf[1] = g_realloc(r->buf[1], sizeof(float) * r->buf_size);
+    }
+
+    float *left = r->buf[0] + r->buf_len;
+    float *right = r->buf[1] + r->buf_len;
+    for (size_t k = 0; k < in_frames; k ++) {
+        left[k] = in[2 * k + 0];
+        right[k] = in[2 * k + 1];
+    }
+    r->buf_len += in_frames;
+
+    const int half = r->taps / 2;
+    size_t produced = 0;
+
+    // each output frame needs |half| input frames past its position
+    while (r->pos + half < r->buf_len) {
+        const float *c = r->coeffs + r->phase * r->taps;
+        const size_t start = r->pos - (half - 1);
+
+        store_frame(r->format, out, produced,
+                    dot_product(r->buf[0] + start, c, r->taps),
+                    dot_product(r->buf[1] + start, c, r->taps));
+        produced ++;
+
+        r->phase += r->M;
+        r->pos += r->phase / r->L;
+        r->phase %= r->L;
+    }
+
+    // drop input which is not needed anymore, keeping filter history
+    size_t drop = MIN(r->pos - (half - 1), r->buf_len);
+    if (drop > 0) {
+        memmove(r->buf[0], r->buf[0] + drop, sizeof(float) * (r->buf_len - drop));
+        memmove(r->buf[1], r->buf[1] + drop, sizeof(float) * (r->buf_len - drop));
+        r->buf_len -= drop;
+        r->pos -= drop;
+    }
+
+    return produced;
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright © 2013-2014  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef FPP_AUDIO_RESAMPLER_H
+#define FPP_AUDIO_RESAMPLER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/// Stereo sample rate and format converter. Input is always interleaved signed 16-bit, output
+/// is interleaved in one of audio_format_e formats. Conversion is done by polyphase windowed
+/// sinc filter, or by linear interpolation at the lowest quality. Converter is stateful and
+/// expects a continuous stream split into arbitrary chunks.
+
+enum audio_format_e {
+    AUDIO_FORMAT_S16 = 0,
+    AUDIO_FORMAT_S32,
+    AUDIO_FORMAT_FLOAT,
+};
+
+enum {
+    AUDIO_RESAMPLER_QUALITY_LINEAR = 0,
+    AUDIO_RESAMPLER_QUALITY_MEDIUM = 1,     ///< 16-tap filter
+    AUDIO_RESAMPLER_QUALITY_HIGH =   2,     ///< 48-tap filter
+};
+
+struct audio_resampler_s;
+
+/// size of one sample, for a single channel
+size_t
+audio_format_sample_size(enum audio_format_e format);
+
+/// converts |samples| floats in [-1, 1] range to |format|, clamping ones which are out of range
+void
+audio_format_from_float(const float *in, size_t samples, enum audio_format_e format, void *out);
+
+struct audio_resampler_s *
+audio_resampler_new(unsigned int in_rate, unsigned int out_rate, enum audio_format_e out_format,
+                    int quality);
+
+void
+audio_resampler_free(struct audio_resampler_s *r);
+
+/// upper bound of frames audio_resampler_process() may produce for |in_frames| input frames.
+/// Doesn't depend on converter state, so can be used to size buffers once
+size_t
+audio_resampler_max_output(struct audio_resampler_s *r, size_t in_frames);
+
+/// converts |in_frames| frames from |in|, writes result to |out|, which must have room for
+/// audio_resampler_max_output() frames. Returns number of frames written
+size_t
+audio_resampler_process(struct audio_resampler_s *r, const int16_t *in, size_t in_frames,
+                        void *out);
+
+#endif // FPP_AUDIO_RESAMPLER_H
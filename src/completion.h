@@ -0,0 +1,75 @@
+/*
+ * Copyright © 2013-2014  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef FPP_COMPLETION_H
+#define FPP_COMPLETION_H
+
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+/// One-shot completion flag. One thread waits until another signals. Waiting doesn't poll,
+/// and signaling costs a single futex wake. Signaled completion must not be reused without
+/// calling completion_init() again.
+
+struct completion_s {
+    int     done;
+};
+
+static inline
+void
+completion_init(struct completion_s *c)
+{
+    __atomic_store_n(&c->done, 0, __ATOMIC_RELAXED);
+}
+
+/// waker may not touch |c| after this call, waiter is free to destroy it as soon as it returns
+static inline
+void
+completion_signal(struct completion_s *c)
+{
+    __atomic_store_n(&c->done, 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &c->done, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+static inline
+void
+completion_wait(struct completion_s *c)
+{
+    while (!__atomic_load_n(&c->done, __ATOMIC_ACQUIRE)) {
+        // returns at once if |done| is not zero anymore; spurious wakeups are fine too
+        syscall(SYS_futex, &c->done, FUTEX_WAIT_PRIVATE, 0, NULL, NULL, 0);
+    }
+}
+
+static inline
+int
+completion_is_done(struct completion_s *c)
+{
+    return __atomic_load_n(&c->done, __ATOMIC_ACQUIRE);
+}
+
+#endif // FPP_COMPLETION_H
@@ -32,9 +32,23 @@
 static struct fpp_config_s default_config = {
     .audio_buffer_min_ms = 20,
     .audio_buffer_max_ms = 500,
+    .audio_fill_ahead_ms = 60,
+    .audio_backend       = "alsa",
+    .audio_wav_path      = "/tmp/freshwrapper-audio",
+    .audio_output_rate   = 0,
+    .audio_output_format = "s16",
+    .audio_resampler_quality = 1,
     .pepperflash_path    = NULL,
     .flash_command_line  = "enable_hw_video_decode=1,enable_stagevideo_auto=1",
     .enable_3d           = 0,
+    .gl_command_buffer   = 0,
+    .graphics3d_backend  = "pixmap",
+    .gl_shadow_state_check = 0,
+    .gl_profiler         = 0,
+    .gl_program_cache_mb = 64,
+    .worker_pool_file_threads = 2,
+    .message_loop_stats         = 0,
+    .message_loop_slow_task_ms  = 0,
     .quirks = {
         .switch_buttons_2_3         = 0,
         .dump_resource_histogram    = 0,
@@ -127,6 +141,30 @@ fpp_config_initialize(void)
         config.audio_buffer_max_ms = intval;
     }
 
+    if (config_lookup_int64(&cfg, "audio_fill_ahead_ms", &intval)) {
+        config.audio_fill_ahead_ms = intval;
+    }
+
+    if (config_lookup_string(&cfg, "audio_backend", &stringval)) {
+        config.audio_backend = strdup(stringval);
+    }
+
+    if (config_lookup_string(&cfg, "audio_wav_path", &stringval)) {
+        config.audio_wav_path = strdup(stringval);
+    }
+
+    if (config_lookup_int64(&cfg, "audio_output_rate", &intval)) {
+        config.audio_output_rate = intval;
+    }
+
+    if (config_lookup_string(&cfg, "audio_output_format", &stringval)) {
+        config.audio_output_format = strdup(stringval);
+    }
+
+    if (config_lookup_int64(&cfg, "audio_resampler_quality", &intval)) {
+        config.audio_resampler_quality = intval;
+    }
+
     if (config_lookup_string(&cfg, "pepperflash_path", &stringval)) {
         config.pepperflash_path = strdup(stringval);
     }
@@ -139,6 +177,38 @@ fpp_config_initialize(void)
         config.enable_3d = intval;
     }
 
+    if (config_lookup_int64(&cfg, "gl_command_buffer", &intval)) {
+        config.gl_command_buffer = intval;
+    }
+
+    if (config_lookup_string(&cfg, "graphics3d_backend", &stringval)) {
+        config.graphics3d_backend = strdup(stringval);
+    }
+
+    if (config_lookup_int64(&cfg, "gl_shadow_state_check", &intval)) {
+        config.gl_shadow_state_check = intval;
+    }
+
+    if (config_lookup_int64(&cfg, "gl_profiler", &intval)) {
+        config.gl_profiler = intval;
+    }
+
+    if (config_lookup_int64(&cfg, "gl_program_cache_mb", &intval)) {
+        config.gl_program_cache_mb = intval;
+    }
+
+    if (config_lookup_int64(&cfg, "worker_pool_file_threads", &intval)) {
+        config.worker_pool_file_threads = intval;
+    }
+
+    if (config_lookup_int64(&cfg, "message_loop_stats", &intval)) {
+        config.message_loop_stats = intval;
+    }
+
+    if (config_lookup_int64(&cfg, "message_loop_slow_task_ms", &intval)) {
+        config.message_loop_slow_task_ms = intval;
+    }
+
     config_destroy(&cfg);
 
 quit:
@@ -168,8 +238,12 @@ fpp_config_destroy(void)
     if (!initialized)
         return;
 
+    FREE_IF_CHANGED(audio_backend);
+    FREE_IF_CHANGED(audio_wav_path);
+    FREE_IF_CHANGED(audio_output_format);
     FREE_IF_CHANGED(pepperflash_path);
     FREE_IF_CHANGED(flash_command_line);
+    FREE_IF_CHANGED(graphics3d_backend);
     g_free(pepper_data_dir);
     g_free(pepper_salt_file_name);
     initialized = 0;
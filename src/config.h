@@ -31,9 +31,23 @@
 struct fpp_config_s {
     int     audio_buffer_min_ms;
     int     audio_buffer_max_ms;
+    int     audio_fill_ahead_ms;
+    char   *audio_backend;
+    char   *audio_wav_path;
+    int     audio_output_rate;
+    char   *audio_output_format;
+    int     audio_resampler_quality;
     char   *pepperflash_path;
     char   *flash_command_line;
     int     enable_3d;
+    int     gl_command_buffer;
+    char   *graphics3d_backend;
+    int     gl_shadow_state_check;
+    int     gl_profiler;
+    int     gl_program_cache_mb;
+    int     worker_pool_file_threads;
+    int     message_loop_stats;
+    int     message_loop_slow_task_ms;
     struct {
         int   switch_buttons_2_3;
         int   dump_resource_histogram;
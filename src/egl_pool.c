@@ -0,0 +1,183 @@
+/*
+ * Copyright © 2013-2014  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "egl_pool.h"
+#include "tables.h"
+
+
+struct context_entry_s {
+    EGLConfig   config;
+    EGLContext  glc;
+    EGLSurface  pbuffer;        ///< EGL_NO_SURFACE if context came without one
+    uint64_t    age;            ///< value of put_counter when entry was filled
+};
+
+struct surface_entry_s {
+    EGLConfig   config;
+    int32_t     width;
+    int32_t     height;
+    Pixmap      pixmap;
+    EGLSurface  surf;           ///< EGL_NO_SURFACE if slot is empty
+    uint64_t    age;
+};
+
+static struct context_entry_s   contexts[EGL_POOL_CONTEXTS];
+static struct surface_entry_s   surfaces[EGL_POOL_SURFACES];
+static uint64_t                 put_counter = 0;
+
+
+static
+void
+context_entry_free(struct context_entry_s *en)
+{
+    if (en->glc == EGL_NO_CONTEXT)
+        return;
+    if (en->pbuffer != EGL_NO_SURFACE)
+        eglDestroySurface(display.egl, en->pbuffer);
+    eglDestroyContext(display.egl, en->glc);
+    en->glc = EGL_NO_CONTEXT;
+    en->pbuffer = EGL_NO_SURFACE;
+}
+
+static
+void
+surface_entry_free(struct surface_entry_s *en)
+{
+    if (en->surf == EGL_NO_SURFACE)
+        return;
+    eglDestroySurface(display.egl, en->surf);
+    XFreePixmap(display.x, en->pixmap);
+    en->surf = EGL_NO_SURFACE;
+    en->pixmap = None;
+}
+
+EGLContext
+egl_pool_take_context(EGLConfig config, EGLSurface *pbuffer)
+{
+    struct context_entry_s *found = NULL;
+
+    // most recently put one is the most likely to be still warm
+    for (int k = 0; k < EGL_POOL_CONTEXTS; k ++) {
+        struct context_entry_s *en = &contexts[k];
+        if (en->glc == EGL_NO_CONTEXT || en->config != config)
+            continue;
+        if ((pbuffer != NULL) != (en->pbuffer != EGL_NO_SURFACE))
+            continue;
+        if (!found || en->age > found->age)
+            found = en;
+    }
+
+    if (!found)
+        return EGL_NO_CONTEXT;
+
+    EGLContext glc = found->glc;
+    if (pbuffer)
+        *pbuffer = found->pbuffer;
+    found->glc = EGL_NO_CONTEXT;
+    found->pbuffer = EGL_NO_SURFACE;
+    return glc;
+}
+
+void
+egl_pool_put_context(EGLConfig config, EGLContext glc, EGLSurface pbuffer)
+{
+    struct context_entry_s *slot = &contexts[0];
+
+    // empty slot, or the oldest one
+    for (int k = 0; k < EGL_POOL_CONTEXTS; k ++) {
+        if (contexts[k].glc == EGL_NO_CONTEXT) {
+            slot = &contexts[k];
+            break;
+        }
+        if (contexts[k].age < slot->age)
+            slot = &contexts[k];
+    }
+
+    context_entry_free(slot);
+    slot->config = config;
+    slot->glc = glc;
+    slot->pbuffer = pbuffer;
+    slot->age = ++ put_counter;
+}
+
+int
+egl_pool_take_surface(EGLConfig config, int32_t width, int32_t height, Pixmap *pixmap,
+                      EGLSurface *surf)
+{
+    for (int k = 0; k < EGL_POOL_SURFACES; k ++) {
+        struct surface_entry_s *en = &surfaces[k];
+        if (en->surf == EGL_NO_SURFACE || en->config != config)
+            continue;
+        if (en->width != width || en->height != height)
+            continue;
+
+        *pixmap = en->pixmap;
+        *surf = en->surf;
+        en->pixmap = None;
+        en->surf = EGL_NO_SURFACE;
+        return 0;
+    }
+
+    return -1;
+}
+
+void
+egl_pool_put_surface(EGLConfig config, int32_t width, int32_t height, Pixmap pixmap,
+                     EGLSurface surf)
+{
+    struct surface_entry_s *slot = &surfaces[0];
+
+    if (surf == EGL_NO_SURFACE) {
+        // nothing to reuse
+        if (pixmap != None)
+            XFreePixmap(display.x, pixmap);
+        return;
+    }
+
+    for (int k = 0; k < EGL_POOL_SURFACES; k ++) {
+        if (surfaces[k].surf == EGL_NO_SURFACE) {
+            slot = &surfaces[k];
+            break;
+        }
+        if (surfaces[k].age < slot->age)
+            slot = &surfaces[k];
+    }
+
+    surface_entry_free(slot);
+    slot->config = config;
+    slot->width = width;
+    slot->height = height;
+    slot->pixmap = pixmap;
+    slot->surf = surf;
+    slot->age = ++ put_counter;
+}
+
+void
+egl_pool_purge(void)
+{
+    for (int k = 0; k < EGL_POOL_CONTEXTS; k ++)
+        context_entry_free(&contexts[k]);
+    for (int k = 0; k < EGL_POOL_SURFACES; k ++)
+        surface_entry_free(&surfaces[k]);
+}
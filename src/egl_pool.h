@@ -0,0 +1,65 @@
+/*
+ * Copyright © 2013-2014  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef FPP_EGL_POOL_H
+#define FPP_EGL_POOL_H
+
+#include <EGL/egl.h>
+#include <X11/Xlib.h>
+#include <stdint.h>
+
+
+/// Recently released EGL contexts and pixmap surfaces of Graphics3D resources, kept for reuse
+/// by resources created or resized later. Pool is per display; all functions must be called
+/// with display.lock held.
+
+#define EGL_POOL_CONTEXTS   2   ///< max number of cached contexts
+#define EGL_POOL_SURFACES   4   ///< max number of cached pixmap surfaces
+
+/// takes cached context with matching |config|. If |pbuffer| is not NULL, only contexts
+/// released with their pbuffer surface are considered, and the surface is stored there.
+/// Returns EGL_NO_CONTEXT if there is no such context
+EGLContext
+egl_pool_take_context(EGLConfig config, EGLSurface *pbuffer);
+
+/// puts context into pool. Context must not be current to any thread, and its state should
+/// be reset to defaults. Least recently put context is destroyed if pool is full
+void
+egl_pool_put_context(EGLConfig config, EGLContext glc, EGLSurface pbuffer);
+
+/// takes cached pixmap surface with matching |config| and size. Returns 0 on success
+int
+egl_pool_take_surface(EGLConfig config, int32_t width, int32_t height, Pixmap *pixmap,
+                      EGLSurface *surf);
+
+/// puts pixmap surface into pool. Surface must not be current to any thread
+void
+egl_pool_put_surface(EGLConfig config, int32_t width, int32_t height, Pixmap pixmap,
+                     EGLSurface surf);
+
+/// destroys everything cached
+void
+egl_pool_purge(void);
+
+#endif // FPP_EGL_POOL_H
@@ -0,0 +1,484 @@
+/*
+ * Copyright © 2013-2014  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "gl_cmd_buffer.h"
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+#include "tables.h"
+#include "ppb_message_loop.h"
+
+
+#define GL_CMD_BUFFER_SIZE          (4 * 1024 * 1024)
+#define GL_CMD_ALIGN(x)             (((x) + 7) & ~(size_t)7)
+
+
+static
+void
+replay_cmd(const struct gl_cmd_s *c)
+{
+    const union gl_cmd_arg_u *a = c->a;
+
+    switch (c->op) {
+    case GLCMD_WRAP:
+        break;
+    case GLCMD_ACTIVE_TEXTURE:
+        glActiveTexture(a[0].e);
+        break;
+    case GLCMD_BIND_BUFFER:
+        glBindBuffer(a[0].e, a[1].u);
+        break;
+    case GLCMD_BIND_FRAMEBUFFER:
+        glBindFramebuffer(a[0].e, a[1].u);
+        break;
+    case GLCMD_BIND_RENDERBUFFER:
+        glBindRenderbuffer(a[0].e, a[1].u);
+        break;
+    case GLCMD_BIND_TEXTURE:
+        glBindTexture(a[0].e, a[1].u);
+        break;
+    case GLCMD_BLEND_COLOR:
+        glBlendColor(a[0].f, a[1].f, a[2].f, a[3].f);
+        break;
+    case GLCMD_BLEND_EQUATION:
+        glBlendEquation(a[0].e);
+        break;
+    case GLCMD_BLEND_EQUATION_SEPARATE:
+        glBlendEquationSeparate(a[0].e, a[1].e);
+        break;
+    case GLCMD_BLEND_FUNC:
+        glBlendFunc(a[0].e, a[1].e);
+        break;
+    case GLCMD_BLEND_FUNC_SEPARATE:
+        glBlendFuncSeparate(a[0].e, a[1].e, a[2].e, a[3].e);
+        break;
+    case GLCMD_BUFFER_DATA:
+        glBufferData(a[0].e, a[1].sp, a[2].p, a[3].e);
+        break;
+    case GLCMD_BUFFER_SUB_DATA:
+        glBufferSubData(a[0].e, a[1].ip, a[2].sp, a[3].p);
+        break;
+    case GLCMD_CLEAR:
+        glClear(a[0].bf);
+        break;
+    case GLCMD_CLEAR_COLOR:
+        glClearColor(a[0].f, a[1].f, a[2].f, a[3].f);
+        break;
+    case GLCMD_CLEAR_DEPTHF:
+        glClearDepthf(a[0].f);
+        break;
+    case GLCMD_CLEAR_STENCIL:
+        glClearStencil(a[0].i);
+        break;
+    case GLCMD_COLOR_MASK:
+        glColorMask(a[0].b, a[1].b, a[2].b, a[3].b);
+        break;
+    case GLCMD_COMPRESSED_TEX_IMAGE_2D:
+        glCompressedTexImage2D(a[0].e, a[1].i, a[2].e, a[3].s, a[4].s, a[5].i, a[6].s, a[7].p);
+        break;
+    case GLCMD_COMPRESSED_TEX_SUB_IMAGE_2D:
+        glCompressedTexSubImage2D(a[0].e, a[1].i, a[2].i, a[3].i, a[4].s, a[5].s, a[6].e, a[7].s,
+                                  a[8].p);
+        break;
+    case GLCMD_CULL_FACE:
+        glCullFace(a[0].e);
+        break;
+    case GLCMD_DEPTH_FUNC:
+        glDepthFunc(a[0].e);
+        break;
+    case GLCMD_DEPTH_MASK:
+        glDepthMask(a[0].b);
+        break;
+    case GLCMD_DEPTH_RANGEF:
+        glDepthRangef(a[0].f, a[1].f);
+        break;
+    case GLCMD_DISABLE:
+        glDisable(a[0].e);
+        break;
+    case GLCMD_DISABLE_VERTEX_ATTRIB_ARRAY:
+        glDisableVertexAttribArray(a[0].u);
+        break;
+    case GLCMD_DRAW_ARRAYS:
+        glDrawArrays(a[0].e, a[1].i, a[2].s);
+        break;
+    case GLCMD_DRAW_ELEMENTS:
+        glDrawElements(a[0].e, a[1].s, a[2].e, a[3].p);
+        break;
+    case GLCMD_ENABLE:
+        glEnable(a[0].e);
+        break;
+    case GLCMD_ENABLE_VERTEX_ATTRIB_ARRAY:
+        glEnableVertexAttribArray(a[0].u);
+        break;
+    case GLCMD_FLUSH:
+        glFlush();
+        break;
+    case GLCMD_FRAMEBUFFER_RENDERBUFFER:
+        glFramebufferRenderbuffer(a[0].e, a[1].e, a[2].e, a[3].u);
+        break;
+    case GLCMD_FRAMEBUFFER_TEXTURE_2D:
+        glFramebufferTexture2D(a[0].e, a[1].e, a[2].e, a[3].u, a[4].i);
+        break;
+    case GLCMD_FRONT_FACE:
+        glFrontFace(a[0].e);
+        break;
+    case GLCMD_GENERATE_MIPMAP:
+        glGenerateMipmap(a[0].e);
+        break;
+    case GLCMD_HINT:
+        glHint(a[0].e, a[1].e);
+        break;
+    case GLCMD_LINE_WIDTH:
+        glLineWidth(a[0].f);
+        break;
+    case GLCMD_PIXEL_STOREI:
+        glPixelStorei(a[0].e, a[1].i);
+        break;
+    case GLCMD_POLYGON_OFFSET:
+        glPolygonOffset(a[0].f, a[1].f);
+        break;
+    case GLCMD_RENDERBUFFER_STORAGE:
+        glRenderbufferStorage(a[0].e, a[1].e, a[2].s, a[3].s);
+        break;
+    case GLCMD_SAMPLE_COVERAGE:
+        glSampleCoverage(a[0].f, a[1].b);
+        break;
+    case GLCMD_SCISSOR:
+        glScissor(a[0].i, a[1].i, a[2].s, a[3].s);
+        break;
+    case GLCMD_STENCIL_FUNC:
+        glStencilFunc(a[0].e, a[1].i, a[2].u);
+        break;
+    case GLCMD_STENCIL_FUNC_SEPARATE:
+        glStencilFuncSeparate(a[0].e, a[1].e, a[2].i, a[3].u);
+        break;
+    case GLCMD_STENCIL_MASK:
+        glStencilMask(a[0].u);
+        break;
+    case GLCMD_STENCIL_MASK_SEPARATE:
+        glStencilMaskSeparate(a[0].e, a[1].u);
+        break;
+    case GLCMD_STENCIL_OP:
+        glStencilOp(a[0].e, a[1].e, a[2].e);
+        break;
+    case GLCMD_STENCIL_OP_SEPARATE:
+        glStencilOpSeparate(a[0].e, a[1].e, a[2].e, a[3].e);
+        break;
+    case GLCMD_TEX_IMAGE_2D:
+        glTexImage2D(a[0].e, a[1].i, a[2].i, a[3].s, a[4].s, a[5].i, a[6].e, a[7].e, a[8].p);
+        break;
+    case GLCMD_TEX_PARAMETERF:
+        glTexParameterf(a[0].e, a[1].e, a[2].f);
+        break;
+    case GLCMD_TEX_PARAMETERFV:
+        glTexParameterfv(a[0].e, a[1].e, a[2].p);
+        break;
+    case GLCMD_TEX_PARAMETERI:
+        glTexParameteri(a[0].e, a[1].e, a[2].i);
+        break;
+    case GLCMD_TEX_PARAMETERIV:
+        glTexParameteriv(a[0].e, a[1].e, a[2].p);
+        break;
+    case GLCMD_TEX_SUB_IMAGE_2D:
+        glTexSubImage2D(a[0].e, a[1].i, a[2].i, a[3].i, a[4].s, a[5].s, a[6].e, a[7].e, a[8].p);
+        break;
+    case GLCMD_UNIFORM_1F:
+        glUniform1f(a[0].i, a[1].f);
+        break;
+    case GLCMD_UNIFORM_1FV:
+        glUniform1fv(a[0].i, a[1].s, a[2].p);
+        break;
+    case GLCMD_UNIFORM_1I:
+        glUniform1i(a[0].i, a[1].i);
+        break;
+    case GLCMD_UNIFORM_1IV:
+        glUniform1iv(a[0].i, a[1].s, a[2].p);
+        break;
+    case GLCMD_UNIFORM_2F:
+        glUniform2f(a[0].i, a[1].f, a[2].f);
+        break;
+    case GLCMD_UNIFORM_2FV:
+        glUniform2fv(a[0].i, a[1].s, a[2].p);
+        break;
+    case GLCMD_UNIFORM_2I:
+        glUniform2i(a[0].i, a[1].i, a[2].i);
+        break;
+    case GLCMD_UNIFORM_2IV:
+        glUniform2iv(a[0].i, a[1].s, a[2].p);
+        break;
+    case GLCMD_UNIFORM_3F:
+        glUniform3f(a[0].i, a[1].f, a[2].f, a[3].f);
+        break;
+    case GLCMD_UNIFORM_3FV:
+        glUniform3fv(a[0].i, a[1].s, a[2].p);
+        break;
+    case GLCMD_UNIFORM_3I:
+        glUniform3i(a[0].i, a[1].i, a[2].i, a[3].i);
+        break;
+    case GLCMD_UNIFORM_3IV:
+        glUniform3iv(a[0].i, a[1].s, a[2].p);
+        break;
+    case GLCMD_UNIFORM_4F:
+        glUniform4f(a[0].i, a[1].f, a[2].f, a[3].f, a[4].f);
+        break;
+    case GLCMD_UNIFORM_4FV:
+        glUniform4fv(a[0].i, a[1].s, a[2].p);
+        break;
+    case GLCMD_UNIFORM_4I:
+        glUniform4i(a[0].i, a[1].i, a[2].i, a[3].i, a[4].i);
+        break;
+    case GLCMD_UNIFORM_4IV:
+        glUniform4iv(a[0].i, a[1].s, a[2].p);
+        break;
+    case GLCMD_UNIFORM_MATRIX_2FV:
+        glUniformMatrix2fv(a[0].i, a[1].s, a[2].b, a[3].p);
+        break;
+    case GLCMD_UNIFORM_MATRIX_3FV:
+        glUniformMatrix3fv(a[0].i, a[1].s, a[2].b, a[3].p);
+        break;
+    case GLCMD_UNIFORM_MATRIX_4FV:
+        glUniformMatrix4fv(a[0].i, a[1].s, a[2].b, a[3].p);
+        break;
+    case GLCMD_USE_PROGRAM:
+        glUseProgram(a[0].u);
+        break;
+    case GLCMD_VERTEX_ATTRIB_1F:
+        glVertexAttrib1f(a[0].u, a[1].f);
+        break;
+    case GLCMD_VERTEX_ATTRIB_2F:
+        glVertexAttrib2f(a[0].u, a[1].f, a[2].f);
+        break;
+    case GLCMD_VERTEX_ATTRIB_3F:
+        glVertexAttrib3f(a[0].u, a[1].f, a[2].f, a[3].f);
+        break;
+    case GLCMD_VERTEX_ATTRIB_4F:
+        glVertexAttrib4f(a[0].u, a[1].f, a[2].f, a[3].f, a[4].f);
+        break;
+    case GLCMD_VERTEX_ATTRIB_POINTER:
+        glVertexAttribPointer(a[0].u, a[1].i, a[2].e, a[3].b, a[4].s, a[5].p);
+        break;
+    case GLCMD_VIEWPORT:
+        glViewport(a[0].i, a[1].i, a[2].s, a[3].s);
+        break;
+    default:
+        trace_error("%s, unknown command %u\n", __func__, c->op);
+        break;
+    }
+}
+
+static
+void *
+gl_thread(void *param)
+{
+    struct gl_cmd_buffer_s *cb = param;
+
+    ppb_message_loop_mark_thread_unsuitable();
+
+    pthread_mutex_lock(&cb->lock);
+    while (1) {
+        uint64_t end = __atomic_load_n(&cb->wr, __ATOMIC_SEQ_CST);
+        if (cb->rd == end) {
+            pthread_cond_broadcast(&cb->cond_drained);
+            if (cb->quit)
+                break;
+
+            __atomic_store_n(&cb->consumer_sleeping, 1, __ATOMIC_SEQ_CST);
+            // producer may have committed a command before seeing the flag
+            if (__atomic_load_n(&cb->wr, __ATOMIC_SEQ_CST) == cb->rd)
+                pthread_cond_wait(&cb->cond_nonempty, &cb->lock);
+            __atomic_store_n(&cb->consumer_sleeping, 0, __ATOMIC_SEQ_CST);
+            continue;
+        }
+
+        EGLSurface egl_surf = cb->egl_surf;
+        EGLContext glc = cb->glc;
+        pthread_mutex_unlock(&cb->lock);
+
+        // whole batch is replayed under a single display lock
+        pthread_mutex_lock(&display.lock);
+        eglMakeCurrent(display.egl, egl_surf, egl_surf, glc);
+
+        uint64_t pos = cb->rd;
+        while (pos < end) {
+            const struct gl_cmd_s *cmd = (void *)(cb->ring + pos % cb->capacity);
+            replay_cmd(cmd);
+            pos += cmd->size;
+        }
+
+        eglMakeCurrent(display.egl, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        pthread_mutex_unlock(&display.lock);
+
+        pthread_mutex_lock(&cb->lock);
+        __atomic_store_n(&cb->rd, end, __ATOMIC_SEQ_CST);
+        pthread_cond_broadcast(&cb->cond_drained);
+    }
+    pthread_mutex_unlock(&cb->lock);
+
+    return NULL;
+}
+
+struct gl_cmd_buffer_s *
+gl_cmd_buffer_create(EGLSurface egl_surf, EGLContext glc)
+{
+    struct gl_cmd_buffer_s *cb = calloc(sizeof(*cb), 1);
+    if (!cb)
+        return NULL;
+
+    cb->capacity = GL_CMD_BUFFER_SIZE;
+    cb->ring = malloc(cb->capacity);
+    if (!cb->ring) {
+        free(cb);
+        return NULL;
+    }
+
+    cb->egl_surf = egl_surf;
+    cb->glc = glc;
+    cb->unpack_alignment = 4;
+    pthread_mutex_init(&cb->lock, NULL);
+    pthread_cond_init(&cb->cond_nonempty, NULL);
+    pthread_cond_init(&cb->cond_drained, NULL);
+
+    if (pthread_create(&cb->thread, NULL, gl_thread, cb) != 0) {
+        trace_error("%s, can't create GL thread\n", __func__);
+        pthread_cond_destroy(&cb->cond_drained);
+        pthread_cond_destroy(&cb->cond_nonempty);
+        pthread_mutex_destroy(&cb->lock);
+        free(cb->ring);
+        free(cb);
+        return NULL;
+    }
+
+    return cb;
+}
+
+void
+gl_cmd_buffer_destroy(struct gl_cmd_buffer_s *cb)
+{
+    if (!cb)
+        return;
+
+    pthread_mutex_lock(&cb->lock);
+    cb->quit = 1;
+    pthread_cond_signal(&cb->cond_nonempty);
+    pthread_mutex_unlock(&cb->lock);
+    pthread_join(cb->thread, NULL);
+
+    pthread_cond_destroy(&cb->cond_drained);
+    pthread_cond_destroy(&cb->cond_nonempty);
+    pthread_mutex_destroy(&cb->lock);
+    free(cb->ring);
+    free(cb);
+}
+
+static
+void
+wake_consumer(struct gl_cmd_buffer_s *cb)
+{
+    if (__atomic_load_n(&cb->consumer_sleeping, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&cb->lock);
+        pthread_cond_signal(&cb->cond_nonempty);
+        pthread_mutex_unlock(&cb->lock);
+    }
+}
+
+// waits until there is at least |size| bytes of free space in the ring
+static
+void
+wait_for_space(struct gl_cmd_buffer_s *cb, size_t size)
+{
+    if (cb->capacity - (cb->wr - __atomic_load_n(&cb->rd, __ATOMIC_SEQ_CST)) >= size)
+        return;
+
+    pthread_mutex_lock(&cb->lock);
+    pthread_cond_signal(&cb->cond_nonempty);
+    while (cb->capacity - (cb->wr - __atomic_load_n(&cb->rd, __ATOMIC_SEQ_CST)) < size)
+        pthread_cond_wait(&cb->cond_drained, &cb->lock);
+    pthread_mutex_unlock(&cb->lock);
+}
+
+struct gl_cmd_s *
+gl_cmd_buffer_alloc(struct gl_cmd_buffer_s *cb, uint32_t op, size_t payload_size)
+{
+    // large uploads are not worth copying, they are executed directly
+    if (payload_size > cb->capacity / 4)
+        return NULL;
+
+    size_t size = GL_CMD_ALIGN(sizeof(struct gl_cmd_s) + payload_size);
+
+    size_t offset = cb->wr % cb->capacity;
+    size_t tail = cb->capacity - offset;
+    if (tail < size) {
+        // command doesn't fit into the rest of the ring; fill it up and start from the beginning
+        wait_for_space(cb, tail);
+        struct gl_cmd_s *filler = (void *)(cb->ring + offset);
+        filler->size = tail;
+        filler->op = GLCMD_WRAP;
+        __atomic_store_n(&cb->wr, cb->wr + tail, __ATOMIC_SEQ_CST);
+    }
+
+    wait_for_space(cb, size);
+    struct gl_cmd_s *cmd = (void *)(cb->ring + cb->wr % cb->capacity);
+    cmd->size = size;
+    cmd->op = op;
+    return cmd;
+}
+
+const void *
+gl_cmd_buffer_copy_payload(struct gl_cmd_s *cmd, const void *data, size_t size)
+{
+    if (!data)
+        return NULL;
+
+    void *payload = cmd + 1;
+    memcpy(payload, data, size);
+    return payload;
+}
+
+void
+gl_cmd_buffer_commit(struct gl_cmd_buffer_s *cb, struct gl_cmd_s *cmd)
+{
+    __atomic_store_n(&cb->wr, cb->wr + cmd->size, __ATOMIC_SEQ_CST);
+    wake_consumer(cb);
+}
+
+void
+gl_cmd_buffer_sync(struct gl_cmd_buffer_s *cb)
+{
+    if (__atomic_load_n(&cb->rd, __ATOMIC_SEQ_CST) == cb->wr)
+        return;
+
+    pthread_mutex_lock(&cb->lock);
+    pthread_cond_signal(&cb->cond_nonempty);
+    while (__atomic_load_n(&cb->rd, __ATOMIC_SEQ_CST) != cb->wr)
+        pthread_cond_wait(&cb->cond_drained, &cb->lock);
+    pthread_mutex_unlock(&cb->lock);
+}
+
+void
+gl_cmd_buffer_set_surface(struct gl_cmd_buffer_s *cb, EGLSurface egl_surf)
+{
+    pthread_mutex_lock(&cb->lock);
+    cb->egl_surf = egl_surf;
+    pthread_mutex_unlock(&cb->lock);
+}
@@ -0,0 +1,194 @@
+/*
+ * Copyright © 2013-2014  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef FPP_GL_CMD_BUFFER_H
+#define FPP_GL_CMD_BUFFER_H
+
+#include <GLES2/gl2.h>
+#include <EGL/egl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stddef.h>
+
+
+#define GL_CMD_MAX_ARGS     10
+#define GL_CMD_IMMEDIATE    ((size_t)-1)    ///< payload size which forces immediate execution
+
+/// identifiers of GL calls which can be recorded into command buffer
+enum gl_cmd_op_e {
+    GLCMD_WRAP = 0,         ///< filler up to the end of ring, not a GL call
+    GLCMD_ACTIVE_TEXTURE,
+    GLCMD_BIND_BUFFER,
+    GLCMD_BIND_FRAMEBUFFER,
+    GLCMD_BIND_RENDERBUFFER,
+    GLCMD_BIND_TEXTURE,
+    GLCMD_BLEND_COLOR,
+    GLCMD_BLEND_EQUATION,
+    GLCMD_BLEND_EQUATION_SEPARATE,
+    GLCMD_BLEND_FUNC,
+    GLCMD_BLEND_FUNC_SEPARATE,
+    GLCMD_BUFFER_DATA,
+    GLCMD_BUFFER_SUB_DATA,
+    GLCMD_CLEAR,
+    GLCMD_CLEAR_COLOR,
+    GLCMD_CLEAR_DEPTHF,
+    GLCMD_CLEAR_STENCIL,
+    GLCMD_COLOR_MASK,
+    GLCMD_COMPRESSED_TEX_IMAGE_2D,
+    GLCMD_COMPRESSED_TEX_SUB_IMAGE_2D,
+    GLCMD_CULL_FACE,
+    GLCMD_DEPTH_FUNC,
+    GLCMD_DEPTH_MASK,
+    GLCMD_DEPTH_RANGEF,
+    GLCMD_DISABLE,
+    GLCMD_DISABLE_VERTEX_ATTRIB_ARRAY,
+    GLCMD_DRAW_ARRAYS,
+    GLCMD_DRAW_ELEMENTS,
+    GLCMD_ENABLE,
+    GLCMD_ENABLE_VERTEX_ATTRIB_ARRAY,
+    GLCMD_FLUSH,
+    GLCMD_FRAMEBUFFER_RENDERBUFFER,
+    GLCMD_FRAMEBUFFER_TEXTURE_2D,
+    GLCMD_FRONT_FACE,
+    GLCMD_GENERATE_MIPMAP,
+    GLCMD_HINT,
+    GLCMD_LINE_WIDTH,
+    GLCMD_PIXEL_STOREI,
+    GLCMD_POLYGON_OFFSET,
+    GLCMD_RENDERBUFFER_STORAGE,
+    GLCMD_SAMPLE_COVERAGE,
+    GLCMD_SCISSOR,
+    GLCMD_STENCIL_FUNC,
+    GLCMD_STENCIL_FUNC_SEPARATE,
+    GLCMD_STENCIL_MASK,
+    GLCMD_STENCIL_MASK_SEPARATE,
+    GLCMD_STENCIL_OP,
+    GLCMD_STENCIL_OP_SEPARATE,
+    GLCMD_TEX_IMAGE_2D,
+    GLCMD_TEX_PARAMETERF,
+    GLCMD_TEX_PARAMETERFV,
+    GLCMD_TEX_PARAMETERI,
+    GLCMD_TEX_PARAMETERIV,
+    GLCMD_TEX_SUB_IMAGE_2D,
+    GLCMD_UNIFORM_1F,
+    GLCMD_UNIFORM_1FV,
+    GLCMD_UNIFORM_1I,
+    GLCMD_UNIFORM_1IV,
+    GLCMD_UNIFORM_2F,
+    GLCMD_UNIFORM_2FV,
+    GLCMD_UNIFORM_2I,
+    GLCMD_UNIFORM_2IV,
+    GLCMD_UNIFORM_3F,
+    GLCMD_UNIFORM_3FV,
+    GLCMD_UNIFORM_3I,
+    GLCMD_UNIFORM_3IV,
+    GLCMD_UNIFORM_4F,
+    GLCMD_UNIFORM_4FV,
+    GLCMD_UNIFORM_4I,
+    GLCMD_UNIFORM_4IV,
+    GLCMD_UNIFORM_MATRIX_2FV,
+    GLCMD_UNIFORM_MATRIX_3FV,
+    GLCMD_UNIFORM_MATRIX_4FV,
+    GLCMD_USE_PROGRAM,
+    GLCMD_VERTEX_ATTRIB_1F,
+    GLCMD_VERTEX_ATTRIB_2F,
+    GLCMD_VERTEX_ATTRIB_3F,
+    GLCMD_VERTEX_ATTRIB_4F,
+    GLCMD_VERTEX_ATTRIB_POINTER,
+    GLCMD_VIEWPORT,
+};
+
+union gl_cmd_arg_u {
+    GLint           i;
+    GLuint          u;
+    GLenum          e;
+    GLfloat         f;
+    GLboolean       b;
+    GLsizei         s;
+    GLbitfield      bf;
+    GLintptr        ip;
+    GLsizeiptr      sp;
+    const void     *p;
+};
+
+/// recorded GL call. Payload (copy of client memory) follows immediately after the structure
+struct gl_cmd_s {
+    uint32_t            size;       ///< size of the whole record, including payload
+    uint32_t            op;         ///< one of gl_cmd_op_e
+    union gl_cmd_arg_u  a[GL_CMD_MAX_ARGS];
+};
+
+struct gl_cmd_buffer_s {
+    char               *ring;
+    size_t              capacity;
+    uint64_t            wr;             ///< write position, modified by producer only
+    uint64_t            rd;             ///< read position, modified by GL thread only
+    int                 consumer_sleeping;
+    int                 quit;
+    pthread_t           thread;
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond_nonempty;
+    pthread_cond_t      cond_drained;
+
+    EGLSurface          egl_surf;       ///< surface and context GL thread makes current
+    EGLContext          glc;
+
+    // state shadowed on the producer side. Used to decide whether call can be deferred
+    GLuint              array_buffer;
+    GLuint              element_array_buffer;
+    GLint               unpack_alignment;
+    uint32_t            client_arrays;  ///< bit mask of attributes sourced from client memory
+};
+
+/// creates command buffer and starts GL thread for it
+struct gl_cmd_buffer_s *
+gl_cmd_buffer_create(EGLSurface egl_surf, EGLContext glc);
+
+/// waits for all recorded commands to complete, stops GL thread and frees buffer
+void
+gl_cmd_buffer_destroy(struct gl_cmd_buffer_s *cb);
+
+/// reserves space for a command with payload of given size. Returns NULL if command can't
+/// be recorded. Callers must serialize producer access (resource lock is used for that)
+struct gl_cmd_s *
+gl_cmd_buffer_alloc(struct gl_cmd_buffer_s *cb, uint32_t op, size_t payload_size);
+
+/// copies client data into command payload. Returns pointer to the copy, or NULL if
+/// data is NULL
+const void *
+gl_cmd_buffer_copy_payload(struct gl_cmd_s *cmd, const void *data, size_t size);
+
+/// makes command visible to the GL thread
+void
+gl_cmd_buffer_commit(struct gl_cmd_buffer_s *cb, struct gl_cmd_s *cmd);
+
+/// waits until GL thread executes all recorded commands and releases the context
+void
+gl_cmd_buffer_sync(struct gl_cmd_buffer_s *cb);
+
+/// changes surface commands are replayed to. Buffer must be synced before the call
+void
+gl_cmd_buffer_set_surface(struct gl_cmd_buffer_s *cb, EGLSurface egl_surf);
+
+#endif // FPP_GL_CMD_BUFFER_H
@@ -0,0 +1,319 @@
+/*
+ * Copyright © 2013-2014  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "gl_profiler.h"
+#include <glib.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "config.h"
+#include "trace.h"
+#include "reverse_constant.h"
+
+
+#define LATENCY_BUCKETS     24      ///< bucket k holds calls that took [2^(k-1), 2^k) us
+
+struct entry_s {
+    const char *func;
+    GLenum      e;
+    uint64_t    count;
+    uint64_t    total_ns;
+    uint64_t    max_ns;
+    uint64_t    bytes;
+    uint32_t    hist[LATENCY_BUCKETS];
+};
+
+struct context_s {
+    PP_Resource context;
+    PP_Instance instance;
+    GHashTable *entries;            ///< struct entry_s -> itself
+};
+
+int                             gl_profiler_enabled = 0;
+static pthread_once_t           init_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t          lock = PTHREAD_MUTEX_INITIALIZER;
+static GHashTable              *contexts = NULL;    ///< PP_Resource -> struct context_s
+static volatile sig_atomic_t    report_requested = 0;
+static int                      handler_installed = 0;  ///< protected by |lock|
+static struct sigaction         prev_sigusr2;           ///< host's handler, restored at shutdown
+
+
+static
+guint
+entry_hash(gconstpointer p)
+{
+    const struct entry_s *en = p;
+    return g_direct_hash(en->func) ^ (en->e * 2654435761u);
+}
+
+static
+gboolean
+entry_equal(gconstpointer a, gconstpointer b)
+{
+    const struct entry_s *en_a = a;
+    const struct entry_s *en_b = b;
+    return en_a->func == en_b->func && en_a->e == en_b->e;
+}
+
+static
+void
+entry_free(gpointer p)
+{
+    g_slice_free(struct entry_s, p);
+}
+
+static
+void
+context_free(gpointer p)
+{
+    struct context_s *ctx = p;
+    g_hash_table_unref(ctx->entries);
+    g_slice_free(struct context_s, ctx);
+}
+
+static
+void
+sigusr2_handler(int sig)
+{
+    // report is printed by next profiled call, as printing is not async-signal-safe
+    report_requested = 1;
+}
+
+static
+void
+do_initialize(void)
+{
+    if (!config.gl_profiler)
+        return;
+
+    contexts = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, context_free);
+    gl_profiler_enabled = 1;
+}
+
+void
+gl_profiler_initialize(void)
+{
+    pthread_once(&init_once, do_initialize);
+    if (!gl_profiler_enabled)
+        return;
+
+    // handler is installed again if plugin is initialized after shutdown without unloading
+    pthread_mutex_lock(&lock);
+    if (!handler_installed) {
+        struct sigaction sa = { .sa_handler = sigusr2_handler, .sa_flags = SA_RESTART };
+        sigemptyset(&sa.sa_mask);
+        if (sigaction(SIGUSR2, &sa, &prev_sigusr2) == 0) {
+            handler_installed = 1;
+            trace_error("GL profiler enabled, send SIGUSR2 to %d to get a report\n",
+                        (int)getpid());
+        }
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void
+gl_profiler_shutdown(void)
+{
+    // handler must not outlive the code it points to
+    pthread_mutex_lock(&lock);
+    if (handler_installed) {
+        sigaction(SIGUSR2, &prev_sigusr2, NULL);
+        handler_installed = 0;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+uint64_t
+gl_profiler_now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static
+unsigned int
+latency_bucket(uint64_t ns)
+{
+    uint64_t us = ns / 1000;
+    unsigned int k = 0;
+    while (us > 0 && k < LATENCY_BUCKETS - 1) {
+        us >>= 1;
+        k ++;
+    }
+    return k;
+}
+
+void
+gl_profiler_record(PP_Resource context, const char *func, const struct gl_profiler_call_s *call)
+{
+    const uint64_t elapsed = gl_profiler_now() - call->start;
+
+    pthread_mutex_lock(&lock);
+    struct context_s *ctx = g_hash_table_lookup(contexts, GSIZE_TO_POINTER(context));
+    if (!ctx) {
+        ctx = g_slice_new0(struct context_s);
+        ctx->context = context;
+        ctx->entries = g_hash_table_new_full(entry_hash, entry_equal, NULL, entry_free);
+        g_hash_table_insert(contexts, GSIZE_TO_POINTER(context), ctx);
+    }
+    if (!ctx->instance)
+        ctx->instance = call->instance;
+
+    struct entry_s key = { .func = func, .e = call->e };
+    struct entry_s *en = g_hash_table_lookup(ctx->entries, &key);
+    if (!en) {
+        en = g_slice_new0(struct entry_s);
+        en->func = func;
+        en->e = call->e;
+        g_hash_table_insert(ctx->entries, en, en);
+    }
+
+    en->count ++;
+    en->total_ns += elapsed;
+    en->bytes += call->bytes;
+    if (elapsed > en->max_ns)
+        en->max_ns = elapsed;
+    en->hist[latency_bucket(elapsed)] ++;
+    pthread_mutex_unlock(&lock);
+
+    if (report_requested) {
+        report_requested = 0;
+        gl_profiler_report(0);
+    }
+}
+
+static
+int
+entry_cmp_total_desc(const void *a, const void *b)
+{
+    const struct entry_s *en_a = *(struct entry_s * const *)a;
+    const struct entry_s *en_b = *(struct entry_s * const *)b;
+    if (en_a->total_ns != en_b->total_ns)
+        return en_a->total_ns < en_b->total_ns ? 1 : -1;
+    return en_a->count < en_b->count ? 1 : (en_a->count > en_b->count ? -1 : 0);
+}
+
+// upper bound of latency below which |fraction| of calls fall, in microseconds
+static
+uint64_t
+percentile_us(const struct entry_s *en, double fraction)
+{
+    const uint64_t threshold = (uint64_t)(en->count * fraction + 0.999999);
+    uint64_t cumulative = 0;
+    for (unsigned int k = 0; k < LATENCY_BUCKETS; k ++) {
+        cumulative += en->hist[k];
+        if (cumulative >= threshold)
+            return (uint64_t)1 << k;
+    }
+    return (uint64_t)1 << (LATENCY_BUCKETS - 1);
+}
+
+static
+void
+report_context(const struct context_s *ctx)
+{
+    const char *prefix = "ppb_opengles2_";
+    const size_t prefix_len = strlen(prefix);
+    guint n = g_hash_table_size(ctx->entries);
+    struct entry_s **entries = malloc(sizeof(*entries) * (n + 1));
+    uint64_t total_count = 0;
+    uint64_t total_ns = 0;
+    uint64_t total_bytes = 0;
+    GHashTableIter iter;
+    gpointer value;
+    guint k = 0;
+
+    g_hash_table_iter_init(&iter, ctx->entries);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        struct entry_s *en = value;
+        entries[k ++] = en;
+        total_count += en->count;
+        total_ns += en->total_ns;
+        total_bytes += en->bytes;
+    }
+    qsort(entries, n, sizeof(*entries), entry_cmp_total_desc);
+
+    trace_error("GL profile, instance %d, context %d: %" PRIu64 " calls, %.3f ms, "
+                "%" PRIu64 " bytes uploaded\n", ctx->instance, ctx->context, total_count,
+                total_ns / 1e6, total_bytes);
+    trace_error("  %-44s %10s %6s %10s %9s %9s %9s %12s  %s\n", "entry point", "calls", "%time",
+                "total ms", "avg us", "p99 us", "max us", "bytes", "latency histogram, us");
+
+    for (k = 0; k < n; k ++) {
+        const struct entry_s *en = entries[k];
+        const char *func = en->func;
+        char name[64];
+        char hist[LATENCY_BUCKETS * 16] = "";
+        size_t pos = 0;
+
+        if (strncmp(func, prefix, prefix_len) == 0)
+            func += prefix_len;
+        if (en->e != 0)
+            snprintf(name, sizeof(name), "%s(%s)", func, reverse_gl_enum(en->e));
+        else
+            snprintf(name, sizeof(name), "%s", func);
+
+        for (unsigned int j = 0; j < LATENCY_BUCKETS && pos < sizeof(hist); j ++) {
+            if (en->hist[j] == 0)
+                continue;
+            pos += snprintf(hist + pos, sizeof(hist) - pos, "%s<%" PRIu64 ":%u", pos ? " " : "",
+                            (uint64_t)1 << j, en->hist[j]);
+        }
+
+        trace_error("  %-44s %10" PRIu64 " %6.2f %10.3f %9.2f %9" PRIu64 " %9.1f %12" PRIu64
+                    "  %s\n", name, en->count, total_ns ? 100.0 * en->total_ns / total_ns : 0.0,
+                    en->total_ns / 1e6, en->total_ns / 1e3 / en->count, percentile_us(en, 0.99),
+                    en->max_ns / 1e3, en->bytes, hist);
+    }
+
+    free(entries);
+}
+
+void
+gl_profiler_report(PP_Instance instance)
+{
+    if (!gl_profiler_enabled)
+        return;
+
+    GHashTableIter iter;
+    gpointer value;
+
+    pthread_mutex_lock(&lock);
+    g_hash_table_iter_init(&iter, contexts);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        struct context_s *ctx = value;
+        if (instance != 0 && ctx->instance != instance)
+            continue;
+        report_context(ctx);
+        if (instance != 0)
+            g_hash_table_iter_remove(&iter);
+    }
+    pthread_mutex_unlock(&lock);
+}
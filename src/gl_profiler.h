@@ -0,0 +1,84 @@
+/*
+ * Copyright © 2013-2014  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef FPP_GL_PROFILER_H
+#define FPP_GL_PROFILER_H
+
+#include <ppapi/c/pp_instance.h>
+#include <ppapi/c/pp_resource.h>
+#include <GLES2/gl2.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/// per-call profiling record, lives on stack of PPB_OpenGLES2 entry point
+struct gl_profiler_call_s {
+    uint64_t    start;      ///< monotonic time in ns, zero if profiler is disabled
+    PP_Instance instance;
+    GLenum      e;          ///< enum argument calls are grouped by, zero if none
+    size_t      bytes;      ///< client memory uploaded to GL
+};
+
+extern int gl_profiler_enabled;
+
+/// enables profiler if configured to. Safe to call more than once
+void
+gl_profiler_initialize(void);
+
+/// restores signal handler replaced by gl_profiler_initialize(). Called before plugin
+/// is unloaded
+void
+gl_profiler_shutdown(void);
+
+uint64_t
+gl_profiler_now(void);
+
+static inline
+void
+gl_profiler_begin(struct gl_profiler_call_s *call)
+{
+    call->start = gl_profiler_enabled ? gl_profiler_now() : 0;
+    call->instance = 0;
+    call->e = 0;
+    call->bytes = 0;
+}
+
+/// accounts call to |func| of |context|. |func| must be a string with static storage duration
+void
+gl_profiler_record(PP_Resource context, const char *func, const struct gl_profiler_call_s *call);
+
+static inline
+void
+gl_profiler_end(PP_Resource context, const char *func, const struct gl_profiler_call_s *call)
+{
+    if (call->start)
+        gl_profiler_record(context, func, call);
+}
+
+/// prints sorted per-context report for |instance| and forgets its data. If |instance| is
+/// zero, all contexts are reported and nothing is forgotten
+void
+gl_profiler_report(PP_Instance instance);
+
+#endif // FPP_GL_PROFILER_H
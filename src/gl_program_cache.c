@@ -0,0 +1,359 @@
+/*
+ * Copyright © 2013-2014  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "gl_program_cache.h"
+#include <fcntl.h>
+#include <glib.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "eintr_retry.h"
+#include "trace.h"
+
+
+#define ENTRY_MAGIC         0x42475046      // "FPGB"
+#define ENTRY_VERSION       1
+#define DIGEST_LEN          32
+#define TMP_PREFIX          "tmp-"
+#define STALE_TMP_SECONDS   60              ///< leftovers of crashed writers are removed after
+
+struct entry_header_s {
+    uint32_t    magic;
+    uint32_t    version;
+    uint32_t    format;
+    uint32_t    size;
+    uint8_t     digest[DIGEST_LEN];         ///< SHA-256 of payload
+};
+
+struct dir_entry_s {
+    char       *name;
+    int64_t     mtime_ns;
+    size_t      size;
+};
+
+static
+void
+scan_and_evict(struct gl_program_cache_s *cache);
+
+static
+void
+payload_digest(const void *data, size_t size, uint8_t digest[DIGEST_LEN])
+{
+    GChecksum *cs = g_checksum_new(G_CHECKSUM_SHA256);
+    gsize len = DIGEST_LEN;
+
+    g_checksum_update(cs, data, size);
+    g_checksum_get_digest(cs, digest, &len);
+    g_checksum_free(cs);
+}
+
+static
+int
+read_full(int fd, void *buf, size_t len)
+{
+    char *p = buf;
+    while (len > 0) {
+        ssize_t ret = RETRY_ON_EINTR(read(fd, p, len));
+        if (ret <= 0)
+            return -1;
+        p += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+static
+int
+write_full(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t ret = RETRY_ON_EINTR(write(fd, p, len));
+        if (ret < 0)
+            return -1;
+        p += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+struct gl_program_cache_s *
+gl_program_cache_open(const char *dir, size_t max_size)
+{
+    if (g_mkdir_with_parents(dir, 0700) != 0) {
+        trace_warning("%s, can't create %s\n", __func__, dir);
+        return NULL;
+    }
+
+    struct gl_program_cache_s *cache = g_slice_alloc0(sizeof(*cache));
+    cache->dir = g_strdup(dir);
+    cache->max_size = max_size;
+    pthread_mutex_init(&cache->lock, NULL);
+
+    pthread_mutex_lock(&cache->lock);
+    scan_and_evict(cache);
+    pthread_mutex_unlock(&cache->lock);
+    return cache;
+}
+
+void
+gl_program_cache_close(struct gl_program_cache_s *cache)
+{
+    if (!cache)
+        return;
+    pthread_mutex_destroy(&cache->lock);
+    g_free(cache->dir);
+    g_slice_free1(sizeof(*cache), cache);
+}
+
+void
+gl_program_cache_key(char key[GL_PROGRAM_CACHE_KEY_LEN + 1], const char *const *parts)
+{
+    GChecksum *cs = g_checksum_new(G_CHECKSUM_SHA256);
+
+    for (const char *const *p = parts; *p; p ++) {
+        // length prefix delimits parts
+        const uint64_t len = strlen(*p);
+        g_checksum_update(cs, (const guchar *)&len, sizeof(len));
+        g_checksum_update(cs, (const guchar *)*p, len);
+    }
+
+    memcpy(key, g_checksum_get_string(cs), GL_PROGRAM_CACHE_KEY_LEN);
+    key[GL_PROGRAM_CACHE_KEY_LEN] = 0;
+    g_checksum_free(cs);
+}
+
+void *
+gl_program_cache_load(struct gl_program_cache_s *cache, const char *key, GLenum *format,
+                      size_t *size)
+{
+    char *path = g_strdup_printf("%s/%s", cache->dir, key);
+    struct entry_header_s hdr;
+    struct stat sb;
+    uint8_t digest[DIGEST_LEN];
+    void *data = NULL;
+
+    int fd = RETRY_ON_EINTR(open(path, O_RDONLY));
+    if (fd < 0)
+        goto done;
+
+    if (fstat(fd, &sb) != 0 || read_full(fd, &hdr, sizeof(hdr)) != 0)
+        goto damaged;
+
+    if (hdr.magic != ENTRY_MAGIC || hdr.version != ENTRY_VERSION ||
+        (uint64_t)sb.st_size != sizeof(hdr) + (uint64_t)hdr.size)
+    {
+        goto damaged;
+    }
+
+    data = malloc(hdr.size > 0 ? hdr.size : 1);
+    if (!data)
+        goto done;
+
+    if (read_full(fd, data, hdr.size) != 0)
+        goto damaged;
+
+    payload_digest(data, hdr.size, digest);
+    if (memcmp(digest, hdr.digest, DIGEST_LEN) != 0)
+        goto damaged;
+
+    // refresh LRU position
+    futimens(fd, NULL);
+
+    *format = hdr.format;
+    *size = hdr.size;
+    goto done;
+
+damaged:
+    trace_warning("%s, removing damaged entry %s\n", __func__, key);
+    gl_program_cache_remove(cache, key);
+    free(data);
+    data = NULL;
+
+done:
+    if (fd >= 0)
+        close(fd);
+    g_free(path);
+    return data;
+}
+
+int
+gl_program_cache_contains(struct gl_program_cache_s *cache, const char *key)
+{
+    char *path = g_strdup_printf("%s/%s", cache->dir, key);
+    int ret = (utimensat(AT_FDCWD, path, NULL, 0) == 0);
+    g_free(path);
+    return ret;
+}
+
+static
+int
+dir_entry_cmp_mtime(const void *a, const void *b)
+{
+    const struct dir_entry_s *en_a = a;
+    const struct dir_entry_s *en_b = b;
+    if (en_a->mtime_ns != en_b->mtime_ns)
+        return en_a->mtime_ns < en_b->mtime_ns ? -1 : 1;
+    return strcmp(en_a->name, en_b->name);
+}
+
+// computes total size of entries, and evicts least recently used ones if it exceeds the
+// limit. Must be called with cache->lock held
+static
+void
+scan_and_evict(struct gl_program_cache_s *cache)
+{
+    GDir *dir = g_dir_open(cache->dir, 0, NULL);
+    if (!dir)
+        return;
+
+    GArray *entries = g_array_new(FALSE, FALSE, sizeof(struct dir_entry_s));
+    const time_t now = time(NULL);
+    size_t total = 0;
+    const char *name;
+
+    while ((name = g_dir_read_name(dir)) != NULL) {
+        char *path = g_strdup_printf("%s/%s", cache->dir, name);
+        struct stat sb;
+
+        if (stat(path, &sb) != 0 || !S_ISREG(sb.st_mode)) {
+            g_free(path);
+            continue;
+        }
+
+        if (strncmp(name, TMP_PREFIX, strlen(TMP_PREFIX)) == 0) {
+            if (now - sb.st_mtime > STALE_TMP_SECONDS)
+                unlink(path);
+        } else if (strlen(name) == GL_PROGRAM_CACHE_KEY_LEN) {
+            struct dir_entry_s en = {
+                .name =     g_strdup(name),
+                .mtime_ns = (int64_t)sb.st_mtim.tv_sec * 1000000000 + sb.st_mtim.tv_nsec,
+                .size =     sb.st_size,
+            };
+            g_array_append_val(entries, en);
+            total += sb.st_size;
+        }
+        g_free(path);
+    }
+    g_dir_close(dir);
+
+    if (total > cache->max_size) {
+        const size_t target = cache->max_size - cache->max_size / 4;
+        g_array_sort(entries, dir_entry_cmp_mtime);
+        for (guint k = 0; k < entries->len && total > target; k ++) {
+            struct dir_entry_s *en = &g_array_index(entries, struct dir_entry_s, k);
+            char *path = g_strdup_printf("%s/%s", cache->dir, en->name);
+            if (unlink(path) == 0)
+                total -= en->size;
+            g_free(path);
+        }
+    }
+
+    for (guint k = 0; k < entries->len; k ++)
+        g_free(g_array_index(entries, struct dir_entry_s, k).name);
+    g_array_free(entries, TRUE);
+
+    cache->total_size = total;
+    cache->stores_since_scan = 0;
+}
+
+int
+gl_program_cache_store(struct gl_program_cache_s *cache, const char *key, GLenum format,
+                       const void *data, size_t size)
+{
+    struct entry_header_s hdr = {
+        .magic =    ENTRY_MAGIC,
+        .version =  ENTRY_VERSION,
+        .format =   format,
+        .size =     size,
+    };
+
+    if (size > UINT32_MAX || sizeof(hdr) + size > cache->max_size)
+        return -1;
+
+    payload_digest(data, size, hdr.digest);
+
+    char *tmp_path = g_strdup_printf("%s/" TMP_PREFIX "XXXXXX", cache->dir);
+    char *path = g_strdup_printf("%s/%s", cache->dir, key);
+    int ret = -1;
+
+    pthread_mutex_lock(&cache->lock);
+    int fd = mkstemp(tmp_path);
+    if (fd < 0) {
+        trace_warning("%s, can't create temporary file in %s\n", __func__, cache->dir);
+        goto done;
+    }
+
+    // data must reach the disk before rename makes entry visible. Empty entries are only
+    // checked for existence, their content doesn't matter
+    if (write_full(fd, &hdr, sizeof(hdr)) != 0 || write_full(fd, data, size) != 0 ||
+        (size > 0 && fdatasync(fd) != 0))
+    {
+        close(fd);
+        unlink(tmp_path);
+        goto done;
+    }
+    close(fd);
+
+    // replaced entry doesn't count anymore
+    struct stat sb;
+    if (stat(path, &sb) == 0 && (size_t)sb.st_size <= cache->total_size)
+        cache->total_size -= sb.st_size;
+
+    if (rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        goto done;
+    }
+
+    ret = 0;
+    cache->total_size += sizeof(hdr) + size;
+    cache->stores_since_scan ++;
+    if (cache->total_size > cache->max_size ||
+        cache->stores_since_scan >= GL_PROGRAM_CACHE_RESCAN_STORES)
+    {
+        scan_and_evict(cache);
+    }
+
+done:
+    pthread_mutex_unlock(&cache->lock);
+    g_free(path);
+    g_free(tmp_path);
+    return ret;
+}
+
+void
+gl_program_cache_remove(struct gl_program_cache_s *cache, const char *key)
+{
+    char *path = g_strdup_printf("%s/%s", cache->dir, key);
+    struct stat sb;
+
+    pthread_mutex_lock(&cache->lock);
+    if (stat(path, &sb) == 0 && unlink(path) == 0 && (size_t)sb.st_size <= cache->total_size)
+        cache->total_size -= sb.st_size;
+    pthread_mutex_unlock(&cache->lock);
+    g_free(path);
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright © 2013-2014  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef FPP_GL_PROGRAM_CACHE_H
+#define FPP_GL_PROGRAM_CACHE_H
+
+#include <GLES2/gl2.h>
+#include <pthread.h>
+#include <stddef.h>
+
+
+/// On-disk cache of linked program binaries. Each entry is a separate file named after its
+/// key, written to a temporary file first and then renamed, so readers never see partially
+/// written entries. Payload checksum is verified on load; damaged entries are removed.
+/// File modification time serves as LRU position, and is refreshed on every hit.
+/// Total size is tracked in memory. Directory is scanned on open, when limit is exceeded, and
+/// every GL_PROGRAM_CACHE_RESCAN_STORES stores to account for other processes. Eviction
+/// frees a quarter of the limit at once, so scans stay rare when cache is full.
+
+#define GL_PROGRAM_CACHE_KEY_LEN        64  ///< hex digits in key, without terminating NUL
+#define GL_PROGRAM_CACHE_RESCAN_STORES  64
+
+struct gl_program_cache_s {
+    char           *dir;
+    size_t          max_size;       ///< total size of entries, in bytes
+    size_t          total_size;     ///< estimate, exact after each scan
+    unsigned int    stores_since_scan;
+    pthread_mutex_t lock;
+};
+
+/// opens cache in |dir|, creating directory if needed, and trims it to |max_size|. Returns
+/// NULL on failure
+struct gl_program_cache_s *
+gl_program_cache_open(const char *dir, size_t max_size);
+
+void
+gl_program_cache_close(struct gl_program_cache_s *cache);
+
+/// computes key from NULL-terminated list of strings. Strings are delimited, so moving text
+/// from one of them to another changes the key
+void
+gl_program_cache_key(char key[GL_PROGRAM_CACHE_KEY_LEN + 1], const char *const *parts);
+
+/// returns malloc()ed payload of entry, or NULL if there is no such entry, or it's damaged
+void *
+gl_program_cache_load(struct gl_program_cache_s *cache, const char *key, GLenum *format,
+                      size_t *size);
+
+/// checks whenever entry exists, refreshing its LRU position if it does
+int
+gl_program_cache_contains(struct gl_program_cache_s *cache, const char *key);
+
+/// stores entry. If total size exceeds limit, least recently used entries are evicted until
+/// it's down to three quarters of the limit. Returns 0 on success
+int
+gl_program_cache_store(struct gl_program_cache_s *cache, const char *key, GLenum format,
+                       const void *data, size_t size);
+
+void
+gl_program_cache_remove(struct gl_program_cache_s *cache, const char *key);
+
+#endif // FPP_GL_PROGRAM_CACHE_H
@@ -0,0 +1,187 @@
+/*
+ * Copyright © 2013-2014  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "gl_shadow_state.h"
+#include <string.h>
+#include "trace.h"
+#include "reverse_constant.h"
+
+
+static const GLenum tracked_caps[] = {
+    GL_BLEND,
+    GL_CULL_FACE,
+    GL_DEPTH_TEST,
+    GL_DITHER,
+    GL_POLYGON_OFFSET_FILL,
+    GL_SAMPLE_ALPHA_TO_COVERAGE,
+    GL_SAMPLE_COVERAGE,
+    GL_SCISSOR_TEST,
+    GL_STENCIL_TEST,
+};
+
+void
+gl_shadow_state_init(struct gl_shadow_state_s *s, GLuint framebuffer, GLint width, GLint height)
+{
+    memset(s, 0, sizeof(*s));
+    s->active_texture = GL_TEXTURE0;
+    s->framebuffer = framebuffer;
+    s->enabled_caps = gl_shadow_state_cap_bit(GL_DITHER);
+    s->blend_src_rgb = GL_ONE;
+    s->blend_dst_rgb = GL_ZERO;
+    s->blend_src_alpha = GL_ONE;
+    s->blend_dst_alpha = GL_ZERO;
+    s->blend_equation_rgb = GL_FUNC_ADD;
+    s->blend_equation_alpha = GL_FUNC_ADD;
+    s->depth_func = GL_LESS;
+    s->depth_mask = GL_TRUE;
+    s->viewport[2] = width;
+    s->viewport[3] = height;
+    glGetIntegerv(GL_MAX_COMBINED_TEXTURE_IMAGE_UNITS, &s->max_texture_units);
+}
+
+uint32_t
+gl_shadow_state_cap_bit(GLenum cap)
+{
+    for (unsigned int k = 0; k < sizeof(tracked_caps) / sizeof(tracked_caps[0]); k ++) {
+        if (tracked_caps[k] == cap)
+            return 1u << k;
+    }
+    return 0;
+}
+
+GLuint *
+gl_shadow_state_texture_slot(struct gl_shadow_state_s *s, GLenum target)
+{
+    const unsigned int unit = s->active_texture - GL_TEXTURE0;
+    if (unit >= GL_SHADOW_TEXTURE_UNITS)
+        return NULL;
+
+    switch (target) {
+    case GL_TEXTURE_2D:         return &s->texture_2d[unit];
+    case GL_TEXTURE_CUBE_MAP:   return &s->texture_cube_map[unit];
+    default:                    return NULL;
+    }
+}
+
+void
+gl_shadow_state_textures_deleted(struct gl_shadow_state_s *s, GLsizei n, const GLuint *textures)
+{
+    // deleted textures are unbound from all units
+    for (GLsizei j = 0; j < n; j ++) {
+        if (textures[j] == 0)
+            continue;
+        for (int k = 0; k < GL_SHADOW_TEXTURE_UNITS; k ++) {
+            if (s->texture_2d[k] == textures[j])
+                s->texture_2d[k] = 0;
+            if (s->texture_cube_map[k] == textures[j])
+                s->texture_cube_map[k] = 0;
+        }
+    }
+}
+
+void
+gl_shadow_state_buffers_deleted(struct gl_shadow_state_s *s, GLsizei n, const GLuint *buffers)
+{
+    for (GLsizei j = 0; j < n; j ++) {
+        if (buffers[j] == 0)
+            continue;
+        if (s->array_buffer == buffers[j])
+            s->array_buffer = 0;
+        if (s->element_array_buffer == buffers[j])
+            s->element_array_buffer = 0;
+    }
+}
+
+void
+gl_shadow_state_renderbuffers_deleted(struct gl_shadow_state_s *s, GLsizei n,
+                                      const GLuint *renderbuffers)
+{
+    for (GLsizei j = 0; j < n; j ++) {
+        if (renderbuffers[j] != 0 && s->renderbuffer == renderbuffers[j])
+            s->renderbuffer = 0;
+    }
+}
+
+static
+int
+check_value(const char *caller, GLenum pname, GLint shadow, GLint actual)
+{
+    if (shadow == actual)
+        return 0;
+
+    trace_error("%s, shadow state diverged: %s is %d (0x%x), but driver reports %d (0x%x)\n",
+                caller, reverse_gl_enum(pname), shadow, shadow, actual, actual);
+    return 1;
+}
+
+int
+gl_shadow_state_verify(const struct gl_shadow_state_s *s, const char *caller)
+{
+    int mismatches = 0;
+    GLint v[4];
+
+#define CHECK(pname, shadow_value)                                          \
+    do {                                                                    \
+        if ((GLuint)(shadow_value) == GL_SHADOW_UNKNOWN)                    \
+            break;                                                          \
+        glGetIntegerv(pname, v);                                            \
+        mismatches += check_value(caller, pname, (GLint)(shadow_value), v[0]); \
+    } while (0)
+
+    CHECK(GL_ACTIVE_TEXTURE, s->active_texture);
+    CHECK(GL_ARRAY_BUFFER_BINDING, s->array_buffer);
+    CHECK(GL_ELEMENT_ARRAY_BUFFER_BINDING, s->element_array_buffer);
+    CHECK(GL_FRAMEBUFFER_BINDING, s->framebuffer);
+    CHECK(GL_RENDERBUFFER_BINDING, s->renderbuffer);
+    CHECK(GL_CURRENT_PROGRAM, s->program);
+    CHECK(GL_BLEND_SRC_RGB, s->blend_src_rgb);
+    CHECK(GL_BLEND_DST_RGB, s->blend_dst_rgb);
+    CHECK(GL_BLEND_SRC_ALPHA, s->blend_src_alpha);
+    CHECK(GL_BLEND_DST_ALPHA, s->blend_dst_alpha);
+    CHECK(GL_BLEND_EQUATION_RGB, s->blend_equation_rgb);
+    CHECK(GL_BLEND_EQUATION_ALPHA, s->blend_equation_alpha);
+    CHECK(GL_DEPTH_FUNC, s->depth_func);
+
+    const unsigned int unit = s->active_texture - GL_TEXTURE0;
+    if (unit < GL_SHADOW_TEXTURE_UNITS) {
+        CHECK(GL_TEXTURE_BINDING_2D, s->texture_2d[unit]);
+        CHECK(GL_TEXTURE_BINDING_CUBE_MAP, s->texture_cube_map[unit]);
+    }
+#undef CHECK
+
+    GLboolean b;
+    glGetBooleanv(GL_DEPTH_WRITEMASK, &b);
+    mismatches += check_value(caller, GL_DEPTH_WRITEMASK, s->depth_mask, b);
+
+    for (unsigned int k = 0; k < sizeof(tracked_caps) / sizeof(tracked_caps[0]); k ++) {
+        mismatches += check_value(caller, tracked_caps[k], !!(s->enabled_caps & (1u << k)),
+                                  glIsEnabled(tracked_caps[k]));
+    }
+
+    glGetIntegerv(GL_VIEWPORT, v);
+    for (int k = 0; k < 4; k ++)
+        mismatches += check_value(caller, GL_VIEWPORT, s->viewport[k], v[k]);
+
+    return mismatches;
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright © 2013-2014  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef FPP_GL_SHADOW_STATE_H
+#define FPP_GL_SHADOW_STATE_H
+
+#include <GLES2/gl2.h>
+#include <stdint.h>
+
+
+#define GL_SHADOW_TEXTURE_UNITS     32
+
+/// value of a binding which actual state is not known; never matches a call argument
+#define GL_SHADOW_UNKNOWN           ((GLuint)~0u)
+
+/// Copy of frequently changed GL state of a context. Used to drop calls which would set
+/// state to its current value.
+struct gl_shadow_state_s {
+    GLenum      active_texture;
+    GLuint      texture_2d[GL_SHADOW_TEXTURE_UNITS];
+    GLuint      texture_cube_map[GL_SHADOW_TEXTURE_UNITS];
+    GLuint      array_buffer;
+    GLuint      element_array_buffer;
+    GLuint      framebuffer;
+    GLuint      renderbuffer;
+    GLuint      program;
+    uint32_t    enabled_caps;           ///< bit mask, see gl_shadow_state_cap_bit()
+    GLenum      blend_src_rgb;
+    GLenum      blend_dst_rgb;
+    GLenum      blend_src_alpha;
+    GLenum      blend_dst_alpha;
+    GLenum      blend_equation_rgb;
+    GLenum      blend_equation_alpha;
+    GLenum      depth_func;
+    GLboolean   depth_mask;
+    GLint       viewport[4];
+    GLint       max_texture_units;      ///< GL_MAX_COMBINED_TEXTURE_IMAGE_UNITS
+};
+
+/// sets state to GL defaults of a freshly created context. Context must be current
+void
+gl_shadow_state_init(struct gl_shadow_state_s *s, GLuint framebuffer, GLint width, GLint height);
+
+/// bit for capability in enabled_caps, or 0 if capability is not tracked
+uint32_t
+gl_shadow_state_cap_bit(GLenum cap);
+
+/// texture binding slot for |target| on current texture unit, or NULL if not tracked
+GLuint *
+gl_shadow_state_texture_slot(struct gl_shadow_state_s *s, GLenum target);
+
+/// handles deletion of objects which may be bound
+void
+gl_shadow_state_textures_deleted(struct gl_shadow_state_s *s, GLsizei n, const GLuint *textures);
+
+void
+gl_shadow_state_buffers_deleted(struct gl_shadow_state_s *s, GLsizei n, const GLuint *buffers);
+
+void
+gl_shadow_state_renderbuffers_deleted(struct gl_shadow_state_s *s, GLsizei n,
+                                      const GLuint *renderbuffers);
+
+/// compares shadow state with state queried by glGet*. Context must be current.
+/// Reports every mismatch and returns their count
+int
+gl_shadow_state_verify(const struct gl_shadow_state_s *s, const char *caller);
+
+#endif // FPP_GL_SHADOW_STATE_H
@@ -0,0 +1,223 @@
+/*
+ * Copyright © 2013-2014  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE             // for dladdr()
+#include "message_loop_stats.h"
+#include <dlfcn.h>
+#include <glib.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "trace.h"
+
+
+#define LATENCY_BUCKETS     24      ///< bucket k holds tasks that took [2^(k-1), 2^k) us
+
+struct callback_entry_s {
+    void       *func;
+    uint64_t    count;
+    uint64_t    total_run_ns;
+    uint64_t    max_run_ns;
+    uint64_t    max_delay_ns;
+};
+
+struct message_loop_stats_s {
+    pthread_mutex_t lock;
+    uint64_t        count;
+    uint32_t        delay_hist[LATENCY_BUCKETS];    ///< dequeue time minus scheduled time
+    uint32_t        run_hist[LATENCY_BUCKETS];
+    GHashTable     *callbacks;                      ///< func -> struct callback_entry_s
+};
+
+
+static
+void
+callback_entry_free(gpointer p)
+{
+    g_slice_free(struct callback_entry_s, p);
+}
+
+struct message_loop_stats_s *
+message_loop_stats_new(void)
+{
+    struct message_loop_stats_s *stats = g_slice_new0(struct message_loop_stats_s);
+    pthread_mutex_init(&stats->lock, NULL);
+    stats->callbacks = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+                                             callback_entry_free);
+    return stats;
+}
+
+void
+message_loop_stats_free(struct message_loop_stats_s *stats)
+{
+    if (!stats)
+        return;
+    g_hash_table_unref(stats->callbacks);
+    pthread_mutex_destroy(&stats->lock);
+    g_slice_free(struct message_loop_stats_s, stats);
+}
+
+static
+unsigned int
+latency_bucket(uint64_t ns)
+{
+    uint64_t us = ns / 1000;
+    unsigned int k = 0;
+    while (us > 0 && k < LATENCY_BUCKETS - 1) {
+        us >>= 1;
+        k ++;
+    }
+    return k;
+}
+
+// static functions are not in dynamic symbol table, for them module and offset are printed,
+// which could be resolved by addr2line
+static
+void
+symbolize(void *func, char *buf, size_t buf_size)
+{
+    Dl_info info;
+
+    if (dladdr(func, &info) == 0 || !info.dli_fname) {
+        snprintf(buf, buf_size, "%p", func);
+        return;
+    }
+
+    if (info.dli_sname && info.dli_saddr == func) {
+        snprintf(buf, buf_size, "%s", info.dli_sname);
+        return;
+    }
+
+    const char *module = strrchr(info.dli_fname, '/');
+    module = module ? module + 1 : info.dli_fname;
+    snprintf(buf, buf_size, "%s+0x%" PRIxPTR, module, (uintptr_t)func - (uintptr_t)info.dli_fbase);
+}
+
+void
+message_loop_stats_record(struct message_loop_stats_s *stats, void *func, uint64_t posted,
+                          uint64_t scheduled, uint64_t dequeued, uint64_t run_time)
+{
+    const uint64_t delay = (dequeued > scheduled) ? dequeued - scheduled : 0;
+
+    pthread_mutex_lock(&stats->lock);
+    stats->count ++;
+    stats->delay_hist[latency_bucket(delay)] ++;
+    stats->run_hist[latency_bucket(run_time)] ++;
+
+    struct callback_entry_s *en = g_hash_table_lookup(stats->callbacks, func);
+    if (!en) {
+        en = g_slice_new0(struct callback_entry_s);
+        en->func = func;
+        g_hash_table_insert(stats->callbacks, func, en);
+    }
+
+    en->count ++;
+    en->total_run_ns += run_time;
+    en->max_run_ns = MAX(en->max_run_ns, run_time);
+    en->max_delay_ns = MAX(en->max_delay_ns, delay);
+    pthread_mutex_unlock(&stats->lock);
+
+    const uint64_t threshold = config.message_loop_slow_task_ms * (uint64_t)1000000;
+    if (threshold > 0 && run_time + delay >= threshold) {
+        char name[256];
+        symbolize(func, name, sizeof(name));
+        trace_warning("slow task %s: ran for %.3f ms, waited %.3f ms in queue, "
+                      "%.3f ms since posted\n", name, run_time / 1e6, delay / 1e6,
+                      (dequeued - posted) / 1e6);
+    }
+}
+
+static
+int
+entry_cmp_total_desc(const void *a, const void *b)
+{
+    const struct callback_entry_s *en_a = *(struct callback_entry_s * const *)a;
+    const struct callback_entry_s *en_b = *(struct callback_entry_s * const *)b;
+    if (en_a->total_run_ns != en_b->total_run_ns)
+        return en_a->total_run_ns < en_b->total_run_ns ? 1 : -1;
+    return en_a->count < en_b->count ? 1 : (en_a->count > en_b->count ? -1 : 0);
+}
+
+static
+void
+format_histogram(const uint32_t *hist, char *buf, size_t buf_size)
+{
+    size_t pos = 0;
+
+    buf[0] = 0;
+    for (unsigned int k = 0; k < LATENCY_BUCKETS && pos < buf_size; k ++) {
+        if (hist[k] == 0)
+            continue;
+        pos += snprintf(buf + pos, buf_size - pos, "%s<%" PRIu64 ":%u", pos ? " " : "",
+                        (uint64_t)1 << k, hist[k]);
+    }
+}
+
+void
+message_loop_stats_report(struct message_loop_stats_s *stats, PP_Resource message_loop,
+                          unsigned int top_n)
+{
+    char hist[LATENCY_BUCKETS * 16];
+    GHashTableIter iter;
+    gpointer value;
+
+    if (!stats)
+        return;
+
+    pthread_mutex_lock(&stats->lock);
+
+    guint n = g_hash_table_size(stats->callbacks);
+    struct callback_entry_s **entries = malloc(sizeof(*entries) * (n + 1));
+    guint k = 0;
+
+    g_hash_table_iter_init(&iter, stats->callbacks);
+    while (g_hash_table_iter_next(&iter, NULL, &value))
+        entries[k ++] = value;
+    qsort(entries, n, sizeof(*entries), entry_cmp_total_desc);
+
+    trace_error("message loop %d: %" PRIu64 " tasks\n", message_loop, stats->count);
+    format_histogram(stats->delay_hist, hist, sizeof(hist));
+    trace_error("  queue delay histogram, us: %s\n", hist);
+    format_histogram(stats->run_hist, hist, sizeof(hist));
+    trace_error("  run time histogram, us: %s\n", hist);
+
+    // run time of a task includes nested loops it has run
+    trace_error("  %-48s %10s %10s %9s %9s %12s\n", "callback", "tasks", "total ms", "avg us",
+                "max us", "max delay us");
+    for (k = 0; k < n && k < top_n; k ++) {
+        const struct callback_entry_s *en = entries[k];
+        char name[256];
+
+        symbolize(en->func, name, sizeof(name));
+        trace_error("  %-48s %10" PRIu64 " %10.3f %9.2f %9.1f %12.1f\n", name, en->count,
+                    en->total_run_ns / 1e6, en->total_run_ns / 1e3 / en->count,
+                    en->max_run_ns / 1e3, en->max_delay_ns / 1e3);
+    }
+
+    pthread_mutex_unlock(&stats->lock);
+    free(entries);
+}
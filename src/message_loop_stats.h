@@ -0,0 +1,55 @@
+/*
+ * Copyright © 2013-2014  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef FPP_MESSAGE_LOOP_STATS_H
+#define FPP_MESSAGE_LOOP_STATS_H
+
+#include <stdint.h>
+#include <ppapi/c/pp_resource.h>
+
+
+/// Per message loop task timing. For each task loop reports when it was posted, when it was
+/// scheduled to run, when it was taken from the queue, and how long callback took. Data is
+/// aggregated into queue delay and run time histograms, and per-callback totals. Callbacks are
+/// identified by function pointer and are symbolized only when report is printed.
+
+struct message_loop_stats_s;
+
+struct message_loop_stats_s *
+message_loop_stats_new(void);
+
+void
+message_loop_stats_free(struct message_loop_stats_s *stats);
+
+/// all times are CLOCK_MONOTONIC nanoseconds
+void
+message_loop_stats_record(struct message_loop_stats_s *stats, void *func, uint64_t posted,
+                          uint64_t scheduled, uint64_t dequeued, uint64_t run_time);
+
+/// prints histograms and |top_n| callbacks with the largest total run time
+void
+message_loop_stats_report(struct message_loop_stats_s *stats, PP_Resource message_loop,
+                          unsigned int top_n);
+
+#endif // FPP_MESSAGE_LOOP_STATS_H
@@ -0,0 +1,100 @@
+/*
+ * Copyright © 2013-2014  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Based on the well-known intrusive MPSC node-based queue by Dmitry Vyukov.
+
+#include "mpsc_queue.h"
+#include <glib.h>
+
+
+struct mpsc_queue_s *
+mpsc_queue_new(void)
+{
+    struct mpsc_queue_s *q = g_slice_alloc0(sizeof(*q));
+    q->head = &q->stub;
+    q->tail = &q->stub;
+    return q;
+}
+
+void
+mpsc_queue_free(struct mpsc_queue_s *q)
+{
+    if (!q)
+        return;
+    g_slice_free1(sizeof(*q), q);
+}
+
+void
+mpsc_queue_push_chain(struct mpsc_queue_s *q, struct mpsc_node_s *first,
+                      struct mpsc_node_s *last)
+{
+    __atomic_store_n(&last->next, NULL, __ATOMIC_RELAXED);
+    struct mpsc_node_s *prev = __atomic_exchange_n(&q->head, last, __ATOMIC_ACQ_REL);
+    // until this store, consumer sees the chain as not yet linked
+    __atomic_store_n(&prev->next, first, __ATOMIC_RELEASE);
+}
+
+void
+mpsc_queue_push(struct mpsc_queue_s *q, struct mpsc_node_s *node)
+{
+    mpsc_queue_push_chain(q, node, node);
+}
+
+struct mpsc_node_s *
+mpsc_queue_pop(struct mpsc_queue_s *q)
+{
+    struct mpsc_node_s *tail = q->tail;
+    struct mpsc_node_s *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+    if (tail == &q->stub) {
+        if (!next)
+            return NULL;
+        // skip the stub
+        q->tail = next;
+        tail = next;
+        next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+    }
+
+    if (next) {
+        q->tail = next;
+        return tail;
+    }
+
+    if (tail != __atomic_load_n(&q->head, __ATOMIC_ACQUIRE)) {
+        // producer has swapped head, but haven't linked its node yet
+        return NULL;
+    }
+
+    // |tail| is the last node. It can't be returned while it's also a link point for producers,
+    // so stub is put behind it
+    mpsc_queue_push(q, &q->stub);
+
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (next) {
+        q->tail = next;
+        return tail;
+    }
+
+    return NULL;
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright © 2013-2014  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef FPP_MPSC_QUEUE_H
+#define FPP_MPSC_QUEUE_H
+
+#include <stddef.h>
+
+
+/// Intrusive lock-free multiple producer, single consumer FIFO queue. Producers do a single
+/// atomic exchange per push, consumer takes no locks at all. Items embed struct mpsc_node_s.
+///
+/// Pop may return NULL while some producer is in the middle of a push. Producers are expected
+/// to notify consumer after push completes, so such item is picked up on the next wakeup.
+
+struct mpsc_node_s {
+    struct mpsc_node_s *next;
+};
+
+struct mpsc_queue_s {
+    struct mpsc_node_s *head;   ///< most recently pushed node, updated by producers
+    char                pad[64 - sizeof(struct mpsc_node_s *)];
+    struct mpsc_node_s *tail;   ///< next node to pop, owned by consumer
+    struct mpsc_node_s  stub;
+};
+
+struct mpsc_queue_s *
+mpsc_queue_new(void);
+
+/// frees queue itself; items still in it are not touched
+void
+mpsc_queue_free(struct mpsc_queue_s *q);
+
+void
+mpsc_queue_push(struct mpsc_queue_s *q, struct mpsc_node_s *node);
+
+/// pushes chain of nodes, linked through |next| from |first| to |last|, as a single operation
+void
+mpsc_queue_push_chain(struct mpsc_queue_s *q, struct mpsc_node_s *first,
+                      struct mpsc_node_s *last);
+
+/// consumer side; returns NULL if queue is empty
+struct mpsc_node_s *
+mpsc_queue_pop(struct mpsc_queue_s *q);
+
+#endif // FPP_MPSC_QUEUE_H
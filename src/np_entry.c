@@ -35,6 +35,7 @@
 #include "config.h"
 #include "reverse_constant.h"
 #include "pp_interface.h"
+#include "gl_profiler.h"
 
 
 static void *module_dl_handler;
@@ -277,6 +278,7 @@ NP_Shutdown(void)
     trace_info_f("[NP] %s\n", __func__);
 
     unload_ppp_module();
+    gl_profiler_shutdown();
     tables_close_display();
 
     return NPERR_NO_ERROR;
@@ -46,15 +46,19 @@
 #include <ppapi/c/pp_errors.h>
 #include <ppapi/c/private/ppp_instance_private.h>
 #include "ppb_input_event.h"
+#include "ppb_instance.h"
 #include "ppb_url_loader.h"
 #include "ppb_url_request_info.h"
 #include "ppb_var.h"
 #include "ppb_core.h"
+#include "ppb_graphics3d.h"
+#include "gl_profiler.h"
 #include "ppb_message_loop.h"
 #include "header_parser.h"
 #include "keycodeconvert.h"
 #include "eintr_retry.h"
 #include "main_thread.h"
+#include "worker_pool.h"
 
 
 static
@@ -346,6 +350,10 @@ _destroy_instance_comt(void *user_data, int32_t result)
     struct destroy_instance_param_s *p = user_data;
 
     p->pp_i->ppp_instance_1_1->DidDestroy(p->pp_i->id);
+    gl_profiler_report(p->pp_i->id);
+    ppb_message_loop_report_stats(ppb_message_loop_get_for_main_thread());
+    ppb_message_loop_report_stats(ppb_message_loop_get_for_browser_thread());
+    worker_pool_report_stats();
     tables_remove_pp_instance(p->pp_i->id);
     pthread_mutex_lock(&display.lock);
     p->pp_i->npp = NULL;
@@ -494,9 +502,13 @@ NPP_DestroyStream(NPP npp, NPStream *stream, NPReason reason)
     }
 
     ul->finished_loading = 1;
+    ppb_url_loader_notify_finished_loading();
 
-    // execute all remaining tasks in task list
-    while (ul && ul->read_tasks) {
+    // execute all remaining tasks in task list. Their callbacks are posted together, so main
+    // loop is woken up once
+    GArray *ccbs = g_array_new(FALSE, FALSE, sizeof(struct PP_CompletionCallback));
+    GArray *results = g_array_new(FALSE, FALSE, sizeof(int32_t));
+    while (ul->read_tasks) {
         GList *llink = g_list_first(ul->read_tasks);
         struct url_loader_read_task_s *rt = llink->data;
         ul->read_tasks = g_list_delete_link(ul->read_tasks, llink);
@@ -511,21 +523,22 @@ NPP_DestroyStream(NPP npp, NPStream *stream, NPReason reason)
         else
             ul->read_pos += read_bytes;
 
-        pp_resource_release(loader);
-        ppb_core_call_on_main_thread(0, rt->ccb, read_bytes);
+        g_array_append_val(ccbs, rt->ccb);
+        g_array_append_val(results, read_bytes);
         g_slice_free(struct url_loader_read_task_s, rt);
-        ul = pp_resource_acquire(loader, PP_RESOURCE_URL_LOADER);
     }
 
-    if (ul && ul->stream_to_file) {
-        struct PP_CompletionCallback ccb = ul->stream_to_file_ccb;
-
-        pp_resource_release(loader);
-        ppb_core_call_on_main_thread(0, ccb, PP_OK);
-        return NPERR_NO_ERROR;
+    if (ul->stream_to_file) {
+        const int32_t result = PP_OK;
+        g_array_append_val(ccbs, ul->stream_to_file_ccb);
+        g_array_append_val(results, result);
     }
 
     pp_resource_release(loader);
+    ppb_core_call_on_main_thread_batch((struct PP_CompletionCallback *)ccbs->data,
+                                       (int32_t *)results->data, ccbs->len);
+    g_array_free(ccbs, TRUE);
+    g_array_free(results, TRUE);
     return NPERR_NO_ERROR;
 }
 
@@ -612,110 +625,116 @@ NPP_Print(NPP npp, NPPrint *platformPrint)
     return;
 }
 
+/// puts BGRA image to the drawable. Transparent images are composed over drawable contents,
+/// and should have premultiplied alpha
+static
+void
+put_image_to_drawable(XGraphicsExposeEvent *ev, char *data, int width, int height, int stride,
+                      int transparent)
+{
+    Display *dpy = ev->display;
+    Drawable drawable = ev->drawable;
+    int screen = 0;
+    cairo_surface_t *src_surf, *dst_surf;
+    cairo_t *cr;
+
+    if (transparent) {
+        XVisualInfo vi;
+        struct {
+            Window root;
+            int x, y;
+            unsigned int width, height, border, depth;
+        } d = {};
+
+        XGetGeometry(dpy, drawable, &d.root, &d.x, &d.y, &d.width, &d.height, &d.border,
+                     &d.depth);
+        if (XMatchVisualInfo(dpy, screen, d.depth, TrueColor, &vi)) {
+            dst_surf = cairo_xlib_surface_create(dpy, drawable, vi.visual, d.width, d.height);
+            src_surf = cairo_image_surface_create_for_data((unsigned char *)data,
+                CAIRO_FORMAT_ARGB32, width, height, stride);
+            cr = cairo_create(dst_surf);
+            cairo_set_source_surface(cr, src_surf, 0, 0);
+            cairo_rectangle(cr, ev->x, ev->y, MIN(width, ev->width), MIN(height, ev->height));
+            cairo_fill(cr);
+            cairo_destroy(cr);
+            cairo_surface_destroy(dst_surf);
+            cairo_surface_destroy(src_surf);
+            XFlush(dpy);
+        }
+    } else {
+        XImage *xi = XCreateImage(dpy, DefaultVisual(dpy, screen), 24, ZPixmap, 0,
+                                  data, width, height, 32, stride);
+
+        XPutImage(dpy, drawable, DefaultGC(dpy, screen), xi, 0, 0,
+                  ev->x, ev->y,
+                  MIN(width, ev->width), MIN(height, ev->height));
+        XFree(xi);
+    }
+}
+
+/// composes picture with premultiplied alpha over the drawable
+static
+void
+compose_argb_pixmap_to_drawable(XGraphicsExposeEvent *ev, Picture src_pict, int width,
+                                int height)
+{
+    Display *dpy = ev->display;
+    Drawable drawable = ev->drawable;
+    int screen = 0;
+    XVisualInfo vi;
+    struct {
+        Window root;
+        int x, y;
+        unsigned int width, height, border, depth;
+    } d = {};
+
+    XGetGeometry(dpy, drawable, &d.root, &d.x, &d.y, &d.width, &d.height, &d.border, &d.depth);
+    if (!XMatchVisualInfo(dpy, screen, d.depth, TrueColor, &vi))
+        return;
+
+    XRenderPictFormat *fmt = XRenderFindVisualFormat(dpy, vi.visual);
+    if (!fmt)
+        return;
+
+    Picture dst_pict = XRenderCreatePicture(dpy, drawable, fmt, 0, NULL);
+    XRenderComposite(dpy, PictOpOver, src_pict, None, dst_pict,
+                     ev->x, ev->y, 0, 0, ev->x, ev->y,
+                     MIN(width, ev->width), MIN(height, ev->height));
+    XRenderFreePicture(dpy, dst_pict);
+    XFlush(dpy);
+}
+
 static
 int16_t
 handle_graphics_expose_event(NPP npp, void *event)
 {
     XGraphicsExposeEvent *ev = event;
     struct pp_instance_s *pp_i = npp->pdata;
+
+    // done before acquiring graphics resource, to let plugin continue drawing meanwhile
+    ppb_graphics3d_wait_for_frame(pp_i->graphics);
+
     struct pp_graphics2d_s *g2d = pp_resource_acquire(pp_i->graphics, PP_RESOURCE_GRAPHICS2D);
     struct pp_graphics3d_s *g3d = pp_resource_acquire(pp_i->graphics, PP_RESOURCE_GRAPHICS3D);
     Display *dpy = ev->display;
     Drawable drawable = ev->drawable;
     int screen = 0;
-    cairo_surface_t *src_surf, *dst_surf;
-    cairo_t *cr;
     int retval;
 
     pthread_mutex_lock(&display.lock);
     if (g2d) {
-        if (pp_i->is_transparent) {
-            XVisualInfo vi;
-            struct {
-                Window root;
-                int x, y;
-                unsigned int width, height, border, depth;
-            } d = {};
-
-            XGetGeometry(dpy, drawable, &d.root, &d.x, &d.y, &d.width, &d.height, &d.border,
-                         &d.depth);
-            if (XMatchVisualInfo(dpy, screen, d.depth, TrueColor, &vi)) {
-                dst_surf = cairo_xlib_surface_create(dpy, drawable, vi.visual, d.width, d.height);
-                src_surf = cairo_image_surface_create_for_data((unsigned char *)g2d->second_buffer,
-                    CAIRO_FORMAT_ARGB32, g2d->scaled_width, g2d->scaled_height, g2d->scaled_stride);
-                cr = cairo_create(dst_surf);
-                cairo_set_source_surface(cr, src_surf, 0, 0);
-                cairo_rectangle(cr, ev->x, ev->y, MIN(g2d->scaled_width, ev->width),
-                                MIN(g2d->scaled_height, ev->height));
-                cairo_fill(cr);
-                cairo_destroy(cr);
-                cairo_surface_destroy(dst_surf);
-                cairo_surface_destroy(src_surf);
-                XFlush(dpy);
-            }
-        } else {
-            XImage *xi = XCreateImage(dpy, DefaultVisual(dpy, screen), 24, ZPixmap, 0,
-                                      g2d->second_buffer, g2d->scaled_width, g2d->scaled_height, 32,
-                                      g2d->scaled_stride);
-
-            XPutImage(dpy, drawable, DefaultGC(dpy, screen), xi, 0, 0,
-                      ev->x, ev->y,
-                      MIN(g2d->scaled_width, ev->width), MIN(g2d->scaled_height, ev->height));
-            XFree(xi);
+        put_image_to_drawable(ev, g2d->second_buffer, g2d->scaled_width, g2d->scaled_height,
+                              g2d->scaled_stride, pp_i->is_transparent);
+    } else if (g3d && g3d->backend == G3D_BACKEND_FBO) {
+        if (ppb_graphics3d_fbo_fetch_frame(g3d, pp_i->is_transparent) == 0) {
+            put_image_to_drawable(ev, g3d->fbo.image, g3d->width, g3d->height, g3d->fbo.stride,
+                                  pp_i->is_transparent);
         }
+    } else if (g3d && g3d->backend == G3D_BACKEND_COMPOSITE) {
+        // frame is already resolved into premultiplied ARGB pixmap
+        compose_argb_pixmap_to_drawable(ev, g3d->pict, g3d->width, g3d->height);
     } else if (g3d) {
         XSync(dpy, False);
-        if (pp_i->is_transparent) {
-            int ret;
-            // copy background to own pixmap
-            XCopyArea(dpy, drawable, g3d->pixmap, DefaultGC(dpy, screen),
-                      ev->x, ev->y,
-                      ev->width, ev->height,
-                      ev->x, ev->y);
-            XSync(dpy, False);
-
-            eglWaitNative(EGL_CORE_NATIVE_ENGINE);
-            ret = eglMakeCurrent(display.egl, g3d->egl_surf, g3d->egl_surf, g3d->glc_t);
-            if (!ret) {
-                trace_error("%s, eglMakeCurrent failed\n", __func__);
-                // TODO: abort?
-            }
-            glViewport(0, 0, g3d->width, g3d->height);
-            glBindTexture(GL_TEXTURE_2D, g3d->tex_back);
-            glCopyTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 0, 0, g3d->width, g3d->height, 0);
-
-            GLfloat p_left =    (float)ev->x / g3d->width;
-            GLfloat p_right =   (float)(ev->x + ev->width) / g3d->width;
-            GLfloat p_top =     (float)(g3d->height - ev->y - ev->height) / g3d->height;
-            GLfloat p_bottom =  (float)(g3d->height - ev->y) / g3d->height;
-            GLfloat square_vertices[] = {
-                p_left, p_top,
-                p_right, p_top,
-                p_left, p_bottom,
-                p_right, p_bottom,
-            };
-
-            glUseProgram(g3d->prog.id);
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, g3d->tex_back);
-            glActiveTexture(GL_TEXTURE1);
-            glBindTexture(GL_TEXTURE_2D, g3d->tex_front);
-
-            glUniform1i(g3d->prog.uniform_tex_back, 0);
-            glUniform1i(g3d->prog.uniform_tex_front, 1);
-
-            glVertexAttribPointer(g3d->prog.attrib_pos, 2, GL_FLOAT, 0, 0, square_vertices);
-            glEnableVertexAttribArray(g3d->prog.attrib_pos);
-
-            glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-
-            glDisableVertexAttribArray(g3d->prog.attrib_pos);
-
-            glFinish();
-            eglMakeCurrent(display.egl, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
-            eglWaitGL();
-        }
-
         XCopyArea(dpy, g3d->pixmap, drawable, DefaultGC(dpy, screen),
                   ev->x, ev->y,
                   ev->width, ev->height,
@@ -742,6 +761,7 @@ handle_graphics_expose_event(NPP npp, void *event)
 
 done:
     pthread_mutex_unlock(&display.lock);
+    ppb_instance_invalidate_serviced(pp_i->id);
     return retval;
 }
 
@@ -860,6 +880,30 @@ x_state_mask_to_pp_inputevent_modifier(unsigned int state)
     return mod;
 }
 
+// X server timestamps are milliseconds since an arbitrary server epoch. They are mapped into
+// PPB_Core ticks domain by an offset. Since every event is observed some time after it was
+// generated, the smallest offset seen so far is the best estimate. Offset is recalculated if
+// server time wraps around.
+static
+PP_TimeTicks
+x_time_to_time_ticks(Time x_time)
+{
+    static int      have_offset = 0;
+    static double   offset;
+    static Time     last_x_time;
+
+    const PP_TimeTicks now = ppb_core_get_time_ticks();
+    const double candidate = now - x_time / 1000.0;
+
+    if (!have_offset || x_time + 60 * 1000 < last_x_time || candidate < offset) {
+        offset = candidate;
+        have_offset = 1;
+    }
+    last_x_time = x_time;
+
+    return x_time / 1000.0 + offset;
+}
+
 struct call_plugin_handle_input_event_param_s {
     struct pp_instance_s       *pp_i;
     PP_Resource                 event_id;
@@ -909,8 +953,8 @@ handle_enter_leave_event(NPP npp, void *event)
     PP_InputEvent_Type event_type = (ev->type == EnterNotify) ? PP_INPUTEVENT_TYPE_MOUSEENTER
                                                               : PP_INPUTEVENT_TYPE_MOUSELEAVE;
     PP_Resource pp_event;
-    pp_event = ppb_mouse_input_event_create(pp_i->id, event_type,
-                                            ev->time/1.0e6, mod, PP_INPUTEVENT_MOUSEBUTTON_NONE,
+    pp_event = ppb_mouse_input_event_create(pp_i->id, event_type, x_time_to_time_ticks(ev->time),
+                                            mod, PP_INPUTEVENT_MOUSEBUTTON_NONE,
                                             &mouse_position, 0, &zero_point);
     ppp_handle_input_event_helper(pp_i, pp_event);
 
@@ -938,8 +982,9 @@ handle_motion_event(NPP npp, void *event)
     PP_Resource pp_event;
 
     pp_event = ppb_mouse_input_event_create(pp_i->id, PP_INPUTEVENT_TYPE_MOUSEMOVE,
-                                            ev->time/1.0e6, mod, PP_INPUTEVENT_MOUSEBUTTON_NONE,
-                                            &mouse_position, 0, &zero_point);
+                                            x_time_to_time_ticks(ev->time), mod,
+                                            PP_INPUTEVENT_MOUSEBUTTON_NONE, &mouse_position, 0,
+                                            &zero_point);
     ppp_handle_input_event_helper(pp_i, pp_event);
     return 1;
 }
@@ -1017,7 +1062,7 @@ handle_button_press_release_event(NPP npp, void *event)
         event_type = (ev->type == ButtonPress) ? PP_INPUTEVENT_TYPE_MOUSEDOWN
                                                : PP_INPUTEVENT_TYPE_MOUSEUP;
         pp_event = ppb_mouse_input_event_create(pp_i->id, event_type,
-                                                ev->time/1.0e6, mod, mouse_button,
+                                                x_time_to_time_ticks(ev->time), mod, mouse_button,
                                                 &mouse_position, 1, &zero_point);
         ppp_handle_input_event_helper(pp_i, pp_event);
 
@@ -1025,7 +1070,8 @@ handle_button_press_release_event(NPP npp, void *event)
         if (ev->type == ButtonRelease && ev_button == 3) {
             pp_event = ppb_mouse_input_event_create(pp_i->id,
                                                     PP_INPUTEVENT_TYPE_CONTEXTMENU,
-                                                    ev->time/1.0e6, mod, mouse_button,
+                                                    x_time_to_time_ticks(ev->time), mod,
+                                                    mouse_button,
                                                     &mouse_position, 1, &zero_point);
             ppp_handle_input_event_helper(pp_i, pp_event);
         }
@@ -1036,7 +1082,7 @@ handle_button_press_release_event(NPP npp, void *event)
         struct PP_FloatPoint wheel_ticks = { .x = wheel_x, .y = wheel_y };
 
         // pp_event = ppb_wheel_input_event_create(
-        //                 pp_i->id, ev->time/1.0e6, mod,
+        //                 pp_i->id, x_time_to_time_ticks(ev->time), mod,
         //                 &wheel_delta, &wheel_ticks, PP_FALSE);
         (void)wheel_delta;
         (void)wheel_ticks;
@@ -1095,15 +1141,16 @@ handle_key_press_release_event(NPP npp, void *event)
     if (ev->type == KeyPress && is_printable_sequence(buffer, charcount)) {
         struct PP_Var character_text = ppb_var_var_from_utf8(buffer, charcount);
         pp_event = ppb_keyboard_input_event_create_1_0(
-                        pp_i->id, PP_INPUTEVENT_TYPE_CHAR, ev->time/1.0e6, mod,
+                        pp_i->id, PP_INPUTEVENT_TYPE_CHAR, x_time_to_time_ticks(ev->time), mod,
                         pp_keycode, character_text);
         ppb_var_release(character_text);
 
         ppp_handle_input_event_helper(pp_i, pp_event);
     }
 
-    pp_event = ppb_keyboard_input_event_create_1_0(pp_i->id, event_type, ev->time/1.0e6,
-                                                   mod, pp_keycode, PP_MakeUndefined());
+    pp_event = ppb_keyboard_input_event_create_1_0(pp_i->id, event_type,
+                                                   x_time_to_time_ticks(ev->time), mod, pp_keycode,
+                                                   PP_MakeUndefined());
     ppp_handle_input_event_helper(pp_i, pp_event);
     return 1;
 }
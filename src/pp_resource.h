@@ -37,16 +37,21 @@
 
 #include <stdlib.h>
 #include <X11/Xlib.h>
+#include <X11/extensions/Xrender.h>
 #include <npapi/npapi.h>
 #include <npapi/npruntime.h>
 #include <glib.h>
 #include <EGL/egl.h>
+#include <EGL/eglext.h>
 #include <GLES2/gl2.h>
 #include <pango/pango.h>
 #include <pango/pangoft2.h>
 #include <pango/pangocairo.h>
 #include <cairo.h>
-#include <asoundlib.h>
+#include "staging_pool.h"
+#include "spsc_ring.h"
+#include "audio_mixer.h"
+#include "gl_shadow_state.h"
 #include <gtk/gtk.h>
 
 
@@ -104,6 +109,12 @@ enum file_ref_type_e {
     PP_FILE_REF_TYPE_FD,
 };
 
+enum g3d_backend_e {
+    G3D_BACKEND_PIXMAP,     ///< render into EGL pixmap surface, present by XCopyArea
+    G3D_BACKEND_FBO,        ///< render into FBO, read back and present by XPutImage
+    G3D_BACKEND_COMPOSITE,  ///< render into FBO, resolve into ARGB pixmap, compose by XRender
+};
+
 struct np_proxy_object_s {
     NPObject npobj;
     struct PP_Var ppobj;
@@ -155,6 +166,12 @@ struct pp_instance_s {
     struct PP_CompletionCallback    graphics_ccb;
     pthread_barrier_t               graphics_barrier;
     uint32_t                        graphics_in_progress;
+
+    // browser invalidation, see ppb_instance_request_invalidate()
+    NPRect                          damage_rect;
+    uint32_t                        have_damage;
+    uint32_t                        invalidate_queued;  ///< task posted to browser thread
+    uint32_t                        invalidate_pending; ///< NPN invalidate not yet exposed
 };
 
 
@@ -239,26 +256,65 @@ struct pp_view_s {
     struct PP_Rect      rect;
 };
 
+struct gl_cmd_buffer_s;
+struct timer_heap_s;
+struct mpsc_queue_s;
+struct message_loop_stats_s;
+
+/// contexts created with share_context pointing to each other form a group
+struct g3d_share_group_s {
+    int             ref_count;      ///< number of contexts in group
+};
+
 struct pp_graphics3d_s {
     COMMON_STRUCTURE_FIELDS
     EGLContext      glc;
     EGLConfig       egl_config;
     EGLContext      glc_t;          ///< presentation context for transparent instances
     EGLConfig       egl_config_t;   ///< EGLConfig for glc_t
+    EGLSurface      egl_surf_t;     ///< surface of ARGB pixmap for glc_t
+    Picture         pict;           ///< XRender picture of ARGB pixmap
     Pixmap          pixmap;
     EGLSurface      egl_surf;
     int32_t         width;
     int32_t         height;
     GHashTable     *sub_maps;
-    GLuint          tex_front;      ///< transparency helper texture, plugin data
-    GLuint          tex_back;       ///< transparency helper texture, previous drawable contents
+    GHashTable     *shaders;        ///< GLuint -> struct shader_info_s, see ppb_opengles2.c
+    GHashTable     *programs;       ///< GLuint -> struct program_info_s
+    GHashTable     *texture_targets;    ///< GLuint -> GLenum, target texture was bound to
+    GHashTable     *buffers;        ///< names of buffers plugin may have created, a set
+    GHashTable     *renderbuffers;  ///< same for renderbuffers
+    GHashTable     *framebuffers;   ///< same for framebuffers
+    struct staging_pool_s staging;  ///< memory for MapSub mappings
+    struct gl_cmd_buffer_s *cmd_buffer; ///< deferred GL commands, NULL if disabled
+    struct gl_shadow_state_s shadow;    ///< last state set through PPB_OpenGLES2
+    struct g3d_share_group_s *share_group;  ///< NULL if context shares nothing
+    enum g3d_backend_e backend;
+    EGLSyncKHR      swap_fence;     ///< signals when last swapped frame is rendered
+
+    struct {
+        GLuint      id;
+        GLuint      color_tex;
+        GLuint      depth_rb;
+        GLuint      stencil_rb;
+        GLenum      depth_format;   ///< internal format of |depth_rb|
+        GLuint      pbo[2];         ///< pixel pack buffers, zero if not supported
+        int         pbo_idx;        ///< buffer next readback goes to
+        int         pbo_ready;      ///< buffer with the most recent frame
+        GLenum      read_format;    ///< GL_BGRA_EXT if supported, GL_RGBA otherwise
+        int32_t     depth_size;     ///< requested depth buffer size
+        int32_t     stencil_size;   ///< requested stencil buffer size
+        char       *raw;            ///< readback destination if there are no PBOs
+        char       *image;          ///< converted frame, top-down BGRA, ready for XPutImage
+        int32_t     stride;
+    } fbo;                          ///< FBO backend state
 
     struct {
         GLuint      id;
         GLuint      attrib_pos;
-        GLint       uniform_tex_back;
-        GLint       uniform_tex_front;
-    } prog;                                     ///< alpha blending GL program
+        GLint       uniform_tex;
+        GLuint      vbo;
+    } prog;                                     ///< alpha premultiplying GL program
 };
 
 struct pp_image_data_s {
@@ -285,6 +341,7 @@ struct pp_graphics2d_s {
     char               *second_buffer;
     cairo_surface_t    *cairo_surf;
     GList              *task_list;
+    int                 need_full_repaint;  ///< next flush invalidates whole area
 };
 
 struct pp_network_monitor_s {
@@ -310,10 +367,13 @@ struct pp_audio_s {
     COMMON_STRUCTURE_FIELDS
     uint32_t                sample_rate;
     uint32_t                sample_frame_count;
-    uint32_t                period_size;
-    snd_pcm_t              *ph;
-    void                   *audio_buffer;
-    pthread_t               thread;
+    uint32_t                device_rate;    ///< rate of the mixer
+    struct audio_resampler_s *resampler;    ///< converts plugin data to mixer format
+    uint32_t                max_chunk;      ///< mixer frames made from one callback buffer
+    void                   *audio_buffer;   ///< filled by plugin callback
+    void                   *convert_buffer; ///< |audio_buffer| converted for mixer
+    struct audio_mixer_source_s source;     ///< ring from callback thread to mixer
+    pthread_t               fill_thread;    ///< calls plugin callback
     uint32_t                playing;
     uint32_t                shutdown;
     PPB_Audio_Callback_1_0  callback_1_0;
@@ -376,6 +436,15 @@ struct pp_tcp_socket_s {
     unsigned int    is_connected;
     unsigned int    destroyed;
     unsigned int    seen_eof;
+    unsigned int    watched;        ///< |sock| is watched by main message loop
+    unsigned int    read_pending;
+    char           *read_buffer;
+    int32_t         read_size;
+    struct PP_CompletionCallback read_ccb;
+    unsigned int    write_pending;
+    const char     *write_buffer;
+    int32_t         write_size;
+    struct PP_CompletionCallback write_ccb;
 };
 
 struct pp_file_ref_s {
@@ -392,8 +461,13 @@ struct pp_file_io_s {
 
 struct pp_message_loop_s {
     COMMON_STRUCTURE_FIELDS
-    GAsyncQueue            *async_q;
-    GQueue                 *int_q;
+    struct mpsc_queue_s    *task_q;         ///< posted tasks, not yet seen by loop thread
+    struct timer_heap_s    *int_q;          ///< tasks ordered by deadline
+    GPtrArray              *parked;         ///< due tasks waiting for their depth, by depth
+    int                     epoll_fd;       ///< loop thread sleeps here
+    int                     wakeup_fd;      ///< eventfd, signaled on each posted task
+    GHashTable             *fd_watches;     ///< fd -> struct message_loop_fd_watch_s
+    struct message_loop_stats_s *stats;     ///< task timing, NULL if disabled
     int                     running;
     int                     teardown;
     int                     depth;
@@ -32,7 +32,15 @@
 #include "config.h"
 #include "pp_resource.h"
 #include "ppb_message_loop.h"
-#include "eintr_retry.h"
+#include "spsc_ring.h"
+#include "audio_mixer.h"
+#include "audio_resampler.h"
+#include <string.h>
+#include <inttypes.h>
+
+
+// plugin always provides stereo signed 16-bit samples, mixer takes stereo floats
+#define FRAME_SIZE      (2 * sizeof(int16_t))
 
 
 static
@@ -67,63 +75,49 @@ do_ppb_audio_create(PP_Instance instance, PP_Resource audio_config,
     a->sample_frame_count = ac->sample_frame_count;
     pp_resource_release(audio_config);
 
-    snd_pcm_hw_params_t *hw_params;
-    snd_pcm_sw_params_t *sw_params;
-
-#define CHECK_A(funcname, params)                                                       \
-    do {                                                                                \
-        int errcode___ = funcname params;                                               \
-        if (errcode___ < 0) {                                                           \
-            trace_error("%s, " #funcname ", %s\n", __func__, snd_strerror(errcode___)); \
-            goto err;                                                                   \
-        }                                                                               \
-    } while (0)
-
-
-    CHECK_A(snd_pcm_open, (&a->ph, "default", SND_PCM_STREAM_PLAYBACK, 0));
-    CHECK_A(snd_pcm_hw_params_malloc, (&hw_params));
-    CHECK_A(snd_pcm_hw_params_any, (a->ph, hw_params));
-    CHECK_A(snd_pcm_hw_params_set_access, (a->ph, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED));
-    CHECK_A(snd_pcm_hw_params_set_format, (a->ph, hw_params, SND_PCM_FORMAT_S16_LE));
-    CHECK_A(snd_pcm_hw_params_set_rate_near, (a->ph, hw_params, &a->sample_rate, 0));
-    CHECK_A(snd_pcm_hw_params_set_channels, (a->ph, hw_params, 2));
-
-    unsigned int period_time = (long long)a->sample_frame_count * 1000 * 1000 / a->sample_rate;
-    period_time = CLAMP(period_time,
-                        1000 * config.audio_buffer_min_ms,
-                        1000 * config.audio_buffer_max_ms);
-    int dir = 1;
-    CHECK_A(snd_pcm_hw_params_set_period_time_near, (a->ph, hw_params, &period_time, &dir));
-
-    unsigned int buffer_time = 4 * period_time;
-    dir = 1;
-    CHECK_A(snd_pcm_hw_params_set_buffer_time_near, (a->ph, hw_params, &buffer_time, &dir));
-
-    dir = 0;
-    CHECK_A(snd_pcm_hw_params_get_buffer_time, (hw_params, &buffer_time, &dir));
-    CHECK_A(snd_pcm_hw_params, (a->ph, hw_params));
-    snd_pcm_hw_params_free(hw_params);
-
-    CHECK_A(snd_pcm_sw_params_malloc, (&sw_params));
-    CHECK_A(snd_pcm_sw_params_current, (a->ph, sw_params));
-    CHECK_A(snd_pcm_sw_params, (a->ph, sw_params));
-    CHECK_A(snd_pcm_prepare, (a->ph));
-    snd_pcm_sw_params_free(sw_params);
-
-#undef CHECK_A
+    // only the first stream decides how output is opened
+    a->device_rate = audio_mixer_acquire(a->sample_rate, a->sample_frame_count);
+    if (a->device_rate == 0) {
+        trace_error("%s, no audio output\n", __func__);
+        goto err;
+    }
+
+    // plugin keeps the rate it asked for, the difference is handled here
+    int quality = MAX(config.audio_resampler_quality, AUDIO_RESAMPLER_QUALITY_LINEAR);
+    a->resampler = audio_resampler_new(a->sample_rate, a->device_rate, AUDIO_FORMAT_FLOAT,
+                                       quality);
+    a->max_chunk = audio_resampler_max_output(a->resampler, a->sample_frame_count);
+    if (a->device_rate != a->sample_rate) {
+        trace_info("%s, converting %u Hz to %u Hz\n", __func__, a->sample_rate,
+                   a->device_rate);
+    }
 
     a->callback_1_0 = audio_callback_1_0;
     a->callback_1_1 = audio_callback_1_1;
     a->user_data = user_data;
-    a->audio_buffer = malloc(a->sample_frame_count * 2 * sizeof(int16_t));
-    if (!a->audio_buffer) {
+    a->audio_buffer = malloc(a->sample_frame_count * FRAME_SIZE);
+    a->convert_buffer = malloc(a->max_chunk * AUDIO_MIXER_FRAME_SIZE);
+    if (!a->audio_buffer || !a->convert_buffer) {
         trace_error("%s, failed to allocate audio buffer\n", __func__);
         goto err;
     }
 
+    // callback thread stays ahead of mixer by the watermark; there must be room for one
+    // more callback buffer above it
+    uint32_t watermark = (long long)config.audio_fill_ahead_ms * a->device_rate / 1000;
+    watermark = MAX(watermark, a->max_chunk);
+    a->source.watermark = watermark;
+    a->source.gain = 1.0f;
+    a->source.ring = spsc_ring_new((watermark + a->max_chunk) * AUDIO_MIXER_FRAME_SIZE);
+
     pp_resource_release(audio);
     return audio;
 err:
+    if (a->device_rate != 0)
+        audio_mixer_release();
+    audio_resampler_free(a->resampler);
+    free_and_nullify(a->audio_buffer);
+    free_and_nullify(a->convert_buffer);
     pp_resource_release(audio);
     pp_resource_expunge(audio);
     return 0;
@@ -143,18 +137,42 @@ ppb_audio_create_1_1(PP_Instance instance, PP_Resource audio_config,
     return do_ppb_audio_create(instance, audio_config, NULL, audio_callback_1_1, user_data);
 }
 
+static
+void
+join_or_detach(pthread_t thread)
+{
+    if (pthread_equal(thread, pthread_self())) {
+        // called from audio callback, thread will quit once callback returns
+        pthread_detach(thread);
+    } else {
+        pthread_join(thread, NULL);
+    }
+}
+
 void
 ppb_audio_destroy(void *p)
 {
     struct pp_audio_s *a = p;
 
     if (a->playing) {
-        a->shutdown = 1;
-        while (a->playing)
-            usleep(10);
+        audio_mixer_remove_source(&a->source);
+        __atomic_store_n(&a->shutdown, 1, __ATOMIC_SEQ_CST);
+        spsc_ring_wake(a->source.ring);
+        join_or_detach(a->fill_thread);
+        a->playing = 0;
+    }
+    if (a->source.underruns > 0) {
+        trace_info("%s, %" PRIu64 " underruns, lowest fill %u of %u frames\n", __func__,
+                   a->source.underruns, a->source.min_fill, a->source.watermark);
     }
-    snd_pcm_close(a->ph);
+
+    audio_mixer_release();
     free_and_nullify(a->audio_buffer);
+    free_and_nullify(a->convert_buffer);
+    audio_resampler_free(a->resampler);
+    a->resampler = NULL;
+    spsc_ring_free(a->source.ring);
+    a->source.ring = NULL;
 }
 
 PP_Bool
@@ -186,55 +204,46 @@ ppb_audio_get_current_config(PP_Resource audio)
     return audio_config;
 }
 
+// Plugin callback is called on its own thread, which is connected to the mixer by lock-free
+// ring. Callback thread keeps ring filled up to the watermark, so jitter in the callback is
+// absorbed by the ring instead of turning into underruns.
+
 static
 void *
-audio_player_thread(void *p)
+audio_fill_thread(void *p)
 {
     struct pp_audio_s *a = p;
-    int error_cnt = 0;
+    struct spsc_ring_s *ring = a->source.ring;
+    const size_t fs = AUDIO_MIXER_FRAME_SIZE;
+    const size_t chunk = a->sample_frame_count * FRAME_SIZE;
+    // there is that much free space when fill level is below the watermark
+    const size_t need_space = spsc_ring_capacity(ring) - a->source.watermark * fs + 1;
 
     ppb_message_loop_mark_thread_unsuitable();
-    a->playing = 1;
     while (1) {
-        if (a->shutdown)
+        // taken before |shutdown| is checked, so wake made right after the check ends the wait
+        const int wake_count = spsc_ring_wake_count(ring);
+        if (__atomic_load_n(&a->shutdown, __ATOMIC_SEQ_CST))
             break;
-
-        snd_pcm_wait(a->ph, 1000);
-        int frame_count = snd_pcm_avail(a->ph);
-        if (frame_count < 0) {
-            trace_warning("%s, snd_pcm_avail error %d\n", __func__, (int)frame_count);
-            RETRY_ON_EINTR(snd_pcm_recover(a->ph, frame_count, 1));
-            error_cnt++;
-            if (error_cnt >= 5)
-                trace_error("%s, too many buffer underruns (1)\n", __func__);
+        if (spsc_ring_wait_writable(ring, need_space, 1000, wake_count) < need_space)
             continue;
-        }
-
-        frame_count = MIN(frame_count, (int)a->sample_frame_count);
+        if (__atomic_load_n(&a->shutdown, __ATOMIC_SEQ_CST))
+            break;
 
         if (a->callback_1_1) {
-            snd_pcm_sframes_t latency = MAX(snd_pcm_forwardable(a->ph), 0);
+            int64_t queued = spsc_ring_readable(ring) / fs + audio_mixer_get_delay();
 
-            a->callback_1_1(a->audio_buffer, frame_count * 2 * sizeof(int16_t),
-                            (PP_TimeDelta)latency / a->sample_rate, a->user_data);
+            a->callback_1_1(a->audio_buffer, chunk, (PP_TimeDelta)queued / a->device_rate,
+                            a->user_data);
         } else if (a->callback_1_0) {
-            a->callback_1_0(a->audio_buffer, frame_count * 2 * sizeof(int16_t), a->user_data);
-        }
-
-        snd_pcm_sframes_t written = snd_pcm_writei(a->ph, a->audio_buffer, frame_count);
-        if (written < 0) {
-            trace_warning("%s, snd_pcm_writei error %d\n", __func__, (int)written);
-            RETRY_ON_EINTR(snd_pcm_recover(a->ph, written, 1));
-            error_cnt++;
-            if (error_cnt >= 5)
-                trace_error("%s, too many buffer underruns (2)\n", __func__);
-            continue;
+            a->callback_1_0(a->audio_buffer, chunk, a->user_data);
         }
 
-        error_cnt = 0;
+        size_t frames = audio_resampler_process(a->resampler, a->audio_buffer,
+                                                a->sample_frame_count, a->convert_buffer);
+        spsc_ring_write(ring, a->convert_buffer, frames * fs);
     }
 
-    a->playing = 0;
     return NULL;
 }
 
@@ -251,8 +260,16 @@ ppb_audio_start_playback(PP_Resource audio)
         return PP_TRUE;
     }
 
-    pthread_create(&a->thread, NULL, audio_player_thread, a);
-    pthread_detach(a->thread);
+    // mixer keeps source silent until callback thread fills its ring
+    audio_mixer_add_source(&a->source);
+    a->shutdown = 0;
+    if (pthread_create(&a->fill_thread, NULL, audio_fill_thread, a) != 0) {
+        trace_error("%s, can't create audio thread\n", __func__);
+        audio_mixer_remove_source(&a->source);
+        pp_resource_release(audio);
+        return PP_FALSE;
+    }
+    a->playing = 1;
     pp_resource_release(audio);
     return PP_TRUE;
 }
@@ -266,12 +283,68 @@ ppb_audio_stop_playback(PP_Resource audio)
         return PP_FALSE;
     }
 
-    if (a->playing) {
-        a->shutdown = 1;
-        while (a->playing)
-            usleep(10);
+    if (!a->playing) {
+        pp_resource_release(audio);
+        return PP_TRUE;
+    }
+
+    struct audio_mixer_source_s *source = &a->source;
+    pthread_t fill_thread = a->fill_thread;
+    pp_resource_release(audio);
+
+    // resource is not locked while waiting, as callback may use it. Callback thread keeps
+    // running until source is faded out, so fade is made of actual data
+    audio_mixer_remove_source(source);
+
+    a = pp_resource_acquire(audio, PP_RESOURCE_AUDIO);
+    if (!a)
+        return PP_TRUE;
+    __atomic_store_n(&a->shutdown, 1, __ATOMIC_SEQ_CST);
+    spsc_ring_wake(a->source.ring);
+    pp_resource_release(audio);
+
+    join_or_detach(fill_thread);
+
+    a = pp_resource_acquire(audio, PP_RESOURCE_AUDIO);
+    if (a) {
+        a->playing = 0;
+        pp_resource_release(audio);
+    }
+
+    return PP_TRUE;
+}
+
+PP_Bool
+ppb_audio_get_stats(PP_Resource audio, struct ppb_audio_stats_s *stats)
+{
+    struct pp_audio_s *a = pp_resource_acquire(audio, PP_RESOURCE_AUDIO);
+    if (!a) {
+        trace_error("%s, bad resource\n", __func__);
+        return PP_FALSE;
+    }
+
+    const size_t fs = AUDIO_MIXER_FRAME_SIZE;
+    stats->underruns =        __atomic_load_n(&a->source.underruns, __ATOMIC_RELAXED);
+    stats->xruns =            audio_mixer_get_xruns();
+    stats->fill_frames =      spsc_ring_readable(a->source.ring) / fs;
+    stats->min_fill_frames =  __atomic_load_n(&a->source.min_fill, __ATOMIC_RELAXED);
+    stats->watermark_frames = a->source.watermark;
+    stats->capacity_frames =  spsc_ring_capacity(a->source.ring) / fs;
+
+    pp_resource_release(audio);
+    return PP_TRUE;
+}
+
+PP_Bool
+ppb_audio_set_gain(PP_Resource audio, float gain)
+{
+    struct pp_audio_s *a = pp_resource_acquire(audio, PP_RESOURCE_AUDIO);
+    if (!a) {
+        trace_error("%s, bad resource\n", __func__);
+        return PP_FALSE;
     }
 
+    audio_mixer_set_gain(&a->source, gain);
     pp_resource_release(audio);
     return PP_TRUE;
 }
@@ -28,6 +28,15 @@
 #include <ppapi/c/ppb_audio.h>
 
 
+struct ppb_audio_stats_s {
+    uint64_t    underruns;          ///< mixer needed data, but nothing was ready
+    uint64_t    xruns;              ///< output errors, shared by all audio resources
+    uint32_t    fill_frames;        ///< frames ready ahead of mixer at the moment
+    uint32_t    min_fill_frames;    ///< lowest fill level since playback start
+    uint32_t    watermark_frames;   ///< fill level callback thread maintains
+    uint32_t    capacity_frames;
+};
+
 PP_Resource
 ppb_audio_create_1_0(PP_Instance instance, PP_Resource audio_config,
                      PPB_Audio_Callback_1_0 audio_callback, void *user_data);
@@ -51,4 +60,12 @@ ppb_audio_start_playback(PP_Resource audio);
 PP_Bool
 ppb_audio_stop_playback(PP_Resource audio);
 
+/// fills |stats| with underrun counters and fill levels of audio resource
+PP_Bool
+ppb_audio_get_stats(PP_Resource audio, struct ppb_audio_stats_s *stats);
+
+/// sets gain applied to audio resource by the mixer; change is ramped, not stepped
+PP_Bool
+ppb_audio_set_gain(PP_Resource audio, float gain);
+
 #endif // FPP_PPB_AUDIO_H
@@ -27,10 +27,12 @@
 #include <stdlib.h>
 #include <pthread.h>
 #include <time.h>
+#include <ppapi/c/pp_errors.h>
 #include "trace.h"
 #include "tables.h"
 #include "pp_resource.h"
 #include "ppb_message_loop.h"
+#include "completion.h"
 
 
 void
@@ -56,8 +58,10 @@ ppb_core_get_time(void)
 PP_TimeTicks
 ppb_core_get_time_ticks(void)
 {
+    // ticks share their clock with message loop deadlines, so they never jump when wall clock
+    // is adjusted
     struct timespec t;
-    clock_gettime(CLOCK_REALTIME, &t);
+    clock_gettime(CLOCK_MONOTONIC, &t);
     return t.tv_sec + t.tv_nsec / 1e9;
 }
 
@@ -73,6 +77,17 @@ ppb_core_call_on_main_thread(int32_t delay_in_milliseconds, struct PP_Completion
                                            result, depth);
 }
 
+void
+ppb_core_call_on_main_thread_batch(const struct PP_CompletionCallback *callbacks,
+                                   const int32_t *results, unsigned int count)
+{
+    PP_Resource main_message_loop = ppb_message_loop_get_for_main_thread();
+    if (main_message_loop == 0)
+        trace_error("%s, no main loop\n", __func__);
+    const int depth = ppb_message_loop_get_depth(main_message_loop);
+    ppb_message_loop_post_work_batch(main_message_loop, callbacks, results, count, 0, depth);
+}
+
 struct call_on_browser_thread_task_s {
     void            (*func)(void *);
     void            *user_data;
@@ -87,14 +102,15 @@ _call_on_browser_thread_comt(void *user_data, int32_t result)
     g_slice_free(struct call_on_browser_thread_task_s, task);
 }
 
-void
-ppb_core_call_on_browser_thread(void (*func)(void *), void *user_data)
+static
+int
+call_on_browser_thread(void (*func)(void *), void *user_data)
 {
     PP_Resource m_loop = ppb_message_loop_get_for_browser_thread();
     struct pp_message_loop_s *ml = pp_resource_acquire(m_loop, PP_RESOURCE_MESSAGE_LOOP);
     if (!ml) {
         trace_error("%s, no message loop for browser thread\n", __func__);
-        return;
+        return -1;
     }
 
     if (!ml->running) {
@@ -102,16 +118,19 @@ ppb_core_call_on_browser_thread(void (*func)(void *), void *user_data)
         if (!pp_i) {
             pp_resource_release(m_loop);
             trace_error("%s, no alive instance available\n", __func__);
-            return;
+            return -1;
         }
 
+        int retval = -1;
         pthread_mutex_lock(&display.lock);
-        if (pp_i->npp)
+        if (pp_i->npp) {
             npn.pluginthreadasynccall(pp_i->npp, func, user_data);
+            retval = 0;
+        }
         pthread_mutex_unlock(&display.lock);
 
         pp_resource_release(m_loop);
-        return;
+        return retval;
     }
 
     struct call_on_browser_thread_task_s *task = g_slice_alloc(sizeof(*task));
@@ -119,6 +138,47 @@ ppb_core_call_on_browser_thread(void (*func)(void *), void *user_data)
     task->user_data = user_data;
     pp_resource_release(m_loop);
     ppb_message_loop_post_work(m_loop, PP_MakeCCB(_call_on_browser_thread_comt, task), 0);
+    return 0;
+}
+
+void
+ppb_core_call_on_browser_thread(void (*func)(void *), void *user_data)
+{
+    call_on_browser_thread(func, user_data);
+}
+
+struct call_on_browser_thread_sync_s {
+    void                  (*func)(void *);
+    void                   *user_data;
+    struct completion_s     done;
+};
+
+static
+void
+_call_on_browser_thread_sync_ptac(void *user_data)
+{
+    struct call_on_browser_thread_sync_s *p = user_data;
+    p->func(p->user_data);
+    completion_signal(&p->done);
+}
+
+int32_t
+ppb_core_call_on_browser_thread_sync(void (*func)(void *), void *user_data)
+{
+    // thread without a loop is not the browser thread, even if browser loop is not set yet
+    const PP_Resource current = ppb_message_loop_get_current();
+    if (current != 0 && current == ppb_message_loop_get_for_browser_thread()) {
+        func(user_data);
+        return PP_OK;
+    }
+
+    struct call_on_browser_thread_sync_s p = { .func = func, .user_data = user_data };
+    completion_init(&p.done);
+    if (call_on_browser_thread(_call_on_browser_thread_sync_ptac, &p) != 0)
+        return PP_ERROR_FAILED;
+
+    completion_wait(&p.done);
+    return PP_OK;
 }
 
 PP_Bool
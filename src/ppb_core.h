@@ -45,9 +45,21 @@ void
 ppb_core_call_on_main_thread(int32_t delay_in_milliseconds, struct PP_CompletionCallback callback,
                              int32_t result);
 
+/// posts several callbacks to the main thread with a single loop wakeup. |callbacks[k]| gets
+/// |results[k]|, callbacks run in order they are listed
+void
+ppb_core_call_on_main_thread_batch(const struct PP_CompletionCallback *callbacks,
+                                   const int32_t *results, unsigned int count);
+
 void
 ppb_core_call_on_browser_thread(void (*func)(void *), void *user_data);
 
+/// calls |func| on the browser thread and waits for it to return. Unlike nested message loop,
+/// calling thread doesn't process any tasks while waiting, so use it only for browser calls
+/// which never call back into plugin. Returns PP_ERROR_FAILED if |func| couldn't be scheduled
+int32_t
+ppb_core_call_on_browser_thread_sync(void (*func)(void *), void *user_data);
+
 PP_Bool
 ppb_core_is_main_thread(void);
 
@@ -24,12 +24,42 @@
 
 #include "ppb_file_io.h"
 #include <stdlib.h>
+#include <string.h>
 #include <ppapi/c/pp_errors.h>
 #include <inttypes.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <glib.h>
 #include "trace.h"
 #include "tables.h"
 #include "pp_resource.h"
 #include "ppb_core.h"
+#include "ppb_message_loop.h"
+#include "worker_pool.h"
+#include "eintr_retry.h"
+
+
+// reads into temporary buffer of that size at most, same limit as in Chrome
+#define MAX_READ_TO_ARRAY_SIZE  (32 * 1024 * 1024)
+
+// blocking operation on an opened file, run by a worker pool thread
+struct file_io_op_s {
+    PP_Resource             file_io;
+    int                     fd;
+    int64_t                 offset;
+    char                   *buffer;
+    int32_t                 length;
+    struct PP_FileInfo     *info;
+};
+
+// data of ReadToArray is copied to plugin's array when read completes, as array size must be
+// equal to number of bytes read
+struct read_to_array_s {
+    char                           *buffer;
+    struct PP_ArrayOutput           output;
+    struct PP_CompletionCallback    callback;
+};
 
 
 int32_t
@@ -131,11 +161,151 @@ out:
     return retval;
 }
 
+static
+int32_t
+errno_to_pp_error(int err)
+{
+    switch (err) {
+    case EACCES:
+    case EPERM:
+        return PP_ERROR_NOACCESS;
+    case ENOSPC:
+    case EDQUOT:
+        return PP_ERROR_NOSPACE;
+    case EFBIG:
+        return PP_ERROR_FILETOOBIG;
+    default:
+        return PP_ERROR_FAILED;
+    }
+}
+
+static
+void
+file_io_op_free(struct file_io_op_s *op)
+{
+    // file descriptor is closed with the last reference to the resource
+    pp_resource_unref(op->file_io);
+    g_slice_free(struct file_io_op_s, op);
+}
+
+static
+int32_t
+query_op(void *user_data)
+{
+    struct file_io_op_s *op = user_data;
+    struct stat sb;
+    int32_t retval = PP_OK;
+
+    if (fstat(op->fd, &sb) != 0) {
+        retval = errno_to_pp_error(errno);
+        goto done;
+    }
+
+    op->info->size = sb.st_size;
+    if (S_ISREG(sb.st_mode))
+        op->info->type = PP_FILETYPE_REGULAR;
+    else if (S_ISDIR(sb.st_mode))
+        op->info->type = PP_FILETYPE_DIRECTORY;
+    else
+        op->info->type = PP_FILETYPE_OTHER;
+
+    op->info->system_type = PP_FILESYSTEMTYPE_EXTERNAL;
+    op->info->creation_time =      sb.st_ctim.tv_sec + sb.st_ctim.tv_nsec / 1e9;
+    op->info->last_access_time =   sb.st_atim.tv_sec + sb.st_atim.tv_nsec / 1e9;
+    op->info->last_modified_time = sb.st_mtim.tv_sec + sb.st_mtim.tv_nsec / 1e9;
+
+done:
+    file_io_op_free(op);
+    return retval;
+}
+
+static
+int32_t
+read_op(void *user_data)
+{
+    struct file_io_op_s *op = user_data;
+    ssize_t ret = RETRY_ON_EINTR(pread(op->fd, op->buffer, op->length, op->offset));
+    int32_t retval = (ret < 0) ? errno_to_pp_error(errno) : (int32_t)ret;
+
+    file_io_op_free(op);
+    return retval;
+}
+
+static
+int32_t
+write_op(void *user_data)
+{
+    struct file_io_op_s *op = user_data;
+    ssize_t ret = RETRY_ON_EINTR(pwrite(op->fd, op->buffer, op->length, op->offset));
+    int32_t retval = (ret < 0) ? errno_to_pp_error(errno) : (int32_t)ret;
+
+    file_io_op_free(op);
+    return retval;
+}
+
+static
+int32_t
+set_length_op(void *user_data)
+{
+    struct file_io_op_s *op = user_data;
+    int ret = RETRY_ON_EINTR(ftruncate(op->fd, op->offset));
+    int32_t retval = (ret < 0) ? errno_to_pp_error(errno) : PP_OK;
+
+    file_io_op_free(op);
+    return retval;
+}
+
+static
+int32_t
+flush_op(void *user_data)
+{
+    struct file_io_op_s *op = user_data;
+    int ret = RETRY_ON_EINTR(fsync(op->fd));
+    int32_t retval = (ret < 0) ? errno_to_pp_error(errno) : PP_OK;
+
+    file_io_op_free(op);
+    return retval;
+}
+
+// passes operation to the worker pool. Resource reference is held until operation completes,
+// so the file descriptor stays valid
+static
+int32_t
+submit_op(PP_Resource file_io, worker_pool_func func, int64_t offset, char *buffer,
+          int32_t length, struct PP_FileInfo *info, struct PP_CompletionCallback callback)
+{
+    struct pp_file_io_s *fio = pp_resource_acquire(file_io, PP_RESOURCE_FILE_IO);
+    if (!fio) {
+        trace_error("%s, bad resource\n", __func__);
+        return PP_ERROR_BADRESOURCE;
+    }
+
+    if (fio->fd < 0) {
+        pp_resource_release(file_io);
+        return PP_ERROR_FAILED;
+    }
+
+    struct file_io_op_s *op = g_slice_alloc0(sizeof(*op));
+    op->file_io = file_io;
+    op->fd = fio->fd;
+    op->offset = offset;
+    op->buffer = buffer;
+    op->length = length;
+    op->info = info;
+    pp_resource_ref(file_io);
+    pp_resource_release(file_io);
+
+    return worker_pool_submit(WORKER_POOL_FILE, func, op, ppb_message_loop_get_current(),
+                              callback);
+}
+
 int32_t
 ppb_file_io_query(PP_Resource file_io, struct PP_FileInfo *info,
                   struct PP_CompletionCallback callback)
 {
-    return PP_OK;
+    if (!info)
+        return PP_ERROR_BADARGUMENT;
+    return submit_op(file_io, query_op, 0, NULL, 0, info, callback);
 }
 
 int32_t
@@ -149,26 +319,32 @@ int32_t
 ppb_file_io_read(PP_Resource file_io, int64_t offset, char *buffer, int32_t bytes_to_read,
                  struct PP_CompletionCallback callback)
 {
-    return PP_OK;
+    if (!buffer || bytes_to_read < 0 || offset < 0)
+        return PP_ERROR_BADARGUMENT;
+    return submit_op(file_io, read_op, offset, buffer, bytes_to_read, NULL, callback);
 }
 
 int32_t
 ppb_file_io_write(PP_Resource file_io, int64_t offset, const char *buffer, int32_t bytes_to_write,
                   struct PP_CompletionCallback callback)
 {
-    return PP_OK;
+    if (!buffer || bytes_to_write < 0 || offset < 0)
+        return PP_ERROR_BADARGUMENT;
+    return submit_op(file_io, write_op, offset, (char *)buffer, bytes_to_write, NULL, callback);
 }
 
 int32_t
 ppb_file_io_set_length(PP_Resource file_io, int64_t length, struct PP_CompletionCallback callback)
 {
-    return PP_OK;
+    if (length < 0)
+        return PP_ERROR_BADARGUMENT;
+    return submit_op(file_io, set_length_op, length, NULL, 0, NULL, callback);
 }
 
 int32_t
 ppb_file_io_flush(PP_Resource file_io, struct PP_CompletionCallback callback)
 {
-    return PP_OK;
+    return submit_op(file_io, flush_op, 0, NULL, 0, NULL, callback);
 }
 
 void
@@ -176,11 +352,61 @@ ppb_file_io_close(PP_Resource file_io)
 {
 }
 
+static
+int32_t
+read_to_array_finish(struct read_to_array_s *rta, int32_t result)
+{
+    if (result >= 0) {
+        char *data = rta->output.GetDataBuffer(rta->output.user_data, result, 1);
+        if (data)
+            memcpy(data, rta->buffer, result);
+        else if (result > 0)
+            result = PP_ERROR_NOMEMORY;
+    }
+
+    g_free(rta->buffer);
+    g_slice_free(struct read_to_array_s, rta);
+    return result;
+}
+
+static
+void
+read_to_array_comt(void *user_data, int32_t result)
+{
+    struct read_to_array_s *rta = user_data;
+    struct PP_CompletionCallback callback = rta->callback;
+
+    result = read_to_array_finish(rta, result);
+    callback.func(callback.user_data, result);
+}
+
 int32_t
 ppb_file_io_read_to_array(PP_Resource file_io, int64_t offset, int32_t max_read_length,
                           struct PP_ArrayOutput *output, struct PP_CompletionCallback callback)
 {
-    return PP_OK;
+    if (!output || !output->GetDataBuffer || max_read_length < 0 || offset < 0)
+        return PP_ERROR_BADARGUMENT;
+
+    struct read_to_array_s *rta = g_slice_alloc0(sizeof(*rta));
+    const int32_t length = MIN(max_read_length, MAX_READ_TO_ARRAY_SIZE);
+    rta->buffer = g_malloc(MAX(length, 1));
+    rta->output = *output;
+    rta->callback = callback;
+
+    if (callback.func == NULL) {
+        int32_t result = submit_op(file_io, read_op, offset, rta->buffer, length, NULL,
+                                   callback);
+        return read_to_array_finish(rta, result);
+    }
+
+    int32_t result = submit_op(file_io, read_op, offset, rta->buffer, length, NULL,
+                               PP_MakeCCB(read_to_array_comt, rta));
+    if (result != PP_OK_COMPLETIONPENDING) {
+        g_free(rta->buffer);
+        g_slice_free(struct read_to_array_s, rta);
+    }
+
+    return result;
 }
 
 
@@ -227,7 +453,7 @@ int32_t
 trace_ppb_file_io_query(PP_Resource file_io, struct PP_FileInfo *info,
                         struct PP_CompletionCallback callback)
 {
-    trace_info("[PPB] {zilch} %s file_io=%d, callback={.func=%p, .user_data=%p, .flags=%u}\n",
+    trace_info("[PPB] {full} %s file_io=%d, callback={.func=%p, .user_data=%p, .flags=%u}\n",
                __func__+6, file_io, callback.func, callback.user_data, callback.flags);
     return ppb_file_io_query(file_io, info, callback);
 }
@@ -249,7 +475,7 @@ int32_t
 trace_ppb_file_io_read(PP_Resource file_io, int64_t offset, char *buffer, int32_t bytes_to_read,
                        struct PP_CompletionCallback callback)
 {
-    trace_info("[PPB] {zilch} %s file_io=%d, offset=%"PRId64", bytes_to_read=%d, "
+    trace_info("[PPB] {full} %s file_io=%d, offset=%"PRId64", bytes_to_read=%d, "
                "callback={.func=%p, .user_data=%p, .flags=%u}\n", __func__+6, file_io, offset,
                bytes_to_read, callback.func, callback.user_data, callback.flags);
     return ppb_file_io_read(file_io, offset, buffer, bytes_to_read, callback);
@@ -260,7 +486,7 @@ int32_t
 trace_ppb_file_io_write(PP_Resource file_io, int64_t offset, const char *buffer,
                         int32_t bytes_to_write, struct PP_CompletionCallback callback)
 {
-    trace_info("[PPB] {zilch} %s file_io=%d, offset=%"PRId64", bytes_to_write=%d, "
+    trace_info("[PPB] {full} %s file_io=%d, offset=%"PRId64", bytes_to_write=%d, "
                "callback={.func=%p, .user_data=%p, .flags=%u}\n", __func__+6, file_io, offset,
                bytes_to_write, callback.func, callback.user_data, callback.flags);
     return ppb_file_io_write(file_io, offset, buffer, bytes_to_write, callback);
@@ -271,7 +497,7 @@ int32_t
 trace_ppb_file_io_set_length(PP_Resource file_io, int64_t length,
                              struct PP_CompletionCallback callback)
 {
-    trace_info("[PPB] {zilch} %s file_io=%d, length=%"PRId64", callback={.func=%p, .user_data=%p, "
+    trace_info("[PPB] {full} %s file_io=%d, length=%"PRId64", callback={.func=%p, .user_data=%p, "
                ".flags=%u}\n", __func__+6, file_io, length, callback.func, callback.user_data,
                callback.flags);
     return ppb_file_io_set_length(file_io, length, callback);
@@ -281,7 +507,7 @@ TRACE_WRAPPER
 int32_t
 trace_ppb_file_io_flush(PP_Resource file_io, struct PP_CompletionCallback callback)
 {
-    trace_info("[PPB] {zilch} %s file_io=%d, callback={.func=%p, .user_data=%p, .flags=%u}\n",
+    trace_info("[PPB] {full} %s file_io=%d, callback={.func=%p, .user_data=%p, .flags=%u}\n",
                __func__+6, file_io, callback.func, callback.user_data, callback.flags);
     return ppb_file_io_flush(file_io, callback);
 }
@@ -300,7 +526,7 @@ trace_ppb_file_io_read_to_array(PP_Resource file_io, int64_t offset, int32_t max
                                 struct PP_ArrayOutput *output,
                                 struct PP_CompletionCallback callback)
 {
-    trace_info("[PPB] {zilch} %s file_io=%d, offset=%"PRId64", max_read_length=%d, "
+    trace_info("[PPB] {full} %s file_io=%d, offset=%"PRId64", max_read_length=%d, "
                "callback={.func=%p, .user_data=%p, .flags=%u}\n", __func__+6, file_io, offset,
                max_read_length, callback.func, callback.user_data, callback.flags);
     return ppb_file_io_read_to_array(file_io, offset, max_read_length, output, callback);
@@ -315,25 +541,25 @@ const struct PPB_FileIO_1_1 ppb_file_io_interface_1_1 = {
     .Create =       TWRAPF(ppb_file_io_create),
     .IsFileIO =     TWRAPF(ppb_file_io_is_file_io),
     .Open =         TWRAPF(ppb_file_io_open),
-    .Query =        TWRAPZ(ppb_file_io_query),
+    .Query =        TWRAPF(ppb_file_io_query),
     .Touch =        TWRAPZ(ppb_file_io_touch),
-    .Read =         TWRAPZ(ppb_file_io_read),
-    .Write =        TWRAPZ(ppb_file_io_write),
-    .SetLength =    TWRAPZ(ppb_file_io_set_length),
-    .Flush =        TWRAPZ(ppb_file_io_flush),
+    .Read =         TWRAPF(ppb_file_io_read),
+    .Write =        TWRAPF(ppb_file_io_write),
+    .SetLength =    TWRAPF(ppb_file_io_set_length),
+    .Flush =        TWRAPF(ppb_file_io_flush),
     .Close =        TWRAPZ(ppb_file_io_close),
-    .ReadToArray =  TWRAPZ(ppb_file_io_read_to_array),
+    .ReadToArray =  TWRAPF(ppb_file_io_read_to_array),
 };
 
 const struct PPB_FileIO_1_0 ppb_file_io_interface_1_0 = {
     .Create =       TWRAPF(ppb_file_io_create),
     .IsFileIO =     TWRAPF(ppb_file_io_is_file_io),
     .Open =         TWRAPF(ppb_file_io_open),
-    .Query =        TWRAPZ(ppb_file_io_query),
+    .Query =        TWRAPF(ppb_file_io_query),
     .Touch =        TWRAPZ(ppb_file_io_touch),
-    .Read =         TWRAPZ(ppb_file_io_read),
-    .Write =        TWRAPZ(ppb_file_io_write),
-    .SetLength =    TWRAPZ(ppb_file_io_set_length),
-    .Flush =        TWRAPZ(ppb_file_io_flush),
+    .Read =         TWRAPF(ppb_file_io_read),
+    .Write =        TWRAPF(ppb_file_io_write),
+    .SetLength =    TWRAPF(ppb_file_io_set_length),
+    .Flush =        TWRAPF(ppb_file_io_flush),
     .Close =        TWRAPZ(ppb_file_io_close),
 };
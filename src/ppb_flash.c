@@ -166,6 +166,8 @@ _get_proxy_for_url_comt(void *user_data, int32_t result)
     ppb_core_call_on_browser_thread(_get_proxy_for_url_ptac, user_data);
 }
 
+// PAC script may be evaluated while resolving proxy, and browser may spin its event loop doing
+// that, calling into plugin. Nested loop keeps such calls from deadlocking
 struct PP_Var
 ppb_flash_get_proxy_for_url(PP_Instance instance, const char *url)
 {
@@ -324,8 +324,6 @@ struct clipboard_write_data_param_s {
     const uint32_t             *formats;
     const struct PP_Var        *data_items;
     int32_t                     result;
-    PP_Resource                 m_loop;
-    int                         depth;
 };
 
 struct selection_entry_s {
@@ -383,12 +381,12 @@ _clipboard_write_data_ptac(void *user_data)
     p->result = PP_OK;
     GtkClipboard *clipboard = get_clipboard_of_type(p->clipboard_type);
     if (!clipboard)
-        goto quit;
+        return;
 
     if (p->data_item_count == 0) {
         // one can pass zero items to clear clipboard
         gtk_clipboard_clear(clipboard);
-        goto quit;
+        return;
     }
 
     GArray *items = g_array_new(FALSE /* no zero teminator */, TRUE /* zero items */, sizeof(item));
@@ -469,16 +467,6 @@ _clipboard_write_data_ptac(void *user_data)
     for (uint32_t k = 0; k < items->len; k ++)
         g_free(targets[k].target);
     g_free(targets);
-
-quit:
-    ppb_message_loop_post_quit_depth(p->m_loop, PP_FALSE, p->depth);
-}
-
-static
-void
-_clipboard_write_data_comt(void *user_data, int32_t result)
-{
-    ppb_core_call_on_browser_thread(_clipboard_write_data_ptac, user_data);
 }
 
 int32_t
@@ -491,21 +479,20 @@ ppb_flash_clipboard_write_data(PP_Instance instance_id, PP_Flash_Clipboard_Type
             return PP_ERROR_FAILED;
     }
 
-    struct clipboard_write_data_param_s *p = g_slice_alloc(sizeof(*p));
-    p->clipboard_type =     clipboard_type;
-    p->data_item_count =    data_item_count;
-    p->formats =            formats;
-    p->data_items =         data_items;
-    p->m_loop =             ppb_message_loop_get_current();
-    p->depth =              ppb_message_loop_get_depth(p->m_loop) + 1;
+    // setting clipboard contents doesn't spin browser event loop, unlike reading, so it's done
+    // without nested loop
+    struct clipboard_write_data_param_s p = {
+        .clipboard_type =   clipboard_type,
+        .data_item_count =  data_item_count,
+        .formats =          formats,
+        .data_items =       data_items,
+        .result =           PP_ERROR_FAILED,
+    };
 
-    ppb_message_loop_post_work(p->m_loop, PP_MakeCCB(_clipboard_write_data_comt, p), 0);
-    ppb_message_loop_run_nested(p->m_loop);
+    if (ppb_core_call_on_browser_thread_sync(_clipboard_write_data_ptac, &p) != PP_OK)
+        return PP_ERROR_FAILED;
 
-    int32_t result = p->result;
-    g_slice_free1(sizeof(*p), p);
-
-    return result;
+    return p.result;
 }
 
 PP_Bool
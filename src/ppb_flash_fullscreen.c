@@ -25,6 +25,7 @@
 #include "ppb_flash_fullscreen.h"
 #include "ppb_core.h"
 #include <stdlib.h>
+#include <pthread.h>
 #include "trace.h"
 #include "tables.h"
 #include "pp_resource.h"
@@ -35,7 +36,11 @@
 #include <X11/Xutil.h>
 
 
-static volatile gint events_inflight = 0;
+// fullscreen window thread waits for events it has passed to browser thread before closing
+// the window
+static pthread_mutex_t  events_inflight_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   events_inflight_cond = PTHREAD_COND_INITIALIZER;
+static int              events_inflight = 0;
 
 struct handle_event_comt_param_s {
     PP_Instance instance_id;
@@ -101,7 +106,12 @@ _handle_event_ptac(void *p)
         NPP_HandleEvent(pp_i->npp, &params->ev);
     }
     g_slice_free(struct handle_event_comt_param_s, params);
-    g_atomic_int_add(&events_inflight, -1);
+
+    pthread_mutex_lock(&events_inflight_lock);
+    events_inflight --;
+    if (events_inflight == 0)
+        pthread_cond_broadcast(&events_inflight_cond);
+    pthread_mutex_unlock(&events_inflight_lock);
 }
 
 static
@@ -216,7 +226,9 @@ fullscreen_window_thread(void *p)
             struct handle_event_comt_param_s *params = g_slice_alloc(sizeof(*params));
             params->instance_id =   pp_i->id;
             params->ev =            ev;
-            g_atomic_int_add(&events_inflight, 1);
+            pthread_mutex_lock(&events_inflight_lock);
+            events_inflight ++;
+            pthread_mutex_unlock(&events_inflight_lock);
             ppb_core_call_on_browser_thread(_handle_event_ptac, params);
         }
     }
@@ -224,9 +236,10 @@ fullscreen_window_thread(void *p)
 quit_and_destroy_fs_wnd:
 
     // wait for all events to be processed
-    while (g_atomic_int_get(&events_inflight)) {
-        usleep(10);
-    }
+    pthread_mutex_lock(&events_inflight_lock);
+    while (events_inflight > 0)
+        pthread_cond_wait(&events_inflight_cond, &events_inflight_lock);
+    pthread_mutex_unlock(&events_inflight_lock);
 
     pp_i->is_fullscreen = 0;
     XDestroyWindow(dpy, pp_i->fs_wnd);
@@ -24,6 +24,7 @@
 
 #include "ppb_graphics2d.h"
 #include "ppb_core.h"
+#include "ppb_instance.h"
 #include <ppapi/c/pp_errors.h>
 #include <stdlib.h>
 #include "trace.h"
@@ -59,6 +60,7 @@ ppb_graphics2d_create(PP_Instance instance, const struct PP_Size *size, PP_Bool
 
     g2d->is_always_opaque = is_always_opaque;
     g2d->scale = 1.0;
+    g2d->need_full_repaint = 1;
     g2d->width =  size->width;
     g2d->height = size->height;
     g2d->stride = 4 * size->width;
@@ -165,15 +167,21 @@ ppb_graphics2d_replace_contents(PP_Resource graphics_2d, PP_Resource image_data)
 
 static
 void
-_call_invalidaterect_ptac(void *param)
+union_rect(struct PP_Rect *dst, int32_t x, int32_t y, int32_t width, int32_t height)
 {
-    struct pp_instance_s *pp_i = tables_get_pp_instance(GPOINTER_TO_SIZE(param));
-    if (!pp_i)
+    if (width <= 0 || height <= 0)
         return;
-    NPRect npr = {.top = 0, .left = 0, .bottom = pp_i->height, .right = pp_i->width};
 
-    npn.invalidaterect(pp_i->npp, &npr);
-    npn.forceredraw(pp_i->npp);
+    if (dst->size.width <= 0 || dst->size.height <= 0) {
+        *dst = PP_MakeRectFromXYWH(x, y, width, height);
+        return;
+    }
+
+    const int32_t left =   MIN(dst->point.x, x);
+    const int32_t top =    MIN(dst->point.y, y);
+    const int32_t right =  MAX(dst->point.x + dst->size.width, x + width);
+    const int32_t bottom = MAX(dst->point.y + dst->size.height, y + height);
+    *dst = PP_MakeRectFromXYWH(left, top, right - left, bottom - top);
 }
 
 int32_t
@@ -205,6 +213,7 @@ ppb_graphics2d_flush(PP_Resource graphics_2d, struct PP_CompletionCallback callb
     pp_i->graphics_in_progress = 1;
     pthread_mutex_unlock(&display.lock);
 
+    struct PP_Rect damage = PP_MakeRectFromXYWH(0, 0, 0, 0);
     while (g2d->task_list) {
         GList *link = g_list_first(g2d->task_list);
         struct g2d_paint_task_s *pt = link->data;
@@ -232,6 +241,12 @@ ppb_graphics2d_flush(PP_Resource graphics_2d, struct PP_CompletionCallback callb
             }
             cairo_surface_flush(g2d->cairo_surf);
             cairo_destroy(cr);
+            if (pt->src_is_set) {
+                union_rect(&damage, pt->src.point.x + pt->ofs.x, pt->src.point.y + pt->ofs.y,
+                           pt->src.size.width, pt->src.size.height);
+            } else {
+                union_rect(&damage, pt->ofs.x, pt->ofs.y, id->width, id->height);
+            }
             pp_resource_release(pt->image_data);
             pp_resource_unref(pt->image_data);
             break;
@@ -253,6 +268,7 @@ ppb_graphics2d_flush(PP_Resource graphics_2d, struct PP_CompletionCallback callb
                 tmp_surf = g2d->cairo_surf;
                 g2d->cairo_surf = id->cairo_surf;
                 id->cairo_surf = tmp_surf;
+                union_rect(&damage, 0, 0, g2d->width, g2d->height);
             }
             pp_resource_release(pt->image_data);
             pp_resource_unref(pt->image_data);
@@ -278,6 +294,16 @@ ppb_graphics2d_flush(PP_Resource graphics_2d, struct PP_CompletionCallback callb
         cairo_surface_destroy(surf);
     }
 
+    // browser repaints only changed area. Scaled output is repainted whole, as scaling smears
+    // edges. Empty flush still invalidates, since it completes on expose
+    const struct PP_Rect *invalid_rect = &damage;
+    if (g2d->need_full_repaint || g2d->scaled_width != g2d->width ||
+        g2d->scaled_height != g2d->height || damage.size.width <= 0)
+    {
+        invalid_rect = NULL;
+    }
+    g2d->need_full_repaint = 0;
+
     pp_resource_release(graphics_2d);
 
     pthread_mutex_lock(&display.lock);
@@ -296,7 +322,7 @@ ppb_graphics2d_flush(PP_Resource graphics_2d, struct PP_CompletionCallback callb
         pthread_mutex_unlock(&display.lock);
     } else {
         pthread_mutex_unlock(&display.lock);
-        ppb_core_call_on_browser_thread(_call_invalidaterect_ptac, GSIZE_TO_POINTER(pp_i->id));
+        ppb_instance_request_invalidate(pp_i->id, invalid_rect);
     }
 
     if (callback.func)
@@ -319,6 +345,7 @@ ppb_graphics2d_set_scale(PP_Resource resource, float scale)
     g2d->scaled_width = g2d->width * scale + 0.5;
     g2d->scaled_height = g2d->height * scale + 0.5;
     g2d->scaled_stride = 4 * g2d->scaled_width;
+    g2d->need_full_repaint = 1;
 
     free(g2d->second_buffer);
     g2d->second_buffer = calloc(g2d->scaled_stride * g2d->scaled_height, 1);
@@ -25,7 +25,9 @@
 #include <assert.h>
 #include "ppb_graphics3d.h"
 #include <stdlib.h>
+#include <string.h>
 #include <EGL/egl.h>
+#include <EGL/eglext.h>
 #include <GLES2/gl2.h>
 #include <GLES2/gl2ext.h>
 #include "trace.h"
@@ -33,7 +35,52 @@
 #include "tables.h"
 #include <ppapi/c/pp_errors.h>
 #include "ppb_core.h"
+#include "ppb_instance.h"
 #include "ppb_opengles2.h"
+#include "gl_cmd_buffer.h"
+#include "config.h"
+#include "staging_pool.h"
+#include "gl_shadow_state.h"
+#include "gl_profiler.h"
+#include "egl_pool.h"
+
+
+#define STAGING_POOL_IDLE_MS    3000    ///< unused staging blocks are freed after this time
+
+
+#ifndef GL_PIXEL_PACK_BUFFER
+#define GL_PIXEL_PACK_BUFFER    0x88EB
+#endif
+#ifndef GL_PIXEL_PACK_BUFFER_BINDING
+#define GL_PIXEL_PACK_BUFFER_BINDING    0x88ED
+#endif
+#ifndef GL_STREAM_READ
+#define GL_STREAM_READ          0x88E1
+#endif
+#ifndef GL_MAP_READ_BIT
+#define GL_MAP_READ_BIT         0x0001
+#endif
+
+typedef void *(*map_buffer_range_f)(GLenum target, GLintptr offset, GLsizeiptr length,
+                                    GLbitfield access);
+typedef GLboolean (*unmap_buffer_f)(GLenum target);
+
+// readback capabilities, the same for all contexts on a display
+static struct {
+    int                 initialized;
+    int                 have_pbo;
+    int                 have_bgra;
+    map_buffer_range_f  MapBufferRange;
+    unmap_buffer_f      UnmapBuffer;
+} readback_caps;
+
+// EGL_KHR_fence_sync entry points, NULL if extension is not supported
+static struct {
+    int                             initialized;
+    PFNEGLCREATESYNCKHRPROC         CreateSync;
+    PFNEGLDESTROYSYNCKHRPROC        DestroySync;
+    PFNEGLCLIENTWAITSYNCKHRPROC     ClientWaitSync;
+} fence_funcs;
 
 
 int32_t
@@ -59,31 +106,92 @@ report_shader_compile_error(const char *fname, GLuint shader, const char *shader
     free(log);
 }
 
-// creates GL context for transparency rendering
+// creates 32-bit ARGB pixmap, EGL surface and picture for it. Presentation context
+// resolves frames there
 static
 int
-create_presentation_egl_context(struct pp_graphics3d_s *g3d)
+create_argb_pixmap(struct pp_graphics3d_s *g3d)
+{
+    g3d->pixmap = XCreatePixmap(display.x, DefaultRootWindow(display.x), MAX(g3d->width, 1),
+                                MAX(g3d->height, 1), 32);
+    g3d->egl_surf_t = eglCreatePixmapSurface(display.egl, g3d->egl_config_t, g3d->pixmap, NULL);
+    if (g3d->egl_surf_t == EGL_NO_SURFACE) {
+        trace_error("%s, failed to create EGL pixmap surface\n", __func__);
+        XFreePixmap(display.x, g3d->pixmap);
+        g3d->pixmap = None;
+        return 1;
+    }
+
+    g3d->pict = XRenderCreatePicture(display.x, g3d->pixmap,
+                                     XRenderFindStandardFormat(display.x, PictStandardARGB32),
+                                     0, NULL);
+    return 0;
+}
+
+static
+void
+destroy_argb_pixmap(struct pp_graphics3d_s *g3d)
+{
+    XRenderFreePicture(display.x, g3d->pict);
+    eglDestroySurface(display.egl, g3d->egl_surf_t);
+    XFreePixmap(display.x, g3d->pixmap);
+    g3d->pict = None;
+    g3d->egl_surf_t = EGL_NO_SURFACE;
+    g3d->pixmap = None;
+}
+
+// chooses EGLConfig for pixmaps of depth 32, which can carry alpha to XRender
+static
+int
+choose_argb_config(EGLConfig *config)
 {
-    int nconfigs = 0;
     EGLint cfg_attrs[] = { EGL_ALPHA_SIZE, 8,
                            EGL_BLUE_SIZE, 8,
                            EGL_GREEN_SIZE, 8,
                            EGL_RED_SIZE, 8,
-                           EGL_RENDERABLE_TYPE,
-                           EGL_OPENGL_ES2_BIT,
+                           EGL_SURFACE_TYPE, EGL_PIXMAP_BIT,
+                           EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
                            EGL_NONE };
+    EGLConfig configs[64];
+    int nconfigs = 0;
 
-    EGLBoolean ret = eglChooseConfig(display.egl, cfg_attrs, &g3d->egl_config_t, 1, &nconfigs);
-    if (!ret) {
+    if (!eglChooseConfig(display.egl, cfg_attrs, configs, 64, &nconfigs)) {
         trace_error("%s, eglChooseConfig returned FALSE\n", __func__);
-        goto err_1;
+        return 1;
     }
 
-    if (nconfigs != 1) {
-        trace_error("%s, eglChooseConfig returned %d configs, expected 1\n", __func__, nconfigs);
-        goto err_1;
+    for (int k = 0; k < nconfigs; k ++) {
+        EGLint visual_id = 0;
+        XVisualInfo vi_template;
+        int nvi = 0;
+
+        eglGetConfigAttrib(display.egl, configs[k], EGL_NATIVE_VISUAL_ID, &visual_id);
+        vi_template.visualid = visual_id;
+        XVisualInfo *vi = XGetVisualInfo(display.x, VisualIDMask, &vi_template, &nvi);
+        const int depth = (vi && nvi > 0) ? vi->depth : 0;
+        if (vi)
+            XFree(vi);
+
+        if (depth == 32) {
+            *config = configs[k];
+            return 0;
+        }
     }
 
+    trace_error("%s, no EGLConfig with 32-bit visual\n", __func__);
+    return 1;
+}
+
+// creates GL context for transparency rendering. Plugin draws into FBO; on swap
+// presentation context resolves it into premultiplied ARGB pixmap, which expose handler
+// composes over the page with a single XRender request
+static
+int
+create_presentation_egl_context(struct pp_graphics3d_s *g3d)
+{
+    if (choose_argb_config(&g3d->egl_config_t) != 0)
+        goto err_1;
+
     EGLint ctxattr[] = { EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE };
     g3d->glc_t = eglCreateContext(display.egl, g3d->egl_config_t, g3d->glc, ctxattr);
     if (g3d->glc_t == EGL_NO_CONTEXT) {
@@ -91,20 +199,16 @@ create_presentation_egl_context(struct pp_graphics3d_s *g3d)
         goto err_1;
     }
 
-    ret = eglMakeCurrent(display.egl, g3d->egl_surf, g3d->egl_surf, g3d->glc_t);
+    if (create_argb_pixmap(g3d) != 0)
+        goto err_2;
+
+    EGLBoolean ret = eglMakeCurrent(display.egl, g3d->egl_surf_t, g3d->egl_surf_t, g3d->glc_t);
     if (!ret) {
         trace_error("%s, eglMakeCurrent failed\n", __func__);
-        goto err_2;
+        goto err_3;
     }
 
-    glGenTextures(1, &g3d->tex_back);
-    glBindTexture(GL_TEXTURE_2D, g3d->tex_back);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-
-    // Create alpha blending GL program
+    // Create premultiplying GL program
     const char *vert_shader_body =
         "attribute vec4 pos;\n"
         "varying vec2 tex_coord;\n"
@@ -114,12 +218,10 @@ create_presentation_egl_context(struct pp_graphics3d_s *g3d)
         "}\n";
     const char *frag_shader_body =
         "varying highp vec2 tex_coord;\n"
-        "uniform sampler2D tex_front;\n"
-        "uniform sampler2D tex_back;\n"
+        "uniform sampler2D tex;\n"
         "void main() {\n"
-        "    highp vec4 c_front = texture2D(tex_front, tex_coord);\n"
-        "    highp vec4 c_back = texture2D(tex_back, tex_coord);\n"
-        "    gl_FragColor = mix(c_back, c_front, c_front.a);\n"
+        "    highp vec4 c = texture2D(tex, tex_coord);\n"
+        "    gl_FragColor = vec4(c.rgb * c.a, c.a);\n"
         "}\n";
 
     GLuint vert_shader = glCreateShader(GL_VERTEX_SHADER);
@@ -131,7 +233,7 @@ create_presentation_egl_context(struct pp_graphics3d_s *g3d)
     glGetShaderiv(vert_shader, GL_COMPILE_STATUS, &status);
     if (status != GL_TRUE) {
         report_shader_compile_error(__func__, vert_shader, vert_shader_body);
-        goto err_3;
+        goto err_4;
     }
 
     glShaderSource(frag_shader, 1, &frag_shader_body, NULL);
@@ -139,7 +241,7 @@ create_presentation_egl_context(struct pp_graphics3d_s *g3d)
     glGetShaderiv(frag_shader, GL_COMPILE_STATUS, &status);
     if (status != GL_TRUE) {
         report_shader_compile_error(__func__, frag_shader, frag_shader_body);
-        goto err_3;
+        goto err_4;
     }
 
     g3d->prog.id = glCreateProgram();
@@ -152,28 +254,456 @@ create_presentation_egl_context(struct pp_graphics3d_s *g3d)
     glGetProgramiv(g3d->prog.id, GL_LINK_STATUS, &status);
     if (status != GL_TRUE) {
         trace_error("%s, GL program link failed\n", __func__);
-        goto err_4;
+        goto err_5;
     }
 
     glDeleteShader(vert_shader);
     glDeleteShader(frag_shader);
 
-    g3d->prog.uniform_tex_back = glGetUniformLocation(g3d->prog.id, "tex_back");
-    g3d->prog.uniform_tex_front = glGetUniformLocation(g3d->prog.id, "tex_front");
+    g3d->prog.uniform_tex = glGetUniformLocation(g3d->prog.id, "tex");
+
+    // state of presentation context never changes
+    static const GLfloat square_vertices[] = { 0.0, 0.0,  1.0, 0.0,  0.0, 1.0,  1.0, 1.0 };
+    glGenBuffers(1, &g3d->prog.vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, g3d->prog.vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(square_vertices), square_vertices, GL_STATIC_DRAW);
+    glUseProgram(g3d->prog.id);
+    glUniform1i(g3d->prog.uniform_tex, 0);
+    glVertexAttribPointer(g3d->prog.attrib_pos, 2, GL_FLOAT, 0, 0, NULL);
+    glEnableVertexAttribArray(g3d->prog.attrib_pos);
+    glDisable(GL_BLEND);
 
     return 0;
 
-err_4:
+err_5:
     glDeleteProgram(g3d->prog.id);
-err_3:
+err_4:
     glDeleteShader(frag_shader);
     glDeleteShader(vert_shader);
+    eglMakeCurrent(display.egl, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+err_3:
+    destroy_argb_pixmap(g3d);
 err_2:
     eglDestroyContext(display.egl, g3d->glc_t);
+    g3d->glc_t = EGL_NO_CONTEXT;
 err_1:
     return 1;
 }
 
+// draws plugin frame from FBO into ARGB pixmap, premultiplying alpha. Context should
+// not be current to the calling thread
+static
+void
+resolve_frame_to_argb_pixmap(struct pp_graphics3d_s *g3d)
+{
+    eglMakeCurrent(display.egl, g3d->egl_surf_t, g3d->egl_surf_t, g3d->glc_t);
+    glViewport(0, 0, g3d->width, g3d->height);
+    glBindTexture(GL_TEXTURE_2D, g3d->fbo.color_tex);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+static
+int
+gl_has_extension(const char *extensions, const char *name)
+{
+    const size_t len = strlen(name);
+    const char *p = extensions;
+
+    while (p && (p = strstr(p, name)) != NULL) {
+        if ((p == extensions || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0'))
+            return 1;
+        p += len;
+    }
+    return 0;
+}
+
+// must be called with display.lock held
+static
+void
+detect_fence_sync(void)
+{
+    if (fence_funcs.initialized)
+        return;
+
+    fence_funcs.initialized = 1;
+    const char *extensions = eglQueryString(display.egl, EGL_EXTENSIONS);
+    if (!gl_has_extension(extensions, "EGL_KHR_fence_sync")) {
+        trace_warning("%s, no EGL_KHR_fence_sync, SwapBuffers will use glFinish\n", __func__);
+        return;
+    }
+
+    fence_funcs.CreateSync = (void *)eglGetProcAddress("eglCreateSyncKHR");
+    fence_funcs.DestroySync = (void *)eglGetProcAddress("eglDestroySyncKHR");
+    fence_funcs.ClientWaitSync = (void *)eglGetProcAddress("eglClientWaitSyncKHR");
+    if (!fence_funcs.CreateSync || !fence_funcs.DestroySync || !fence_funcs.ClientWaitSync)
+        fence_funcs.CreateSync = NULL;
+}
+
+// must be called with display.lock held and some context current
+static
+void
+detect_readback_caps(void)
+{
+    if (readback_caps.initialized)
+        return;
+
+    const char *version = (const char *)glGetString(GL_VERSION);
+    const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+
+    if (version && strncmp(version, "OpenGL ES 3", strlen("OpenGL ES 3")) == 0) {
+        readback_caps.MapBufferRange = (void *)eglGetProcAddress("glMapBufferRange");
+        readback_caps.UnmapBuffer = (void *)eglGetProcAddress("glUnmapBuffer");
+    } else if (gl_has_extension(extensions, "GL_NV_pixel_buffer_object") &&
+               gl_has_extension(extensions, "GL_EXT_map_buffer_range") &&
+               gl_has_extension(extensions, "GL_OES_mapbuffer"))
+    {
+        readback_caps.MapBufferRange = (void *)eglGetProcAddress("glMapBufferRangeEXT");
+        readback_caps.UnmapBuffer = (void *)eglGetProcAddress("glUnmapBufferOES");
+    }
+
+    readback_caps.have_pbo = readback_caps.MapBufferRange && readback_caps.UnmapBuffer;
+    readback_caps.have_bgra = gl_has_extension(extensions, "GL_EXT_read_format_bgra");
+    readback_caps.initialized = 1;
+
+    if (!readback_caps.have_pbo)
+        trace_warning("%s, no pixel buffer objects, readback will be synchronous\n", __func__);
+}
+
+// (re)allocates storage for FBO attachments and readback buffers. Bindings are preserved.
+static
+int
+fbo_allocate_storage(struct pp_graphics3d_s *g3d)
+{
+    const int32_t width = MAX(g3d->width, 1);
+    const int32_t height = MAX(g3d->height, 1);
+    GLint prev_tex, prev_rb, prev_fbo;
+
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &prev_tex);
+    glGetIntegerv(GL_RENDERBUFFER_BINDING, &prev_rb);
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prev_fbo);
+
+    glBindTexture(GL_TEXTURE_2D, g3d->fbo.color_tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+    if (g3d->fbo.depth_rb) {
+        glBindRenderbuffer(GL_RENDERBUFFER, g3d->fbo.depth_rb);
+        glRenderbufferStorage(GL_RENDERBUFFER, g3d->fbo.depth_format, width, height);
+    }
+
+    if (g3d->fbo.stencil_rb && g3d->fbo.stencil_rb != g3d->fbo.depth_rb) {
+        glBindRenderbuffer(GL_RENDERBUFFER, g3d->fbo.stencil_rb);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_STENCIL_INDEX8, width, height);
+    }
+
+    const size_t frame_size = (size_t)width * height * 4;
+    if (g3d->fbo.pbo[0]) {
+        for (int k = 0; k < 2; k ++) {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, g3d->fbo.pbo[k]);
+            glBufferData(GL_PIXEL_PACK_BUFFER, frame_size, NULL, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    } else {
+        free(g3d->fbo.raw);
+        g3d->fbo.raw = malloc(frame_size);
+    }
+
+    free(g3d->fbo.image);
+    g3d->fbo.stride = width * 4;
+    g3d->fbo.image = malloc(frame_size);
+    g3d->fbo.pbo_idx = 0;
+    g3d->fbo.pbo_ready = -1;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, g3d->fbo.id);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, prev_fbo);
+    glBindRenderbuffer(GL_RENDERBUFFER, prev_rb);
+    glBindTexture(GL_TEXTURE_2D, prev_tex);
+
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        trace_error("%s, framebuffer incomplete, status 0x%04x\n", __func__, status);
+        return 1;
+    }
+
+    if (!g3d->fbo.image || (!g3d->fbo.pbo[0] && !g3d->fbo.raw)) {
+        trace_error("%s, can't allocate memory\n", __func__);
+        return 1;
+    }
+
+    return 0;
+}
+
+// creates offscreen framebuffer which replaces default one for the plugin. Context
+// must be current
+static
+int
+fbo_create(struct pp_graphics3d_s *g3d)
+{
+    const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+
+    detect_readback_caps();
+    g3d->fbo.read_format = readback_caps.have_bgra ? GL_BGRA_EXT : GL_RGBA;
+
+    glGenFramebuffers(1, &g3d->fbo.id);
+    glGenTextures(1, &g3d->fbo.color_tex);
+    glBindTexture(GL_TEXTURE_2D, g3d->fbo.color_tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    if (g3d->fbo.depth_size > 0 && g3d->fbo.stencil_size > 0 &&
+        gl_has_extension(extensions, "GL_OES_packed_depth_stencil"))
+    {
+        glGenRenderbuffers(1, &g3d->fbo.depth_rb);
+        g3d->fbo.stencil_rb = g3d->fbo.depth_rb;
+        g3d->fbo.depth_format = GL_DEPTH24_STENCIL8_OES;
+    } else {
+        if (g3d->fbo.depth_size > 0) {
+            glGenRenderbuffers(1, &g3d->fbo.depth_rb);
+            // 16 bits is the only depth format ES 2.0 guarantees
+            g3d->fbo.depth_format = g3d->fbo.depth_size > 16 &&
+                                    gl_has_extension(extensions, "GL_OES_depth24")
+                                        ? GL_DEPTH_COMPONENT24_OES
+                                        : GL_DEPTH_COMPONENT16;
+        }
+        if (g3d->fbo.stencil_size > 0)
+            glGenRenderbuffers(1, &g3d->fbo.stencil_rb);
+    }
+
+    if (readback_caps.have_pbo)
+        glGenBuffers(2, g3d->fbo.pbo);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, g3d->fbo.id);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                           g3d->fbo.color_tex, 0);
+    if (g3d->fbo.depth_rb) {
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER,
+                                  g3d->fbo.depth_rb);
+    }
+    if (g3d->fbo.stencil_rb) {
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_RENDERBUFFER,
+                                  g3d->fbo.stencil_rb);
+    }
+
+    if (fbo_allocate_storage(g3d) != 0)
+        return 1;
+
+    // default viewport and scissor box are set by the size of 1x1 pbuffer surface
+    glViewport(0, 0, g3d->width, g3d->height);
+    glScissor(0, 0, g3d->width, g3d->height);
+    return 0;
+}
+
+static
+void
+fbo_destroy(struct pp_graphics3d_s *g3d)
+{
+    if (g3d->fbo.pbo[0])
+        glDeleteBuffers(2, g3d->fbo.pbo);
+    if (g3d->fbo.stencil_rb && g3d->fbo.stencil_rb != g3d->fbo.depth_rb)
+        glDeleteRenderbuffers(1, &g3d->fbo.stencil_rb);
+    if (g3d->fbo.depth_rb)
+        glDeleteRenderbuffers(1, &g3d->fbo.depth_rb);
+    glDeleteTextures(1, &g3d->fbo.color_tex);
+    glDeleteFramebuffers(1, &g3d->fbo.id);
+    free(g3d->fbo.raw);
+    free(g3d->fbo.image);
+    g3d->fbo.raw = NULL;
+    g3d->fbo.image = NULL;
+}
+
+// issues readback of the FBO contents. With PBOs, transfer proceeds asynchronously, and
+// buffers alternate, so the next frame can be read while the previous one is still mapped
+static
+void
+fbo_start_readback(struct pp_graphics3d_s *g3d)
+{
+    GLint prev_fbo, prev_pack_alignment;
+
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prev_fbo);
+    glGetIntegerv(GL_PACK_ALIGNMENT, &prev_pack_alignment);
+    glBindFramebuffer(GL_FRAMEBUFFER, g3d->fbo.id);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+    if (g3d->fbo.pbo[0]) {
+        const int idx = g3d->fbo.pbo_idx;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, g3d->fbo.pbo[idx]);
+        glReadPixels(0, 0, g3d->width, g3d->height, g3d->fbo.read_format, GL_UNSIGNED_BYTE,
+                     NULL);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        g3d->fbo.pbo_ready = idx;
+        g3d->fbo.pbo_idx = 1 - idx;
+    } else {
+        glReadPixels(0, 0, g3d->width, g3d->height, g3d->fbo.read_format, GL_UNSIGNED_BYTE,
+                     g3d->fbo.raw);
+    }
+
+    glPixelStorei(GL_PACK_ALIGNMENT, prev_pack_alignment);
+    glBindFramebuffer(GL_FRAMEBUFFER, prev_fbo);
+}
+
+int
+ppb_graphics3d_fbo_fetch_frame(struct pp_graphics3d_s *g3d, int premultiply)
+{
+    const int32_t width = g3d->width;
+    const int32_t height = g3d->height;
+    const uint8_t *src = (const uint8_t *)g3d->fbo.raw;
+
+    if (!g3d->fbo.image)
+        return 1;
+
+    eglMakeCurrent(display.egl, g3d->egl_surf, g3d->egl_surf, g3d->glc);
+
+    if (g3d->fbo.pbo[0]) {
+        if (g3d->fbo.pbo_ready < 0) {
+            src = NULL;
+        } else {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, g3d->fbo.pbo[g3d->fbo.pbo_ready]);
+            src = readback_caps.MapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                                               (GLsizeiptr)width * height * 4, GL_MAP_READ_BIT);
+        }
+    }
+
+    if (src) {
+        const int swap_rb = (g3d->fbo.read_format != GL_BGRA_EXT);
+
+        // GL rows go bottom-up, X expects them top-down
+        for (int32_t y = 0; y < height; y ++) {
+            const uint8_t *s = src + (size_t)(height - 1 - y) * width * 4;
+            uint8_t *d = (uint8_t *)g3d->fbo.image + (size_t)y * g3d->fbo.stride;
+
+            if (!swap_rb && !premultiply) {
+                memcpy(d, s, width * 4);
+                continue;
+            }
+
+            for (int32_t x = 0; x < width; x ++, s += 4, d += 4) {
+                uint8_t c0 = swap_rb ? s[2] : s[0];
+                uint8_t c1 = s[1];
+                uint8_t c2 = swap_rb ? s[0] : s[2];
+                uint8_t a = s[3];
+
+                if (premultiply) {
+                    c0 = (c0 * a + 127) / 255;
+                    c1 = (c1 * a + 127) / 255;
+                    c2 = (c2 * a + 127) / 255;
+                }
+
+                d[0] = c0;
+                d[1] = c1;
+                d[2] = c2;
+                d[3] = a;
+            }
+        }
+    }
+
+    if (g3d->fbo.pbo[0] && g3d->fbo.pbo_ready >= 0) {
+        if (src)
+            readback_caps.UnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    eglMakeCurrent(display.egl, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    return src ? 0 : 1;
+}
+
+void
+ppb_graphics3d_wait_for_frame(PP_Resource context)
+{
+    struct pp_graphics3d_s *g3d = pp_resource_acquire(context, PP_RESOURCE_GRAPHICS3D);
+    if (!g3d)
+        return;
+
+    pthread_mutex_lock(&display.lock);
+    EGLSyncKHR fence = g3d->swap_fence;
+    g3d->swap_fence = EGL_NO_SYNC_KHR;
+    pthread_mutex_unlock(&display.lock);
+    pp_resource_release(context);
+
+    if (fence == EGL_NO_SYNC_KHR)
+        return;
+
+    // neither resource nor display lock is held here, plugin can continue drawing
+    if (fence_funcs.ClientWaitSync(display.egl, fence, 0, EGL_FOREVER_KHR) == EGL_FALSE)
+        trace_error("%s, eglClientWaitSyncKHR failed\n", __func__);
+    fence_funcs.DestroySync(display.egl, fence);
+}
+
+// returns state of current context to defaults, so context can be handed over to another
+// Graphics3D resource. Objects of previous owner should be deleted by then, as new owner may
+// belong to another page
+static
+void
+reset_context_state(void)
+{
+    static const GLenum caps[] = {
+        GL_BLEND, GL_CULL_FACE, GL_DEPTH_TEST, GL_POLYGON_OFFSET_FILL,
+        GL_SAMPLE_ALPHA_TO_COVERAGE, GL_SAMPLE_COVERAGE, GL_SCISSOR_TEST, GL_STENCIL_TEST,
+    };
+    GLint max_attribs = 0;
+    GLint max_units = 0;
+
+    // attribute pointers capture array buffer binding
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    glGetIntegerv(GL_MAX_VERTEX_ATTRIBS, &max_attribs);
+    for (GLint k = 0; k < max_attribs; k ++) {
+        glDisableVertexAttribArray(k);
+        glVertexAttrib4f(k, 0.0, 0.0, 0.0, 1.0);
+        glVertexAttribPointer(k, 4, GL_FLOAT, GL_FALSE, 0, NULL);
+    }
+
+    glGetIntegerv(GL_MAX_COMBINED_TEXTURE_IMAGE_UNITS, &max_units);
+    for (GLint k = 0; k < max_units; k ++) {
+        glActiveTexture(GL_TEXTURE0 + k);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    }
+    glActiveTexture(GL_TEXTURE0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glUseProgram(0);
+
+    for (unsigned int k = 0; k < sizeof(caps) / sizeof(caps[0]); k ++)
+        glDisable(caps[k]);
+    glEnable(GL_DITHER);
+
+    glBlendColor(0.0, 0.0, 0.0, 0.0);
+    glBlendEquation(GL_FUNC_ADD);
+    glBlendFunc(GL_ONE, GL_ZERO);
+    glClearColor(0.0, 0.0, 0.0, 0.0);
+    glClearDepthf(1.0);
+    glClearStencil(0);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glCullFace(GL_BACK);
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+    glDepthRangef(0.0, 1.0);
+    glFrontFace(GL_CCW);
+    glHint(GL_GENERATE_MIPMAP_HINT, GL_DONT_CARE);
+    glLineWidth(1.0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glPolygonOffset(0.0, 0.0);
+    glSampleCoverage(1.0, GL_FALSE);
+    glStencilFunc(GL_ALWAYS, 0, ~0u);
+    glStencilMask(~0u);
+    glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+
+    // real values depend on surface size, they are set when context is taken from pool
+    glViewport(0, 0, 0, 0);
+    glScissor(0, 0, 0, 0);
+
+    // errors raised by previous owner must not be seen by the next one
+    while (glGetError() != GL_NO_ERROR) {
+    }
+}
+
 PP_Resource
 ppb_graphics3d_create(PP_Instance instance, PP_Resource share_context, const int32_t attrib_list[])
 {
@@ -196,10 +726,22 @@ ppb_graphics3d_create(PP_Instance instance, PP_Resource share_context, const int
     }
     attrib_len ++;
 
+    gl_profiler_initialize();
+    g3d->swap_fence = EGL_NO_SYNC_KHR;
+    if (config.graphics3d_backend && strcmp(config.graphics3d_backend, "fbo") == 0)
+        g3d->backend = G3D_BACKEND_FBO;
+    else if (pp_i->is_transparent)
+        g3d->backend = G3D_BACKEND_COMPOSITE;
+    else
+        g3d->backend = G3D_BACKEND_PIXMAP;
+    const int uses_fbo = (g3d->backend != G3D_BACKEND_PIXMAP);
+
     EGLint *egl_attribute_list = calloc(attrib_len + 3 * 2, sizeof(EGLint));
     int done = 0, k1 = 0, k2 = 0;
     egl_attribute_list[k2++] = EGL_SURFACE_TYPE;
-    egl_attribute_list[k2++] = EGL_PIXMAP_BIT | EGL_WINDOW_BIT;
+    egl_attribute_list[k2++] = uses_fbo
+                                    ? EGL_PBUFFER_BIT
+                                    : EGL_PIXMAP_BIT | EGL_WINDOW_BIT;
     egl_attribute_list[k2++] = EGL_RENDERABLE_TYPE;
     egl_attribute_list[k2++] = EGL_OPENGL_ES2_BIT;
 
@@ -243,11 +785,13 @@ ppb_graphics3d_create(PP_Instance instance, PP_Resource share_context, const int
             k1 += 2;
             break;
         case PP_GRAPHICS3DATTRIB_DEPTH_SIZE:
+            g3d->fbo.depth_size = attrib_list[k1 + 1];
             egl_attribute_list[k2++] = EGL_DEPTH_SIZE;
             egl_attribute_list[k2++] = attrib_list[k1 + 1];
             k1 += 2;
             break;
         case PP_GRAPHICS3DATTRIB_STENCIL_SIZE:
+            g3d->fbo.stencil_size = attrib_list[k1 + 1];
             egl_attribute_list[k2++] = EGL_STENCIL_SIZE;
             egl_attribute_list[k2++] = attrib_list[k1 + 1];
             k1 += 2;
@@ -270,7 +814,25 @@ ppb_graphics3d_create(PP_Instance instance, PP_Resource share_context, const int
         }
     }
 
+    // resource must be acquired before display.lock is taken, to keep lock order
+    struct pp_graphics3d_s *g3d_share = NULL;
+    if (share_context != 0) {
+        g3d_share = pp_resource_acquire(share_context, PP_RESOURCE_GRAPHICS3D);
+        if (!g3d_share) {
+            trace_error("%s, bad share_context\n", __func__);
+            free(egl_attribute_list);
+            pp_resource_release(context);
+            pp_resource_expunge(context);
+            return 0;
+        }
+
+        // objects created by share_context should exist before new context sees them
+        if (g3d_share->cmd_buffer)
+            gl_cmd_buffer_sync(g3d_share->cmd_buffer);
+    }
+
     pthread_mutex_lock(&display.lock);
+    detect_fence_sync();
     int nconfigs = 0;
     EGLBoolean ret = eglChooseConfig(display.egl, egl_attribute_list,
                                      &g3d->egl_config, 1, &nconfigs);
@@ -285,19 +847,61 @@ ppb_graphics3d_create(PP_Instance instance, PP_Resource share_context, const int
         goto err;
     }
 
-    // TODO: support shared_context
-    EGLint ctxattr[] = { EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE };
-    g3d->glc = eglCreateContext(display.egl, g3d->egl_config, EGL_NO_CONTEXT, ctxattr);
-    if (g3d->glc == EGL_NO_CONTEXT) {
-        trace_error("%s, eglCreateContext returned EGL_NO_CONTEXT\n", __func__);
-        goto err;
+    // pooled contexts share nothing, so they can't serve as members of a share group
+    g3d->egl_surf = EGL_NO_SURFACE;
+    g3d->glc = EGL_NO_CONTEXT;
+    if (!g3d_share)
+        g3d->glc = egl_pool_take_context(g3d->egl_config, uses_fbo ? &g3d->egl_surf : NULL);
+    const int recycled = (g3d->glc != EGL_NO_CONTEXT);
+
+    if (!recycled) {
+        EGLint ctxattr[] = { EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE };
+        g3d->glc = eglCreateContext(display.egl, g3d->egl_config,
+                                    g3d_share ? g3d_share->glc : EGL_NO_CONTEXT, ctxattr);
+        if (g3d->glc == EGL_NO_CONTEXT) {
+            trace_error("%s, eglCreateContext returned EGL_NO_CONTEXT\n", __func__);
+            goto err;
+        }
+    }
+
+    if (g3d_share) {
+        // EGL keeps shared objects alive while any context of the group exists, so contexts
+        // may be destroyed in any order. Group itself is freed with the last member.
+        if (!g3d_share->share_group) {
+            // from now on shaders of g3d_share may be linked by other contexts, so deferred
+            // compilations can't wait any longer
+            eglMakeCurrent(display.egl, g3d_share->egl_surf, g3d_share->egl_surf,
+                           g3d_share->glc);
+            ppb_opengles2_compile_pending_shaders(g3d_share);
+            eglMakeCurrent(display.egl, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+
+            g3d_share->share_group = g_slice_alloc0(sizeof(*g3d_share->share_group));
+            g3d_share->share_group->ref_count = 1;
+        }
+        g3d->share_group = g3d_share->share_group;
+        __atomic_add_fetch(&g3d->share_group->ref_count, 1, __ATOMIC_SEQ_CST);
+        pp_resource_release(share_context);
+        g3d_share = NULL;
     }
 
-    g3d->pixmap = XCreatePixmap(display.x, DefaultRootWindow(display.x), g3d->width, g3d->height,
-                                DefaultDepth(display.x, 0));
-    g3d->egl_surf = eglCreatePixmapSurface(display.egl, g3d->egl_config, g3d->pixmap, NULL);
+    if (uses_fbo) {
+        // surface is only needed to make context current, all rendering goes to FBO.
+        // Recycled context comes with its own
+        g3d->pixmap = None;
+        if (!recycled) {
+            EGLint pbuffer_attrs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+            g3d->egl_surf = eglCreatePbufferSurface(display.egl, g3d->egl_config,
+                                                    pbuffer_attrs);
+        }
+    } else if (egl_pool_take_surface(g3d->egl_config, g3d->width, g3d->height, &g3d->pixmap,
+                                     &g3d->egl_surf) != 0)
+    {
+        g3d->pixmap = XCreatePixmap(display.x, DefaultRootWindow(display.x), g3d->width,
+                                    g3d->height, DefaultDepth(display.x, 0));
+        g3d->egl_surf = eglCreatePixmapSurface(display.egl, g3d->egl_config, g3d->pixmap, NULL);
+    }
     if (g3d->egl_surf == EGL_NO_SURFACE) {
-        trace_error("%s, failed to create EGL pixmap surface\n", __func__);
+        trace_error("%s, failed to create EGL surface\n", __func__);
         goto err;
     }
 
@@ -307,34 +911,56 @@ ppb_graphics3d_create(PP_Instance instance, PP_Resource share_context, const int
         goto err;
     }
 
-    // clear surface
+    if (recycled) {
+        // EGL sets viewport and scissor box to surface size only when context is made
+        // current for the first time. Everything else was reset before pooling
+        glViewport(0, 0, g3d->width, g3d->height);
+        glScissor(0, 0, g3d->width, g3d->height);
+    }
+
+    if (uses_fbo) {
+        if (fbo_create(g3d) != 0) {
+            trace_error("%s, can't create framebuffer object\n", __func__);
+            goto err;
+        }
+    }
+
+    // clear surface; pooled one still holds contents left by its previous owner
     glClearColor(0.0, 0.0, 0.0, 1.0);
-    glClear(GL_COLOR_BUFFER_BIT);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 
-    if (pp_i->is_transparent) {
-        // create texture for plugin content
-        glGenTextures(1, &g3d->tex_front);
-        glBindTexture(GL_TEXTURE_2D, g3d->tex_front);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    gl_shadow_state_init(&g3d->shadow, g3d->fbo.id, g3d->width, g3d->height);
 
+    if (g3d->backend == G3D_BACKEND_COMPOSITE) {
+        // no 32-bit visual is common on non-composited X servers. Readback path handles
+        // transparency too, only slower, and it uses the same FBO
         if (create_presentation_egl_context(g3d) != 0) {
-            trace_error("%s, can't create EGL context for transparency processing\n", __func__);
-            goto err;
+            trace_warning("%s, can't create EGL context for transparency processing, "
+                          "falling back to readback\n", __func__);
+            g3d->backend = G3D_BACKEND_FBO;
         }
     }
 
     eglMakeCurrent(display.egl, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
 
     g3d->sub_maps = g_hash_table_new(g_direct_hash, g_direct_equal);
+    ppb_opengles2_init_program_tracking(g3d);
+    staging_pool_init(&g3d->staging);
     pthread_mutex_unlock(&display.lock);
 
+    if (config.gl_command_buffer) {
+        g3d->cmd_buffer = gl_cmd_buffer_create(g3d->egl_surf, g3d->glc);
+        if (!g3d->cmd_buffer)
+            trace_error("%s, can't create command buffer, falling back to direct calls\n",
+                        __func__);
+    }
+
     pp_resource_release(context);
     return context;
 err:
     pthread_mutex_unlock(&display.lock);
+    if (g3d_share)
+        pp_resource_release(share_context);
     pp_resource_release(context);
     pp_resource_expunge(context);
     return 0;
@@ -344,27 +970,67 @@ void
 ppb_graphics3d_destroy(void *p)
 {
     struct pp_graphics3d_s *g3d = p;
-    struct pp_instance_s *pp_i = g3d->instance;
+
+    ppb_opengles2_release_sub_maps(g3d);
     g_hash_table_destroy(g3d->sub_maps);
+    staging_pool_destroy(&g3d->staging);
 
-    pthread_mutex_lock(&display.lock);
+    // replays all pending commands and stops GL thread
+    if (g3d->cmd_buffer) {
+        gl_cmd_buffer_destroy(g3d->cmd_buffer);
+        g3d->cmd_buffer = NULL;
+    }
 
-    // bringing egl_surf to current thread releases it from any others
-    eglMakeCurrent(display.egl, g3d->egl_surf, g3d->egl_surf, g3d->glc);
-    // free it here, to be able to destroy X Pixmap
-    eglMakeCurrent(display.egl, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    pthread_mutex_lock(&display.lock);
 
-    eglDestroySurface(display.egl, g3d->egl_surf);
-    XFreePixmap(display.x, g3d->pixmap);
+    if (g3d->swap_fence != EGL_NO_SYNC_KHR)
+        fence_funcs.DestroySync(display.egl, g3d->swap_fence);
 
-    if (pp_i->is_transparent) {
-        glDeleteTextures(1, &g3d->tex_back);
-        glDeleteTextures(1, &g3d->tex_front);
+    if (g3d->backend == G3D_BACKEND_COMPOSITE) {
+        eglMakeCurrent(display.egl, g3d->egl_surf_t, g3d->egl_surf_t, g3d->glc_t);
+        glDeleteBuffers(1, &g3d->prog.vbo);
         glDeleteProgram(g3d->prog.id);
+        eglMakeCurrent(display.egl, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        destroy_argb_pixmap(g3d);
         eglDestroyContext(display.egl, g3d->glc_t);
     }
 
-    eglDestroyContext(display.egl, g3d->glc);
+    // objects of a share group may still be used by other members, so such contexts are
+    // never pooled
+    const int poolable = (g3d->share_group == NULL);
+
+    // bringing egl_surf to current thread releases it from any others
+    eglMakeCurrent(display.egl, g3d->egl_surf, g3d->egl_surf, g3d->glc);
+    if (g3d->backend != G3D_BACKEND_PIXMAP)
+        fbo_destroy(g3d);
+    if (poolable) {
+        ppb_opengles2_delete_objects(g3d);
+        reset_context_state();
+    }
+    // release it here, to be able to reuse or destroy surface
+    eglMakeCurrent(display.egl, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    ppb_opengles2_release_program_tracking(g3d);
+
+    if (g3d->backend == G3D_BACKEND_PIXMAP) {
+        egl_pool_put_surface(g3d->egl_config, g3d->width, g3d->height, g3d->pixmap,
+                             g3d->egl_surf);
+        if (poolable)
+            egl_pool_put_context(g3d->egl_config, g3d->glc, EGL_NO_SURFACE);
+        else
+            eglDestroyContext(display.egl, g3d->glc);
+    } else if (poolable) {
+        // pbuffer goes along with context
+        egl_pool_put_context(g3d->egl_config, g3d->glc, g3d->egl_surf);
+    } else {
+        eglDestroySurface(display.egl, g3d->egl_surf);
+        eglDestroyContext(display.egl, g3d->glc);
+    }
+
+    if (g3d->share_group) {
+        if (__atomic_sub_fetch(&g3d->share_group->ref_count, 1, __ATOMIC_SEQ_CST) == 0)
+            g_slice_free(struct g3d_share_group_s, g3d->share_group);
+        g3d->share_group = NULL;
+    }
     pthread_mutex_unlock(&display.lock);
 }
 
@@ -406,48 +1072,70 @@ ppb_graphics3d_resize_buffers(PP_Resource context, int32_t width, int32_t height
         return PP_ERROR_BADRESOURCE;
     }
 
+    if (width == g3d->width && height == g3d->height) {
+        pp_resource_release(context);
+        return PP_OK;
+    }
+
+    if (g3d->cmd_buffer)
+        gl_cmd_buffer_sync(g3d->cmd_buffer);
+
     pthread_mutex_lock(&display.lock);
+    const int32_t old_width = g3d->width;
+    const int32_t old_height = g3d->height;
     g3d->width = width;
     g3d->height = height;
 
+    if (g3d->backend != G3D_BACKEND_PIXMAP) {
+        // FBO keeps its name, so plugin bindings stay valid; only storage changes
+        eglMakeCurrent(display.egl, g3d->egl_surf, g3d->egl_surf, g3d->glc);
+        int ret = fbo_allocate_storage(g3d);
+
+        if (g3d->backend == G3D_BACKEND_COMPOSITE) {
+            // release old surface from whatever thread it is current to
+            eglMakeCurrent(display.egl, g3d->egl_surf_t, g3d->egl_surf_t, g3d->glc_t);
+            eglMakeCurrent(display.egl, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            destroy_argb_pixmap(g3d);
+            if (create_argb_pixmap(g3d) != 0)
+                ret = 1;
+        }
+
+        eglMakeCurrent(display.egl, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        pthread_mutex_unlock(&display.lock);
+        pp_resource_release(context);
+        return ret == 0 ? PP_OK : PP_ERROR_NOMEMORY;
+    }
+
     EGLSurface old_surf = g3d->egl_surf;
     Pixmap old_pixmap = g3d->pixmap;
     // release possibly bound to other thread g3d->egl_surf and bind it to current
     eglMakeCurrent(display.egl, g3d->egl_surf, g3d->egl_surf, g3d->glc);
 
-    g3d->pixmap = XCreatePixmap(display.x, DefaultRootWindow(display.x), g3d->width, g3d->height,
-                                DefaultDepth(display.x, 0));
-    g3d->egl_surf = eglCreatePixmapSurface(display.egl, g3d->egl_config, g3d->pixmap, NULL);
+    // sizes often oscillate during window animations, previous surfaces are likely in pool
+    if (egl_pool_take_surface(g3d->egl_config, width, height, &g3d->pixmap, &g3d->egl_surf) != 0) {
+        g3d->pixmap = XCreatePixmap(display.x, DefaultRootWindow(display.x), g3d->width,
+                                    g3d->height, DefaultDepth(display.x, 0));
+        g3d->egl_surf = eglCreatePixmapSurface(display.egl, g3d->egl_config, g3d->pixmap, NULL);
+    }
 
     // make new g3d->egl_surf current to current thread to release old_surf
     eglMakeCurrent(display.egl, g3d->egl_surf, g3d->egl_surf, g3d->glc);
 
-    // clear surface
+    // clear surface; pooled one still holds contents left by its previous owner
     glClearColor(0.0, 0.0, 0.0, 1.0);
-    glClear(GL_COLOR_BUFFER_BIT);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 
-    // destroy old egl surface and x pixmap
-    eglDestroySurface(display.egl, old_surf);
-    XFreePixmap(display.x, old_pixmap);
+    if (g3d->cmd_buffer)
+        gl_cmd_buffer_set_surface(g3d->cmd_buffer, g3d->egl_surf);
+
+    // keep old egl surface and x pixmap for reuse
+    egl_pool_put_surface(g3d->egl_config, old_width, old_height, old_pixmap, old_surf);
 
     pthread_mutex_unlock(&display.lock);
     pp_resource_release(context);
     return PP_OK;
 }
 
-static
-void
-_call_invalidaterect_ptac(void *param)
-{
-    struct pp_instance_s *pp_i = tables_get_pp_instance(GPOINTER_TO_SIZE(param));
-    if (!pp_i)
-        return;
-    NPRect npr = {.top = 0, .left = 0, .bottom = pp_i->height, .right = pp_i->width};
-
-    npn.invalidaterect(pp_i->npp, &npr);
-    npn.forceredraw(pp_i->npp);
-}
-
 int32_t
 ppb_graphics3d_swap_buffers(PP_Resource context, struct PP_CompletionCallback callback)
 {
@@ -459,6 +1147,9 @@ ppb_graphics3d_swap_buffers(PP_Resource context, struct PP_CompletionCallback ca
 
     struct pp_instance_s *pp_i = g3d->instance;
 
+    if (g3d->cmd_buffer)
+        gl_cmd_buffer_sync(g3d->cmd_buffer);
+
     pthread_mutex_lock(&display.lock);
     if (pp_i->graphics != context) {
         // Other context bound, do nothing.
@@ -474,13 +1165,27 @@ ppb_graphics3d_swap_buffers(PP_Resource context, struct PP_CompletionCallback ca
     }
 
     eglMakeCurrent(display.egl, g3d->egl_surf, g3d->egl_surf, g3d->glc);
-    if (pp_i->is_transparent) {
-        glBindTexture(GL_TEXTURE_2D, g3d->tex_front);
-        glCopyTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 0, 0, g3d->width, g3d->height, 0);
+    if (g3d->backend == G3D_BACKEND_FBO) {
+        fbo_start_readback(g3d);
+    } else if (g3d->backend == G3D_BACKEND_COMPOSITE) {
+        // frame is resolved once here; expose handler only composes the result
+        glFlush();
+        resolve_frame_to_argb_pixmap(g3d);
     }
-    glFinish();  // ensure painting is done
+
+    // Instead of waiting for painting to finish here, put a fence. Presentation code waits
+    // for it, while plugin is free to record the next frame.
+    if (fence_funcs.CreateSync)
+        g3d->swap_fence = fence_funcs.CreateSync(display.egl, EGL_SYNC_FENCE_KHR, NULL);
+    if (g3d->swap_fence != EGL_NO_SYNC_KHR)
+        glFlush();  // fence must reach GPU, or waiting on it may never end
+    else
+        glFinish();  // ensure painting is done
     eglMakeCurrent(display.egl, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
 
+    // streaming uploads reuse the same blocks every frame; anything left alone is not needed
+    staging_pool_trim(&g3d->staging, STAGING_POOL_IDLE_MS);
+
     pp_resource_release(context);
 
     pp_i->graphics_ccb = callback;
@@ -501,7 +1206,7 @@ ppb_graphics3d_swap_buffers(PP_Resource context, struct PP_CompletionCallback ca
         pthread_mutex_unlock(&display.lock);
     } else {
         pthread_mutex_unlock(&display.lock);
-        ppb_core_call_on_browser_thread(_call_invalidaterect_ptac, GSIZE_TO_POINTER(pp_i->id));
+        ppb_instance_request_invalidate(pp_i->id, NULL);
     }
 
     if (callback.func)
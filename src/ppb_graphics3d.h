@@ -55,4 +55,16 @@ ppb_graphics3d_resize_buffers(PP_Resource context, int32_t width, int32_t height
 int32_t
 ppb_graphics3d_swap_buffers(PP_Resource context, struct PP_CompletionCallback callback);
 
+struct pp_graphics3d_s;
+
+/// waits until frame passed to the last SwapBuffers call is rendered. Does nothing if
+/// |context| is not a Graphics3D resource
+void
+ppb_graphics3d_wait_for_frame(PP_Resource context);
+
+/// converts last read back frame of FBO backend into g3d->fbo.image. Must be called with
+/// display.lock held. Returns 0 on success
+int
+ppb_graphics3d_fbo_fetch_frame(struct pp_graphics3d_s *g3d, int premultiply);
+
 #endif // FPP_PPB_GRAPHICS3D_H
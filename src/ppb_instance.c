@@ -24,6 +24,7 @@
 
 #include "ppb_instance.h"
 #include <stdlib.h>
+#include <pthread.h>
 #include "trace.h"
 #include "tables.h"
 #include "pp_resource.h"
@@ -63,6 +64,7 @@ ppb_instance_bind_graphics(PP_Instance instance, PP_Resource device)
         pthread_mutex_lock(&display.lock);
         pp_i->graphics = device;
         pthread_mutex_unlock(&display.lock);
+        g2d->need_full_repaint = 1;
         pp_resource_release(device);
         retval = PP_TRUE;
     } else if (g3d) {
@@ -211,6 +213,88 @@ ppb_instance_execute_script(PP_Instance instance, struct PP_Var script, struct P
     return result;
 }
 
+// protects invalidation state of all instances
+static pthread_mutex_t invalidate_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static
+void
+_call_invalidaterect_ptac(void *param)
+{
+    struct pp_instance_s *pp_i = tables_get_pp_instance(GPOINTER_TO_SIZE(param));
+    if (!pp_i)
+        return;
+
+    // damage accumulated since now will be handled by the next invalidate
+    pthread_mutex_lock(&invalidate_lock);
+    NPRect npr = pp_i->damage_rect;
+    pp_i->have_damage = 0;
+    pp_i->invalidate_queued = 0;
+    pp_i->invalidate_pending = 1;
+    pthread_mutex_unlock(&invalidate_lock);
+
+    npn.invalidaterect(pp_i->npp, &npr);
+    npn.forceredraw(pp_i->npp);
+}
+
+void
+ppb_instance_request_invalidate(PP_Instance instance, const struct PP_Rect *rect)
+{
+    struct pp_instance_s *pp_i = tables_get_pp_instance(instance);
+    if (!pp_i)
+        return;
+
+    NPRect npr = {.top = 0, .left = 0, .bottom = pp_i->height, .right = pp_i->width};
+    if (rect) {
+        const int32_t left =   MAX(rect->point.x, 0);
+        const int32_t top =    MAX(rect->point.y, 0);
+        const int32_t right =  MIN(rect->point.x + rect->size.width, (int32_t)pp_i->width);
+        const int32_t bottom = MIN(rect->point.y + rect->size.height, (int32_t)pp_i->height);
+
+        // rect clipped to nothing still gets whole instance invalidated. Graphics2D flush is
+        // completed from expose handler, so there must be an expose
+        if (left < right && top < bottom)
+            npr = (NPRect){.top = top, .left = left, .bottom = bottom, .right = right};
+    }
+
+    pthread_mutex_lock(&invalidate_lock);
+    if (pp_i->have_damage) {
+        pp_i->damage_rect.left =   MIN(pp_i->damage_rect.left, npr.left);
+        pp_i->damage_rect.top =    MIN(pp_i->damage_rect.top, npr.top);
+        pp_i->damage_rect.right =  MAX(pp_i->damage_rect.right, npr.right);
+        pp_i->damage_rect.bottom = MAX(pp_i->damage_rect.bottom, npr.bottom);
+    } else {
+        pp_i->damage_rect = npr;
+        pp_i->have_damage = 1;
+    }
+
+    // while task is queued or browser haven't sent expose yet, damage is just accumulated
+    int post_task = !pp_i->invalidate_queued && !pp_i->invalidate_pending;
+    if (post_task)
+        pp_i->invalidate_queued = 1;
+    pthread_mutex_unlock(&invalidate_lock);
+
+    if (post_task)
+        ppb_core_call_on_browser_thread(_call_invalidaterect_ptac, GSIZE_TO_POINTER(instance));
+}
+
+void
+ppb_instance_invalidate_serviced(PP_Instance instance)
+{
+    struct pp_instance_s *pp_i = tables_get_pp_instance(instance);
+    if (!pp_i)
+        return;
+
+    pthread_mutex_lock(&invalidate_lock);
+    pp_i->invalidate_pending = 0;
+    int post_task = pp_i->have_damage && !pp_i->invalidate_queued;
+    if (post_task)
+        pp_i->invalidate_queued = 1;
+    pthread_mutex_unlock(&invalidate_lock);
+
+    if (post_task)
+        ppb_core_call_on_browser_thread(_call_invalidaterect_ptac, GSIZE_TO_POINTER(instance));
+}
+
 
 // trace wrappers
 TRACE_WRAPPER
@@ -27,6 +27,7 @@
 
 #include <ppapi/c/ppb_instance.h>
 #include <ppapi/c/private/ppb_instance_private.h>
+#include <ppapi/c/pp_rect.h>
 
 PP_Bool
 ppb_instance_bind_graphics(PP_Instance instance, PP_Resource device);
@@ -43,4 +44,13 @@ ppb_instance_get_owner_element_object(PP_Instance instance);
 struct PP_Var
 ppb_instance_execute_script(PP_Instance instance, struct PP_Var script, struct PP_Var *exception);
 
+/// asks browser to repaint |rect| of the instance, or whole instance if |rect| is NULL or lies
+/// outside of it. Requests made while previous one is still waiting for expose are merged into one
+void
+ppb_instance_request_invalidate(PP_Instance instance, const struct PP_Rect *rect);
+
+/// should be called from expose handler. Issues invalidate for damage accumulated meanwhile
+void
+ppb_instance_invalidate_serviced(PP_Instance instance);
+
 #endif // FPP_PPB_INSTANCE_H
@@ -25,18 +25,88 @@
 #include "ppb_message_loop.h"
 #include <ppapi/c/pp_errors.h>
 #include <stdlib.h>
+#include <string.h>
 #include <inttypes.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <glib.h>
 #include "trace.h"
 #include "tables.h"
 #include "pp_resource.h"
+#include "timer_heap.h"
+#include "mpsc_queue.h"
+#include "message_loop_stats.h"
+#include "config.h"
+#include "eintr_retry.h"
 
 
+#define MAX_EPOLL_EVENTS    16
+#define TASK_CACHE_SIZE     64
+#define STATS_TOP_N         20
+
+struct message_loop_task_s {
+    struct mpsc_node_s              node;   ///< must be the first
+    struct timespec                 when;
+    int                             terminate;
+    int                             depth;
+    struct PP_CompletionCallback    ccb;
+    int32_t                         result_to_pass;
+    PP_Bool                         should_destroy_ml;
+    uint64_t                        posted;     ///< monotonic ns, for stats
+};
+
+struct message_loop_fd_watch_s {
+    int                             fd;
+    ppb_message_loop_fd_callback    cb;
+    void                           *user_data;
+};
+
 static __thread PP_Resource this_thread_message_loop = 0;
 static __thread int         thread_is_not_suitable_for_message_loop = 0;
 static          PP_Resource main_thread_message_loop = 0;
 static          PP_Resource browser_thread_message_loop = 0;
 
+// Freed tasks are kept in a small per-thread cache, linked through node.next. Tasks are allocated
+// by posting threads and freed by loop threads, but most threads do both.
+static __thread struct message_loop_task_s *task_cache = NULL;
+static __thread unsigned int                task_cache_len = 0;
+
+static
+struct message_loop_task_s *
+task_alloc(void)
+{
+    struct message_loop_task_s *task = task_cache;
+    if (!task)
+        return g_slice_alloc0(sizeof(*task));
+
+    task_cache = (struct message_loop_task_s *)task->node.next;
+    task_cache_len --;
+    memset(task, 0, sizeof(*task));
+    return task;
+}
+
+static
+void
+task_free(struct message_loop_task_s *task)
+{
+    if (task_cache_len >= TASK_CACHE_SIZE) {
+        g_slice_free(struct message_loop_task_s, task);
+        return;
+    }
+
+    task->node.next = (struct mpsc_node_s *)task_cache;
+    task_cache = task;
+    task_cache_len ++;
+}
+
+static inline
+uint64_t
+timespec_to_ns(struct timespec t)
+{
+    return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
 
 PP_Resource
 ppb_message_loop_create(PP_Instance instance)
@@ -54,12 +124,38 @@ ppb_message_loop_create(PP_Instance instance)
         return 0;
     }
 
-    ml->async_q = g_async_queue_new();
-    ml->int_q = g_queue_new();
+    ml->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    ml->wakeup_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (ml->epoll_fd < 0 || ml->wakeup_fd < 0) {
+        trace_error("%s, can't create epoll or eventfd descriptor\n", __func__);
+        goto err;
+    }
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = ml->wakeup_fd };
+    if (epoll_ctl(ml->epoll_fd, EPOLL_CTL_ADD, ml->wakeup_fd, &ev) != 0) {
+        trace_error("%s, can't add eventfd to epoll set\n", __func__);
+        goto err;
+    }
+
+    ml->task_q = mpsc_queue_new();
+    ml->int_q = timer_heap_new();
+    ml->parked = g_ptr_array_new();
+    ml->fd_watches = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+    if (config.message_loop_stats || config.message_loop_slow_task_ms > 0)
+        ml->stats = message_loop_stats_new();
     ml->depth = 1;
 
     pp_resource_release(message_loop);
     return message_loop;
+
+err:
+    if (ml->epoll_fd >= 0)
+        close(ml->epoll_fd);
+    if (ml->wakeup_fd >= 0)
+        close(ml->wakeup_fd);
+    pp_resource_release(message_loop);
+    pp_resource_expunge(message_loop);
+    return 0;
 }
 
 void
@@ -67,15 +163,50 @@ ppb_message_loop_destroy(void *p)
 {
     struct pp_message_loop_s *ml = p;
 
-    if (ml->async_q) {
-        g_async_queue_unref(ml->async_q);
-        ml->async_q = NULL;
+    if (ml->epoll_fd >= 0) {
+        close(ml->epoll_fd);
+        ml->epoll_fd = -1;
+    }
+
+    if (ml->wakeup_fd >= 0) {
+        close(ml->wakeup_fd);
+        ml->wakeup_fd = -1;
+    }
+
+    if (ml->fd_watches) {
+        g_hash_table_destroy(ml->fd_watches);
+        ml->fd_watches = NULL;
+    }
+
+    if (ml->stats) {
+        if (config.message_loop_stats)
+            message_loop_stats_report(ml->stats, ml->self_id, STATS_TOP_N);
+        message_loop_stats_free(ml->stats);
+        ml->stats = NULL;
+    }
+
+    if (ml->task_q) {
+        struct mpsc_node_s *node;
+        while ((node = mpsc_queue_pop(ml->task_q)) != NULL)
+            task_free((struct message_loop_task_s *)node);
+        mpsc_queue_free(ml->task_q);
+        ml->task_q = NULL;
     }
 
     if (ml->int_q) {
-        g_queue_free(ml->int_q);
+        timer_heap_free(ml->int_q);
         ml->int_q = NULL;
     }
+
+    if (ml->parked) {
+        for (guint k = 0; k < ml->parked->len; k ++) {
+            GQueue *q = g_ptr_array_index(ml->parked, k);
+            if (q)
+                g_queue_free(q);
+        }
+        g_ptr_array_free(ml->parked, TRUE);
+        ml->parked = NULL;
+    }
 }
 
 PP_Resource
@@ -162,33 +293,6 @@ ppb_message_loop_attach_to_current_thread(PP_Resource message_loop)
     return PP_OK;
 }
 
-struct message_loop_task_s {
-    struct timespec                 when;
-    int                             terminate;
-    int                             depth;
-    struct PP_CompletionCallback    ccb;
-    int32_t                         result_to_pass;
-    PP_Bool                         should_destroy_ml;
-};
-
-static gint
-time_compare_func(gconstpointer a, gconstpointer b, gpointer user_data)
-{
-    const struct message_loop_task_s *task_a = a;
-    const struct message_loop_task_s *task_b = b;
-
-    if (task_a->when.tv_sec < task_b->when.tv_sec)
-        return -1;
-    else if (task_a->when.tv_sec > task_b->when.tv_sec)
-        return 1;
-    else if (task_a->when.tv_nsec < task_b->when.tv_nsec)
-        return -1;
-    else if (task_a->when.tv_nsec > task_b->when.tv_nsec)
-        return 1;
-    else
-        return 0;
-}
-
 int32_t
 ppb_message_loop_run(PP_Resource message_loop)
 {
@@ -201,18 +305,103 @@ ppb_message_loop_run_nested(PP_Resource message_loop)
     return ppb_message_loop_run_int(message_loop, 1, 1);
 }
 
+// Tasks which are due, but belong to an outer loop, are parked in a FIFO queue of their depth.
 static
-struct timespec
-add_ms(struct timespec t, unsigned int ms)
+void
+park_task(GPtrArray *parked, struct message_loop_task_s *task)
 {
-    t.tv_sec += ms / 1000;
-    t.tv_nsec += (ms % 1000) * 1000 * 1000;
-    if (t.tv_nsec > 1000 * 1000 * 1000) {
-        t.tv_sec += 1;
-        t.tv_nsec -= 1000 * 1000 * 1000;
+    if ((guint)task->depth >= parked->len)
+        g_ptr_array_set_size(parked, task->depth + 1);
+
+    GQueue *q = g_ptr_array_index(parked, task->depth);
+    if (!q) {
+        q = g_queue_new();
+        g_ptr_array_index(parked, task->depth) = q;
     }
 
-    return t;
+    g_queue_push_tail(q, task);
+}
+
+// Once loop of a given depth is running, tasks of that depth and deeper are runnable again.
+// They are returned to the heap with their original deadlines, which are already in the past.
+static
+void
+unpark_tasks(GPtrArray *parked, struct timer_heap_s *int_q, int depth)
+{
+    for (guint k = depth; k < parked->len; k ++) {
+        GQueue *q = g_ptr_array_index(parked, k);
+        if (!q)
+            continue;
+
+        struct message_loop_task_s *task;
+        while ((task = g_queue_pop_head(q)) != NULL)
+            timer_heap_push(int_q, task->when, task);
+    }
+}
+
+static
+void
+dispatch_fd_event(PP_Resource message_loop, int fd, uint32_t events)
+{
+    struct pp_message_loop_s *ml = pp_resource_acquire(message_loop, PP_RESOURCE_MESSAGE_LOOP);
+    if (!ml)
+        return;
+
+    struct message_loop_fd_watch_s *w = g_hash_table_lookup(ml->fd_watches, GINT_TO_POINTER(fd));
+    struct message_loop_fd_watch_s watch = {};
+    if (w)
+        watch = *w;
+    pp_resource_release(message_loop);
+
+    // watch may have been removed after epoll_wait() returned
+    if (watch.cb)
+        watch.cb(fd, events, watch.user_data);
+}
+
+// Sleeps until a task is posted, a watched fd becomes ready, or |timeout_ms| passes. Posted
+// tasks are moved to the heap.
+static
+void
+wait_for_events(PP_Resource message_loop, int epoll_fd, int wakeup_fd,
+                struct mpsc_queue_s *task_q, struct timer_heap_s *int_q, int timeout_ms)
+{
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    int n = epoll_wait(epoll_fd, events, MAX_EPOLL_EVENTS, timeout_ms);
+    if (n < 0) {
+        // on EINTR caller recalculates timeout and comes back
+        if (errno != EINTR)
+            trace_error("%s, epoll_wait failed\n", __func__);
+        return;
+    }
+
+    for (int k = 0; k < n; k ++) {
+        if (events[k].data.fd != wakeup_fd) {
+            dispatch_fd_event(message_loop, events[k].data.fd, events[k].events);
+            continue;
+        }
+
+        // reset counter before draining the queue, so a task pushed concurrently is either
+        // drained now, or signals eventfd again
+        uint64_t cnt;
+        ssize_t ret = RETRY_ON_EINTR(read(wakeup_fd, &cnt, sizeof(cnt)));
+        (void)ret;  // EAGAIN means someone else has already reset it
+
+        struct mpsc_node_s *node;
+        while ((node = mpsc_queue_pop(task_q)) != NULL) {
+            struct message_loop_task_s *task = (struct message_loop_task_s *)node;
+            timer_heap_push(int_q, task->when, task);
+        }
+    }
+}
+
+static
+void
+wake_up_loop(struct pp_message_loop_s *ml)
+{
+    // write can fail only if counter is about to overflow, loop is awake in that case anyway
+    const uint64_t one = 1;
+    ssize_t ret = RETRY_ON_EINTR(write(ml->wakeup_fd, &one, sizeof(one)));
+    (void)ret;
 }
 
 int32_t
@@ -253,34 +442,39 @@ ppb_message_loop_run_int(PP_Resource message_loop, int nested, int increase_dept
     int destroy_ml = 0;
     int depth = ml->depth;
     pp_resource_ref(message_loop);
-    GAsyncQueue *async_q = ml->async_q;
-    GQueue *int_q = ml->int_q;
+    struct mpsc_queue_s *task_q = ml->task_q;
+    struct timer_heap_s *int_q = ml->int_q;
+    GPtrArray *parked = ml->parked;
+    int epoll_fd = ml->epoll_fd;
+    int wakeup_fd = ml->wakeup_fd;
+    struct message_loop_stats_s *stats = ml->stats;
     pp_resource_release(message_loop);
 
+    unpark_tasks(parked, int_q, depth);
+
     while (1) {
         struct timespec now;
-        struct message_loop_task_s *task = g_queue_peek_head(int_q);
-        gint64 timeout = 1000 * 1000;
+        struct message_loop_task_s *task = timer_heap_peek(int_q, NULL);
+        gint64 timeout = -1;
         if (task) {
-            clock_gettime(CLOCK_REALTIME, &now);
+            clock_gettime(CLOCK_MONOTONIC, &now);
             timeout = (task->when.tv_sec - now.tv_sec) * 1000 * 1000 +
                       (task->when.tv_nsec - now.tv_nsec) / 1000;
             if (timeout <= 0) {
                 // remove task from the queue
-                g_queue_pop_head(int_q);
+                timer_heap_pop(int_q);
 
                 // check if depth is correct
                 if (task->depth > 0 && task->depth < depth) {
-                    // wrong, reschedule it a bit later
-                    task->when = add_ms(now, 10);
-                    g_queue_insert_sorted(int_q, task, time_compare_func, NULL);
+                    // wrong, keep it until outer loop gets control back
+                    park_task(parked, task);
                     continue;
                 }
 
                 if (task->terminate) {
                     if (depth > 1) {
                         // exit at once, all remaining task will be processed by outer loop
-                        g_slice_free(struct message_loop_task_s, task);
+                        task_free(task);
                         break;
                     }
 
@@ -293,7 +487,7 @@ ppb_message_loop_run_int(PP_Resource message_loop, int nested, int increase_dept
                         pp_resource_release(message_loop);
                     }
 
-                    g_slice_free(struct message_loop_task_s, task);
+                    task_free(task);
                     continue;
                 }
 
@@ -301,10 +495,22 @@ ppb_message_loop_run_int(PP_Resource message_loop, int nested, int increase_dept
                 const struct PP_CompletionCallback ccb = task->ccb;
                 if (ccb.func) {
                     ccb.func(ccb.user_data, task->result_to_pass);
+
+                    if (stats) {
+                        struct timespec done;
+                        clock_gettime(CLOCK_MONOTONIC, &done);
+                        message_loop_stats_record(stats, ccb.func, task->posted,
+                                                  timespec_to_ns(task->when),
+                                                  timespec_to_ns(now),
+                                                  timespec_to_ns(done) - timespec_to_ns(now));
+                    }
+
+                    // callback may have run nested loops which parked tasks of this depth
+                    unpark_tasks(parked, int_q, depth);
                 }
 
                 // free task
-                g_slice_free(struct message_loop_task_s, task);
+                task_free(task);
                 continue;   // run cycle again
             }
         } else if (teardown) {
@@ -312,9 +518,12 @@ ppb_message_loop_run_int(PP_Resource message_loop, int nested, int increase_dept
             break;
         }
 
-        task = g_async_queue_timeout_pop(async_q, timeout);
-        if (task)
-            g_queue_insert_sorted(int_q, task, time_compare_func, NULL);
+        // no idle wakeups: without pending tasks, sleep until something is posted or fd fires
+        const int timeout_ms = (timeout < 0) ? -1 : (int)MIN((timeout + 999) / 1000, G_MAXINT);
+        wait_for_events(message_loop, epoll_fd, wakeup_fd, task_q, int_q, timeout_ms);
+
+        // fd callbacks may have run nested loops too
+        unpark_tasks(parked, int_q, depth);
     }
 
     // mark thread as non-running
@@ -336,13 +545,19 @@ ppb_message_loop_run_int(PP_Resource message_loop, int nested, int increase_dept
 }
 
 int32_t
-ppb_message_loop_post_work_with_result(PP_Resource message_loop,
-                                       struct PP_CompletionCallback callback, int64_t delay_ms,
-                                       int32_t result_to_pass, int depth)
+ppb_message_loop_post_work_batch(PP_Resource message_loop,
+                                 const struct PP_CompletionCallback *callbacks,
+                                 const int32_t *results, unsigned int count, int64_t delay_ms,
+                                 int depth)
 {
-    if (callback.func == NULL) {
-        trace_error("%s, callback.func == NULL\n", __func__);
-        return PP_ERROR_BADARGUMENT;
+    if (count == 0)
+        return PP_OK;
+
+    for (unsigned int k = 0; k < count; k ++) {
+        if (callbacks[k].func == NULL) {
+            trace_error("%s, callback.func == NULL\n", __func__);
+            return PP_ERROR_BADARGUMENT;
+        }
     }
 
     struct pp_message_loop_s *ml = pp_resource_acquire(message_loop, PP_RESOURCE_MESSAGE_LOOP);
@@ -358,26 +573,50 @@ ppb_message_loop_post_work_with_result(PP_Resource message_loop,
         return PP_ERROR_FAILED;
     }
 
-    struct message_loop_task_s *task = g_slice_alloc0(sizeof(*task));
-
-    task->result_to_pass = result_to_pass;
-    task->ccb = callback;
-    task->depth = depth;
+    // calculate absolute time callbacks should be run at
+    struct timespec when;
+    clock_gettime(CLOCK_MONOTONIC, &when);
+    const uint64_t posted = timespec_to_ns(when);
+    when.tv_sec += delay_ms / 1000;
+    when.tv_nsec += (delay_ms % 1000) * 1000 * 1000;
+    while (when.tv_nsec >= 1000 * 1000 * 1000) {
+        when.tv_sec += 1;
+        when.tv_nsec -= 1000 * 1000 * 1000;
+    }
 
-    // calculate absolute time callback should be run at
-    clock_gettime(CLOCK_REALTIME, &task->when);
-    task->when.tv_sec += delay_ms / 1000;
-    task->when.tv_nsec += (delay_ms % 1000) * 1000 * 1000;
-    while (task->when.tv_nsec >= 1000 * 1000 * 1000) {
-        task->when.tv_sec += 1;
-        task->when.tv_nsec -= 1000 * 1000 * 1000;
+    struct message_loop_task_s *first = NULL;
+    struct message_loop_task_s *last = NULL;
+    for (unsigned int k = 0; k < count; k ++) {
+        struct message_loop_task_s *task = task_alloc();
+
+        task->result_to_pass = results[k];
+        task->ccb = callbacks[k];
+        task->depth = depth;
+        task->when = when;
+        task->posted = posted;
+
+        if (last)
+            last->node.next = &task->node;
+        else
+            first = task;
+        last = task;
     }
 
-    g_async_queue_push(ml->async_q, task);
+    mpsc_queue_push_chain(ml->task_q, &first->node, &last->node);
+    wake_up_loop(ml);
     pp_resource_release(message_loop);
     return PP_OK;
 }
 
+int32_t
+ppb_message_loop_post_work_with_result(PP_Resource message_loop,
+                                       struct PP_CompletionCallback callback, int64_t delay_ms,
+                                       int32_t result_to_pass, int depth)
+{
+    return ppb_message_loop_post_work_batch(message_loop, &callback, &result_to_pass, 1, delay_ms,
+                                            depth);
+}
+
 int32_t
 ppb_message_loop_post_work(PP_Resource message_loop, struct PP_CompletionCallback callback,
                            int64_t delay_ms)
@@ -394,16 +633,18 @@ ppb_message_loop_post_quit_depth(PP_Resource message_loop, PP_Bool should_destro
         return PP_ERROR_BADRESOURCE;
     }
 
-    struct message_loop_task_s *task = g_slice_alloc0(sizeof(*task));
+    struct message_loop_task_s *task = task_alloc();
 
     task->terminate = 1;
     task->depth = depth;
     task->should_destroy_ml = should_destroy;
     task->result_to_pass = PP_OK;
 
-    clock_gettime(CLOCK_REALTIME, &task->when); // run as early as possible
+    clock_gettime(CLOCK_MONOTONIC, &task->when); // run as early as possible
+    task->posted = timespec_to_ns(task->when);
 
-    g_async_queue_push(ml->async_q, task);
+    mpsc_queue_push(ml->task_q, &task->node);
+    wake_up_loop(ml);
     pp_resource_release(message_loop);
     return PP_OK;
 }
@@ -415,6 +656,72 @@ ppb_message_loop_post_quit(PP_Resource message_loop, PP_Bool should_destroy)
     return ppb_message_loop_post_quit_depth(message_loop, should_destroy, depth);
 }
 
+void
+ppb_message_loop_report_stats(PP_Resource message_loop)
+{
+    if (!config.message_loop_stats)
+        return;
+
+    struct pp_message_loop_s *ml = pp_resource_acquire(message_loop, PP_RESOURCE_MESSAGE_LOOP);
+    if (!ml)
+        return;
+
+    message_loop_stats_report(ml->stats, message_loop, STATS_TOP_N);
+    pp_resource_release(message_loop);
+}
+
+int32_t
+ppb_message_loop_watch_fd(PP_Resource message_loop, int fd, uint32_t events,
+                          ppb_message_loop_fd_callback cb, void *user_data)
+{
+    if (fd < 0 || !cb) {
+        trace_error("%s, bad arguments\n", __func__);
+        return PP_ERROR_BADARGUMENT;
+    }
+
+    struct pp_message_loop_s *ml = pp_resource_acquire(message_loop, PP_RESOURCE_MESSAGE_LOOP);
+    if (!ml) {
+        trace_error("%s, bad resource\n", __func__);
+        return PP_ERROR_BADRESOURCE;
+    }
+
+    const int exists = g_hash_table_lookup(ml->fd_watches, GINT_TO_POINTER(fd)) != NULL;
+    struct epoll_event ev = { .events = events, .data.fd = fd };
+    if (epoll_ctl(ml->epoll_fd, exists ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev) != 0) {
+        trace_error("%s, epoll_ctl failed for fd %d\n", __func__, fd);
+        pp_resource_release(message_loop);
+        return PP_ERROR_FAILED;
+    }
+
+    struct message_loop_fd_watch_s *w = g_malloc0(sizeof(*w));
+    w->fd = fd;
+    w->cb = cb;
+    w->user_data = user_data;
+    g_hash_table_replace(ml->fd_watches, GINT_TO_POINTER(fd), w);
+
+    pp_resource_release(message_loop);
+    return PP_OK;
+}
+
+int32_t
+ppb_message_loop_unwatch_fd(PP_Resource message_loop, int fd)
+{
+    struct pp_message_loop_s *ml = pp_resource_acquire(message_loop, PP_RESOURCE_MESSAGE_LOOP);
+    if (!ml) {
+        trace_error("%s, bad resource\n", __func__);
+        return PP_ERROR_BADRESOURCE;
+    }
+
+    if (!g_hash_table_remove(ml->fd_watches, GINT_TO_POINTER(fd))) {
+        pp_resource_release(message_loop);
+        return PP_ERROR_BADARGUMENT;
+    }
+
+    epoll_ctl(ml->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    pp_resource_release(message_loop);
+    return PP_OK;
+}
+
 
 // trace wrappers
 TRACE_WRAPPER
@@ -26,6 +26,12 @@
 #define FPP_PPB_MESSAGE_LOOP_H
 
 #include <ppapi/c/ppb_message_loop.h>
+#include <stdint.h>
+
+
+/// called on the loop thread when watched file descriptor becomes ready; |events| is a set of
+/// EPOLL* flags
+typedef void (*ppb_message_loop_fd_callback)(int fd, uint32_t events, void *user_data);
 
 
 PP_Resource
@@ -69,6 +75,14 @@ ppb_message_loop_post_work_with_result(PP_Resource message_loop,
                                        struct PP_CompletionCallback callback, int64_t delay_ms,
                                        int32_t result_to_pass, int depth);
 
+/// posts |count| callbacks with the same delay and depth at once, |callbacks[k]| gets
+/// |results[k]|. Callbacks run in order they are listed; loop is woken up only once
+int32_t
+ppb_message_loop_post_work_batch(PP_Resource message_loop,
+                                 const struct PP_CompletionCallback *callbacks,
+                                 const int32_t *results, unsigned int count, int64_t delay_ms,
+                                 int depth);
+
 int32_t
 ppb_message_loop_post_work(PP_Resource message_loop, struct PP_CompletionCallback callback,
                            int64_t delay_ms);
@@ -82,4 +96,20 @@ ppb_message_loop_post_quit_depth(PP_Resource message_loop, PP_Bool should_destro
 void
 ppb_message_loop_mark_thread_unsuitable(void);
 
+/// prints task timing report if message_loop_stats is enabled in config
+void
+ppb_message_loop_report_stats(PP_Resource message_loop);
+
+/// make |message_loop| wait for |events| (EPOLLIN, EPOLLOUT, ...) on |fd| in addition to tasks.
+/// Callback is called from the loop at any nesting depth until the watch is removed. Watches are
+/// level-triggered, so callback should consume the condition it was woken for.
+int32_t
+ppb_message_loop_watch_fd(PP_Resource message_loop, int fd, uint32_t events,
+                          ppb_message_loop_fd_callback cb, void *user_data);
+
+/// stop watching |fd|. Once the function returns, callback for |fd| won't be called again
+/// unless it's already running on the loop thread.
+int32_t
+ppb_message_loop_unwatch_fd(PP_Resource message_loop, int fd);
+
 #endif // FPP_PPB_MESSAGE_LOOP_H
@@ -24,32 +24,511 @@
 
 #include "ppb_opengles2.h"
 #include <stdlib.h>
+#include <string.h>
 #include "trace.h"
 #include "tables.h"
 #include "pp_resource.h"
 #include "reverse_constant.h"
+#include "gl_cmd_buffer.h"
+#include "staging_pool.h"
+#include "gl_shadow_state.h"
+#include "gl_profiler.h"
+#include "gl_program_cache.h"
+#include "config.h"
 
 
+// Each entry point has |prof| record on stack, which is accounted by epilogues if profiler is
+// enabled. Calls may set prof.e to group statistics by enum argument, and prof.bytes to amount
+// of client memory uploaded.
 #define PROLOGUE(g3d, escape_statement)                                                 \
+    struct gl_profiler_call_s prof;                                                     \
+    gl_profiler_begin(&prof);                                                           \
     struct pp_graphics3d_s *g3d = pp_resource_acquire(context, PP_RESOURCE_GRAPHICS3D); \
     if (!g3d) {                                                                         \
         trace_error("%s, bad resource\n", __func__);                                    \
         escape_statement;                                                               \
     }                                                                                   \
+    prof.instance = g3d->instance->id;                                                  \
+    if (g3d->cmd_buffer)                                                                \
+        gl_cmd_buffer_sync(g3d->cmd_buffer);                                            \
     pthread_mutex_lock(&display.lock);                                                  \
     eglMakeCurrent(display.egl, g3d->egl_surf, g3d->egl_surf, g3d->glc)
 
 #define EPILOGUE()                                                                      \
     eglMakeCurrent(display.egl, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);        \
     pthread_mutex_unlock(&display.lock);                                                \
-    pp_resource_release(context)
+    pp_resource_release(context);                                                       \
+    gl_profiler_end(context, __func__, &prof)
+
+// Calls that return nothing are recorded into context command buffer, if there is one, and
+// later replayed by GL thread. If command can't be recorded, all previously recorded commands
+// are waited for, and call is executed immediately, the same way PROLOGUE/EPILOGUE do.
+// |payload_size| is evaluated only if command buffer exists, so it may refer to g3d->cmd_buffer.
+#define DEFERRED_PROLOGUE(g3d, cmd, op, payload_size)                                   \
+    ACQUIRE_G3D(g3d);                                                                   \
+    DEFERRED_BEGIN(g3d, cmd, op, payload_size)
+
+#define ACQUIRE_G3D(g3d)                                                                \
+    struct gl_profiler_call_s prof;                                                     \
+    gl_profiler_begin(&prof);                                                           \
+    struct pp_graphics3d_s *g3d = pp_resource_acquire(context, PP_RESOURCE_GRAPHICS3D); \
+    if (!g3d) {                                                                         \
+        trace_error("%s, bad resource\n", __func__);                                    \
+        return;                                                                         \
+    }                                                                                   \
+    prof.instance = g3d->instance->id
+
+#define DEFERRED_BEGIN(g3d, cmd, op, payload_size)                                      \
+    struct gl_cmd_s *cmd = NULL;                                                        \
+    if (g3d->cmd_buffer) {                                                              \
+        cmd = gl_cmd_buffer_alloc(g3d->cmd_buffer, op, payload_size);                   \
+        if (!cmd)                                                                       \
+            gl_cmd_buffer_sync(g3d->cmd_buffer);                                        \
+    }                                                                                   \
+    if (!cmd) {                                                                         \
+        pthread_mutex_lock(&display.lock);                                              \
+        eglMakeCurrent(display.egl, g3d->egl_surf, g3d->egl_surf, g3d->glc);            \
+    }
+
+#define DEFERRED_EPILOGUE(g3d, cmd)                                                     \
+    if (cmd) {                                                                          \
+        gl_cmd_buffer_commit(g3d->cmd_buffer, cmd);                                     \
+    } else {                                                                            \
+        eglMakeCurrent(display.egl, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);    \
+        pthread_mutex_unlock(&display.lock);                                            \
+    }                                                                                   \
+    pp_resource_release(context);                                                       \
+    gl_profiler_end(context, __func__, &prof)
+
+// Drops a call which would set shadowed state to the value it already has. In checking mode,
+// shadow is compared against driver state first.
+#define SHADOW_SKIP_IF(g3d, unchanged)                                                  \
+    if (unchanged) {                                                                    \
+        if (config.gl_shadow_state_check)                                               \
+            shadow_state_check(g3d, __func__);                                          \
+        pp_resource_release(context);                                                   \
+        gl_profiler_end(context, __func__, &prof);                                      \
+        return;                                                                         \
+    }
+
+
+static
+void
+shadow_state_check(struct pp_graphics3d_s *g3d, const char *caller)
+{
+    if (g3d->cmd_buffer)
+        gl_cmd_buffer_sync(g3d->cmd_buffer);
+    pthread_mutex_lock(&display.lock);
+    eglMakeCurrent(display.egl, g3d->egl_surf, g3d->egl_surf, g3d->glc);
+    gl_shadow_state_verify(&g3d->shadow, caller);
+    eglMakeCurrent(display.egl, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    pthread_mutex_unlock(&display.lock);
+}
+
+// Shaders and programs are tracked to avoid compiling and linking programs which binaries are
+// in on-disk cache. CompileShader only marks shader as pending; actual compilation happens
+// when result is needed: on cache miss in LinkProgram, or when shader is queried.
+// Contexts of share groups bypass tracking, as their objects may be used by other contexts.
+struct shader_info_s {
+    GLenum      type;
+    char       *source;             ///< last source set by ShaderSource
+    char       *compiled_source;    ///< source at the time of last CompileShader
+    int         compile_pending;    ///< GL source equals compiled_source, but isn't compiled
+    int         attach_count;
+    int         deleted;
+};
+
+struct program_info_s {
+    GLuint      vertex_shader;
+    GLuint      fragment_shader;
+    GString    *attrib_bindings;    ///< BindAttribLocation calls, affect link result
+    int         linked;             ///< last LinkProgram succeeded
+};
+
+// binary produced by link, to be stored after display.lock is released
+struct program_binary_s {
+    char        key[GL_PROGRAM_CACHE_KEY_LEN + 1];
+    GLenum      format;
+    void       *data;
+    GLsizei     size;
+};
+
+// accessed with display.lock held, except |cache| which is never changed after initialization,
+// and |pending_markers| which is written to disk after display.lock is released
+static struct {
+    int                             initialized;
+    struct gl_program_cache_s      *cache;
+    char                           *driver_id;  ///< vendor, renderer and version strings
+    PFNGLGETPROGRAMBINARYOESPROC    GetProgramBinary;
+    PFNGLPROGRAMBINARYOESPROC       ProgramBinary;
+    GHashTable                     *known_markers;  ///< keys of markers known to be on disk
+    GSList                         *pending_markers;    ///< keys to store, protected by
+                                                        ///< |markers_lock|
+    pthread_mutex_t                 markers_lock;
+} binary_cache = {
+    .markers_lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+
+static
+void
+shader_info_free(gpointer p)
+{
+    struct shader_info_s *si = p;
+    g_free(si->source);
+    g_free(si->compiled_source);
+    g_slice_free(struct shader_info_s, si);
+}
+
+static
+void
+program_info_free(gpointer p)
+{
+    struct program_info_s *pi = p;
+    g_string_free(pi->attrib_bindings, TRUE);
+    g_slice_free(struct program_info_s, pi);
+}
+
+// Shadow is updated before the call is made, and result of the call is not known then. So
+// only arguments driver surely accepts are recorded; for others binding becomes unknown.
+// Members of share groups may see objects created or changed by other contexts, so nothing
+// is assumed about them.
+
+// texture can be bound to the target it was bound to first, or to any if it's new
+static
+int
+texture_binding_valid(struct pp_graphics3d_s *g3d, GLenum target, GLuint texture)
+{
+    if (texture == 0)
+        return 1;
+    if (target != GL_TEXTURE_2D && target != GL_TEXTURE_CUBE_MAP)
+        return 0;
+    if (g3d->share_group)
+        return 0;
+
+    // names from GenTextures are stored with zero target until first bound
+    GLenum known = GPOINTER_TO_UINT(g_hash_table_lookup(g3d->texture_targets,
+                                                        GUINT_TO_POINTER(texture)));
+    if (known != 0)
+        return known == target;
+
+    g_hash_table_insert(g3d->texture_targets, GUINT_TO_POINTER(texture),
+                        GUINT_TO_POINTER(target));
+    return 1;
+}
+
+// in GLES2 any name can be bound to any buffer target. In share groups, name may refer to
+// an object another context deleted, and binding still holds the old one
+static
+int
+buffer_binding_valid(struct pp_graphics3d_s *g3d, GLuint buffer)
+{
+    return buffer == 0 || !g3d->share_group;
+}
+
+// program which link failed, or not linked yet, can't be made current
+static
+int
+program_usable(struct pp_graphics3d_s *g3d, GLuint program)
+{
+    if (program == 0)
+        return 1;
+    if (g3d->share_group)
+        return 0;
+
+    struct program_info_s *pi = g_hash_table_lookup(g3d->programs, GUINT_TO_POINTER(program));
+    return pi && pi->linked;
+}
+
+// Every object name plugin gets or binds is remembered, so objects can be deleted before
+// context is pooled; binding an unused name creates an object too.
+static
+void
+track_names(GHashTable *names, GLsizei n, const GLuint *list)
+{
+    for (GLsizei k = 0; k < n; k ++) {
+        if (list[k] != 0)
+            g_hash_table_add(names, GUINT_TO_POINTER(list[k]));
+    }
+}
+
+static
+void
+untrack_names(GHashTable *names, GLsizei n, const GLuint *list)
+{
+    for (GLsizei k = 0; k < n; k ++)
+        g_hash_table_remove(names, GUINT_TO_POINTER(list[k]));
+}
+
+static
+void
+delete_names(GHashTable *names, void (*delete_func)(GLsizei n, const GLuint *list))
+{
+    GHashTableIter iter;
+    gpointer key;
+    GLuint list[256];
+    GLsizei n = 0;
+
+    g_hash_table_iter_init(&iter, names);
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+        list[n++] = GPOINTER_TO_UINT(key);
+        if (n == sizeof(list) / sizeof(list[0])) {
+            delete_func(n, list);
+            n = 0;
+        }
+    }
+    if (n > 0)
+        delete_func(n, list);
+    g_hash_table_remove_all(names);
+}
+
+// must be called with display.lock held and context current
+static
+void
+binary_cache_initialize(void)
+{
+    if (binary_cache.initialized)
+        return;
+    binary_cache.initialized = 1;
+
+    if (config.gl_program_cache_mb <= 0)
+        return;
+
+    const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+    GLint format_count = 0;
+    if (!extensions || !strstr(extensions, "GL_OES_get_program_binary"))
+        return;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &format_count);
+    if (format_count <= 0)
+        return;
+
+    binary_cache.GetProgramBinary = (void *)eglGetProcAddress("glGetProgramBinaryOES");
+    binary_cache.ProgramBinary = (void *)eglGetProcAddress("glProgramBinaryOES");
+    if (!binary_cache.GetProgramBinary || !binary_cache.ProgramBinary)
+        return;
+
+    binary_cache.driver_id = g_strdup_printf("%s\n%s\n%s", glGetString(GL_VENDOR),
+                                             glGetString(GL_RENDERER), glGetString(GL_VERSION));
+
+    char *dir = g_strdup_printf("%s/gl_program_cache", fpp_config_get_pepper_data_dir());
+    binary_cache.cache = gl_program_cache_open(dir, (size_t)config.gl_program_cache_mb << 20);
+    binary_cache.known_markers = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    g_free(dir);
+}
+
+static
+int
+binary_cache_enabled(struct pp_graphics3d_s *g3d)
+{
+    binary_cache_initialize();
+    return binary_cache.cache && !g3d->share_group;
+}
+
+// key of an empty entry which marks shader source as successfully compiled before
+static
+void
+shader_marker_key(char *key, const struct shader_info_s *si)
+{
+    const char *type = (si->type == GL_VERTEX_SHADER) ? "vertex" : "fragment";
+    const char *parts[] = { "shader", binary_cache.driver_id, type, si->compiled_source, NULL };
+    gl_program_cache_key(key, parts);
+}
+
+// checks for marker of successful compilation. Positive answers are remembered, so disk is
+// consulted once per source
+static
+int
+shader_marker_exists(const char *key)
+{
+    if (g_hash_table_contains(binary_cache.known_markers, key))
+        return 1;
+    if (!gl_program_cache_contains(binary_cache.cache, key))
+        return 0;
+    g_hash_table_add(binary_cache.known_markers, g_strdup(key));
+    return 1;
+}
+
+// marker is stored later by binary_cache_flush_markers(), as writing to disk is too slow to
+// be done under display.lock
+static
+void
+queue_shader_marker(const struct shader_info_s *si)
+{
+    char key[GL_PROGRAM_CACHE_KEY_LEN + 1];
+
+    shader_marker_key(key, si);
+    if (g_hash_table_contains(binary_cache.known_markers, key))
+        return;
+    g_hash_table_add(binary_cache.known_markers, g_strdup(key));
+
+    pthread_mutex_lock(&binary_cache.markers_lock);
+    binary_cache.pending_markers = g_slist_prepend(binary_cache.pending_markers, g_strdup(key));
+    pthread_mutex_unlock(&binary_cache.markers_lock);
+}
+
+// must be called without display.lock held
+static
+void
+binary_cache_flush_markers(void)
+{
+    pthread_mutex_lock(&binary_cache.markers_lock);
+    GSList *pending = binary_cache.pending_markers;
+    binary_cache.pending_markers = NULL;
+    pthread_mutex_unlock(&binary_cache.markers_lock);
+
+    for (GSList *l = pending; l != NULL; l = l->next) {
+        // marker may be there from previous sessions
+        if (!gl_program_cache_contains(binary_cache.cache, l->data))
+            gl_program_cache_store(binary_cache.cache, l->data, 0, "", 0);
+    }
+    g_slist_free_full(pending, g_free);
+}
+
+static
+void
+ensure_compiled(struct shader_info_s *si, GLuint shader)
+{
+    if (!si || !si->compile_pending)
+        return;
+
+    si->compile_pending = 0;
+    glCompileShader(shader);
+
+    GLint status = GL_FALSE;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (status && binary_cache.cache)
+        queue_shader_marker(si);
+}
+
+static
+void
+shader_info_unref(struct pp_graphics3d_s *g3d, GLuint shader, struct shader_info_s *si)
+{
+    si->attach_count --;
+    if (si->deleted && si->attach_count <= 0)
+        g_hash_table_remove(g3d->shaders, GUINT_TO_POINTER(shader));
+}
+
+// links program, taking binary from cache if possible. If binary was missing, it's
+// returned in |bin| for storing
+static
+void
+link_program(struct pp_graphics3d_s *g3d, GLuint program, struct program_info_s *pi,
+             struct program_binary_s *bin)
+{
+    struct shader_info_s *vs = g_hash_table_lookup(g3d->shaders,
+                                                   GUINT_TO_POINTER(pi->vertex_shader));
+    struct shader_info_s *fs = g_hash_table_lookup(g3d->shaders,
+                                                   GUINT_TO_POINTER(pi->fragment_shader));
+
+    if (!binary_cache_enabled(g3d) || !vs || !fs || !vs->compiled_source ||
+        !fs->compiled_source)
+    {
+        ensure_compiled(vs, pi->vertex_shader);
+        ensure_compiled(fs, pi->fragment_shader);
+        glLinkProgram(program);
+        return;
+    }
+
+    const char *parts[] = { "program", binary_cache.driver_id, vs->compiled_source,
+                            fs->compiled_source, pi->attrib_bindings->str, NULL };
+    gl_program_cache_key(bin->key, parts);
+
+    size_t size = 0;
+    GLenum format = 0;
+    void *data = gl_program_cache_load(binary_cache.cache, bin->key, &format, &size);
+    if (data) {
+        GLint status = GL_FALSE;
+        binary_cache.ProgramBinary(program, format, data, size);
+        free(data);
+        glGetProgramiv(program, GL_LINK_STATUS, &status);
+        if (status)
+            return;
+
+        // driver rejected binary, perhaps it was updated without changing version string
+        gl_program_cache_remove(binary_cache.cache, bin->key);
+    }
+
+    ensure_compiled(vs, pi->vertex_shader);
+    ensure_compiled(fs, pi->fragment_shader);
+    glLinkProgram(program);
+
+    GLint status = GL_FALSE;
+    GLint length = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (status)
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH_OES, &length);
+    if (length <= 0)
+        return;
+
+    bin->data = malloc(length);
+    if (!bin->data)
+        return;
+    binary_cache.GetProgramBinary(program, length, &bin->size, &bin->format, bin->data);
+    if (bin->size <= 0) {
+        free(bin->data);
+        bin->data = NULL;
+    }
+}
+
+// size of client memory block with pixel data of given format, taking unpack alignment
+// into account. Returns GL_CMD_IMMEDIATE for unknown formats. Without command buffer
+// alignment is not tracked, and default of 4 is assumed.
+static
+size_t
+image_data_size(const struct gl_cmd_buffer_s *cb, GLsizei width, GLsizei height, GLenum format,
+                GLenum type)
+{
+    size_t components;
+    size_t bytes_per_pixel;
+
+    if (width <= 0 || height <= 0)
+        return 0;
+
+    switch (format) {
+    case GL_ALPHA:
+    case GL_LUMINANCE:          components = 1; break;
+    case GL_LUMINANCE_ALPHA:    components = 2; break;
+    case GL_RGB:                components = 3; break;
+    case GL_RGBA:
+    case GL_BGRA_EXT:           components = 4; break;
+    default:                    return GL_CMD_IMMEDIATE;
+    }
+
+    switch (type) {
+    case GL_UNSIGNED_BYTE:          bytes_per_pixel = components; break;
+    case GL_UNSIGNED_SHORT_5_6_5:
+    case GL_UNSIGNED_SHORT_4_4_4_4:
+    case GL_UNSIGNED_SHORT_5_5_5_1: bytes_per_pixel = 2; break;
+    case GL_HALF_FLOAT_OES:         bytes_per_pixel = 2 * components; break;
+    case GL_FLOAT:                  bytes_per_pixel = 4 * components; break;
+    default:                        return GL_CMD_IMMEDIATE;
+    }
+
+    const size_t alignment = !cb ? 4 : cb->unpack_alignment > 0 ? cb->unpack_alignment : 1;
+    const size_t row_size = width * bytes_per_pixel;
+    const size_t stride = (row_size + alignment - 1) / alignment * alignment;
+
+    return stride * (height - 1) + row_size;
+}
 
 void
 ppb_opengles2_ActiveTexture(PP_Resource context, GLenum texture)
 {
-    PROLOGUE(g3d, return);
-    glActiveTexture(texture);
-    EPILOGUE();
+    ACQUIRE_G3D(g3d);
+    SHADOW_SKIP_IF(g3d, g3d->shadow.active_texture == texture);
+    // rejected call leaves active unit as is, but there is no way to know which one that is
+    // without a round trip, as previous calls may be still in command buffer
+    const int valid = (texture >= GL_TEXTURE0 &&
+                       texture < GL_TEXTURE0 + (GLuint)g3d->shadow.max_texture_units);
+    g3d->shadow.active_texture = valid ? texture : GL_SHADOW_UNKNOWN;
+    DEFERRED_BEGIN(g3d, cmd, GLCMD_ACTIVE_TEXTURE, 0);
+    if (cmd) {
+        cmd->a[0].e = texture;
+    } else {
+        glActiveTexture(texture);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
@@ -57,6 +536,15 @@ ppb_opengles2_AttachShader(PP_Resource context, GLuint program, GLuint shader)
 {
     PROLOGUE(g3d, return);
     glAttachShader(program, shader);
+    struct program_info_s *pi = g_hash_table_lookup(g3d->programs, GUINT_TO_POINTER(program));
+    struct shader_info_s *si = g_hash_table_lookup(g3d->shaders, GUINT_TO_POINTER(shader));
+    if (pi && si) {
+        if (si->type == GL_VERTEX_SHADER)
+            pi->vertex_shader = shader;
+        else
+            pi->fragment_shader = shader;
+        si->attach_count ++;
+    }
     EPILOGUE();
 }
 
@@ -66,99 +554,228 @@ ppb_opengles2_BindAttribLocation(PP_Resource context, GLuint program, GLuint ind
 {
     PROLOGUE(g3d, return);
     glBindAttribLocation(program, index, name);
+    struct program_info_s *pi = g_hash_table_lookup(g3d->programs, GUINT_TO_POINTER(program));
+    if (pi && name)
+        g_string_append_printf(pi->attrib_bindings, "%u:%s\n", index, name);
     EPILOGUE();
 }
 
 void
 ppb_opengles2_BindBuffer(PP_Resource context, GLenum target, GLuint buffer)
 {
-    PROLOGUE(g3d, return);
-    glBindBuffer(target, buffer);
-    EPILOGUE();
+    ACQUIRE_G3D(g3d);
+    prof.e = target;
+    GLuint *slot = (target == GL_ARRAY_BUFFER) ? &g3d->shadow.array_buffer
+                 : (target == GL_ELEMENT_ARRAY_BUFFER) ? &g3d->shadow.element_array_buffer
+                 : NULL;
+    track_names(g3d->buffers, 1, &buffer);
+    SHADOW_SKIP_IF(g3d, slot && *slot == buffer);
+    if (slot)
+        *slot = buffer_binding_valid(g3d, buffer) ? buffer : GL_SHADOW_UNKNOWN;
+    DEFERRED_BEGIN(g3d, cmd, GLCMD_BIND_BUFFER, 0);
+    if (cmd) {
+        cmd->a[0].e = target;
+        cmd->a[1].u = buffer;
+    } else {
+        glBindBuffer(target, buffer);
+    }
+    if (g3d->cmd_buffer) {
+        if (target == GL_ARRAY_BUFFER)
+            g3d->cmd_buffer->array_buffer = buffer;
+        else if (target == GL_ELEMENT_ARRAY_BUFFER)
+            g3d->cmd_buffer->element_array_buffer = buffer;
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_BindFramebuffer(PP_Resource context, GLenum target, GLuint framebuffer)
 {
-    PROLOGUE(g3d, return);
-    glBindFramebuffer(target, framebuffer);
-    EPILOGUE();
+    ACQUIRE_G3D(g3d);
+    prof.e = target;
+    track_names(g3d->framebuffers, 1, &framebuffer);
+    // FBO backend substitutes its own framebuffer for the default one
+    if (framebuffer == 0)
+        framebuffer = g3d->fbo.id;
+    SHADOW_SKIP_IF(g3d, target == GL_FRAMEBUFFER && g3d->shadow.framebuffer == framebuffer);
+    if (target == GL_FRAMEBUFFER)
+        g3d->shadow.framebuffer = framebuffer;
+    DEFERRED_BEGIN(g3d, cmd, GLCMD_BIND_FRAMEBUFFER, 0);
+    if (cmd) {
+        cmd->a[0].e = target;
+        cmd->a[1].u = framebuffer;
+    } else {
+        glBindFramebuffer(target, framebuffer);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_BindRenderbuffer(PP_Resource context, GLenum target, GLuint renderbuffer)
 {
-    PROLOGUE(g3d, return);
-    glBindRenderbuffer(target, renderbuffer);
-    EPILOGUE();
+    ACQUIRE_G3D(g3d);
+    track_names(g3d->renderbuffers, 1, &renderbuffer);
+    SHADOW_SKIP_IF(g3d, target == GL_RENDERBUFFER && g3d->shadow.renderbuffer == renderbuffer);
+    if (target == GL_RENDERBUFFER)
+        g3d->shadow.renderbuffer = renderbuffer;
+    DEFERRED_BEGIN(g3d, cmd, GLCMD_BIND_RENDERBUFFER, 0);
+    if (cmd) {
+        cmd->a[0].e = target;
+        cmd->a[1].u = renderbuffer;
+    } else {
+        glBindRenderbuffer(target, renderbuffer);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_BindTexture(PP_Resource context, GLenum target, GLuint texture)
 {
-    PROLOGUE(g3d, return);
-    glBindTexture(target, texture);
-    EPILOGUE();
+    ACQUIRE_G3D(g3d);
+    prof.e = target;
+    GLuint *slot = gl_shadow_state_texture_slot(&g3d->shadow, target);
+    SHADOW_SKIP_IF(g3d, slot && *slot == texture);
+    // also records target of a new name
+    const int valid = texture_binding_valid(g3d, target, texture);
+    if (slot)
+        *slot = valid ? texture : GL_SHADOW_UNKNOWN;
+    DEFERRED_BEGIN(g3d, cmd, GLCMD_BIND_TEXTURE, 0);
+    if (cmd) {
+        cmd->a[0].e = target;
+        cmd->a[1].u = texture;
+    } else {
+        glBindTexture(target, texture);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_BlendColor(PP_Resource context, GLclampf red, GLclampf green, GLclampf blue,
                          GLclampf alpha)
 {
-    PROLOGUE(g3d, return);
-    glBlendColor(red, green, blue, alpha);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_BLEND_COLOR, 0);
+    if (cmd) {
+        cmd->a[0].f = red;
+        cmd->a[1].f = green;
+        cmd->a[2].f = blue;
+        cmd->a[3].f = alpha;
+    } else {
+        glBlendColor(red, green, blue, alpha);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_BlendEquation(PP_Resource context, GLenum mode)
 {
-    PROLOGUE(g3d, return);
-    glBlendEquation(mode);
-    EPILOGUE();
+    ACQUIRE_G3D(g3d);
+    struct gl_shadow_state_s *sh = &g3d->shadow;
+    SHADOW_SKIP_IF(g3d, sh->blend_equation_rgb == mode && sh->blend_equation_alpha == mode);
+    sh->blend_equation_rgb = sh->blend_equation_alpha = mode;
+    DEFERRED_BEGIN(g3d, cmd, GLCMD_BLEND_EQUATION, 0);
+    if (cmd) {
+        cmd->a[0].e = mode;
+    } else {
+        glBlendEquation(mode);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_BlendEquationSeparate(PP_Resource context, GLenum modeRGB, GLenum modeAlpha)
 {
-    PROLOGUE(g3d, return);
-    glBlendEquationSeparate(modeRGB, modeAlpha);
-    EPILOGUE();
+    ACQUIRE_G3D(g3d);
+    struct gl_shadow_state_s *sh = &g3d->shadow;
+    SHADOW_SKIP_IF(g3d, sh->blend_equation_rgb == modeRGB && sh->blend_equation_alpha == modeAlpha);
+    sh->blend_equation_rgb = modeRGB;
+    sh->blend_equation_alpha = modeAlpha;
+    DEFERRED_BEGIN(g3d, cmd, GLCMD_BLEND_EQUATION_SEPARATE, 0);
+    if (cmd) {
+        cmd->a[0].e = modeRGB;
+        cmd->a[1].e = modeAlpha;
+    } else {
+        glBlendEquationSeparate(modeRGB, modeAlpha);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_BlendFunc(PP_Resource context, GLenum sfactor, GLenum dfactor)
 {
-    PROLOGUE(g3d, return);
-    glBlendFunc(sfactor, dfactor);
-    EPILOGUE();
+    ACQUIRE_G3D(g3d);
+    struct gl_shadow_state_s *sh = &g3d->shadow;
+    SHADOW_SKIP_IF(g3d, sh->blend_src_rgb == sfactor && sh->blend_src_alpha == sfactor &&
+                        sh->blend_dst_rgb == dfactor && sh->blend_dst_alpha == dfactor);
+    sh->blend_src_rgb = sh->blend_src_alpha = sfactor;
+    sh->blend_dst_rgb = sh->blend_dst_alpha = dfactor;
+    DEFERRED_BEGIN(g3d, cmd, GLCMD_BLEND_FUNC, 0);
+    if (cmd) {
+        cmd->a[0].e = sfactor;
+        cmd->a[1].e = dfactor;
+    } else {
+        glBlendFunc(sfactor, dfactor);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_BlendFuncSeparate(PP_Resource context, GLenum srcRGB, GLenum dstRGB, GLenum srcAlpha,
                                 GLenum dstAlpha)
 {
-    PROLOGUE(g3d, return);
-    glBlendFuncSeparate(srcRGB, dstRGB, srcAlpha, dstAlpha);
-    EPILOGUE();
+    ACQUIRE_G3D(g3d);
+    struct gl_shadow_state_s *sh = &g3d->shadow;
+    SHADOW_SKIP_IF(g3d, sh->blend_src_rgb == srcRGB && sh->blend_dst_rgb == dstRGB &&
+                        sh->blend_src_alpha == srcAlpha && sh->blend_dst_alpha == dstAlpha);
+    sh->blend_src_rgb = srcRGB;
+    sh->blend_dst_rgb = dstRGB;
+    sh->blend_src_alpha = srcAlpha;
+    sh->blend_dst_alpha = dstAlpha;
+    DEFERRED_BEGIN(g3d, cmd, GLCMD_BLEND_FUNC_SEPARATE, 0);
+    if (cmd) {
+        cmd->a[0].e = srcRGB;
+        cmd->a[1].e = dstRGB;
+        cmd->a[2].e = srcAlpha;
+        cmd->a[3].e = dstAlpha;
+    } else {
+        glBlendFuncSeparate(srcRGB, dstRGB, srcAlpha, dstAlpha);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_BufferData(PP_Resource context, GLenum target, GLsizeiptr size, const void *data,
                          GLenum usage)
 {
-    PROLOGUE(g3d, return);
-    glBufferData(target, size, data, usage);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_BUFFER_DATA, data ? size : 0);
+    prof.e = target;
+    prof.bytes = data ? size : 0;
+    if (cmd) {
+        cmd->a[0].e = target;
+        cmd->a[1].sp = size;
+        cmd->a[2].p = gl_cmd_buffer_copy_payload(cmd, data, size);
+        cmd->a[3].e = usage;
+    } else {
+        glBufferData(target, size, data, usage);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_BufferSubData(PP_Resource context, GLenum target, GLintptr offset, GLsizeiptr size,
                             const void *data)
 {
-    PROLOGUE(g3d, return);
-    glBufferSubData(target, offset, size, data);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_BUFFER_SUB_DATA, data ? size : 0);
+    prof.e = target;
+    prof.bytes = data ? size : 0;
+    if (cmd) {
+        cmd->a[0].e = target;
+        cmd->a[1].ip = offset;
+        cmd->a[2].sp = size;
+        cmd->a[3].p = gl_cmd_buffer_copy_payload(cmd, data, size);
+    } else {
+        glBufferSubData(target, offset, size, data);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 GLenum
@@ -173,50 +790,84 @@ ppb_opengles2_CheckFramebufferStatus(PP_Resource context, GLenum target)
 void
 ppb_opengles2_Clear(PP_Resource context, GLbitfield mask)
 {
-    PROLOGUE(g3d, return);
-    glClear(mask);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_CLEAR, 0);
+    if (cmd) {
+        cmd->a[0].bf = mask;
+    } else {
+        glClear(mask);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_ClearColor(PP_Resource context, GLclampf red, GLclampf green, GLclampf blue,
                          GLclampf alpha)
 {
-    PROLOGUE(g3d, return);
-    glClearColor(red, green, blue, alpha);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_CLEAR_COLOR, 0);
+    if (cmd) {
+        cmd->a[0].f = red;
+        cmd->a[1].f = green;
+        cmd->a[2].f = blue;
+        cmd->a[3].f = alpha;
+    } else {
+        glClearColor(red, green, blue, alpha);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_ClearDepthf(PP_Resource context, GLclampf depth)
 {
-    PROLOGUE(g3d, return);
-    glClearDepthf(depth);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_CLEAR_DEPTHF, 0);
+    if (cmd) {
+        cmd->a[0].f = depth;
+    } else {
+        glClearDepthf(depth);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_ClearStencil(PP_Resource context, GLint s)
 {
-    PROLOGUE(g3d, return);
-    glClearStencil(s);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_CLEAR_STENCIL, 0);
+    if (cmd) {
+        cmd->a[0].i = s;
+    } else {
+        glClearStencil(s);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_ColorMask(PP_Resource context, GLboolean red, GLboolean green, GLboolean blue,
                         GLboolean alpha)
 {
-    PROLOGUE(g3d, return);
-    glColorMask(red, green, blue, alpha);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_COLOR_MASK, 0);
+    if (cmd) {
+        cmd->a[0].b = red;
+        cmd->a[1].b = green;
+        cmd->a[2].b = blue;
+        cmd->a[3].b = alpha;
+    } else {
+        glColorMask(red, green, blue, alpha);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_CompileShader(PP_Resource context, GLuint shader)
 {
     PROLOGUE(g3d, return);
-    glCompileShader(shader);
+    struct shader_info_s *si = g_hash_table_lookup(g3d->shaders, GUINT_TO_POINTER(shader));
+    if (si && si->source) {
+        g_free(si->compiled_source);
+        si->compiled_source = g_strdup(si->source);
+    }
+    if (si && si->source && binary_cache_enabled(g3d))
+        si->compile_pending = 1;
+    else
+        glCompileShader(shader);
     EPILOGUE();
 }
 
@@ -225,9 +876,22 @@ ppb_opengles2_CompressedTexImage2D(PP_Resource context, GLenum target, GLint lev
                                    GLenum internalformat, GLsizei width, GLsizei height,
                                    GLint border, GLsizei imageSize, const void *data)
 {
-    PROLOGUE(g3d, return);
-    glCompressedTexImage2D(target, level, internalformat, width, height, border, imageSize, data);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_COMPRESSED_TEX_IMAGE_2D, data ? imageSize : 0);
+    prof.bytes = data ? imageSize : 0;
+    if (cmd) {
+        cmd->a[0].e = target;
+        cmd->a[1].i = level;
+        cmd->a[2].e = internalformat;
+        cmd->a[3].s = width;
+        cmd->a[4].s = height;
+        cmd->a[5].i = border;
+        cmd->a[6].s = imageSize;
+        cmd->a[7].p = gl_cmd_buffer_copy_payload(cmd, data, imageSize);
+    } else {
+        glCompressedTexImage2D(target, level, internalformat, width, height, border, imageSize,
+                               data);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
@@ -235,10 +899,23 @@ ppb_opengles2_CompressedTexSubImage2D(PP_Resource context, GLenum target, GLint
                                       GLint xoffset, GLint yoffset, GLsizei width, GLsizei height,
                                       GLenum format, GLsizei imageSize, const void *data)
 {
-    PROLOGUE(g3d, return);
-    glCompressedTexSubImage2D(target, level, xoffset, yoffset, width, height, format, imageSize,
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_COMPRESSED_TEX_SUB_IMAGE_2D, data ? imageSize : 0);
+    prof.bytes = data ? imageSize : 0;
+    if (cmd) {
+        cmd->a[0].e = target;
+        cmd->a[1].i = level;
+        cmd->a[2].i = xoffset;
+        cmd->a[3].i = yoffset;
+        cmd->a[4].s = width;
+        cmd->a[5].s = height;
+        cmd->a[6].e = format;
+        cmd->a[7].s = imageSize;
+        cmd->a[8].p = gl_cmd_buffer_copy_payload(cmd, data, imageSize);
+    } else {
+        glCompressedTexSubImage2D(target, level, xoffset, yoffset, width, height, format, imageSize,
                               data);
-    EPILOGUE();
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
@@ -264,6 +941,11 @@ ppb_opengles2_CreateProgram(PP_Resource context)
 {
     PROLOGUE(g3d, return 0);
     GLuint res = glCreateProgram();
+    if (res != 0) {
+        struct program_info_s *pi = g_slice_alloc0(sizeof(*pi));
+        pi->attrib_bindings = g_string_new(NULL);
+        g_hash_table_replace(g3d->programs, GUINT_TO_POINTER(res), pi);
+    }
     EPILOGUE();
     return res;
 }
@@ -273,6 +955,11 @@ ppb_opengles2_CreateShader(PP_Resource context, GLenum type)
 {
     PROLOGUE(g3d, return 0);
     GLuint res = glCreateShader(type);
+    if (res != 0) {
+        struct shader_info_s *si = g_slice_alloc0(sizeof(*si));
+        si->type = type;
+        g_hash_table_replace(g3d->shaders, GUINT_TO_POINTER(res), si);
+    }
     EPILOGUE();
     return res;
 }
@@ -280,9 +967,13 @@ ppb_opengles2_CreateShader(PP_Resource context, GLenum type)
 void
 ppb_opengles2_CullFace(PP_Resource context, GLenum mode)
 {
-    PROLOGUE(g3d, return);
-    glCullFace(mode);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_CULL_FACE, 0);
+    if (cmd) {
+        cmd->a[0].e = mode;
+    } else {
+        glCullFace(mode);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
@@ -290,6 +981,17 @@ ppb_opengles2_DeleteBuffers(PP_Resource context, GLsizei n, const GLuint *buffer
 {
     PROLOGUE(g3d, return);
     glDeleteBuffers(n, buffers);
+    gl_shadow_state_buffers_deleted(&g3d->shadow, n, buffers);
+    untrack_names(g3d->buffers, n, buffers);
+    if (g3d->cmd_buffer) {
+        // deleting bound buffer reverts binding to zero
+        for (GLsizei k = 0; k < n; k ++) {
+            if (buffers[k] == g3d->cmd_buffer->array_buffer)
+                g3d->cmd_buffer->array_buffer = 0;
+            if (buffers[k] == g3d->cmd_buffer->element_array_buffer)
+                g3d->cmd_buffer->element_array_buffer = 0;
+        }
+    }
     EPILOGUE();
 }
 
@@ -298,6 +1000,19 @@ ppb_opengles2_DeleteFramebuffers(PP_Resource context, GLsizei n, const GLuint *f
 {
     PROLOGUE(g3d, return);
     glDeleteFramebuffers(n, framebuffers);
+    untrack_names(g3d->framebuffers, n, framebuffers);
+    if (g3d->fbo.id) {
+        // deleting bound framebuffer reverts binding to the default one, which is not
+        // the one plugin draws to
+        GLint binding = 0;
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &binding);
+        if (binding == 0)
+            glBindFramebuffer(GL_FRAMEBUFFER, g3d->fbo.id);
+    }
+    for (GLsizei k = 0; k < n; k ++) {
+        if (framebuffers[k] != 0 && framebuffers[k] == g3d->shadow.framebuffer)
+            g3d->shadow.framebuffer = g3d->fbo.id;
+    }
     EPILOGUE();
 }
 
@@ -306,6 +1021,18 @@ ppb_opengles2_DeleteProgram(PP_Resource context, GLuint program)
 {
     PROLOGUE(g3d, return);
     glDeleteProgram(program);
+    struct program_info_s *pi = g_hash_table_lookup(g3d->programs, GUINT_TO_POINTER(program));
+    if (pi) {
+        // deleting program detaches its shaders
+        GLuint attached[2] = { pi->vertex_shader, pi->fragment_shader };
+        for (int k = 0; k < 2; k ++) {
+            struct shader_info_s *si = g_hash_table_lookup(g3d->shaders,
+                                                           GUINT_TO_POINTER(attached[k]));
+            if (si)
+                shader_info_unref(g3d, attached[k], si);
+        }
+        g_hash_table_remove(g3d->programs, GUINT_TO_POINTER(program));
+    }
     EPILOGUE();
 }
 
@@ -314,6 +1041,8 @@ ppb_opengles2_DeleteRenderbuffers(PP_Resource context, GLsizei n, const GLuint *
 {
     PROLOGUE(g3d, return);
     glDeleteRenderbuffers(n, renderbuffers);
+    gl_shadow_state_renderbuffers_deleted(&g3d->shadow, n, renderbuffers);
+    untrack_names(g3d->renderbuffers, n, renderbuffers);
     EPILOGUE();
 }
 
@@ -322,6 +1051,13 @@ ppb_opengles2_DeleteShader(PP_Resource context, GLuint shader)
 {
     PROLOGUE(g3d, return);
     glDeleteShader(shader);
+    // attached shader lives until detached, and may still need to be compiled for relinking
+    struct shader_info_s *si = g_hash_table_lookup(g3d->shaders, GUINT_TO_POINTER(shader));
+    if (si) {
+        si->deleted = 1;
+        if (si->attach_count <= 0)
+            g_hash_table_remove(g3d->shaders, GUINT_TO_POINTER(shader));
+    }
     EPILOGUE();
 }
 
@@ -330,31 +1066,53 @@ ppb_opengles2_DeleteTextures(PP_Resource context, GLsizei n, const GLuint *textu
 {
     PROLOGUE(g3d, return);
     glDeleteTextures(n, textures);
+    gl_shadow_state_textures_deleted(&g3d->shadow, n, textures);
+    untrack_names(g3d->texture_targets, n, textures);
     EPILOGUE();
 }
 
 void
 ppb_opengles2_DepthFunc(PP_Resource context, GLenum func)
 {
-    PROLOGUE(g3d, return);
-    glDepthFunc(func);
-    EPILOGUE();
+    ACQUIRE_G3D(g3d);
+    SHADOW_SKIP_IF(g3d, g3d->shadow.depth_func == func);
+    g3d->shadow.depth_func = func;
+    DEFERRED_BEGIN(g3d, cmd, GLCMD_DEPTH_FUNC, 0);
+    if (cmd) {
+        cmd->a[0].e = func;
+    } else {
+        glDepthFunc(func);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_DepthMask(PP_Resource context, GLboolean flag)
 {
-    PROLOGUE(g3d, return);
-    glDepthMask(flag);
-    EPILOGUE();
+    ACQUIRE_G3D(g3d);
+    flag = flag ? GL_TRUE : GL_FALSE;
+    SHADOW_SKIP_IF(g3d, g3d->shadow.depth_mask == flag);
+    g3d->shadow.depth_mask = flag;
+    DEFERRED_BEGIN(g3d, cmd, GLCMD_DEPTH_MASK, 0);
+    if (cmd) {
+        cmd->a[0].b = flag;
+    } else {
+        glDepthMask(flag);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_DepthRangef(PP_Resource context, GLclampf zNear, GLclampf zFar)
 {
-    PROLOGUE(g3d, return);
-    glDepthRangef(zNear, zFar);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_DEPTH_RANGEF, 0);
+    if (cmd) {
+        cmd->a[0].f = zNear;
+        cmd->a[1].f = zFar;
+    } else {
+        glDepthRangef(zNear, zFar);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
@@ -362,56 +1120,110 @@ ppb_opengles2_DetachShader(PP_Resource context, GLuint program, GLuint shader)
 {
     PROLOGUE(g3d, return);
     glDetachShader(program, shader);
+    struct program_info_s *pi = g_hash_table_lookup(g3d->programs, GUINT_TO_POINTER(program));
+    struct shader_info_s *si = g_hash_table_lookup(g3d->shaders, GUINT_TO_POINTER(shader));
+    if (pi && si && (pi->vertex_shader == shader || pi->fragment_shader == shader)) {
+        if (pi->vertex_shader == shader)
+            pi->vertex_shader = 0;
+        else
+            pi->fragment_shader = 0;
+        shader_info_unref(g3d, shader, si);
+    }
     EPILOGUE();
 }
 
 void
 ppb_opengles2_Disable(PP_Resource context, GLenum cap)
 {
-    PROLOGUE(g3d, return);
-    glDisable(cap);
-    EPILOGUE();
+    ACQUIRE_G3D(g3d);
+    prof.e = cap;
+    const uint32_t bit = gl_shadow_state_cap_bit(cap);
+    SHADOW_SKIP_IF(g3d, bit && !(g3d->shadow.enabled_caps & bit));
+    g3d->shadow.enabled_caps &= ~bit;
+    DEFERRED_BEGIN(g3d, cmd, GLCMD_DISABLE, 0);
+    if (cmd) {
+        cmd->a[0].e = cap;
+    } else {
+        glDisable(cap);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_DisableVertexAttribArray(PP_Resource context, GLuint index)
 {
-    PROLOGUE(g3d, return);
-    glDisableVertexAttribArray(index);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_DISABLE_VERTEX_ATTRIB_ARRAY, 0);
+    if (cmd) {
+        cmd->a[0].u = index;
+    } else {
+        glDisableVertexAttribArray(index);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_DrawArrays(PP_Resource context, GLenum mode, GLint first, GLsizei count)
 {
-    PROLOGUE(g3d, return);
-    glDrawArrays(mode, first, count);
-    EPILOGUE();
+    // attributes sourced from client memory must be read before this call returns
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_DRAW_ARRAYS,
+                      g3d->cmd_buffer->client_arrays ? GL_CMD_IMMEDIATE : 0);
+    prof.e = mode;
+    if (cmd) {
+        cmd->a[0].e = mode;
+        cmd->a[1].i = first;
+        cmd->a[2].s = count;
+    } else {
+        glDrawArrays(mode, first, count);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_DrawElements(PP_Resource context, GLenum mode, GLsizei count, GLenum type,
                            const void *indices)
 {
-    PROLOGUE(g3d, return);
-    glDrawElements(mode, count, type, indices);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_DRAW_ELEMENTS,
+                      (g3d->cmd_buffer->client_arrays || !g3d->cmd_buffer->element_array_buffer)
+                        ? GL_CMD_IMMEDIATE : 0);
+    prof.e = mode;
+    if (cmd) {
+        cmd->a[0].e = mode;
+        cmd->a[1].s = count;
+        cmd->a[2].e = type;
+        cmd->a[3].p = indices;
+    } else {
+        glDrawElements(mode, count, type, indices);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_Enable(PP_Resource context, GLenum cap)
 {
-    PROLOGUE(g3d, return);
-    glEnable(cap);
-    EPILOGUE();
+    ACQUIRE_G3D(g3d);
+    prof.e = cap;
+    const uint32_t bit = gl_shadow_state_cap_bit(cap);
+    SHADOW_SKIP_IF(g3d, bit && (g3d->shadow.enabled_caps & bit));
+    g3d->shadow.enabled_caps |= bit;
+    DEFERRED_BEGIN(g3d, cmd, GLCMD_ENABLE, 0);
+    if (cmd) {
+        cmd->a[0].e = cap;
+    } else {
+        glEnable(cap);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_EnableVertexAttribArray(PP_Resource context, GLuint index)
 {
-    PROLOGUE(g3d, return);
-    glEnableVertexAttribArray(index);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_ENABLE_VERTEX_ATTRIB_ARRAY, 0);
+    if (cmd) {
+        cmd->a[0].u = index;
+    } else {
+        glEnableVertexAttribArray(index);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
@@ -425,35 +1237,60 @@ ppb_opengles2_Finish(PP_Resource context)
 void
 ppb_opengles2_Flush(PP_Resource context)
 {
-    PROLOGUE(g3d, return);
-    glFlush();
-    EPILOGUE();
+    // other contexts of a share group may rely on commands issued before flush, so they
+    // are executed right away
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_FLUSH,
+                      (g3d->share_group &&
+                       __atomic_load_n(&g3d->share_group->ref_count, __ATOMIC_SEQ_CST) > 1)
+                            ? GL_CMD_IMMEDIATE : 0);
+    if (!cmd)
+        glFlush();
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_FramebufferRenderbuffer(PP_Resource context, GLenum target, GLenum attachment,
                                       GLenum renderbuffertarget, GLuint renderbuffer)
 {
-    PROLOGUE(g3d, return);
-    glFramebufferRenderbuffer(target, attachment, renderbuffertarget, renderbuffer);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_FRAMEBUFFER_RENDERBUFFER, 0);
+    if (cmd) {
+        cmd->a[0].e = target;
+        cmd->a[1].e = attachment;
+        cmd->a[2].e = renderbuffertarget;
+        cmd->a[3].u = renderbuffer;
+    } else {
+        glFramebufferRenderbuffer(target, attachment, renderbuffertarget, renderbuffer);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_FramebufferTexture2D(PP_Resource context, GLenum target, GLenum attachment,
                                    GLenum textarget, GLuint texture, GLint level)
 {
-    PROLOGUE(g3d, return);
-    glFramebufferTexture2D(target, attachment, textarget, texture, level);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_FRAMEBUFFER_TEXTURE_2D, 0);
+    if (cmd) {
+        cmd->a[0].e = target;
+        cmd->a[1].e = attachment;
+        cmd->a[2].e = textarget;
+        cmd->a[3].u = texture;
+        cmd->a[4].i = level;
+    } else {
+        glFramebufferTexture2D(target, attachment, textarget, texture, level);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_FrontFace(PP_Resource context, GLenum mode)
 {
-    PROLOGUE(g3d, return);
-    glFrontFace(mode);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_FRONT_FACE, 0);
+    if (cmd) {
+        cmd->a[0].e = mode;
+    } else {
+        glFrontFace(mode);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
@@ -461,15 +1298,20 @@ ppb_opengles2_GenBuffers(PP_Resource context, GLsizei n, GLuint *buffers)
 {
     PROLOGUE(g3d, return);
     glGenBuffers(n, buffers);
+    track_names(g3d->buffers, n, buffers);
     EPILOGUE();
 }
 
 void
 ppb_opengles2_GenerateMipmap(PP_Resource context, GLenum target)
 {
-    PROLOGUE(g3d, return);
-    glGenerateMipmap(target);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_GENERATE_MIPMAP, 0);
+    if (cmd) {
+        cmd->a[0].e = target;
+    } else {
+        glGenerateMipmap(target);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
@@ -477,6 +1319,7 @@ ppb_opengles2_GenFramebuffers(PP_Resource context, GLsizei n, GLuint *framebuffe
 {
     PROLOGUE(g3d, return);
     glGenFramebuffers(n, framebuffers);
+    track_names(g3d->framebuffers, n, framebuffers);
     EPILOGUE();
 }
 
@@ -485,6 +1328,7 @@ ppb_opengles2_GenRenderbuffers(PP_Resource context, GLsizei n, GLuint *renderbuf
 {
     PROLOGUE(g3d, return);
     glGenRenderbuffers(n, renderbuffers);
+    track_names(g3d->renderbuffers, n, renderbuffers);
     EPILOGUE();
 }
 
@@ -493,6 +1337,10 @@ ppb_opengles2_GenTextures(PP_Resource context, GLsizei n, GLuint *textures)
 {
     PROLOGUE(g3d, return);
     glGenTextures(n, textures);
+    for (GLsizei k = 0; k < n; k ++) {
+        if (!g_hash_table_contains(g3d->texture_targets, GUINT_TO_POINTER(textures[k])))
+            g_hash_table_insert(g3d->texture_targets, GUINT_TO_POINTER(textures[k]), NULL);
+    }
     EPILOGUE();
 }
 
@@ -578,7 +1426,10 @@ void
 ppb_opengles2_GetIntegerv(PP_Resource context, GLenum pname, GLint *params)
 {
     PROLOGUE(g3d, return);
+    prof.e = pname;
     glGetIntegerv(pname, params);
+    if (pname == GL_FRAMEBUFFER_BINDING && g3d->fbo.id && params[0] == (GLint)g3d->fbo.id)
+        params[0] = 0;
     EPILOGUE();
 }
 
@@ -612,8 +1463,21 @@ void
 ppb_opengles2_GetShaderiv(PP_Resource context, GLuint shader, GLenum pname, GLint *params)
 {
     PROLOGUE(g3d, return);
+    struct shader_info_s *si = g_hash_table_lookup(g3d->shaders, GUINT_TO_POINTER(shader));
+    if (si && si->compile_pending && pname == GL_COMPILE_STATUS) {
+        // same source compiled fine before, there is no need to compile it right now
+        char key[GL_PROGRAM_CACHE_KEY_LEN + 1];
+        shader_marker_key(key, si);
+        if (shader_marker_exists(key)) {
+            params[0] = GL_TRUE;
+            EPILOGUE();
+            return;
+        }
+    }
+    ensure_compiled(si, shader);
     glGetShaderiv(shader, pname, params);
     EPILOGUE();
+    binary_cache_flush_markers();
 }
 
 void
@@ -621,8 +1485,10 @@ ppb_opengles2_GetShaderInfoLog(PP_Resource context, GLuint shader, GLsizei bufsi
                                char *infolog)
 {
     PROLOGUE(g3d, return);
+    ensure_compiled(g_hash_table_lookup(g3d->shaders, GUINT_TO_POINTER(shader)), shader);
     glGetShaderInfoLog(shader, bufsize, length, infolog);
     EPILOGUE();
+    binary_cache_flush_markers();
 }
 
 void
@@ -721,9 +1587,14 @@ ppb_opengles2_GetVertexAttribPointerv(PP_Resource context, GLuint index, GLenum
 void
 ppb_opengles2_Hint(PP_Resource context, GLenum target, GLenum mode)
 {
-    PROLOGUE(g3d, return);
-    glHint(target, mode);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_HINT, 0);
+    if (cmd) {
+        cmd->a[0].e = target;
+        cmd->a[1].e = mode;
+    } else {
+        glHint(target, mode);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 GLboolean
@@ -792,33 +1663,66 @@ ppb_opengles2_IsTexture(PP_Resource context, GLuint texture)
 void
 ppb_opengles2_LineWidth(PP_Resource context, GLfloat width)
 {
-    PROLOGUE(g3d, return);
-    glLineWidth(width);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_LINE_WIDTH, 0);
+    if (cmd) {
+        cmd->a[0].f = width;
+    } else {
+        glLineWidth(width);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_LinkProgram(PP_Resource context, GLuint program)
 {
     PROLOGUE(g3d, return);
-    glLinkProgram(program);
+    struct program_binary_s bin = { .data = NULL };
+    struct program_info_s *pi = g_hash_table_lookup(g3d->programs, GUINT_TO_POINTER(program));
+    if (pi) {
+        GLint status = GL_FALSE;
+        link_program(g3d, program, pi, &bin);
+        glGetProgramiv(program, GL_LINK_STATUS, &status);
+        pi->linked = (status == GL_TRUE);
+    } else {
+        glLinkProgram(program);
+    }
     EPILOGUE();
+
+    // writing to disk is too slow to be done under display.lock
+    if (bin.data) {
+        gl_program_cache_store(binary_cache.cache, bin.key, bin.format, bin.data, bin.size);
+        free(bin.data);
+    }
+    binary_cache_flush_markers();
 }
 
 void
 ppb_opengles2_PixelStorei(PP_Resource context, GLenum pname, GLint param)
 {
-    PROLOGUE(g3d, return);
-    glPixelStorei(pname, param);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_PIXEL_STOREI, 0);
+    prof.e = pname;
+    if (cmd) {
+        cmd->a[0].e = pname;
+        cmd->a[1].i = param;
+    } else {
+        glPixelStorei(pname, param);
+    }
+    if (g3d->cmd_buffer && pname == GL_UNPACK_ALIGNMENT)
+        g3d->cmd_buffer->unpack_alignment = param;
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_PolygonOffset(PP_Resource context, GLfloat factor, GLfloat units)
 {
-    PROLOGUE(g3d, return);
-    glPolygonOffset(factor, units);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_POLYGON_OFFSET, 0);
+    if (cmd) {
+        cmd->a[0].f = factor;
+        cmd->a[1].f = units;
+    } else {
+        glPolygonOffset(factor, units);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
@@ -842,25 +1746,44 @@ void
 ppb_opengles2_RenderbufferStorage(PP_Resource context, GLenum target, GLenum internalformat,
                                   GLsizei width, GLsizei height)
 {
-    PROLOGUE(g3d, return);
-    glRenderbufferStorage(target, internalformat, width, height);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_RENDERBUFFER_STORAGE, 0);
+    if (cmd) {
+        cmd->a[0].e = target;
+        cmd->a[1].e = internalformat;
+        cmd->a[2].s = width;
+        cmd->a[3].s = height;
+    } else {
+        glRenderbufferStorage(target, internalformat, width, height);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_SampleCoverage(PP_Resource context, GLclampf value, GLboolean invert)
 {
-    PROLOGUE(g3d, return);
-    glSampleCoverage(value, invert);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_SAMPLE_COVERAGE, 0);
+    if (cmd) {
+        cmd->a[0].f = value;
+        cmd->a[1].b = invert;
+    } else {
+        glSampleCoverage(value, invert);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_Scissor(PP_Resource context, GLint x, GLint y, GLsizei width, GLsizei height)
 {
-    PROLOGUE(g3d, return);
-    glScissor(x, y, width, height);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_SCISSOR, 0);
+    if (cmd) {
+        cmd->a[0].i = x;
+        cmd->a[1].i = y;
+        cmd->a[2].s = width;
+        cmd->a[3].s = height;
+    } else {
+        glScissor(x, y, width, height);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
@@ -877,58 +1800,110 @@ ppb_opengles2_ShaderSource(PP_Resource context, GLuint shader, GLsizei count, co
                            const GLint *length)
 {
     PROLOGUE(g3d, return);
+    struct shader_info_s *si = g_hash_table_lookup(g3d->shaders, GUINT_TO_POINTER(shader));
+    // pending compilation must use source which was current at CompileShader time
+    ensure_compiled(si, shader);
     glShaderSource(shader, count, str, length);
+    if (si) {
+        GString *source = g_string_new(NULL);
+        for (GLsizei k = 0; k < count; k ++) {
+            if (!str[k])
+                continue;
+            if (length && length[k] >= 0)
+                g_string_append_len(source, str[k], length[k]);
+            else
+                g_string_append(source, str[k]);
+        }
+        g_free(si->source);
+        si->source = g_string_free(source, FALSE);
+    }
     EPILOGUE();
+    binary_cache_flush_markers();
 }
 
 void
 ppb_opengles2_StencilFunc(PP_Resource context, GLenum func, GLint ref, GLuint mask)
 {
-    PROLOGUE(g3d, return);
-    glStencilFunc(func, ref, mask);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_STENCIL_FUNC, 0);
+    if (cmd) {
+        cmd->a[0].e = func;
+        cmd->a[1].i = ref;
+        cmd->a[2].u = mask;
+    } else {
+        glStencilFunc(func, ref, mask);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_StencilFuncSeparate(PP_Resource context, GLenum face, GLenum func, GLint ref,
                                   GLuint mask)
 {
-    PROLOGUE(g3d, return);
-    glStencilFuncSeparate(face, func, ref, mask);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_STENCIL_FUNC_SEPARATE, 0);
+    if (cmd) {
+        cmd->a[0].e = face;
+        cmd->a[1].e = func;
+        cmd->a[2].i = ref;
+        cmd->a[3].u = mask;
+    } else {
+        glStencilFuncSeparate(face, func, ref, mask);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_StencilMask(PP_Resource context, GLuint mask)
 {
-    PROLOGUE(g3d, return);
-    glStencilMask(mask);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_STENCIL_MASK, 0);
+    if (cmd) {
+        cmd->a[0].u = mask;
+    } else {
+        glStencilMask(mask);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_StencilMaskSeparate(PP_Resource context, GLenum face, GLuint mask)
 {
-    PROLOGUE(g3d, return);
-    glStencilMaskSeparate(face, mask);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_STENCIL_MASK_SEPARATE, 0);
+    if (cmd) {
+        cmd->a[0].e = face;
+        cmd->a[1].u = mask;
+    } else {
+        glStencilMaskSeparate(face, mask);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_StencilOp(PP_Resource context, GLenum fail, GLenum zfail, GLenum zpass)
 {
-    PROLOGUE(g3d, return);
-    glStencilOp(fail, zfail, zpass);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_STENCIL_OP, 0);
+    if (cmd) {
+        cmd->a[0].e = fail;
+        cmd->a[1].e = zfail;
+        cmd->a[2].e = zpass;
+    } else {
+        glStencilOp(fail, zfail, zpass);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_StencilOpSeparate(PP_Resource context, GLenum face, GLenum fail, GLenum zfail,
                                 GLenum zpass)
 {
-    PROLOGUE(g3d, return);
-    glStencilOpSeparate(face, fail, zfail, zpass);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_STENCIL_OP_SEPARATE, 0);
+    if (cmd) {
+        cmd->a[0].e = face;
+        cmd->a[1].e = fail;
+        cmd->a[2].e = zfail;
+        cmd->a[3].e = zpass;
+    } else {
+        glStencilOpSeparate(face, fail, zfail, zpass);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
@@ -936,42 +1911,87 @@ ppb_opengles2_TexImage2D(PP_Resource context, GLenum target, GLint level, GLint
                          GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type,
                          const void *pixels)
 {
-    PROLOGUE(g3d, return);
-    glTexImage2D(target, level, internalformat, width, height, border, format, type, pixels);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_TEX_IMAGE_2D,
+                      pixels ? image_data_size(g3d->cmd_buffer, width, height, format, type)
+                             : 0);
+    if (prof.start && pixels) {
+        const size_t sz = image_data_size(g3d->cmd_buffer, width, height, format, type);
+        prof.bytes = (sz != GL_CMD_IMMEDIATE) ? sz : 0;
+    }
+    if (cmd) {
+        cmd->a[0].e = target;
+        cmd->a[1].i = level;
+        cmd->a[2].i = internalformat;
+        cmd->a[3].s = width;
+        cmd->a[4].s = height;
+        cmd->a[5].i = border;
+        cmd->a[6].e = format;
+        cmd->a[7].e = type;
+        cmd->a[8].p = gl_cmd_buffer_copy_payload(cmd, pixels,
+                        image_data_size(g3d->cmd_buffer, width, height, format, type));
+    } else {
+        glTexImage2D(target, level, internalformat, width, height, border, format, type, pixels);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_TexParameterf(PP_Resource context, GLenum target, GLenum pname, GLfloat param)
 {
-    PROLOGUE(g3d, return);
-    glTexParameterf(target, pname, param);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_TEX_PARAMETERF, 0);
+    prof.e = pname;
+    if (cmd) {
+        cmd->a[0].e = target;
+        cmd->a[1].e = pname;
+        cmd->a[2].f = param;
+    } else {
+        glTexParameterf(target, pname, param);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_TexParameterfv(PP_Resource context, GLenum target, GLenum pname,
                              const GLfloat *params)
 {
-    PROLOGUE(g3d, return);
-    glTexParameterfv(target, pname, params);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_TEX_PARAMETERFV, params ? sizeof(GLfloat) : 0);
+    if (cmd) {
+        cmd->a[0].e = target;
+        cmd->a[1].e = pname;
+        cmd->a[2].p = gl_cmd_buffer_copy_payload(cmd, params, sizeof(GLfloat));
+    } else {
+        glTexParameterfv(target, pname, params);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_TexParameteri(PP_Resource context, GLenum target, GLenum pname, GLint param)
 {
-    PROLOGUE(g3d, return);
-    glTexParameteri(target, pname, param);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_TEX_PARAMETERI, 0);
+    prof.e = pname;
+    if (cmd) {
+        cmd->a[0].e = target;
+        cmd->a[1].e = pname;
+        cmd->a[2].i = param;
+    } else {
+        glTexParameteri(target, pname, param);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_TexParameteriv(PP_Resource context, GLenum target, GLenum pname, const GLint *params)
 {
-    PROLOGUE(g3d, return);
-    glTexParameteriv(target, pname, params);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_TEX_PARAMETERIV, params ? sizeof(GLint) : 0);
+    if (cmd) {
+        cmd->a[0].e = target;
+        cmd->a[1].e = pname;
+        cmd->a[2].p = gl_cmd_buffer_copy_payload(cmd, params, sizeof(GLint));
+    } else {
+        glTexParameteriv(target, pname, params);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
@@ -979,173 +1999,320 @@ ppb_opengles2_TexSubImage2D(PP_Resource context, GLenum target, GLint level, GLi
                             GLint yoffset, GLsizei width, GLsizei height, GLenum format,
                             GLenum type, const void *pixels)
 {
-    PROLOGUE(g3d, return);
-    glTexSubImage2D(target, level, xoffset, yoffset, width, height, format, type, pixels);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_TEX_SUB_IMAGE_2D,
+                      pixels ? image_data_size(g3d->cmd_buffer, width, height, format, type)
+                             : 0);
+    if (prof.start && pixels) {
+        const size_t sz = image_data_size(g3d->cmd_buffer, width, height, format, type);
+        prof.bytes = (sz != GL_CMD_IMMEDIATE) ? sz : 0;
+    }
+    if (cmd) {
+        cmd->a[0].e = target;
+        cmd->a[1].i = level;
+        cmd->a[2].i = xoffset;
+        cmd->a[3].i = yoffset;
+        cmd->a[4].s = width;
+        cmd->a[5].s = height;
+        cmd->a[6].e = format;
+        cmd->a[7].e = type;
+        cmd->a[8].p = gl_cmd_buffer_copy_payload(cmd, pixels,
+                        image_data_size(g3d->cmd_buffer, width, height, format, type));
+    } else {
+        glTexSubImage2D(target, level, xoffset, yoffset, width, height, format, type, pixels);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_Uniform1f(PP_Resource context, GLint location, GLfloat x)
 {
-    PROLOGUE(g3d, return);
-    glUniform1f(location, x);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_UNIFORM_1F, 0);
+    if (cmd) {
+        cmd->a[0].i = location;
+        cmd->a[1].f = x;
+    } else {
+        glUniform1f(location, x);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_Uniform1fv(PP_Resource context, GLint location, GLsizei count, const GLfloat *v)
 {
-    PROLOGUE(g3d, return);
-    glUniform1fv(location, count, v);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_UNIFORM_1FV, v ? count * 1 * sizeof(GLfloat) : 0);
+    if (cmd) {
+        cmd->a[0].i = location;
+        cmd->a[1].s = count;
+        cmd->a[2].p = gl_cmd_buffer_copy_payload(cmd, v, count * 1 * sizeof(GLfloat));
+    } else {
+        glUniform1fv(location, count, v);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_Uniform1i(PP_Resource context, GLint location, GLint x)
 {
-    PROLOGUE(g3d, return);
-    glUniform1i(location, x);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_UNIFORM_1I, 0);
+    if (cmd) {
+        cmd->a[0].i = location;
+        cmd->a[1].i = x;
+    } else {
+        glUniform1i(location, x);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_Uniform1iv(PP_Resource context, GLint location, GLsizei count, const GLint *v)
 {
-    PROLOGUE(g3d, return);
-    glUniform1iv(location, count, v);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_UNIFORM_1IV, v ? count * 1 * sizeof(GLint) : 0);
+    if (cmd) {
+        cmd->a[0].i = location;
+        cmd->a[1].s = count;
+        cmd->a[2].p = gl_cmd_buffer_copy_payload(cmd, v, count * 1 * sizeof(GLint));
+    } else {
+        glUniform1iv(location, count, v);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_Uniform2f(PP_Resource context, GLint location, GLfloat x, GLfloat y)
 {
-    PROLOGUE(g3d, return);
-    glUniform2f(location, x, y);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_UNIFORM_2F, 0);
+    if (cmd) {
+        cmd->a[0].i = location;
+        cmd->a[1].f = x;
+        cmd->a[2].f = y;
+    } else {
+        glUniform2f(location, x, y);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_Uniform2fv(PP_Resource context, GLint location, GLsizei count, const GLfloat *v)
 {
-    PROLOGUE(g3d, return);
-    glUniform2fv(location, count, v);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_UNIFORM_2FV, v ? count * 2 * sizeof(GLfloat) : 0);
+    if (cmd) {
+        cmd->a[0].i = location;
+        cmd->a[1].s = count;
+        cmd->a[2].p = gl_cmd_buffer_copy_payload(cmd, v, count * 2 * sizeof(GLfloat));
+    } else {
+        glUniform2fv(location, count, v);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_Uniform2i(PP_Resource context, GLint location, GLint x, GLint y)
 {
-    PROLOGUE(g3d, return);
-    glUniform2i(location, x, y);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_UNIFORM_2I, 0);
+    if (cmd) {
+        cmd->a[0].i = location;
+        cmd->a[1].i = x;
+        cmd->a[2].i = y;
+    } else {
+        glUniform2i(location, x, y);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_Uniform2iv(PP_Resource context, GLint location, GLsizei count, const GLint *v)
 {
-    PROLOGUE(g3d, return);
-    glUniform2iv(location, count, v);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_UNIFORM_2IV, v ? count * 2 * sizeof(GLint) : 0);
+    if (cmd) {
+        cmd->a[0].i = location;
+        cmd->a[1].s = count;
+        cmd->a[2].p = gl_cmd_buffer_copy_payload(cmd, v, count * 2 * sizeof(GLint));
+    } else {
+        glUniform2iv(location, count, v);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_Uniform3f(PP_Resource context, GLint location, GLfloat x, GLfloat y, GLfloat z)
 {
-    PROLOGUE(g3d, return);
-    glUniform3f(location, x, y, z);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_UNIFORM_3F, 0);
+    if (cmd) {
+        cmd->a[0].i = location;
+        cmd->a[1].f = x;
+        cmd->a[2].f = y;
+        cmd->a[3].f = z;
+    } else {
+        glUniform3f(location, x, y, z);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_Uniform3fv(PP_Resource context, GLint location, GLsizei count, const GLfloat *v)
 {
-    PROLOGUE(g3d, return);
-    glUniform3fv(location, count, v);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_UNIFORM_3FV, v ? count * 3 * sizeof(GLfloat) : 0);
+    if (cmd) {
+        cmd->a[0].i = location;
+        cmd->a[1].s = count;
+        cmd->a[2].p = gl_cmd_buffer_copy_payload(cmd, v, count * 3 * sizeof(GLfloat));
+    } else {
+        glUniform3fv(location, count, v);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_Uniform3i(PP_Resource context, GLint location, GLint x, GLint y, GLint z)
 {
-    PROLOGUE(g3d, return);
-    glUniform3i(location, x, y, z);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_UNIFORM_3I, 0);
+    if (cmd) {
+        cmd->a[0].i = location;
+        cmd->a[1].i = x;
+        cmd->a[2].i = y;
+        cmd->a[3].i = z;
+    } else {
+        glUniform3i(location, x, y, z);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_Uniform3iv(PP_Resource context, GLint location, GLsizei count, const GLint *v)
 {
-    PROLOGUE(g3d, return);
-    glUniform3iv(location, count, v);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_UNIFORM_3IV, v ? count * 3 * sizeof(GLint) : 0);
+    if (cmd) {
+        cmd->a[0].i = location;
+        cmd->a[1].s = count;
+        cmd->a[2].p = gl_cmd_buffer_copy_payload(cmd, v, count * 3 * sizeof(GLint));
+    } else {
+        glUniform3iv(location, count, v);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_Uniform4f(PP_Resource context, GLint location, GLfloat x, GLfloat y, GLfloat z,
                         GLfloat w)
 {
-    PROLOGUE(g3d, return);
-    glUniform4f(location, x, y, z, w);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_UNIFORM_4F, 0);
+    if (cmd) {
+        cmd->a[0].i = location;
+        cmd->a[1].f = x;
+        cmd->a[2].f = y;
+        cmd->a[3].f = z;
+        cmd->a[4].f = w;
+    } else {
+        glUniform4f(location, x, y, z, w);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_Uniform4fv(PP_Resource context, GLint location, GLsizei count, const GLfloat *v)
 {
-    PROLOGUE(g3d, return);
-    glUniform4fv(location, count, v);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_UNIFORM_4FV, v ? count * 4 * sizeof(GLfloat) : 0);
+    if (cmd) {
+        cmd->a[0].i = location;
+        cmd->a[1].s = count;
+        cmd->a[2].p = gl_cmd_buffer_copy_payload(cmd, v, count * 4 * sizeof(GLfloat));
+    } else {
+        glUniform4fv(location, count, v);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_Uniform4i(PP_Resource context, GLint location, GLint x, GLint y, GLint z, GLint w)
 {
-    PROLOGUE(g3d, return);
-    glUniform4i(location, x, y, z, w);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_UNIFORM_4I, 0);
+    if (cmd) {
+        cmd->a[0].i = location;
+        cmd->a[1].i = x;
+        cmd->a[2].i = y;
+        cmd->a[3].i = z;
+        cmd->a[4].i = w;
+    } else {
+        glUniform4i(location, x, y, z, w);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_Uniform4iv(PP_Resource context, GLint location, GLsizei count, const GLint *v)
 {
-    PROLOGUE(g3d, return);
-    glUniform4iv(location, count, v);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_UNIFORM_4IV, v ? count * 4 * sizeof(GLint) : 0);
+    if (cmd) {
+        cmd->a[0].i = location;
+        cmd->a[1].s = count;
+        cmd->a[2].p = gl_cmd_buffer_copy_payload(cmd, v, count * 4 * sizeof(GLint));
+    } else {
+        glUniform4iv(location, count, v);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_UniformMatrix2fv(PP_Resource context, GLint location, GLsizei count,
                                GLboolean transpose, const GLfloat *value)
 {
-    PROLOGUE(g3d, return);
-    glUniformMatrix2fv(location, count, transpose, value);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_UNIFORM_MATRIX_2FV, value ? count * 4 * sizeof(GLfloat) : 0);
+    if (cmd) {
+        cmd->a[0].i = location;
+        cmd->a[1].s = count;
+        cmd->a[2].b = transpose;
+        cmd->a[3].p = gl_cmd_buffer_copy_payload(cmd, value, count * 4 * sizeof(GLfloat));
+    } else {
+        glUniformMatrix2fv(location, count, transpose, value);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_UniformMatrix3fv(PP_Resource context, GLint location, GLsizei count,
                                GLboolean transpose, const GLfloat *value)
 {
-    PROLOGUE(g3d, return);
-    glUniformMatrix3fv(location, count, transpose, value);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_UNIFORM_MATRIX_3FV, value ? count * 9 * sizeof(GLfloat) : 0);
+    if (cmd) {
+        cmd->a[0].i = location;
+        cmd->a[1].s = count;
+        cmd->a[2].b = transpose;
+        cmd->a[3].p = gl_cmd_buffer_copy_payload(cmd, value, count * 9 * sizeof(GLfloat));
+    } else {
+        glUniformMatrix3fv(location, count, transpose, value);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_UniformMatrix4fv(PP_Resource context, GLint location, GLsizei count,
                                GLboolean transpose, const GLfloat *value)
 {
-    PROLOGUE(g3d, return);
-    glUniformMatrix4fv(location, count, transpose, value);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_UNIFORM_MATRIX_4FV, value ? count * 16 * sizeof(GLfloat) : 0);
+    if (cmd) {
+        cmd->a[0].i = location;
+        cmd->a[1].s = count;
+        cmd->a[2].b = transpose;
+        cmd->a[3].p = gl_cmd_buffer_copy_payload(cmd, value, count * 16 * sizeof(GLfloat));
+    } else {
+        glUniformMatrix4fv(location, count, transpose, value);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_UseProgram(PP_Resource context, GLuint program)
 {
-    PROLOGUE(g3d, return);
-    glUseProgram(program);
-    EPILOGUE();
+    ACQUIRE_G3D(g3d);
+    SHADOW_SKIP_IF(g3d, g3d->shadow.program == program);
+    g3d->shadow.program = program_usable(g3d, program) ? program : GL_SHADOW_UNKNOWN;
+    DEFERRED_BEGIN(g3d, cmd, GLCMD_USE_PROGRAM, 0);
+    if (cmd) {
+        cmd->a[0].u = program;
+    } else {
+        glUseProgram(program);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
@@ -1159,9 +2326,14 @@ ppb_opengles2_ValidateProgram(PP_Resource context, GLuint program)
 void
 ppb_opengles2_VertexAttrib1f(PP_Resource context, GLuint indx, GLfloat x)
 {
-    PROLOGUE(g3d, return);
-    glVertexAttrib1f(indx, x);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_VERTEX_ATTRIB_1F, 0);
+    if (cmd) {
+        cmd->a[0].u = indx;
+        cmd->a[1].f = x;
+    } else {
+        glVertexAttrib1f(indx, x);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
@@ -1175,9 +2347,15 @@ ppb_opengles2_VertexAttrib1fv(PP_Resource context, GLuint indx, const GLfloat *v
 void
 ppb_opengles2_VertexAttrib2f(PP_Resource context, GLuint indx, GLfloat x, GLfloat y)
 {
-    PROLOGUE(g3d, return);
-    glVertexAttrib2f(indx, x, y);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_VERTEX_ATTRIB_2F, 0);
+    if (cmd) {
+        cmd->a[0].u = indx;
+        cmd->a[1].f = x;
+        cmd->a[2].f = y;
+    } else {
+        glVertexAttrib2f(indx, x, y);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
@@ -1191,9 +2369,16 @@ ppb_opengles2_VertexAttrib2fv(PP_Resource context, GLuint indx, const GLfloat *v
 void
 ppb_opengles2_VertexAttrib3f(PP_Resource context, GLuint indx, GLfloat x, GLfloat y, GLfloat z)
 {
-    PROLOGUE(g3d, return);
-    glVertexAttrib3f(indx, x, y, z);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_VERTEX_ATTRIB_3F, 0);
+    if (cmd) {
+        cmd->a[0].u = indx;
+        cmd->a[1].f = x;
+        cmd->a[2].f = y;
+        cmd->a[3].f = z;
+    } else {
+        glVertexAttrib3f(indx, x, y, z);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
@@ -1208,9 +2393,17 @@ void
 ppb_opengles2_VertexAttrib4f(PP_Resource context, GLuint indx, GLfloat x, GLfloat y, GLfloat z,
                              GLfloat w)
 {
-    PROLOGUE(g3d, return);
-    glVertexAttrib4f(indx, x, y, z, w);
-    EPILOGUE();
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_VERTEX_ATTRIB_4F, 0);
+    if (cmd) {
+        cmd->a[0].u = indx;
+        cmd->a[1].f = x;
+        cmd->a[2].f = y;
+        cmd->a[3].f = z;
+        cmd->a[4].f = w;
+    } else {
+        glVertexAttrib4f(indx, x, y, z, w);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
@@ -1225,17 +2418,50 @@ void
 ppb_opengles2_VertexAttribPointer(PP_Resource context, GLuint indx, GLint size, GLenum type,
                                   GLboolean normalized, GLsizei stride, const void *ptr)
 {
-    PROLOGUE(g3d, return);
-    glVertexAttribPointer(indx, size, type, normalized, stride, ptr);
-    EPILOGUE();
+    // without bound array buffer, ptr points to client memory
+    DEFERRED_PROLOGUE(g3d, cmd, GLCMD_VERTEX_ATTRIB_POINTER,
+                      g3d->cmd_buffer->array_buffer ? 0 : GL_CMD_IMMEDIATE);
+    if (cmd) {
+        cmd->a[0].u = indx;
+        cmd->a[1].i = size;
+        cmd->a[2].e = type;
+        cmd->a[3].b = normalized;
+        cmd->a[4].s = stride;
+        cmd->a[5].p = ptr;
+    } else {
+        glVertexAttribPointer(indx, size, type, normalized, stride, ptr);
+    }
+    if (g3d->cmd_buffer && indx < 32) {
+        if (g3d->cmd_buffer->array_buffer)
+            g3d->cmd_buffer->client_arrays &= ~(1u << indx);
+        else
+            g3d->cmd_buffer->client_arrays |= (1u << indx);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 void
 ppb_opengles2_Viewport(PP_Resource context, GLint x, GLint y, GLsizei width, GLsizei height)
 {
-    PROLOGUE(g3d, return);
-    glViewport(x, y, width, height);
-    EPILOGUE();
+    ACQUIRE_G3D(g3d);
+    GLint *vp = g3d->shadow.viewport;
+    SHADOW_SKIP_IF(g3d, vp[0] == x && vp[1] == y && vp[2] == width && vp[3] == height);
+    if (width >= 0 && height >= 0) {
+        vp[0] = x;
+        vp[1] = y;
+        vp[2] = width;
+        vp[3] = height;
+    }
+    DEFERRED_BEGIN(g3d, cmd, GLCMD_VIEWPORT, 0);
+    if (cmd) {
+        cmd->a[0].i = x;
+        cmd->a[1].i = y;
+        cmd->a[2].s = width;
+        cmd->a[3].s = height;
+    } else {
+        glViewport(x, y, width, height);
+    }
+    DEFERRED_EPILOGUE(g3d, cmd);
 }
 
 GLboolean
@@ -1245,29 +2471,75 @@ ppb_opengles2_chromium_enable_feature_enable_feature_chromium(PP_Resource contex
     return PP_FALSE;
 }
 
+struct sub_mapping_param_s {
+    int             is_texture;
+    GLenum          target;
+    GLintptr        offset;     ///< buffer mappings only
+    GLsizeiptr      size;       ///< buffer mappings only
+    GLint           level;
+    GLint           xoffset;
+    GLint           yoffset;
+    GLsizei         width;
+    GLsizei         height;
+    GLenum          format;
+    GLenum          type;
+    GLenum          access;
+};
+
 void *
 ppb_opengles2_chromium_map_sub_map_buffer_sub_data_chromium(PP_Resource context, GLuint target,
                                                             GLintptr offset, GLsizeiptr size,
                                                             GLenum access)
 {
-    return NULL;
+    if (access != GL_WRITE_ONLY_OES || offset < 0 || size < 0) {
+        trace_error("%s, bad arguments\n", __func__);
+        return NULL;
+    }
+
+    struct pp_graphics3d_s *g3d = pp_resource_acquire(context, PP_RESOURCE_GRAPHICS3D);
+    if (!g3d) {
+        trace_error("%s, bad resource\n", __func__);
+        return NULL;
+    }
+
+    void *res = staging_pool_alloc(&g3d->staging, size);
+    if (!res) {
+        trace_error("%s, can't allocate memory\n", __func__);
+        goto err;
+    }
+
+    struct sub_mapping_param_s *map_params = g_slice_alloc0(sizeof(*map_params));
+    map_params->is_texture = 0;
+    map_params->target = target;
+    map_params->offset = offset;
+    map_params->size = size;
+    map_params->access = access;
+
+    g_hash_table_insert(g3d->sub_maps, res, map_params);
+
+err:
+    pp_resource_release(context);
+    return res;
 }
 
 void
 ppb_opengles2_chromium_map_sub_unmap_buffer_sub_data_chromium(PP_Resource context, const void *mem)
 {
-}
+    PROLOGUE(g3d, return);
+    struct sub_mapping_param_s *mp = g_hash_table_lookup(g3d->sub_maps, mem);
+    if (!mp || mp->is_texture) {
+        trace_error("%s, memory was not mapped\n", __func__);
+        goto err;
+    }
 
-struct tex_sub_mapping_param_s {
-    GLint           level;
-    GLint           xoffset;
-    GLint           yoffset;
-    GLsizei         width;
-    GLsizei         height;
-    GLenum          format;
-    GLenum          type;
-    GLenum          access;
-};
+    g_hash_table_remove(g3d->sub_maps, mem);
+    glBufferSubData(mp->target, mp->offset, mp->size, mem);
+    g_slice_free(struct sub_mapping_param_s, mp);
+    staging_pool_free(&g3d->staging, (void *)mem);
+
+err:
+    EPILOGUE();
+}
 
 void *
 ppb_opengles2_chromium_map_sub_map_tex_sub_image_2d_chromium(PP_Resource context, GLenum target,
@@ -1276,7 +2548,9 @@ ppb_opengles2_chromium_map_sub_map_tex_sub_image_2d_chromium(PP_Resource context
                                                              GLsizei height, GLenum format,
                                                              GLenum type, GLenum access)
 {
-    if (target != GL_TEXTURE_2D || level != 0 || access != GL_WRITE_ONLY_OES) {
+    if (target != GL_TEXTURE_2D || level != 0 || access != GL_WRITE_ONLY_OES || width < 0 ||
+        height < 0)
+    {
         trace_error("%s, bad arguments\n", __func__);
         return NULL;
     }
@@ -1287,7 +2561,16 @@ ppb_opengles2_chromium_map_sub_map_tex_sub_image_2d_chromium(PP_Resource context
         return NULL;
     }
 
-    struct tex_sub_mapping_param_s *map_params = g_slice_alloc(sizeof(*map_params));
+    int bytes_per_pixel = (GL_RGB == format) ? 3 : 4;
+    void *res = staging_pool_alloc(&g3d->staging, (size_t)width * height * bytes_per_pixel);
+    if (!res) {
+        trace_error("%s, can't allocate memory\n", __func__);
+        goto err;
+    }
+
+    struct sub_mapping_param_s *map_params = g_slice_alloc0(sizeof(*map_params));
+    map_params->is_texture = 1;
+    map_params->target = target;
     map_params->level = level;
     map_params->xoffset = xoffset;
     map_params->yoffset = yoffset;
@@ -1297,11 +2580,9 @@ ppb_opengles2_chromium_map_sub_map_tex_sub_image_2d_chromium(PP_Resource context
     map_params->type = type;
     map_params->access = access;
 
-    int bytes_per_pixel = (GL_RGB == format) ? 3 : 4;
-    void *res = malloc(width * height * bytes_per_pixel);
-
     g_hash_table_insert(g3d->sub_maps, res, map_params);
 
+err:
     pp_resource_release(context);
     return res;
 }
@@ -1311,8 +2592,8 @@ ppb_opengles2_chromium_map_sub_unmap_tex_sub_image_2d_chromium(PP_Resource conte
                                                                const void *mem)
 {
     PROLOGUE(g3d, return);
-    struct tex_sub_mapping_param_s *mp = g_hash_table_lookup(g3d->sub_maps, mem);
-    if (!mp) {
+    struct sub_mapping_param_s *mp = g_hash_table_lookup(g3d->sub_maps, mem);
+    if (!mp || !mp->is_texture) {
         trace_error("%s, memory was not mapped\n", __func__);
         goto err;
     }
@@ -1320,13 +2601,93 @@ ppb_opengles2_chromium_map_sub_unmap_tex_sub_image_2d_chromium(PP_Resource conte
     g_hash_table_remove(g3d->sub_maps, mem);
     glTexSubImage2D(GL_TEXTURE_2D, mp->level, mp->xoffset, mp->yoffset, mp->width, mp->height,
                     mp->format, mp->type, mem);
-    g_slice_free(struct tex_sub_mapping_param_s, mp);
-    free((void *)mem);
+    g_slice_free(struct sub_mapping_param_s, mp);
+    staging_pool_free(&g3d->staging, (void *)mem);
 
 err:
     EPILOGUE();
 }
 
+void
+ppb_opengles2_release_sub_maps(struct pp_graphics3d_s *g3d)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+
+    g_hash_table_iter_init(&iter, g3d->sub_maps);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        staging_pool_free(&g3d->staging, key);
+        g_slice_free(struct sub_mapping_param_s, value);
+    }
+    g_hash_table_remove_all(g3d->sub_maps);
+}
+
+void
+ppb_opengles2_init_program_tracking(struct pp_graphics3d_s *g3d)
+{
+    g3d->shaders = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, shader_info_free);
+    g3d->programs = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+                                          program_info_free);
+    g3d->texture_targets = g_hash_table_new(g_direct_hash, g_direct_equal);
+    g3d->buffers = g_hash_table_new(g_direct_hash, g_direct_equal);
+    g3d->renderbuffers = g_hash_table_new(g_direct_hash, g_direct_equal);
+    g3d->framebuffers = g_hash_table_new(g_direct_hash, g_direct_equal);
+}
+
+void
+ppb_opengles2_release_program_tracking(struct pp_graphics3d_s *g3d)
+{
+    g_hash_table_destroy(g3d->shaders);
+    g_hash_table_destroy(g3d->programs);
+    g_hash_table_destroy(g3d->texture_targets);
+    g_hash_table_destroy(g3d->buffers);
+    g_hash_table_destroy(g3d->renderbuffers);
+    g_hash_table_destroy(g3d->framebuffers);
+    g3d->shaders = NULL;
+    g3d->programs = NULL;
+    g3d->texture_targets = NULL;
+    g3d->buffers = NULL;
+    g3d->renderbuffers = NULL;
+    g3d->framebuffers = NULL;
+}
+
+void
+ppb_opengles2_delete_objects(struct pp_graphics3d_s *g3d)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+
+    // deleting program detaches its shaders, so they go after programs
+    g_hash_table_iter_init(&iter, g3d->programs);
+    while (g_hash_table_iter_next(&iter, &key, NULL))
+        glDeleteProgram(GPOINTER_TO_UINT(key));
+    g_hash_table_remove_all(g3d->programs);
+
+    g_hash_table_iter_init(&iter, g3d->shaders);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        struct shader_info_s *si = value;
+        if (!si->deleted)
+            glDeleteShader(GPOINTER_TO_UINT(key));
+    }
+    g_hash_table_remove_all(g3d->shaders);
+
+    delete_names(g3d->texture_targets, glDeleteTextures);
+    delete_names(g3d->buffers, glDeleteBuffers);
+    delete_names(g3d->renderbuffers, glDeleteRenderbuffers);
+    delete_names(g3d->framebuffers, glDeleteFramebuffers);
+}
+
+void
+ppb_opengles2_compile_pending_shaders(struct pp_graphics3d_s *g3d)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+
+    g_hash_table_iter_init(&iter, g3d->shaders);
+    while (g_hash_table_iter_next(&iter, &key, &value))
+        ensure_compiled(value, GPOINTER_TO_UINT(key));
+}
+
 void
 ppb_opengles2_framebuffer_blit_blit_framebuffer_ext(PP_Resource context, GLint srcX0, GLint srcY0,
                                                     GLint srcX1, GLint srcY1, GLint dstX0,
@@ -2759,7 +4120,7 @@ trace_ppb_opengles2_chromium_map_sub_map_buffer_sub_data_chromium(PP_Resource co
                                                                   GLuint target, GLintptr offset,
                                                                   GLsizeiptr size, GLenum access)
 {
-    trace_info("[PPB] {zilch} %s context=%d, target=%u, offset=%ld, size=%lu, access=%u(%s)\n",
+    trace_info("[PPB] {full} %s context=%d, target=%u, offset=%ld, size=%lu, access=%u(%s)\n",
                __func__+6, context, target, (long)offset, (unsigned long)size, access,
                reverse_gl_enum(access));
     return ppb_opengles2_chromium_map_sub_map_buffer_sub_data_chromium(context, target, offset,
@@ -2771,7 +4132,7 @@ void
 trace_ppb_opengles2_chromium_map_sub_unmap_buffer_sub_data_chromium(PP_Resource context,
                                                                     const void *mem)
 {
-    trace_info("[PPB] {zilch} %s context=%d, mem=%p\n", __func__+6, context, mem);
+    trace_info("[PPB] {full} %s context=%d, mem=%p\n", __func__+6, context, mem);
     ppb_opengles2_chromium_map_sub_unmap_buffer_sub_data_chromium(context, mem);
 }
 
@@ -3082,8 +4443,8 @@ const struct PPB_OpenGLES2ChromiumEnableFeature ppb_opengles2_chromium_enable_fe
 };
 
 const struct PPB_OpenGLES2ChromiumMapSub ppb_opengles2_chromium_map_sub_interface_1_0 = {
-    .MapBufferSubDataCHROMIUM =   TWRAPZ(ppb_opengles2_chromium_map_sub_map_buffer_sub_data_chromium),
-    .UnmapBufferSubDataCHROMIUM = TWRAPZ(ppb_opengles2_chromium_map_sub_unmap_buffer_sub_data_chromium),
+    .MapBufferSubDataCHROMIUM =   TWRAPF(ppb_opengles2_chromium_map_sub_map_buffer_sub_data_chromium),
+    .UnmapBufferSubDataCHROMIUM = TWRAPF(ppb_opengles2_chromium_map_sub_unmap_buffer_sub_data_chromium),
     .MapTexSubImage2DCHROMIUM =   TWRAPF(ppb_opengles2_chromium_map_sub_map_tex_sub_image_2d_chromium),
     .UnmapTexSubImage2DCHROMIUM = TWRAPF(ppb_opengles2_chromium_map_sub_unmap_tex_sub_image_2d_chromium),
 };
@@ -523,6 +523,29 @@ void
 ppb_opengles2_chromium_map_sub_unmap_tex_sub_image_2d_chromium(PP_Resource context,
                                                                const void *mem);
 
+struct pp_graphics3d_s;
+
+/// frees memory of all MapSub mappings which are still active
+void
+ppb_opengles2_release_sub_maps(struct pp_graphics3d_s *g3d);
+
+/// sets up tracking of objects plugin creates. Programs and shaders are used by program binary
+/// cache, all of them are deleted before context is pooled
+void
+ppb_opengles2_init_program_tracking(struct pp_graphics3d_s *g3d);
+
+void
+ppb_opengles2_release_program_tracking(struct pp_graphics3d_s *g3d);
+
+/// deletes every object plugin created in the context, so context can be given to another
+/// resource. Context must be current
+void
+ppb_opengles2_delete_objects(struct pp_graphics3d_s *g3d);
+
+/// compiles shaders which compilation was deferred. Context must be current
+void
+ppb_opengles2_compile_pending_shaders(struct pp_graphics3d_s *g3d);
+
 void
 ppb_opengles2_framebuffer_blit_blit_framebuffer_ext(PP_Resource context, GLint srcX0, GLint srcY0,
                                                     GLint srcX1, GLint srcY1, GLint dstX0,
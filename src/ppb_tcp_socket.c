@@ -23,17 +23,101 @@
  */
 
 #include "ppb_tcp_socket.h"
+#include <errno.h>
+#include <glib.h>
 #include <stdlib.h>
+#include <sys/epoll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <ppapi/c/pp_errors.h>
 #include "ppb_core.h"
+#include "ppb_message_loop.h"
 #include "trace.h"
 #include "tables.h"
 #include "pp_resource.h"
 #include "async_network.h"
 
 
+// Reads and writes are done by the main message loop itself, right when socket becomes ready,
+// and their callbacks are called from there. Socket is watched only while some operation is
+// pending.
+
+static
+void
+handle_socket_event(int fd, uint32_t events, void *user_data);
+
+static
+int32_t
+update_watch(struct pp_tcp_socket_s *ts)
+{
+    PP_Resource m_loop = ppb_message_loop_get_for_main_thread();
+    const uint32_t events = (ts->read_pending ? EPOLLIN : 0) | (ts->write_pending ? EPOLLOUT : 0);
+
+    if (events == 0) {
+        if (ts->watched)
+            ppb_message_loop_unwatch_fd(m_loop, ts->sock);
+        ts->watched = 0;
+        return PP_OK;
+    }
+
+    int32_t ret = ppb_message_loop_watch_fd(m_loop, ts->sock, events, handle_socket_event,
+                                            GSIZE_TO_POINTER(ts->self_id));
+    if (ret == PP_OK)
+        ts->watched = 1;
+    return ret;
+}
+
+static
+void
+handle_socket_event(int fd, uint32_t events, void *user_data)
+{
+    PP_Resource tcp_socket = GPOINTER_TO_SIZE(user_data);
+    struct pp_tcp_socket_s *ts = pp_resource_acquire(tcp_socket, PP_RESOURCE_TCP_SOCKET);
+    if (!ts)
+        return;
+
+    struct PP_CompletionCallback read_ccb = { .func = NULL };
+    struct PP_CompletionCallback write_ccb = { .func = NULL };
+    int32_t read_result = 0;
+    int32_t write_result = 0;
+    const uint32_t failure = EPOLLERR | EPOLLHUP;
+
+    if (ts->read_pending && (events & (EPOLLIN | failure))) {
+        int32_t ret = recv(fd, ts->read_buffer, ts->read_size, MSG_DONTWAIT);
+        if (ret >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            if (ret < 0)
+                ret = async_network_get_pp_errno();
+            else if (ret == 0)
+                ts->seen_eof = 1;
+
+            ts->read_pending = 0;
+            read_ccb = ts->read_ccb;
+            read_result = ret;
+        }
+    }
+
+    if (ts->write_pending && (events & (EPOLLOUT | failure))) {
+        int32_t ret = send(fd, ts->write_buffer, ts->write_size, MSG_DONTWAIT);
+        if (ret >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            if (ret < 0)
+                ret = async_network_get_pp_errno();
+
+            ts->write_pending = 0;
+            write_ccb = ts->write_ccb;
+            write_result = ret;
+        }
+    }
+
+    update_watch(ts);
+    pp_resource_release(tcp_socket);
+
+    if (read_ccb.func)
+        read_ccb.func(read_ccb.user_data, read_result);
+    if (write_ccb.func)
+        write_ccb.func(write_ccb.user_data, write_result);
+}
+
+
 PP_Resource
 ppb_tcp_socket_create(PP_Instance instance)
 {
@@ -61,6 +145,15 @@ ppb_tcp_socket_destroy(void *ptr)
     if (!ts->destroyed) {
         struct async_network_task_s *task = async_network_task_create();
 
+        // socket is not going to be read from or written to anymore
+        if (ts->read_pending)
+            ppb_core_call_on_main_thread(0, ts->read_ccb, PP_ERROR_ABORTED);
+        if (ts->write_pending)
+            ppb_core_call_on_main_thread(0, ts->write_ccb, PP_ERROR_ABORTED);
+        ts->read_pending = 0;
+        ts->write_pending = 0;
+        update_watch(ts);
+
         ts->destroyed = 1;
         ts->is_connected = 0;
 
@@ -219,20 +312,26 @@ ppb_tcp_socket_read(PP_Resource tcp_socket, char *buffer, int32_t bytes_to_read,
         return PP_ERROR_FAILED;
     }
 
+    if (ts->read_pending) {
+        trace_warning("%s, read is in progress\n", __func__);
+        pp_resource_release(tcp_socket);
+        return PP_ERROR_INPROGRESS;
+    }
+
     if (bytes_to_read > 1024 * 1024)
         bytes_to_read = 1024 * 1024;
 
-    struct async_network_task_s *task = async_network_task_create();
+    ts->read_buffer = buffer;
+    ts->read_size = bytes_to_read;
+    ts->read_ccb = callback;
+    ts->read_pending = 1;
+    if (update_watch(ts) != PP_OK) {
+        ts->read_pending = 0;
+        pp_resource_release(tcp_socket);
+        return PP_ERROR_FAILED;
+    }
 
-    task->type = ASYNC_NETWORK_TCP_READ;
-    task->resource = tcp_socket;
-    task->instance = ts->instance;
-    task->buffer = buffer;
-    task->bufsize = bytes_to_read;
-    task->callback = callback;
     pp_resource_release(tcp_socket);
-
-    async_network_task_push(task);
     return PP_OK_COMPLETIONPENDING;
 }
 
@@ -257,20 +356,26 @@ ppb_tcp_socket_write(PP_Resource tcp_socket, const char *buffer, int32_t bytes_t
         return PP_ERROR_FAILED;
     }
 
+    if (ts->write_pending) {
+        trace_warning("%s, write is in progress\n", __func__);
+        pp_resource_release(tcp_socket);
+        return PP_ERROR_INPROGRESS;
+    }
+
     if (bytes_to_write > 1024 * 1024)
         bytes_to_write = 1024 * 1024;
 
-    struct async_network_task_s *task = async_network_task_create();
+    ts->write_buffer = buffer;
+    ts->write_size = bytes_to_write;
+    ts->write_ccb = callback;
+    ts->write_pending = 1;
+    if (update_watch(ts) != PP_OK) {
+        ts->write_pending = 0;
+        pp_resource_release(tcp_socket);
+        return PP_ERROR_FAILED;
+    }
 
-    task->type = ASYNC_NETWORK_TCP_WRITE;
-    task->resource = tcp_socket;
-    task->instance = ts->instance;
-    task->buffer = (char *)buffer;
-    task->bufsize = bytes_to_write;
-    task->callback = callback;
     pp_resource_release(tcp_socket);
-
-    async_network_task_push(task);
     return PP_OK_COMPLETIONPENDING;
 }
 
@@ -66,6 +66,46 @@ ppb_url_loader_create(PP_Instance instance)
     return url_loader;
 }
 
+// blocking (callback-less) open and follow_redirect wait on this until stream is finished
+static pthread_mutex_t  finished_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   finished_cond = PTHREAD_COND_INITIALIZER;
+static uint64_t         finished_gen = 0;
+
+
+void
+ppb_url_loader_notify_finished_loading(void)
+{
+    pthread_mutex_lock(&finished_lock);
+    finished_gen ++;
+    pthread_cond_broadcast(&finished_cond);
+    pthread_mutex_unlock(&finished_lock);
+}
+
+static
+void
+wait_for_finished_loading(PP_Resource loader)
+{
+    while (1) {
+        // generation is taken before checking the flag, so notification can't be missed
+        pthread_mutex_lock(&finished_lock);
+        uint64_t gen = finished_gen;
+        pthread_mutex_unlock(&finished_lock);
+
+        struct pp_url_loader_s *ul = pp_resource_acquire(loader, PP_RESOURCE_URL_LOADER);
+        if (!ul)
+            return;
+        int done = ul->finished_loading;
+        pp_resource_release(loader);
+        if (done)
+            return;
+
+        pthread_mutex_lock(&finished_lock);
+        while (gen == finished_gen)
+            pthread_cond_wait(&finished_cond, &finished_lock);
+        pthread_mutex_unlock(&finished_lock);
+    }
+}
+
 void
 ppb_url_loader_destroy(void *p)
 {
@@ -88,6 +128,10 @@ ppb_url_loader_destroy(void *p)
 
     post_data_free(ul->post_data);
     ul->post_data = NULL;
+
+    // wake up anyone still waiting for this loader
+    ul->finished_loading = 1;
+    ppb_url_loader_notify_finished_loading();
 }
 
 PP_Bool
@@ -337,18 +381,7 @@ ppb_url_loader_open_target(PP_Resource loader, PP_Resource request_info,
         return PP_ERROR_FAILED;
 
     if (callback.func == NULL) {
-        int done = 0;
-        while (!done) {
-            ul = pp_resource_acquire(loader, PP_RESOURCE_URL_LOADER);
-            if (ul) {
-                done = ul->finished_loading;
-                pp_resource_release(loader);
-            } else {
-                break;
-            }
-            printf("waitin'\n");
-            usleep(10000);
-        }
+        wait_for_finished_loading(loader);
         return PP_OK;
     }
 
@@ -418,18 +451,7 @@ ppb_url_loader_follow_redirect(PP_Resource loader, struct PP_CompletionCallback
         return PP_ERROR_FAILED;
 
     if (callback.func == NULL) {
-        int done = 0;
-        while (!done) {
-            ul = pp_resource_acquire(loader, PP_RESOURCE_URL_LOADER);
-            if (ul) {
-                done = ul->finished_loading;
-                pp_resource_release(loader);
-            } else {
-                break;
-            }
-            printf("waitin'\n");
-            usleep(10000);
-        }
+        wait_for_finished_loading(loader);
         return PP_OK;
     }
 
@@ -49,6 +49,11 @@ ppb_url_loader_open_target(PP_Resource loader, PP_Resource request_info,
 int32_t
 ppb_url_loader_follow_redirect(PP_Resource loader, struct PP_CompletionCallback callback);
 
+/// wakes up threads blocked in callback-less Open() or FollowRedirect(). Should be called
+/// after setting |finished_loading| flag of any URL loader
+void
+ppb_url_loader_notify_finished_loading(void);
+
 PP_Bool
 ppb_url_loader_get_upload_progress(PP_Resource loader, int64_t *bytes_sent,
                                    int64_t *total_bytes_to_be_sent);
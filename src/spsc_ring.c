@@ -0,0 +1,201 @@
+/*
+ * Copyright © 2013-2014  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "spsc_ring.h"
+#include <glib.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+
+struct spsc_ring_s *
+spsc_ring_new(size_t min_capacity)
+{
+    size_t capacity = 64;
+    while (capacity < min_capacity)
+        capacity *= 2;
+
+    struct spsc_ring_s *r = g_slice_alloc0(sizeof(*r));
+    r->mask = capacity - 1;
+    r->data = g_malloc(capacity);
+    return r;
+}
+
+void
+spsc_ring_free(struct spsc_ring_s *r)
+{
+    if (!r)
+        return;
+    g_free(r->data);
+    g_slice_free1(sizeof(*r), r);
+}
+
+size_t
+spsc_ring_capacity(struct spsc_ring_s *r)
+{
+    return r->mask + 1;
+}
+
+size_t
+spsc_ring_readable(struct spsc_ring_s *r)
+{
+    size_t tail = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+    return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) - tail;
+}
+
+size_t
+spsc_ring_writable(struct spsc_ring_s *r)
+{
+    size_t head = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+    return r->mask + 1 - (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE));
+}
+
+static
+void
+notify_other_side(struct spsc_ring_s *r)
+{
+    // sequentially consistent pair with the one in wait_for_change(): either waiter sees the
+    // new |seq| value, or we see it's going to sleep
+    __atomic_add_fetch(&r->seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&r->waiters, __ATOMIC_SEQ_CST) > 0)
+        syscall(SYS_futex, &r->seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+size_t
+spsc_ring_write(struct spsc_ring_s *r, const void *data, size_t len)
+{
+    size_t head = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+    size_t free_space = r->mask + 1 - (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE));
+
+    len = MIN(len, free_space);
+    if (len == 0)
+        return 0;
+
+    size_t ofs = head & r->mask;
+    size_t first = MIN(len, r->mask + 1 - ofs);
+    memcpy(r->data + ofs, data, first);
+    memcpy(r->data, (const char *)data + first, len - first);
+
+    __atomic_store_n(&r->head, head + len, __ATOMIC_RELEASE);
+    notify_other_side(r);
+    return len;
+}
+
+size_t
+spsc_ring_read(struct spsc_ring_s *r, void *data, size_t len)
+{
+    size_t tail = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+    size_t avail = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) - tail;
+
+    len = MIN(len, avail);
+    if (len == 0)
+        return 0;
+
+    size_t ofs = tail & r->mask;
+    size_t first = MIN(len, r->mask + 1 - ofs);
+    memcpy(data, r->data + ofs, first);
+    memcpy((char *)data + first, r->data, len - first);
+
+    __atomic_store_n(&r->tail, tail + len, __ATOMIC_RELEASE);
+    notify_other_side(r);
+    return len;
+}
+
+static
+size_t
+wait_for_change(struct spsc_ring_s *r, size_t (*get_amount)(struct spsc_ring_s *), size_t len,
+                int timeout_ms, int wake_count)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000 * 1000;
+    if (deadline.tv_nsec >= 1000 * 1000 * 1000) {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000 * 1000 * 1000;
+    }
+
+    size_t amount = get_amount(r);
+    if (amount >= len)
+        return amount;
+
+    __atomic_add_fetch(&r->waiters, 1, __ATOMIC_SEQ_CST);
+    while (1) {
+        int seq = __atomic_load_n(&r->seq, __ATOMIC_SEQ_CST);
+        amount = get_amount(r);
+        if (amount >= len)
+            break;
+
+        // includes wakes made before the wait began. Wake made after this check bumps |seq|,
+        // so futex returns at once and the check is repeated
+        if (__atomic_load_n(&r->wakeups, __ATOMIC_SEQ_CST) != wake_count)
+            break;
+
+        struct timespec now, rel;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        rel.tv_sec = deadline.tv_sec - now.tv_sec;
+        rel.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+        if (rel.tv_nsec < 0) {
+            rel.tv_sec -= 1;
+            rel.tv_nsec += 1000 * 1000 * 1000;
+        }
+        if (rel.tv_sec < 0)
+            break;
+
+        // returns at once if |seq| have changed since it was read
+        syscall(SYS_futex, &r->seq, FUTEX_WAIT_PRIVATE, seq, &rel, NULL, 0);
+    }
+    __atomic_sub_fetch(&r->waiters, 1, __ATOMIC_SEQ_CST);
+
+    return amount;
+}
+
+int
+spsc_ring_wake_count(struct spsc_ring_s *r)
+{
+    return __atomic_load_n(&r->wakeups, __ATOMIC_SEQ_CST);
+}
+
+size_t
+spsc_ring_wait_writable(struct spsc_ring_s *r, size_t len, int timeout_ms, int wake_count)
+{
+    return wait_for_change(r, spsc_ring_writable, len, timeout_ms, wake_count);
+}
+
+size_t
+spsc_ring_wait_readable(struct spsc_ring_s *r, size_t len, int timeout_ms, int wake_count)
+{
+    return wait_for_change(r, spsc_ring_readable, len, timeout_ms, wake_count);
+}
+
+void
+spsc_ring_wake(struct spsc_ring_s *r)
+{
+    __atomic_add_fetch(&r->wakeups, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&r->seq, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, &r->seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
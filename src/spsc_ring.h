@@ -0,0 +1,92 @@
+/*
+ * Copyright © 2013-2014  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef FPP_SPSC_RING_H
+#define FPP_SPSC_RING_H
+
+#include <stddef.h>
+
+
+/// Lock-free single producer, single consumer byte ring. Neither side takes locks; each side
+/// owns its own index and only reads the other one. Either side may block waiting for room or
+/// data, which costs a futex wake on the opposite side only when someone actually sleeps.
+
+struct spsc_ring_s {
+    size_t          head;       ///< total bytes written, owned by producer
+    char            pad1[64 - sizeof(size_t)];
+    size_t          tail;       ///< total bytes read, owned by consumer
+    char            pad2[64 - sizeof(size_t)];
+    int             seq;        ///< bumped on every read and write, futex word
+    int             waiters;    ///< number of threads sleeping on |seq|
+    int             wakeups;    ///< bumped by spsc_ring_wake()
+    size_t          mask;
+    char           *data;
+};
+
+/// capacity is rounded up to a power of two
+struct spsc_ring_s *
+spsc_ring_new(size_t min_capacity);
+
+void
+spsc_ring_free(struct spsc_ring_s *r);
+
+size_t
+spsc_ring_capacity(struct spsc_ring_s *r);
+
+/// bytes available for reading. Exact for consumer, lower bound for everyone else
+size_t
+spsc_ring_readable(struct spsc_ring_s *r);
+
+/// free space. Exact for producer, lower bound for everyone else
+size_t
+spsc_ring_writable(struct spsc_ring_s *r);
+
+/// producer side; copies as much of |data| as fits, returns number of bytes written
+size_t
+spsc_ring_write(struct spsc_ring_s *r, const void *data, size_t len);
+
+/// consumer side; returns number of bytes read, which may be less than |len|
+size_t
+spsc_ring_read(struct spsc_ring_s *r, void *data, size_t len);
+
+/// number of spsc_ring_wake() calls so far. Should be taken before checking whatever condition
+/// wake is used to signal, and passed to the wait, so wake made in between is not lost
+int
+spsc_ring_wake_count(struct spsc_ring_s *r);
+
+/// producer side; sleeps until at least |len| bytes are free, |timeout_ms| passes, or
+/// spsc_ring_wake() count differs from |wake_count|. Returns free space, which may be less
+/// than |len|
+size_t
+spsc_ring_wait_writable(struct spsc_ring_s *r, size_t len, int timeout_ms, int wake_count);
+
+/// consumer side counterpart of spsc_ring_wait_writable()
+size_t
+spsc_ring_wait_readable(struct spsc_ring_s *r, size_t len, int timeout_ms, int wake_count);
+
+/// wakes up both sides, e.g. to make them notice shutdown request
+void
+spsc_ring_wake(struct spsc_ring_s *r);
+
+#endif // FPP_SPSC_RING_H
@@ -0,0 +1,156 @@
+/*
+ * Copyright © 2013-2014  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "staging_pool.h"
+#include <stdlib.h>
+#include <time.h>
+
+
+struct staging_block_s {
+    struct staging_block_s *next;
+    int64_t                 released;   ///< time block was returned to the pool, ms
+    int32_t                 size_class; ///< -1 for blocks too large to be cached
+};
+
+// keeps data 16-byte aligned
+#define BLOCK_HEADER_SIZE   ((sizeof(struct staging_block_s) + 15) & ~(size_t)15)
+
+static
+int64_t
+monotonic_ms(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (int64_t)t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+
+static
+size_t
+class_size(int size_class)
+{
+    return (size_t)1 << (STAGING_POOL_MIN_SHIFT + size_class);
+}
+
+static
+int
+size_to_class(size_t size)
+{
+    int size_class = 0;
+    while (size_class < STAGING_POOL_CLASS_COUNT && class_size(size_class) < size)
+        size_class ++;
+    return size_class < STAGING_POOL_CLASS_COUNT ? size_class : -1;
+}
+
+void
+staging_pool_init(struct staging_pool_s *pool)
+{
+    for (int k = 0; k < STAGING_POOL_CLASS_COUNT; k ++)
+        pool->free_list[k] = NULL;
+    pool->cached_bytes = 0;
+}
+
+void
+staging_pool_destroy(struct staging_pool_s *pool)
+{
+    for (int k = 0; k < STAGING_POOL_CLASS_COUNT; k ++) {
+        struct staging_block_s *blk = pool->free_list[k];
+        while (blk) {
+            struct staging_block_s *next = blk->next;
+            free(blk);
+            blk = next;
+        }
+        pool->free_list[k] = NULL;
+    }
+    pool->cached_bytes = 0;
+}
+
+void *
+staging_pool_alloc(struct staging_pool_s *pool, size_t size)
+{
+    const int size_class = size_to_class(size);
+    struct staging_block_s *blk;
+
+    if (size_class < 0) {
+        if (size > SIZE_MAX - BLOCK_HEADER_SIZE)
+            return NULL;
+        blk = malloc(BLOCK_HEADER_SIZE + size);
+    } else if (pool->free_list[size_class]) {
+        blk = pool->free_list[size_class];
+        pool->free_list[size_class] = blk->next;
+        pool->cached_bytes -= class_size(size_class);
+    } else {
+        blk = malloc(BLOCK_HEADER_SIZE + class_size(size_class));
+    }
+
+    if (!blk)
+        return NULL;
+
+    blk->next = NULL;
+    blk->size_class = size_class;
+    return (char *)blk + BLOCK_HEADER_SIZE;
+}
+
+void
+staging_pool_free(struct staging_pool_s *pool, void *ptr)
+{
+    if (!ptr)
+        return;
+
+    struct staging_block_s *blk = (void *)((char *)ptr - BLOCK_HEADER_SIZE);
+    if (blk->size_class < 0 ||
+        pool->cached_bytes + class_size(blk->size_class) > STAGING_POOL_MAX_CACHED)
+    {
+        free(blk);
+        return;
+    }
+
+    // most recently released blocks go first, so the stale ones gather at the tail
+    blk->released = monotonic_ms();
+    blk->next = pool->free_list[blk->size_class];
+    pool->free_list[blk->size_class] = blk;
+    pool->cached_bytes += class_size(blk->size_class);
+}
+
+void
+staging_pool_trim(struct staging_pool_s *pool, int64_t max_idle_ms)
+{
+    const int64_t threshold = monotonic_ms() - max_idle_ms;
+
+    for (int k = 0; k < STAGING_POOL_CLASS_COUNT; k ++) {
+        struct staging_block_s **link = &pool->free_list[k];
+
+        while (*link && (*link)->released > threshold)
+            link = &(*link)->next;
+
+        // everything past this point is even older
+        struct staging_block_s *blk = *link;
+        *link = NULL;
+        while (blk) {
+            struct staging_block_s *next = blk->next;
+            pool->cached_bytes -= class_size(k);
+            free(blk);
+            blk = next;
+        }
+    }
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright © 2013-2014  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef FPP_STAGING_POOL_H
+#define FPP_STAGING_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/// Pool of reusable memory blocks for staging client uploads. Block sizes are rounded up to
+/// power of two classes; released blocks are kept for reuse until pool is trimmed.
+/// Pool does no locking, callers serialize access.
+
+#define STAGING_POOL_MIN_SHIFT      12  ///< smallest class is 4 KiB
+#define STAGING_POOL_CLASS_COUNT    16  ///< largest class is 128 MiB
+#define STAGING_POOL_MAX_CACHED     (64 * 1024 * 1024)  ///< max total size of cached blocks
+
+struct staging_block_s;
+
+struct staging_pool_s {
+    struct staging_block_s *free_list[STAGING_POOL_CLASS_COUNT];
+    size_t                  cached_bytes;   ///< total size of blocks in free lists
+};
+
+void
+staging_pool_init(struct staging_pool_s *pool);
+
+/// releases all cached blocks. Blocks still in use should not be returned afterwards
+void
+staging_pool_destroy(struct staging_pool_s *pool);
+
+/// returns block of at least |size| bytes, or NULL on failure
+void *
+staging_pool_alloc(struct staging_pool_s *pool, size_t size);
+
+/// returns block to the pool
+void
+staging_pool_free(struct staging_pool_s *pool, void *ptr);
+
+/// frees cached blocks which were not reused for |max_idle_ms| milliseconds
+void
+staging_pool_trim(struct staging_pool_s *pool, int64_t max_idle_ms);
+
+#endif // FPP_STAGING_POOL_H
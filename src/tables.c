@@ -32,6 +32,7 @@
 #include "p2n_proxy_class.h"
 #include "n2p_proxy_class.h"
 #include "config.h"
+#include "egl_pool.h"
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 
@@ -263,6 +264,7 @@ tables_close_display(void)
 {
     pthread_mutex_lock(&display.lock);
     XFreeCursor(display.x, display.transparent_cursor);
+    egl_pool_purge();
     eglTerminate(display.egl);
     XCloseDisplay(display.x);
     pthread_mutex_unlock(&display.lock);
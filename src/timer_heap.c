@@ -0,0 +1,119 @@
+/*
+ * Copyright © 2013-2014  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "timer_heap.h"
+#include <glib.h>
+
+
+#define INITIAL_CAPACITY    64
+
+static
+int
+node_less(const struct timer_heap_node_s *a, const struct timer_heap_node_s *b)
+{
+    if (a->when.tv_sec != b->when.tv_sec)
+        return a->when.tv_sec < b->when.tv_sec;
+    if (a->when.tv_nsec != b->when.tv_nsec)
+        return a->when.tv_nsec < b->when.tv_nsec;
+    return a->seq < b->seq;
+}
+
+struct timer_heap_s *
+timer_heap_new(void)
+{
+    return g_slice_alloc0(sizeof(struct timer_heap_s));
+}
+
+void
+timer_heap_free(struct timer_heap_s *heap)
+{
+    if (!heap)
+        return;
+    g_free(heap->nodes);
+    g_slice_free1(sizeof(*heap), heap);
+}
+
+void
+timer_heap_push(struct timer_heap_s *heap, struct timespec when, void *data)
+{
+    if (heap->count == heap->capacity) {
+        heap->capacity = heap->capacity ? heap->capacity * 2 : INITIAL_CAPACITY;
+        heap->nodes = g_renew(struct timer_heap_node_s, heap->nodes, heap->capacity);
+    }
+
+    const struct timer_heap_node_s node = {
+        .when = when,
+        .seq =  heap->next_seq ++,
+        .data = data,
+    };
+
+    // sift up
+    size_t k = heap->count ++;
+    while (k > 0) {
+        size_t parent = (k - 1) / 2;
+        if (!node_less(&node, &heap->nodes[parent]))
+            break;
+        heap->nodes[k] = heap->nodes[parent];
+        k = parent;
+    }
+    heap->nodes[k] = node;
+}
+
+void *
+timer_heap_peek(const struct timer_heap_s *heap, struct timespec *when)
+{
+    if (heap->count == 0)
+        return NULL;
+    if (when)
+        *when = heap->nodes[0].when;
+    return heap->nodes[0].data;
+}
+
+void *
+timer_heap_pop(struct timer_heap_s *heap)
+{
+    if (heap->count == 0)
+        return NULL;
+
+    void *data = heap->nodes[0].data;
+    const struct timer_heap_node_s last = heap->nodes[-- heap->count];
+
+    // sift down the last node from the root
+    size_t k = 0;
+    while (1) {
+        size_t child = 2 * k + 1;
+        if (child >= heap->count)
+            break;
+        if (child + 1 < heap->count && node_less(&heap->nodes[child + 1], &heap->nodes[child]))
+            child ++;
+        if (!node_less(&heap->nodes[child], &last))
+            break;
+        heap->nodes[k] = heap->nodes[child];
+        k = child;
+    }
+    if (heap->count > 0)
+        heap->nodes[k] = last;
+
+    return data;
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright © 2013-2014  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef FPP_TIMER_HEAP_H
+#define FPP_TIMER_HEAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+
+/// Binary min-heap of opaque items ordered by deadline. Items with equal deadlines come out
+/// in order they were pushed. Push and pop are O(log n), peek is O(1).
+/// Heap does no locking, callers serialize access.
+
+struct timer_heap_node_s {
+    struct timespec when;
+    uint64_t        seq;            ///< push order, breaks ties between equal deadlines
+    void           *data;
+};
+
+struct timer_heap_s {
+    struct timer_heap_node_s   *nodes;
+    size_t                      count;
+    size_t                      capacity;
+    uint64_t                    next_seq;
+};
+
+struct timer_heap_s *
+timer_heap_new(void);
+
+/// frees heap itself; items still in it are not touched
+void
+timer_heap_free(struct timer_heap_s *heap);
+
+void
+timer_heap_push(struct timer_heap_s *heap, struct timespec when, void *data);
+
+/// returns item with the earliest deadline without removing it, or NULL if heap is empty.
+/// Deadline is stored to |when| if it's not NULL
+void *
+timer_heap_peek(const struct timer_heap_s *heap, struct timespec *when);
+
+/// removes and returns item with the earliest deadline, or NULL if heap is empty
+void *
+timer_heap_pop(struct timer_heap_s *heap);
+
+static inline
+size_t
+timer_heap_size(const struct timer_heap_s *heap)
+{
+    return heap->count;
+}
+
+#endif // FPP_TIMER_HEAP_H
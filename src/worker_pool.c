@@ -0,0 +1,218 @@
+/*
+ * Copyright © 2013-2014  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "worker_pool.h"
+#include <glib.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+#include <ppapi/c/pp_errors.h>
+#include "config.h"
+#include "ppb_message_loop.h"
+#include "trace.h"
+
+
+// jobs which waited in queue longer than that are reported
+#define SLOW_WAIT_NS    (1000ULL * 1000 * 1000)
+
+struct job_s {
+    worker_pool_func                func;
+    void                           *user_data;
+    PP_Resource                     message_loop;
+    struct PP_CompletionCallback    callback;
+    uint64_t                        submitted;
+};
+
+struct class_s {
+    const char                 *name;
+    pthread_mutex_t             lock;
+    pthread_cond_t              cond;
+    GQueue                      jobs;
+    unsigned int                idle;           ///< threads waiting for a job
+    struct worker_pool_stats_s  stats;
+};
+
+static struct class_s   classes[WORKER_POOL_CLASS_COUNT] = {
+    [WORKER_POOL_FILE] = { .name = "file" },
+};
+static pthread_once_t   init_once = PTHREAD_ONCE_INIT;
+
+
+static
+uint64_t
+now_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static
+void
+do_initialize(void)
+{
+    const int limits[WORKER_POOL_CLASS_COUNT] = {
+        [WORKER_POOL_FILE] = config.worker_pool_file_threads,
+    };
+
+    for (int k = 0; k < WORKER_POOL_CLASS_COUNT; k ++) {
+        struct class_s *c = &classes[k];
+        pthread_mutex_init(&c->lock, NULL);
+        pthread_cond_init(&c->cond, NULL);
+        g_queue_init(&c->jobs);
+        c->stats.max_threads = MAX(limits[k], 1);
+    }
+}
+
+static
+void *
+worker_thread(void *param)
+{
+    struct class_s *c = param;
+
+    pthread_mutex_lock(&c->lock);
+    while (1) {
+        struct job_s *job = g_queue_pop_head(&c->jobs);
+        if (!job) {
+            c->idle ++;
+            pthread_cond_wait(&c->cond, &c->lock);
+            c->idle --;
+            continue;
+        }
+
+        const uint64_t waited = now_ns() - job->submitted;
+        c->stats.queued --;
+        c->stats.running ++;
+        c->stats.total_wait_ns += waited;
+        c->stats.max_wait_ns = MAX(c->stats.max_wait_ns, waited);
+        const unsigned int queued = c->stats.queued;
+        pthread_mutex_unlock(&c->lock);
+
+        if (waited > SLOW_WAIT_NS) {
+            trace_warning("%s, %s job waited for %d ms, %u more in queue\n", __func__, c->name,
+                          (int)(waited / 1000000), queued);
+        }
+
+        int32_t result = job->func(job->user_data);
+
+        // stats are up to date by the time completion is delivered
+        pthread_mutex_lock(&c->lock);
+        c->stats.running --;
+        c->stats.completed ++;
+        pthread_mutex_unlock(&c->lock);
+
+        ppb_message_loop_post_work_with_result(job->message_loop, job->callback, 0, result, 0);
+        g_slice_free(struct job_s, job);
+        pthread_mutex_lock(&c->lock);
+    }
+
+    return NULL;
+}
+
+int32_t
+worker_pool_submit(enum worker_pool_class_e cls, worker_pool_func func, void *user_data,
+                   PP_Resource message_loop, struct PP_CompletionCallback callback)
+{
+    if (cls < 0 || cls >= WORKER_POOL_CLASS_COUNT || !func) {
+        trace_error("%s, bad arguments\n", __func__);
+        return PP_ERROR_BADARGUMENT;
+    }
+
+    // blocking call, nothing to wait for
+    if (callback.func == NULL)
+        return func(user_data);
+
+    pthread_once(&init_once, do_initialize);
+
+    if (message_loop == 0)
+        message_loop = ppb_message_loop_get_for_main_thread();
+
+    struct class_s *c = &classes[cls];
+    struct job_s *job = g_slice_alloc(sizeof(*job));
+    job->func = func;
+    job->user_data = user_data;
+    job->message_loop = message_loop;
+    job->callback = callback;
+    job->submitted = now_ns();
+
+    pthread_mutex_lock(&c->lock);
+    g_queue_push_tail(&c->jobs, job);
+    c->stats.queued ++;
+
+    if (c->idle > 0) {
+        pthread_cond_signal(&c->cond);
+    } else if (c->stats.threads < c->stats.max_threads) {
+        pthread_t t;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        if (pthread_create(&t, &attr, worker_thread, c) == 0) {
+            c->stats.threads ++;
+        } else if (c->stats.threads == 0) {
+            // no thread will ever pick the job up
+            g_queue_remove(&c->jobs, job);
+            c->stats.queued --;
+            pthread_mutex_unlock(&c->lock);
+            pthread_attr_destroy(&attr);
+            g_slice_free(struct job_s, job);
+            trace_error("%s, can't start %s worker thread\n", __func__, c->name);
+            return PP_ERROR_FAILED;
+        }
+        pthread_attr_destroy(&attr);
+    }
+    pthread_mutex_unlock(&c->lock);
+
+    return PP_OK_COMPLETIONPENDING;
+}
+
+void
+worker_pool_get_stats(enum worker_pool_class_e cls, struct worker_pool_stats_s *stats)
+{
+    if (cls < 0 || cls >= WORKER_POOL_CLASS_COUNT || !stats)
+        return;
+
+    pthread_once(&init_once, do_initialize);
+
+    struct class_s *c = &classes[cls];
+    pthread_mutex_lock(&c->lock);
+    *stats = c->stats;
+    pthread_mutex_unlock(&c->lock);
+}
+
+void
+worker_pool_report_stats(void)
+{
+    if (!config.message_loop_stats)
+        return;
+
+    for (int k = 0; k < WORKER_POOL_CLASS_COUNT; k ++) {
+        struct worker_pool_stats_s st;
+        worker_pool_get_stats(k, &st);
+        trace_error("worker pool %s: %" PRIu64 " jobs, %u/%u threads, %u running, %u queued, "
+                    "wait avg %" PRIu64 " us, max %" PRIu64 " us\n", classes[k].name,
+                    st.completed, st.threads, st.max_threads, st.running, st.queued,
+                    st.completed ? st.total_wait_ns / st.completed / 1000 : 0,
+                    st.max_wait_ns / 1000);
+    }
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright © 2013-2014  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef FPP_WORKER_POOL_H
+#define FPP_WORKER_POOL_H
+
+#include <stdint.h>
+#include <ppapi/c/pp_completion_callback.h>
+#include <ppapi/c/pp_resource.h>
+
+
+/// Pool of threads for blocking work. For now its only user is PPB_FileIO, whose operations
+/// run in WORKER_POOL_FILE class. Other PPAPI calls either are synchronous by contract, or
+/// don't block (DNS and sockets are driven by event loops), so they don't go through the pool.
+/// Each class has its own queue and thread limit; a new kind of blocking work should get a class
+/// of its own, so it can't starve file operations. Threads are started on demand and are never
+/// stopped.
+
+enum worker_pool_class_e {
+    WORKER_POOL_FILE = 0,       ///< PPB_FileIO operations
+    WORKER_POOL_CLASS_COUNT,
+};
+
+typedef int32_t (*worker_pool_func)(void *user_data);
+
+struct worker_pool_stats_s {
+    unsigned int    max_threads;
+    unsigned int    threads;
+    unsigned int    running;        ///< jobs being run now
+    unsigned int    queued;         ///< jobs waiting for a thread
+    uint64_t        completed;
+    uint64_t        total_wait_ns;  ///< time completed jobs spent in queue
+    uint64_t        max_wait_ns;
+};
+
+/// runs |func| on a thread of class |cls|, then posts |callback| to |message_loop| with value
+/// returned by |func| as a result. If |message_loop| is 0, main thread loop is used.
+/// If |callback| is blocking (func == NULL), |func| is run on the calling thread and its result
+/// is returned. Otherwise PP_OK_COMPLETIONPENDING is returned.
+int32_t
+worker_pool_submit(enum worker_pool_class_e cls, worker_pool_func func, void *user_data,
+                   PP_Resource message_loop, struct PP_CompletionCallback callback);
+
+void
+worker_pool_get_stats(enum worker_pool_class_e cls, struct worker_pool_stats_s *stats);
+
+/// prints queue statistics of all classes if message_loop_stats is enabled in config
+void
+worker_pool_report_stats(void);
+
+#endif // FPP_WORKER_POOL_H
@@ -0,0 +1,160 @@
+#undef NDEBUG
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <src/audio_backend_null.c>
+
+
+#define SAMPLE_RATE     48000
+#define PERIOD_FRAMES   256
+#define SIGNAL_FRAMES   1000    ///< not a multiple of period, so last write is a partial one
+#define WAIT_MS         100
+
+static int file_seq;
+
+static
+uint32_t
+get_le(const uint8_t *p, int size)
+{
+    uint32_t value = 0;
+    for (int k = 0; k < size; k ++)
+        value |= (uint32_t)p[k] << (8 * k);
+    return value;
+}
+
+static
+void
+make_signal(void *buf, enum audio_format_e format)
+{
+    for (int k = 0; k < SIGNAL_FRAMES; k ++) {
+        double v = sin(2 * M_PI * k / 100);
+        if (format == AUDIO_FORMAT_FLOAT) {
+            ((float *)buf)[2 * k + 0] = v;
+            ((float *)buf)[2 * k + 1] = -v;
+        } else {
+            ((int16_t *)buf)[2 * k + 0] = lrint(v * 16000);
+            ((int16_t *)buf)[2 * k + 1] = lrint(-v * 16000);
+        }
+    }
+}
+
+/// plays signal through "wav" backend, and returns contents of resulting file
+static
+uint8_t *
+record(enum audio_format_e format, const void *signal, size_t *file_size)
+{
+    unsigned int rate = SAMPLE_RATE;
+    unsigned int period = PERIOD_FRAMES;
+    enum audio_format_e fmt = format;
+    struct audio_stream_s *s = audio_backend_wav.open(&rate, &fmt, &period);
+    assert(s);
+    assert(rate == SAMPLE_RATE && fmt == format && period == PERIOD_FRAMES);
+
+    const size_t frame_size = 2 * audio_format_sample_size(format);
+    int done = 0;
+    while (done < SIGNAL_FRAMES) {
+        assert(audio_backend_wav.wait_avail(s, WAIT_MS) > 0);
+        int ret = audio_backend_wav.write(s, (const char *)signal + done * frame_size,
+                                          SIGNAL_FRAMES - done);
+        assert(ret >= 0);
+        done += ret;
+    }
+    audio_backend_wav.close(s);
+
+    char *fname = g_strdup_printf("%s-%d-%d.wav", config.audio_wav_path, (int)getpid(),
+                                  file_seq ++);
+    gchar *contents;
+    gsize len;
+    assert(g_file_get_contents(fname, &contents, &len, NULL));
+    unlink(fname);
+    g_free(fname);
+
+    *file_size = len;
+    return (uint8_t *)contents;
+}
+
+static
+void
+check_fmt(const uint8_t *f, enum audio_format_e format, uint32_t fmt_size)
+{
+    const uint32_t sample_size = audio_format_sample_size(format);
+
+    assert(memcmp(f + 0, "RIFF", 4) == 0);
+    assert(memcmp(f + 8, "WAVE", 4) == 0);
+    assert(memcmp(f + 12, "fmt ", 4) == 0);
+    assert(get_le(f + 16, 4) == fmt_size);
+    assert(get_le(f + 20, 2) == (format == AUDIO_FORMAT_FLOAT ? 3 : 1));
+    assert(get_le(f + 22, 2) == 2);
+    assert(get_le(f + 24, 4) == SAMPLE_RATE);
+    assert(get_le(f + 28, 4) == SAMPLE_RATE * 2 * sample_size);
+    assert(get_le(f + 32, 2) == 2 * sample_size);
+    assert(get_le(f + 34, 2) == 8 * sample_size);
+}
+
+static
+void
+test_s16(void)
+{
+    int16_t signal[SIGNAL_FRAMES * 2];
+    make_signal(signal, AUDIO_FORMAT_S16);
+
+    size_t len;
+    uint8_t *f = record(AUDIO_FORMAT_S16, signal, &len);
+    const uint32_t data_size = sizeof(signal);
+
+    assert(len == 44 + data_size);
+    check_fmt(f, AUDIO_FORMAT_S16, 16);
+    assert(get_le(f + 4, 4) == len - 8);
+    assert(memcmp(f + 36, "data", 4) == 0);
+    assert(get_le(f + 40, 4) == data_size);
+    assert(memcmp(f + 44, signal, data_size) == 0);
+
+    g_free(f);
+}
+
+static
+void
+test_float(void)
+{
+    float signal[SIGNAL_FRAMES * 2];
+    make_signal(signal, AUDIO_FORMAT_FLOAT);
+
+    size_t len;
+    uint8_t *f = record(AUDIO_FORMAT_FLOAT, signal, &len);
+    const uint32_t data_size = sizeof(signal);
+
+    // non-PCM format requires cbSize field, and "fact" chunk with frame count
+    assert(len == 58 + data_size);
+    check_fmt(f, AUDIO_FORMAT_FLOAT, 18);
+    assert(get_le(f + 4, 4) == len - 8);
+    assert(get_le(f + 36, 2) == 0);
+    assert(memcmp(f + 38, "fact", 4) == 0);
+    assert(get_le(f + 42, 4) == 4);
+    assert(get_le(f + 46, 4) == SIGNAL_FRAMES);
+    assert(memcmp(f + 50, "data", 4) == 0);
+    assert(get_le(f + 54, 4) == data_size);
+    assert(memcmp(f + 58, signal, data_size) == 0);
+
+    g_free(f);
+}
+
+int
+main(void)
+{
+    char dir_template[] = "/tmp/fpp-test-wav-XXXXXX";
+    char *dir = mkdtemp(dir_template);
+    assert(dir);
+    config.audio_wav_path = g_strdup_printf("%s/audio", dir);
+
+    test_s16();
+    test_float();
+
+    rmdir(dir);
+    g_free(config.audio_wav_path);
+
+    printf("pass\n");
+    return 0;
+}
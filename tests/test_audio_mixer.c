@@ -0,0 +1,214 @@
+/*
+ * Copyright © 2013-2014  Rinat Ibragimov
+ *
+ * This file is part of FreshPlayerPlugin.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+#include <src/audio_mixer.c>
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+
+
+#define RATE        48000
+#define FRAMES      1024
+
+static
+void
+push(struct audio_mixer_source_s *src, float value, size_t frames)
+{
+    float buf[2];
+
+    buf[0] = value;
+    buf[1] = -value;
+    for (size_t k = 0; k < frames; k ++)
+        assert(spsc_ring_write(src->ring, buf, sizeof(buf)) == sizeof(buf));
+}
+
+static
+void
+init_source(struct audio_mixer_source_s *src, uint32_t watermark)
+{
+    memset(src, 0, sizeof(*src));
+    src->ring = spsc_ring_new(8 * FRAMES * AUDIO_MIXER_FRAME_SIZE);
+    src->watermark = watermark;
+    src->gain = 1.0f;
+}
+
+static
+void
+test_saturation(void)
+{
+    struct audio_mixer_source_s a, b;
+    int16_t out[2 * FRAMES];
+
+    printf("saturation\n");
+    init_source(&a, 0);
+    init_source(&b, 0);
+    audio_mixer_add_source(&a);
+    audio_mixer_add_source(&b);
+    push(&a, 0.75f, FRAMES);
+    push(&b, 0.75f, FRAMES);
+
+    mix_sources(&mixer, FRAMES);
+    // fade-in is over, sum is out of range
+    assert(fabsf(mixer.mix[2 * (FRAMES - 1)] - 1.5f) < 1e-5);
+    assert(fabsf(mixer.mix[2 * (FRAMES - 1) + 1] + 1.5f) < 1e-5);
+
+    // clipped instead of wrapping around
+    audio_format_from_float(mixer.mix, 2 * FRAMES, AUDIO_FORMAT_S16, out);
+    assert(out[2 * (FRAMES - 1)] == 32767);
+    assert(out[2 * (FRAMES - 1) + 1] == -32768);
+    for (size_t k = 0; k < FRAMES; k ++)
+        assert(out[2 * k] >= 0 && out[2 * k + 1] <= 0);
+
+    a.removing = b.removing = 1;
+    mix_sources(&mixer, FRAMES);
+    assert(a.removed && b.removed);
+    assert(mixer.sources == NULL);
+    spsc_ring_free(a.ring);
+    spsc_ring_free(b.ring);
+}
+
+static
+void
+test_fade_in_and_out(void)
+{
+    struct audio_mixer_source_s a;
+    const size_t fade_frames = FADE_MS * RATE / 1000;
+
+    printf("fade in and out\n");
+    init_source(&a, 512);
+    audio_mixer_add_source(&a);
+
+    // silent until watermark is reached, ring is left intact
+    push(&a, 0.5f, 256);
+    mix_sources(&mixer, FRAMES);
+    assert(!a.primed);
+    assert(spsc_ring_readable(a.ring) == 256 * AUDIO_MIXER_FRAME_SIZE);
+    for (size_t k = 0; k < 2 * FRAMES; k ++)
+        assert(mixer.mix[k] == 0.0f);
+
+    push(&a, 0.5f, 2 * FRAMES - 256);
+    mix_sources(&mixer, FRAMES);
+    assert(a.primed);
+    assert(mixer.mix[0] > 0.0f && mixer.mix[0] < 0.01f);
+    for (size_t k = 1; k < FRAMES; k ++)
+        assert(mixer.mix[2 * k] >= mixer.mix[2 * (k - 1)]);
+    assert(fabsf(mixer.mix[2 * (fade_frames + 1)] - 0.5f) < 1e-5);
+    assert(a.underruns == 0);
+
+    // removal ramps down, rest of the ring is not played
+    a.removing = 1;
+    mix_sources(&mixer, FRAMES);
+    assert(a.removed);
+    assert(mixer.sources == NULL);
+    assert(fabsf(mixer.mix[0] - 0.5f) < 0.01f);
+    for (size_t k = 1; k < FRAMES; k ++)
+        assert(mixer.mix[2 * k] <= mixer.mix[2 * (k - 1)]);
+    assert(mixer.mix[2 * (fade_frames + 1)] == 0.0f);
+
+    spsc_ring_free(a.ring);
+}
+
+static
+void
+test_gain_and_underrun(void)
+{
+    struct audio_mixer_source_s a;
+
+    printf("gain and underrun\n");
+    init_source(&a, 0);
+    audio_mixer_add_source(&a);
+    audio_mixer_set_gain(&a, 0.5f);
+    push(&a, 0.8f, FRAMES);
+    mix_sources(&mixer, FRAMES);
+    assert(fabsf(mixer.mix[2 * (FRAMES - 1)] - 0.4f) < 1e-5);
+
+    // ring ran dry: counted, and source fades in again afterwards
+    push(&a, 0.8f, FRAMES / 2);
+    mix_sources(&mixer, FRAMES);
+    assert(a.underruns == 1);
+    assert(a.cur_gain == 0.0f);
+    assert(mixer.mix[2 * (FRAMES - 1)] == 0.0f);
+
+    push(&a, 0.8f, FRAMES);
+    mix_sources(&mixer, FRAMES);
+    assert(mixer.mix[0] < 0.01f);
+    assert(fabsf(mixer.mix[2 * (FRAMES - 1)] - 0.4f) < 1e-5);
+
+    a.removing = 1;
+    mix_sources(&mixer, FRAMES);
+    assert(a.removed);
+    spsc_ring_free(a.ring);
+}
+
+static
+int64_t
+monotonic_ms(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (int64_t)t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+
+static
+void
+test_remove_timeout(void)
+{
+    struct audio_mixer_source_s a;
+
+    printf("remove timeout\n");
+    init_source(&a, 0);
+    audio_mixer_add_source(&a);
+
+    // there is no mixer thread, so removal gives up after timeout measured by monotonic clock
+    int64_t start = monotonic_ms();
+    audio_mixer_remove_source(&a);
+    int64_t elapsed = monotonic_ms() - start;
+    assert(elapsed >= REMOVE_TIMEOUT_MS - 1);
+    assert(elapsed < REMOVE_TIMEOUT_MS + 500);
+    assert(a.removed);
+    assert(mixer.sources == NULL);
+    spsc_ring_free(a.ring);
+}
+
+int
+main(void)
+{
+    // set up mixer state without opening output
+    mixer.rate = RATE;
+    mixer.ramp_step = 1000.0f / (FADE_MS * RATE);
+    mixer.mix = malloc(FRAMES * AUDIO_MIXER_FRAME_SIZE);
+    mixer.tmp = malloc(FRAMES * AUDIO_MIXER_FRAME_SIZE);
+
+    test_saturation();
+    test_fade_in_and_out();
+    test_gain_and_underrun();
+    test_remove_timeout();
+
+    free(mixer.mix);
+    free(mixer.tmp);
+    printf("pass\n");
+    return 0;
+}
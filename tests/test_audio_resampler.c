@@ -0,0 +1,186 @@
+#undef NDEBUG
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <src/audio_resampler.c>
+
+
+#define TONE_HZ         1000.0
+#define AMPLITUDE       16000.0
+
+static
+int16_t *
+make_tone(unsigned int rate, size_t frames)
+{
+    int16_t *buf = malloc(frames * 2 * sizeof(int16_t));
+    for (size_t k = 0; k < frames; k ++) {
+        double v = AMPLITUDE * sin(2 * M_PI * TONE_HZ * k / rate);
+        buf[2 * k + 0] = lrint(v);
+        buf[2 * k + 1] = lrint(-v);
+    }
+    return buf;
+}
+
+/// signal-to-noise ratio of resampled tone against exact tone at output rate, in dB
+static
+double
+tone_snr(unsigned int in_rate, unsigned int out_rate, int quality)
+{
+    const size_t in_frames = in_rate / 2;
+    int16_t *in = make_tone(in_rate, in_frames);
+    struct audio_resampler_s *r = audio_resampler_new(in_rate, out_rate, AUDIO_FORMAT_FLOAT,
+                                                      quality);
+    float *out = malloc(audio_resampler_max_output(r, in_frames) * 2 * sizeof(float));
+    size_t out_frames = audio_resampler_process(r, in, in_frames, out);
+
+    // output lags by half of the filter, so the tail is missing
+    assert(out_frames <= (size_t)in_frames * out_rate / in_rate + 1);
+    assert(out_frames + r->taps * out_rate / in_rate + 2 >= (size_t)in_frames * out_rate / in_rate);
+
+    double signal = 0, noise = 0;
+    // skip filter startup
+    for (size_t k = 100; k < out_frames; k ++) {
+        double ref = AMPLITUDE / 32768.0 * sin(2 * M_PI * TONE_HZ * k / out_rate);
+        signal += ref * ref;
+        noise += (out[2 * k] - ref) * (out[2 * k] - ref);
+        noise += (out[2 * k + 1] + ref) * (out[2 * k + 1] + ref);
+    }
+
+    audio_resampler_free(r);
+    free(out);
+    free(in);
+    return 10 * log10(2 * signal / noise);
+}
+
+/// output of a stream fed in random pieces must not depend on how it was split
+static
+void
+test_chunking(unsigned int in_rate, unsigned int out_rate, int quality)
+{
+    const size_t in_frames = 20000;
+    int16_t *in = make_tone(in_rate, in_frames);
+    struct audio_resampler_s *r1 = audio_resampler_new(in_rate, out_rate, AUDIO_FORMAT_S16,
+                                                       quality);
+    struct audio_resampler_s *r2 = audio_resampler_new(in_rate, out_rate, AUDIO_FORMAT_S16,
+                                                       quality);
+    const size_t out_size = audio_resampler_max_output(r1, in_frames) + 100;
+    int16_t *out1 = malloc(out_size * 2 * sizeof(int16_t));
+    int16_t *out2 = malloc(out_size * 2 * sizeof(int16_t));
+
+    size_t n1 = audio_resampler_process(r1, in, in_frames, out1);
+
+    size_t n2 = 0;
+    size_t ofs = 0;
+    srand(1);
+    while (ofs < in_frames) {
+        size_t chunk = rand() % 700;
+        chunk = MIN(chunk, in_frames - ofs);
+        assert(n2 + audio_resampler_max_output(r2, chunk) <= out_size);
+        n2 += audio_resampler_process(r2, in + 2 * ofs, chunk, out2 + 2 * n2);
+        ofs += chunk;
+    }
+
+    assert(n1 == n2);
+    assert(memcmp(out1, out2, n1 * 2 * sizeof(int16_t)) == 0);
+
+    audio_resampler_free(r1);
+    audio_resampler_free(r2);
+    free(out1);
+    free(out2);
+    free(in);
+}
+
+static
+void
+test_format_conversion(void)
+{
+    const int16_t in[8] = {0, 1, -1, 32767, -32768, 1000, -1000, 12345};
+    int16_t out_s16[8];
+    int32_t out_s32[8];
+    float   out_float[8];
+
+    struct audio_resampler_s *r = audio_resampler_new(44100, 44100, AUDIO_FORMAT_S16, 1);
+    assert(audio_resampler_process(r, in, 4, out_s16) == 4);
+    assert(memcmp(in, out_s16, sizeof(in)) == 0);
+    audio_resampler_free(r);
+
+    r = audio_resampler_new(48000, 48000, AUDIO_FORMAT_S32, 1);
+    assert(audio_resampler_process(r, in, 4, out_s32) == 4);
+    for (int k = 0; k < 8; k ++)
+        assert(out_s32[k] == in[k] * 65536);
+    audio_resampler_free(r);
+
+    r = audio_resampler_new(48000, 48000, AUDIO_FORMAT_FLOAT, 1);
+    assert(audio_resampler_process(r, in, 4, out_float) == 4);
+    for (int k = 0; k < 8; k ++)
+        assert(out_float[k] == in[k] / 32768.0f);
+    assert(out_float[4] == -1.0f);
+    audio_resampler_free(r);
+}
+
+/// full-scale square wave overshoots after filtering; output must saturate, not wrap around
+static
+void
+test_saturation(enum audio_format_e format)
+{
+    const size_t in_frames = 4410;
+    int16_t *in = malloc(in_frames * 2 * sizeof(int16_t));
+    for (size_t k = 0; k < in_frames; k ++)
+        in[2 * k] = in[2 * k + 1] = (k / 20) % 2 ? 32767 : -32768;
+
+    struct audio_resampler_s *r = audio_resampler_new(44100, 48000, format,
+                                                      AUDIO_RESAMPLER_QUALITY_HIGH);
+    size_t max_frames = audio_resampler_max_output(r, in_frames);
+    void *out = malloc(max_frames * 2 * audio_format_sample_size(format));
+    size_t n = audio_resampler_process(r, in, in_frames, out);
+
+    for (size_t k = 30; k < n; k ++) {
+        int64_t v = (format == AUDIO_FORMAT_S16) ? ((int16_t *)out)[2 * k]
+                                                 : ((int32_t *)out)[2 * k] / 65536;
+        // no sign flips from wrapping: sign of output follows sign of the nearest input
+        size_t nearest = (size_t)((double)k * 44100 / 48000 + 0.5);
+        if (nearest % 20 == 10 || nearest % 20 == 0 || nearest % 20 == 19 || nearest % 20 == 9)
+            continue;
+        int positive = (nearest / 20) % 2;
+        assert(positive ? v > 0 : v < 0);
+    }
+
+    audio_resampler_free(r);
+    free(out);
+    free(in);
+}
+
+int
+main(void)
+{
+    assert(audio_format_sample_size(AUDIO_FORMAT_S16) == 2);
+    assert(audio_format_sample_size(AUDIO_FORMAT_S32) == 4);
+    assert(audio_format_sample_size(AUDIO_FORMAT_FLOAT) == 4);
+
+    test_format_conversion();
+
+    // quality levels must be ordered, and all of them usable
+    const unsigned int rates[][2] = { {44100, 48000}, {48000, 44100}, {22050, 48000} };
+    for (unsigned int k = 0; k < sizeof(rates) / sizeof(rates[0]); k ++) {
+        double snr_linear = tone_snr(rates[k][0], rates[k][1], AUDIO_RESAMPLER_QUALITY_LINEAR);
+        double snr_medium = tone_snr(rates[k][0], rates[k][1], AUDIO_RESAMPLER_QUALITY_MEDIUM);
+        double snr_high =   tone_snr(rates[k][0], rates[k][1], AUDIO_RESAMPLER_QUALITY_HIGH);
+        assert(snr_linear > 30);
+        assert(snr_medium > 60);
+        assert(snr_high > 80);
+        assert(snr_medium > snr_linear);
+        assert(snr_high > snr_medium);
+    }
+
+    for (int quality = 0; quality <= 2; quality ++) {
+        test_chunking(44100, 48000, quality);
+        test_chunking(48000, 44100, quality);
+    }
+
+    test_saturation(AUDIO_FORMAT_S16);
+    test_saturation(AUDIO_FORMAT_S32);
+
+    printf("pass\n");
+    return 0;
+}
@@ -0,0 +1,204 @@
+#undef NDEBUG
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <src/gl_cmd_buffer.c>
+
+
+#define CMD_COUNT       3000
+#define MAX_PAYLOAD     (128 * 1024)    ///< large enough for commands to wrap the ring many times
+
+static int      call_log[CMD_COUNT];
+static int      call_count;
+static uint8_t  payload[MAX_PAYLOAD];
+
+// payloads of varying size, so ring end is hit at different offsets
+static
+size_t
+payload_size(int seq)
+{
+    return (size_t)seq * 997 % MAX_PAYLOAD;
+}
+
+// GL calls are replaced with functions that log them, there is no GL context in the test
+
+EGLBoolean
+eglMakeCurrent(EGLDisplay dpy, EGLSurface draw, EGLSurface read, EGLContext ctx)
+{
+    return EGL_TRUE;
+}
+
+void
+glClear(GLbitfield mask)
+{
+    assert(call_count < CMD_COUNT);
+    call_log[call_count ++] = mask;
+}
+
+void
+glBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void *data)
+{
+    assert(call_count < CMD_COUNT);
+    call_log[call_count ++] = offset;
+
+    // payload is a copy, taken at the time of recording
+    const uint8_t *p = data;
+    assert((size_t)size == payload_size(offset));
+    for (GLsizeiptr k = 0; k < size; k ++)
+        assert(p[k] == (uint8_t)(offset + k));
+}
+
+static
+void
+fill_payload(int seq, size_t size)
+{
+    for (size_t k = 0; k < size; k ++)
+        payload[k] = (uint8_t)(seq + k);
+}
+
+/// records a call which writes its sequence number into the log on replay
+static
+struct gl_cmd_s *
+record(struct gl_cmd_buffer_s *cb, int seq)
+{
+    struct gl_cmd_s *cmd;
+
+    if (seq % 2 == 0) {
+        cmd = gl_cmd_buffer_alloc(cb, GLCMD_CLEAR, 0);
+        assert(cmd);
+        cmd->a[0].bf = seq;
+    } else {
+        const size_t size = payload_size(seq);
+        fill_payload(seq, size);
+        cmd = gl_cmd_buffer_alloc(cb, GLCMD_BUFFER_SUB_DATA, size);
+        assert(cmd);
+        cmd->a[0].e = GL_ARRAY_BUFFER;
+        cmd->a[1].ip = seq;
+        cmd->a[2].sp = size;
+        cmd->a[3].p = gl_cmd_buffer_copy_payload(cmd, payload, size);
+
+        // producer is free to reuse client memory right after recording
+        memset(payload, 0, size);
+    }
+
+    // records are aligned, and never cross the end of the ring
+    assert(((char *)cmd - cb->ring) % 8 == 0);
+    assert((char *)cmd + cmd->size <= cb->ring + cb->capacity);
+
+    gl_cmd_buffer_commit(cb, cmd);
+    return cmd;
+}
+
+static
+void
+check_log(int count)
+{
+    assert(call_count == count);
+    for (int k = 0; k < count; k ++)
+        assert(call_log[k] == k);
+}
+
+static
+void
+test_alloc(void)
+{
+    struct gl_cmd_buffer_s *cb = gl_cmd_buffer_create(EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    assert(cb);
+    assert(cb->capacity == GL_CMD_BUFFER_SIZE);
+
+    // header and payload are allocated together, payload follows the header
+    struct gl_cmd_s *cmd = gl_cmd_buffer_alloc(cb, GLCMD_CLEAR, 5);
+    assert(cmd);
+    assert(cmd->op == GLCMD_CLEAR);
+    assert(cmd->size == GL_CMD_ALIGN(sizeof(struct gl_cmd_s) + 5));
+    assert(gl_cmd_buffer_copy_payload(cmd, "abcde", 5) == (void *)(cmd + 1));
+    assert(gl_cmd_buffer_copy_payload(cmd, NULL, 5) == NULL);
+    cmd->a[0].bf = 0;
+    gl_cmd_buffer_commit(cb, cmd);
+
+    // payloads up to a quarter of the ring are accepted
+    cmd = gl_cmd_buffer_alloc(cb, GLCMD_CLEAR, cb->capacity / 4);
+    assert(cmd);
+    cmd->a[0].bf = 1;
+    gl_cmd_buffer_commit(cb, cmd);
+
+    gl_cmd_buffer_sync(cb);
+    check_log(2);
+
+    gl_cmd_buffer_destroy(cb);
+    call_count = 0;
+}
+
+static
+void
+test_wrap_and_order(void)
+{
+    struct gl_cmd_buffer_s *cb = gl_cmd_buffer_create(EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    assert(cb);
+
+    // producer outruns GL thread, and waits for space whenever ring is full
+    int wraps = 0;
+    struct gl_cmd_s *prev = NULL;
+    for (int k = 0; k < CMD_COUNT; k ++) {
+        struct gl_cmd_s *cmd = record(cb, k);
+        if (prev && cmd < prev)
+            wraps ++;
+        prev = cmd;
+    }
+
+    gl_cmd_buffer_sync(cb);
+    assert(wraps > 10);
+    assert(cb->rd == cb->wr);
+
+    // fillers at the end of the ring are skipped, everything else is replayed in order
+    check_log(CMD_COUNT);
+
+    gl_cmd_buffer_destroy(cb);
+    call_count = 0;
+}
+
+static
+void
+test_immediate_fallback(void)
+{
+    struct gl_cmd_buffer_s *cb = gl_cmd_buffer_create(EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    assert(cb);
+
+    int seq = 0;
+    while (seq < 100)
+        record(cb, seq ++);
+
+    // larger payloads, and calls that must not be deferred, are not recorded at all
+    assert(gl_cmd_buffer_alloc(cb, GLCMD_BUFFER_SUB_DATA, cb->capacity / 4 + 1) == NULL);
+    assert(gl_cmd_buffer_alloc(cb, GLCMD_TEX_IMAGE_2D, GL_CMD_IMMEDIATE) == NULL);
+
+    // caller then waits for recorded commands, and makes the call itself, the way
+    // DEFERRED_BEGIN does. Order is preserved
+    gl_cmd_buffer_sync(cb);
+    check_log(seq);
+    glClear(seq ++);
+
+    while (seq < 200)
+        record(cb, seq ++);
+
+    // destroy replays everything that's left
+    gl_cmd_buffer_destroy(cb);
+    check_log(seq);
+    call_count = 0;
+}
+
+int
+main(void)
+{
+    pthread_mutex_init(&display.lock, NULL);
+
+    test_alloc();
+    test_wrap_and_order();
+    test_immediate_fallback();
+
+    pthread_mutex_destroy(&display.lock);
+
+    printf("pass\n");
+    return 0;
+}
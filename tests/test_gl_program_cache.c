@@ -0,0 +1,191 @@
+#undef NDEBUG
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include <src/gl_program_cache.c>
+
+
+static
+char *
+entry_path(struct gl_program_cache_s *cache, const char *key)
+{
+    return g_strdup_printf("%s/%s", cache->dir, key);
+}
+
+static
+void
+set_mtime(struct gl_program_cache_s *cache, const char *key, time_t t)
+{
+    char *path = entry_path(cache, key);
+    struct timespec times[2] = { { .tv_sec = t }, { .tv_sec = t } };
+    assert(utimensat(AT_FDCWD, path, times, 0) == 0);
+    g_free(path);
+}
+
+static
+int
+entry_exists(struct gl_program_cache_s *cache, const char *key)
+{
+    char *path = entry_path(cache, key);
+    int ret = g_file_test(path, G_FILE_TEST_EXISTS);
+    g_free(path);
+    return ret;
+}
+
+int
+main(void)
+{
+    char tmpl[] = "/tmp/fpp-program-cache-XXXXXX";
+    char *base = mkdtemp(tmpl);
+    assert(base);
+    char *dir = g_strdup_printf("%s/nested/cache", base);
+
+    // each entry takes header + payload bytes, cache fits four 1000-byte entries only
+    const size_t entry_size = sizeof(struct entry_header_s) + 1000;
+    struct gl_program_cache_s *cache = gl_program_cache_open(dir, 4 * entry_size + 100);
+    assert(cache);
+    assert(g_file_test(dir, G_FILE_TEST_IS_DIR));
+
+    // ===
+    // keys are stable, and depend on part boundaries
+    char k1[GL_PROGRAM_CACHE_KEY_LEN + 1];
+    char k2[GL_PROGRAM_CACHE_KEY_LEN + 1];
+    char k3[GL_PROGRAM_CACHE_KEY_LEN + 1];
+    char k4[GL_PROGRAM_CACHE_KEY_LEN + 1];
+    char k5[GL_PROGRAM_CACHE_KEY_LEN + 1];
+    const char *parts1[] = { "driver", "void main(){}", NULL };
+    const char *parts2[] = { "drive", "rvoid main(){}", NULL };
+    const char *parts3[] = { "driver", "void main(){ }", NULL };
+    const char *parts4[] = { "driver", "void main(){  }", NULL };
+    const char *parts5[] = { "driver", "void main(){   }", NULL };
+    gl_program_cache_key(k1, parts1);
+    gl_program_cache_key(k2, parts2);
+    gl_program_cache_key(k3, parts3);
+    gl_program_cache_key(k4, parts4);
+    gl_program_cache_key(k5, parts5);
+    assert(strlen(k1) == GL_PROGRAM_CACHE_KEY_LEN);
+    assert(strcmp(k1, k2) != 0);
+    assert(strcmp(k1, k3) != 0);
+
+    char k1_again[GL_PROGRAM_CACHE_KEY_LEN + 1];
+    gl_program_cache_key(k1_again, parts1);
+    assert(strcmp(k1, k1_again) == 0);
+
+    // ===
+    // round trip
+    char payload[1000];
+    for (size_t k = 0; k < sizeof(payload); k ++)
+        payload[k] = (char)(k * 7);
+
+    GLenum format = 0;
+    size_t size = 0;
+    assert(gl_program_cache_load(cache, k1, &format, &size) == NULL);
+    assert(!gl_program_cache_contains(cache, k1));
+
+    assert(gl_program_cache_store(cache, k1, 0x1234, payload, sizeof(payload)) == 0);
+    assert(gl_program_cache_contains(cache, k1));
+    char *data = gl_program_cache_load(cache, k1, &format, &size);
+    assert(data);
+    assert(format == 0x1234);
+    assert(size == sizeof(payload));
+    assert(memcmp(data, payload, size) == 0);
+    free(data);
+
+    // ===
+    // damaged entry is detected and removed
+    char *path = entry_path(cache, k1);
+    FILE *fp = fopen(path, "r+b");
+    assert(fp);
+    fseek(fp, sizeof(struct entry_header_s) + 10, SEEK_SET);
+    fputc(payload[10] ^ 0x55, fp);
+    fclose(fp);
+    assert(gl_program_cache_load(cache, k1, &format, &size) == NULL);
+    assert(!entry_exists(cache, k1));
+
+    // truncated one too
+    assert(gl_program_cache_store(cache, k1, 0x1234, payload, sizeof(payload)) == 0);
+    assert(truncate(path, entry_size - 1) == 0);
+    assert(gl_program_cache_load(cache, k1, &format, &size) == NULL);
+    assert(!entry_exists(cache, k1));
+    g_free(path);
+
+    // ===
+    // size estimate is off after external truncation, reopening rescans the directory
+    gl_program_cache_close(cache);
+    cache = gl_program_cache_open(dir, 4 * entry_size + 100);
+    assert(cache);
+    assert(cache->total_size == 0);
+
+    // ===
+    // least recently used entries are evicted down to three quarters of the limit
+    const time_t now = time(NULL);
+    assert(gl_program_cache_store(cache, k1, 1, payload, sizeof(payload)) == 0);
+    assert(gl_program_cache_store(cache, k2, 2, payload, sizeof(payload)) == 0);
+    assert(gl_program_cache_store(cache, k3, 3, payload, sizeof(payload)) == 0);
+    assert(gl_program_cache_store(cache, k4, 4, payload, sizeof(payload)) == 0);
+    set_mtime(cache, k1, now - 400);
+    set_mtime(cache, k2, now - 300);
+    set_mtime(cache, k3, now - 200);
+    set_mtime(cache, k4, now - 100);
+
+    // hit makes k1 the most recently used
+    data = gl_program_cache_load(cache, k1, &format, &size);
+    assert(data);
+    free(data);
+
+    // overwriting an entry doesn't count twice
+    assert(gl_program_cache_store(cache, k4, 4, payload, sizeof(payload)) == 0);
+    set_mtime(cache, k4, now - 100);
+    assert(entry_exists(cache, k2));
+    assert(cache->total_size == 4 * entry_size);
+
+    assert(gl_program_cache_store(cache, k5, 5, payload, sizeof(payload)) == 0);
+    assert(entry_exists(cache, k1));
+    assert(!entry_exists(cache, k2));
+    assert(!entry_exists(cache, k3));
+    assert(entry_exists(cache, k4));
+    assert(entry_exists(cache, k5));
+    assert(cache->total_size == 3 * entry_size);
+
+    // ===
+    // entries larger than the whole cache are not stored
+    char *huge = calloc(5 * entry_size, 1);
+    assert(gl_program_cache_store(cache, k2, 1, huge, 5 * entry_size) != 0);
+    assert(!entry_exists(cache, k2));
+    free(huge);
+
+    // ===
+    // reopening with a smaller limit trims the cache
+    set_mtime(cache, k1, now - 30);
+    set_mtime(cache, k4, now - 20);
+    set_mtime(cache, k5, now - 10);
+    gl_program_cache_close(cache);
+    cache = gl_program_cache_open(dir, 2 * entry_size + 100);
+    assert(cache);
+    assert(!entry_exists(cache, k1));
+    assert(!entry_exists(cache, k4));
+    assert(entry_exists(cache, k5));
+    assert(cache->total_size == entry_size);
+
+    // ===
+    // empty entries work as markers
+    assert(gl_program_cache_store(cache, k3, 0, "", 0) == 0);
+    assert(gl_program_cache_contains(cache, k3));
+
+    gl_program_cache_remove(cache, k3);
+    gl_program_cache_remove(cache, k5);
+    assert(cache->total_size == 0);
+    gl_program_cache_close(cache);
+    assert(rmdir(dir) == 0);
+    g_free(dir);
+    dir = g_strdup_printf("%s/nested", base);
+    assert(rmdir(dir) == 0);
+    assert(rmdir(base) == 0);
+    g_free(dir);
+
+    printf("pass\n");
+    return 0;
+}
@@ -0,0 +1,91 @@
+#undef NDEBUG
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <src/mpsc_queue.c>
+
+
+#define PRODUCERS       4
+#define ITEMS_EACH      200000
+#define CHAIN_LENGTH    5
+
+struct item_s {
+    struct mpsc_node_s  node;       // must be the first
+    int                 producer;
+    int                 seq;
+};
+
+static struct mpsc_queue_s *q;
+static struct item_s        items[PRODUCERS][ITEMS_EACH];
+
+static
+void *
+producer(void *param)
+{
+    const int id = (int)(size_t)param;
+
+    for (int k = 0; k < ITEMS_EACH; k += CHAIN_LENGTH) {
+        for (int j = k; j < k + CHAIN_LENGTH; j ++) {
+            items[id][j].producer = id;
+            items[id][j].seq = j;
+        }
+
+        if (id % 2 == 0) {
+            for (int j = k; j < k + CHAIN_LENGTH; j ++)
+                mpsc_queue_push(q, &items[id][j].node);
+        } else {
+            for (int j = k; j < k + CHAIN_LENGTH - 1; j ++)
+                items[id][j].node.next = &items[id][j + 1].node;
+            mpsc_queue_push_chain(q, &items[id][k].node, &items[id][k + CHAIN_LENGTH - 1].node);
+        }
+    }
+
+    return NULL;
+}
+
+int
+main(void)
+{
+    q = mpsc_queue_new();
+
+    // ===
+    // single thread, FIFO order
+    struct item_s a, b, c;
+    assert(mpsc_queue_pop(q) == NULL);
+    mpsc_queue_push(q, &a.node);
+    assert(mpsc_queue_pop(q) == &a.node);
+    assert(mpsc_queue_pop(q) == NULL);
+    mpsc_queue_push(q, &a.node);
+    b.node.next = &c.node;
+    mpsc_queue_push_chain(q, &b.node, &c.node);
+    assert(mpsc_queue_pop(q) == &a.node);
+    assert(mpsc_queue_pop(q) == &b.node);
+    assert(mpsc_queue_pop(q) == &c.node);
+    assert(mpsc_queue_pop(q) == NULL);
+
+    // ===
+    // concurrent producers, every item comes out once, and in order for each producer
+    pthread_t t[PRODUCERS];
+    for (int k = 0; k < PRODUCERS; k ++)
+        pthread_create(&t[k], NULL, producer, (void *)(size_t)k);
+
+    int next_seq[PRODUCERS] = {};
+    int total = 0;
+    while (total < PRODUCERS * ITEMS_EACH) {
+        struct item_s *it = (struct item_s *)mpsc_queue_pop(q);
+        if (!it)
+            continue;
+        assert(it->seq == next_seq[it->producer]);
+        next_seq[it->producer] ++;
+        total ++;
+    }
+
+    for (int k = 0; k < PRODUCERS; k ++)
+        pthread_join(t[k], NULL);
+    assert(mpsc_queue_pop(q) == NULL);
+
+    mpsc_queue_free(q);
+    printf("pass\n");
+    return 0;
+}
@@ -0,0 +1,121 @@
+#undef NDEBUG
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <src/ppb_audio.c>
+#include <src/ppb_audio_config.h>
+
+
+#define INSTANCE_ID             42
+#define SAMPLE_FRAMES           512
+#define MIN_CALLBACKS           4
+#define MAX_TEARDOWN_MS         200     ///< fade-out, plus a few periods of output buffer
+#define MAX_TEARDOWN_CPU_MS     5
+#define SETTLE_MS               50
+#define TEST_TIMEOUT_SEC        10
+
+static struct pp_instance_s instance;
+static int                  callbacks;
+
+static
+int64_t
+clock_ms(clockid_t clock_id)
+{
+    struct timespec t;
+    clock_gettime(clock_id, &t);
+    return (int64_t)t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+
+static
+void
+audio_callback(void *sample_buffer, uint32_t buffer_size_in_bytes, PP_TimeDelta latency,
+               void *user_data)
+{
+    memset(sample_buffer, 0, buffer_size_in_bytes);
+    __atomic_add_fetch(&callbacks, 1, __ATOMIC_SEQ_CST);
+}
+
+static
+int
+get_callbacks(void)
+{
+    return __atomic_load_n(&callbacks, __ATOMIC_SEQ_CST);
+}
+
+static
+void
+wait_for_callbacks(void)
+{
+    const int target = get_callbacks() + MIN_CALLBACKS;
+    while (get_callbacks() < target)
+        usleep(1000);
+}
+
+// callback thread must be gone once call returns, and waiting for it must not spin
+static
+void
+check_teardown(PP_Resource audio, int destroy)
+{
+    int64_t wall_start = clock_ms(CLOCK_MONOTONIC);
+    int64_t cpu_start = clock_ms(CLOCK_THREAD_CPUTIME_ID);
+    if (destroy)
+        pp_resource_unref(audio);
+    else
+        assert(ppb_audio_stop_playback(audio) == PP_TRUE);
+    int64_t cpu_spent = clock_ms(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+    int64_t wall_spent = clock_ms(CLOCK_MONOTONIC) - wall_start;
+
+    assert(wall_spent <= MAX_TEARDOWN_MS);
+    assert(cpu_spent <= MAX_TEARDOWN_CPU_MS);
+
+    const int count = get_callbacks();
+    usleep(SETTLE_MS * 1000);
+    assert(get_callbacks() == count);
+}
+
+int
+main(void)
+{
+    // hangs are turned into failures
+    alarm(TEST_TIMEOUT_SEC);
+    config.audio_backend = "null";
+    config.audio_buffer_min_ms = 20;
+    config.audio_buffer_max_ms = 500;
+    config.audio_fill_ahead_ms = 60;
+
+    tables_add_pp_instance(INSTANCE_ID, &instance);
+    PP_Resource audio_config =
+        ppb_audio_config_create_stereo_16_bit(INSTANCE_ID, PP_AUDIOSAMPLERATE_48000,
+                                              SAMPLE_FRAMES);
+    assert(audio_config);
+    PP_Resource audio = ppb_audio_create_1_1(INSTANCE_ID, audio_config, audio_callback, NULL);
+    assert(audio);
+
+    // ===
+    // stop
+    assert(ppb_audio_start_playback(audio) == PP_TRUE);
+    wait_for_callbacks();
+    check_teardown(audio, 0);
+
+    // stopped stream can be started again
+    assert(ppb_audio_start_playback(audio) == PP_TRUE);
+    wait_for_callbacks();
+    check_teardown(audio, 0);
+
+    // ===
+    // destroy while playing
+    assert(ppb_audio_start_playback(audio) == PP_TRUE);
+    wait_for_callbacks();
+    check_teardown(audio, 1);
+    assert(!ppb_audio_is_audio(audio));
+
+    pp_resource_unref(audio_config);
+    tables_remove_pp_instance(INSTANCE_ID);
+
+    printf("pass\n");
+    return 0;
+}
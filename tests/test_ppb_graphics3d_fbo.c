@@ -0,0 +1,151 @@
+#undef NDEBUG
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <src/ppb_graphics3d.c>
+#include <src/ppb_opengles2.h>
+
+
+#define INSTANCE_ID     42
+#define WIDTH           64
+#define HEIGHT          32
+#define NEW_WIDTH       40
+#define NEW_HEIGHT      24
+#define SKIP_CODE       77      ///< ctest reports test as skipped, see tests/CMakeLists.txt
+
+static struct pp_instance_s instance;
+
+/// clears frame to blue, then bottom left quadrant to red
+static
+void
+draw_frame(PP_Resource context, int width, int height)
+{
+    ppb_opengles2_ClearColor(context, 0.0, 0.0, 1.0, 1.0);
+    ppb_opengles2_Clear(context, GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    ppb_opengles2_Enable(context, GL_SCISSOR_TEST);
+    ppb_opengles2_Scissor(context, 0, 0, width / 2, height / 2);
+    ppb_opengles2_ClearColor(context, 1.0, 0.0, 0.0, 1.0);
+    ppb_opengles2_Clear(context, GL_COLOR_BUFFER_BIT);
+    ppb_opengles2_Disable(context, GL_SCISSOR_TEST);
+}
+
+/// does the same readback SwapBuffers does, and converts result into g3d->fbo.image
+static
+struct pp_graphics3d_s *
+read_frame(PP_Resource context, int premultiply)
+{
+    struct pp_graphics3d_s *g3d = pp_resource_acquire(context, PP_RESOURCE_GRAPHICS3D);
+    assert(g3d);
+
+    pthread_mutex_lock(&display.lock);
+    eglMakeCurrent(display.egl, g3d->egl_surf, g3d->egl_surf, g3d->glc);
+    fbo_start_readback(g3d);
+    glFinish();
+    eglMakeCurrent(display.egl, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    assert(ppb_graphics3d_fbo_fetch_frame(g3d, premultiply) == 0);
+    pthread_mutex_unlock(&display.lock);
+
+    return g3d;
+}
+
+static
+void
+check_pixel(const struct pp_graphics3d_s *g3d, int x, int y, uint32_t bgra)
+{
+    const uint8_t *p = (const uint8_t *)g3d->fbo.image + y * g3d->fbo.stride + x * 4;
+    for (int k = 0; k < 4; k ++) {
+        const int expected = (bgra >> (8 * (3 - k))) & 0xff;
+        assert(abs(p[k] - expected) <= 1);
+    }
+}
+
+/// checks image is top-down BGRA, with red quadrant at the bottom left
+static
+void
+check_frame(PP_Resource context, int width, int height)
+{
+    const uint32_t red = 0x0000ffff;
+    const uint32_t blue = 0xff0000ff;
+    struct pp_graphics3d_s *g3d = read_frame(context, 0);
+
+    assert(g3d->width == width && g3d->height == height);
+    assert(g3d->fbo.stride == width * 4);
+
+    for (int y = 0; y < height; y ++) {
+        for (int x = 0; x < width; x ++) {
+            const int in_quadrant = (x < width / 2 && y >= height - height / 2);
+            check_pixel(g3d, x, y, in_quadrant ? red : blue);
+        }
+    }
+
+    pp_resource_release(context);
+}
+
+int
+main(void)
+{
+    // llvmpipe renders the same everywhere, no matter which GPU is present
+    setenv("LIBGL_ALWAYS_SOFTWARE", "1", 1);
+    config.graphics3d_backend = "fbo";
+    config.gl_command_buffer = 0;
+
+    if (tables_open_display() != 0) {
+        // X server is required for EGL, run under Xvfb
+        printf("skip, no X display\n");
+        return SKIP_CODE;
+    }
+
+    instance.id = INSTANCE_ID;
+    tables_add_pp_instance(INSTANCE_ID, &instance);
+
+    const int32_t attribs[] = {
+        PP_GRAPHICS3DATTRIB_WIDTH,          WIDTH,
+        PP_GRAPHICS3DATTRIB_HEIGHT,         HEIGHT,
+        PP_GRAPHICS3DATTRIB_ALPHA_SIZE,     8,
+        PP_GRAPHICS3DATTRIB_DEPTH_SIZE,     24,
+        PP_GRAPHICS3DATTRIB_NONE,
+    };
+    PP_Resource context = ppb_graphics3d_create(INSTANCE_ID, 0, attribs);
+    assert(context);
+
+    // ===
+    // frame goes to offscreen framebuffer, and is read back
+    struct pp_graphics3d_s *g3d = pp_resource_acquire(context, PP_RESOURCE_GRAPHICS3D);
+    assert(g3d);
+    assert(g3d->backend == G3D_BACKEND_FBO);
+    assert(g3d->fbo.id != 0 && g3d->fbo.depth_rb != 0);
+    pp_resource_release(context);
+
+    draw_frame(context, WIDTH, HEIGHT);
+    check_frame(context, WIDTH, HEIGHT);
+
+    // ===
+    // binding framebuffer 0 by plugin means binding the FBO
+    ppb_opengles2_BindFramebuffer(context, GL_FRAMEBUFFER, 0);
+    draw_frame(context, WIDTH, HEIGHT);
+    check_frame(context, WIDTH, HEIGHT);
+
+    // ===
+    // storage is reallocated on resize, framebuffer stays complete
+    assert(ppb_graphics3d_resize_buffers(context, NEW_WIDTH, NEW_HEIGHT) == PP_OK);
+    ppb_opengles2_Viewport(context, 0, 0, NEW_WIDTH, NEW_HEIGHT);
+    draw_frame(context, NEW_WIDTH, NEW_HEIGHT);
+    check_frame(context, NEW_WIDTH, NEW_HEIGHT);
+
+    // ===
+    // premultiplication of semi-transparent frame
+    ppb_opengles2_ClearColor(context, 1.0, 0.5, 0.0, 0.5);
+    ppb_opengles2_Clear(context, GL_COLOR_BUFFER_BIT);
+    g3d = read_frame(context, 1);
+    check_pixel(g3d, 0, 0, 0x00408080);
+    check_pixel(g3d, NEW_WIDTH - 1, NEW_HEIGHT - 1, 0x00408080);
+    pp_resource_release(context);
+
+    pp_resource_unref(context);
+    tables_remove_pp_instance(INSTANCE_ID);
+    tables_close_display();
+
+    printf("pass\n");
+    return 0;
+}
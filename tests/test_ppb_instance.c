@@ -0,0 +1,102 @@
+#undef NDEBUG
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <src/ppb_instance.c>
+#include <src/ppb_message_loop.h>
+#include <ppapi/c/pp_errors.h>
+
+
+#define INSTANCE_ID     42
+#define WIDTH           100
+#define HEIGHT          50
+
+static struct pp_instance_s instance;
+static struct _NPP          npp;
+static int                  invalidate_calls;
+static NPRect               invalidated;
+
+static
+void
+fake_pluginthreadasynccall(NPP npp, void (*func)(void *), void *user_data)
+{
+    func(user_data);
+}
+
+static
+void
+fake_invalidaterect(NPP npp, NPRect *rect)
+{
+    invalidate_calls ++;
+    invalidated = *rect;
+}
+
+static
+void
+fake_forceredraw(NPP npp)
+{
+}
+
+/// requests invalidate of |rect|, and checks browser was asked to repaint the given area
+static
+void
+check_invalidate(const struct PP_Rect *rect, int left, int top, int right, int bottom)
+{
+    const int prev_calls = invalidate_calls;
+    ppb_instance_request_invalidate(INSTANCE_ID, rect);
+    assert(invalidate_calls == prev_calls + 1);
+    assert(invalidated.left == left && invalidated.top == top);
+    assert(invalidated.right == right && invalidated.bottom == bottom);
+
+    // expose
+    ppb_instance_invalidate_serviced(INSTANCE_ID);
+    assert(invalidate_calls == prev_calls + 1);
+}
+
+int
+main(void)
+{
+    npn.pluginthreadasynccall = fake_pluginthreadasynccall;
+    npn.invalidaterect = fake_invalidaterect;
+    npn.forceredraw = fake_forceredraw;
+
+    instance.npp = &npp;
+    instance.width = WIDTH;
+    instance.height = HEIGHT;
+    tables_add_pp_instance(INSTANCE_ID, &instance);
+
+    // browser loop is not running, calls go through NPN_PluginThreadAsyncCall
+    PP_Resource loop = ppb_message_loop_create(INSTANCE_ID);
+    assert(ppb_message_loop_attach_to_current_thread(loop) == PP_OK);
+    assert(ppb_message_loop_proclaim_this_thread_browser() == PP_OK);
+
+    // ===
+    // whole instance
+    check_invalidate(NULL, 0, 0, WIDTH, HEIGHT);
+
+    // ===
+    // rect is clipped to instance bounds
+    struct PP_Rect r = PP_MakeRectFromXYWH(-10, 20, 30, 100);
+    check_invalidate(&r, 0, 20, 20, HEIGHT);
+
+    // ===
+    // rect outside of instance still gets an expose, as Graphics2D flush waits for it
+    r = PP_MakeRectFromXYWH(WIDTH + 10, 0, 10, 10);
+    check_invalidate(&r, 0, 0, WIDTH, HEIGHT);
+
+    r = PP_MakeRectFromXYWH(0, 0, 0, 0);
+    check_invalidate(&r, 0, 0, WIDTH, HEIGHT);
+
+    // ===
+    // size is not known before first SetWindow
+    instance.width = 0;
+    instance.height = 0;
+    r = PP_MakeRectFromXYWH(0, 0, 10, 10);
+    check_invalidate(&r, 0, 0, 0, 0);
+
+    pp_resource_unref(loop);
+    tables_remove_pp_instance(INSTANCE_ID);
+
+    printf("pass\n");
+    return 0;
+}
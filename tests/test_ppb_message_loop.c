@@ -0,0 +1,183 @@
+#undef NDEBUG
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <src/ppb_message_loop.c>
+
+
+#define INSTANCE_ID         42
+#define WRITE_DELAY_MS      50
+#define SILENCE_MS          100
+#define BATCH_SIZE          16
+#define TEST_TIMEOUT_SEC    5
+
+static struct pp_instance_s instance;
+static PP_Resource          loop;
+static int                  pipe_fds[2];
+static int                  fd_calls;
+static int                  outer_task_done;
+static int                  batch_ran;
+
+static
+void *
+delayed_write_thread(void *param)
+{
+    (void)param;
+    usleep(WRITE_DELAY_MS * 1000);
+    assert(write(pipe_fds[1], "x", 1) == 1);
+    return NULL;
+}
+
+static
+void
+write_later(pthread_t *t)
+{
+    pthread_create(t, NULL, delayed_write_thread, NULL);
+}
+
+static
+void
+consume_byte(int fd)
+{
+    char c;
+    assert(read(fd, &c, 1) == 1);
+}
+
+// quits loop it's run from
+static
+void
+quit_cb(void *user_data, int32_t result)
+{
+    ppb_message_loop_post_quit(loop, PP_FALSE);
+}
+
+// there are no tasks at all, loop must be woken up by fd alone
+static
+void
+fd_quit_cb(int fd, uint32_t events, void *user_data)
+{
+    assert(events & EPOLLIN);
+    consume_byte(fd);
+    fd_calls ++;
+    assert(ppb_message_loop_unwatch_fd(loop, fd) == PP_OK);
+    ppb_message_loop_post_quit(loop, PP_FALSE);
+}
+
+static
+void
+batch_cb(void *user_data, int32_t result)
+{
+    const int idx = (int)(size_t)user_data;
+    assert(idx == batch_ran);
+    assert(result == idx * 10);
+    if (++ batch_ran == BATCH_SIZE)
+        ppb_message_loop_post_quit(loop, PP_FALSE);
+}
+
+/// number of times loop was signaled since last run. Counter is left as it was
+static
+uint64_t
+peek_wakeups(void)
+{
+    struct pp_message_loop_s *ml = pp_resource_acquire(loop, PP_RESOURCE_MESSAGE_LOOP);
+    assert(ml);
+    uint64_t cnt = 0;
+    if (read(ml->wakeup_fd, &cnt, sizeof(cnt)) == sizeof(cnt))
+        assert(write(ml->wakeup_fd, &cnt, sizeof(cnt)) == sizeof(cnt));
+    pp_resource_release(loop);
+    return cnt;
+}
+
+static
+void
+outer_task_cb(void *user_data, int32_t result)
+{
+    outer_task_done = 1;
+    ppb_message_loop_post_quit(loop, PP_FALSE);
+}
+
+// task of outer loop gets parked while nested loop runs. It must be run after callback returns,
+// even though nothing else is posted
+static
+void
+fd_nested_cb(int fd, uint32_t events, void *user_data)
+{
+    consume_byte(fd);
+    fd_calls ++;
+    assert(ppb_message_loop_unwatch_fd(loop, fd) == PP_OK);
+
+    const int depth = ppb_message_loop_get_depth(loop);
+    ppb_message_loop_post_work_with_result(loop, PP_MakeCCB(outer_task_cb, NULL), 0, PP_OK,
+                                           depth);
+    ppb_message_loop_post_work(loop, PP_MakeCCB(quit_cb, NULL), WRITE_DELAY_MS);
+    ppb_message_loop_run_nested(loop);
+    assert(!outer_task_done);
+}
+
+int
+main(void)
+{
+    // hangs are turned into failures
+    alarm(TEST_TIMEOUT_SEC);
+
+    tables_add_pp_instance(INSTANCE_ID, &instance);
+    loop = ppb_message_loop_create(INSTANCE_ID);
+    assert(loop);
+    assert(ppb_message_loop_attach_to_current_thread(loop) == PP_OK);
+    assert(pipe(pipe_fds) == 0);
+
+    // ===
+    // bad arguments
+    assert(ppb_message_loop_watch_fd(loop, -1, EPOLLIN, fd_quit_cb, NULL) != PP_OK);
+    assert(ppb_message_loop_watch_fd(loop, pipe_fds[0], EPOLLIN, NULL, NULL) != PP_OK);
+    assert(ppb_message_loop_unwatch_fd(loop, pipe_fds[0]) != PP_OK);
+
+    // ===
+    // batch runs in order, with its own results, after a single wakeup
+    struct PP_CompletionCallback ccbs[BATCH_SIZE];
+    int32_t results[BATCH_SIZE];
+    for (int k = 0; k < BATCH_SIZE; k ++) {
+        ccbs[k] = PP_MakeCCB(batch_cb, (void *)(size_t)k);
+        results[k] = k * 10;
+    }
+    assert(ppb_message_loop_post_work_batch(loop, ccbs, results, BATCH_SIZE, 0, 0) == PP_OK);
+    assert(peek_wakeups() == 1);
+    ppb_message_loop_run(loop);
+    assert(batch_ran == BATCH_SIZE);
+
+    // ===
+    // dispatch, and wakeup without tasks
+    pthread_t t;
+    assert(ppb_message_loop_watch_fd(loop, pipe_fds[0], EPOLLIN, fd_quit_cb, NULL) == PP_OK);
+    write_later(&t);
+    ppb_message_loop_run(loop);
+    pthread_join(t, NULL);
+    assert(fd_calls == 1);
+
+    // ===
+    // removed watch doesn't fire
+    assert(write(pipe_fds[1], "x", 1) == 1);
+    ppb_message_loop_post_work(loop, PP_MakeCCB(quit_cb, NULL), SILENCE_MS);
+    ppb_message_loop_run(loop);
+    assert(fd_calls == 1);
+    consume_byte(pipe_fds[0]);
+
+    // ===
+    // tasks parked by nested loop of fd callback are run afterwards
+    assert(ppb_message_loop_watch_fd(loop, pipe_fds[0], EPOLLIN, fd_nested_cb, NULL) == PP_OK);
+    write_later(&t);
+    ppb_message_loop_run(loop);
+    pthread_join(t, NULL);
+    assert(fd_calls == 2);
+    assert(outer_task_done);
+
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    pp_resource_unref(loop);
+    tables_remove_pp_instance(INSTANCE_ID);
+
+    printf("pass\n");
+    return 0;
+}
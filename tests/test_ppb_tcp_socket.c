@@ -0,0 +1,168 @@
+#undef NDEBUG
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <src/ppb_tcp_socket.c>
+
+
+#define INSTANCE_ID         42
+#define WRITE_DELAY_MS      50
+#define TEST_TIMEOUT_SEC    5
+
+static struct pp_instance_s instance;
+static PP_Resource          loop;
+static pthread_t            loop_thread;
+static int                  peer_fd;
+static char                 read_buf[64];
+static int                  completions;
+static int32_t              read_result;
+static int32_t              write_result;
+
+static
+void *
+delayed_write_thread(void *param)
+{
+    usleep(WRITE_DELAY_MS * 1000);
+    assert(write(peer_fd, "hello", 5) == 5);
+    return NULL;
+}
+
+// both results are delivered on the main loop thread, by the loop itself
+static
+void
+read_cb(void *user_data, int32_t result)
+{
+    assert(pthread_equal(pthread_self(), loop_thread));
+    read_result = result;
+    if (++ completions == (int)(size_t)user_data)
+        ppb_message_loop_post_quit(loop, PP_FALSE);
+}
+
+static
+void
+write_cb(void *user_data, int32_t result)
+{
+    assert(pthread_equal(pthread_self(), loop_thread));
+    write_result = result;
+    if (++ completions == (int)(size_t)user_data)
+        ppb_message_loop_post_quit(loop, PP_FALSE);
+}
+
+static
+void
+destroy_socket_cb(void *user_data, int32_t result)
+{
+    pp_resource_unref((PP_Resource)(size_t)user_data);
+}
+
+/// creates socket, connected to |peer_fd|
+static
+PP_Resource
+create_connected_socket(void)
+{
+    int fds[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+    PP_Resource tcp_socket = ppb_tcp_socket_create(INSTANCE_ID);
+    struct pp_tcp_socket_s *ts = pp_resource_acquire(tcp_socket, PP_RESOURCE_TCP_SOCKET);
+    assert(ts);
+    close(ts->sock);
+    ts->sock = fds[0];
+    ts->is_connected = 1;
+    pp_resource_release(tcp_socket);
+
+    peer_fd = fds[1];
+    return tcp_socket;
+}
+
+static
+int
+is_watched(PP_Resource tcp_socket)
+{
+    struct pp_tcp_socket_s *ts = pp_resource_acquire(tcp_socket, PP_RESOURCE_TCP_SOCKET);
+    assert(ts);
+    int watched = ts->watched;
+    pp_resource_release(tcp_socket);
+    return watched;
+}
+
+int
+main(void)
+{
+    // hangs are turned into failures
+    alarm(TEST_TIMEOUT_SEC);
+
+    tables_add_pp_instance(INSTANCE_ID, &instance);
+    loop = ppb_message_loop_create(INSTANCE_ID);
+    assert(loop);
+    assert(ppb_message_loop_attach_to_current_thread(loop) == PP_OK);
+    assert(ppb_message_loop_proclaim_this_thread_main() == PP_OK);
+    loop_thread = pthread_self();
+
+    PP_Resource tcp_socket = create_connected_socket();
+
+    // ===
+    // read waits for data, without any thread in between
+    pthread_t t;
+    assert(ppb_tcp_socket_read(tcp_socket, read_buf, sizeof(read_buf),
+                               PP_MakeCCB(read_cb, (void *)1)) == PP_OK_COMPLETIONPENDING);
+    assert(is_watched(tcp_socket));
+    assert(ppb_tcp_socket_read(tcp_socket, read_buf, sizeof(read_buf),
+                               PP_MakeCCB(read_cb, (void *)1)) == PP_ERROR_INPROGRESS);
+    pthread_create(&t, NULL, delayed_write_thread, NULL);
+    ppb_message_loop_run(loop);
+    pthread_join(t, NULL);
+    assert(read_result == 5);
+    assert(memcmp(read_buf, "hello", 5) == 0);
+    assert(!is_watched(tcp_socket));
+
+    // ===
+    // read and write pending at the same time
+    completions = 0;
+    assert(ppb_tcp_socket_read(tcp_socket, read_buf, sizeof(read_buf),
+                               PP_MakeCCB(read_cb, (void *)2)) == PP_OK_COMPLETIONPENDING);
+    assert(ppb_tcp_socket_write(tcp_socket, "world", 5,
+                                PP_MakeCCB(write_cb, (void *)2)) == PP_OK_COMPLETIONPENDING);
+    pthread_create(&t, NULL, delayed_write_thread, NULL);
+    ppb_message_loop_run(loop);
+    pthread_join(t, NULL);
+    assert(write_result == 5);
+    assert(read_result == 5);
+
+    char buf[8];
+    assert(read(peer_fd, buf, sizeof(buf)) == 5);
+    assert(memcmp(buf, "world", 5) == 0);
+    assert(!is_watched(tcp_socket));
+
+    // ===
+    // end of stream
+    completions = 0;
+    assert(ppb_tcp_socket_read(tcp_socket, read_buf, sizeof(read_buf),
+                               PP_MakeCCB(read_cb, (void *)1)) == PP_OK_COMPLETIONPENDING);
+    close(peer_fd);
+    ppb_message_loop_run(loop);
+    assert(read_result == 0);
+    assert(ppb_tcp_socket_read(tcp_socket, read_buf, sizeof(read_buf),
+                               PP_MakeCCB(read_cb, (void *)1)) == PP_ERROR_FAILED);
+    pp_resource_unref(tcp_socket);
+
+    // ===
+    // pending read is aborted when socket is destroyed
+    tcp_socket = create_connected_socket();
+    completions = 0;
+    assert(ppb_tcp_socket_read(tcp_socket, read_buf, sizeof(read_buf),
+                               PP_MakeCCB(read_cb, (void *)1)) == PP_OK_COMPLETIONPENDING);
+    ppb_message_loop_post_work(loop, PP_MakeCCB(destroy_socket_cb, (void *)(size_t)tcp_socket), 0);
+    ppb_message_loop_run(loop);
+    assert(read_result == PP_ERROR_ABORTED);
+    close(peer_fd);
+
+    pp_resource_unref(loop);
+    tables_remove_pp_instance(INSTANCE_ID);
+
+    printf("pass\n");
+    return 0;
+}
@@ -0,0 +1,103 @@
+#undef NDEBUG
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <src/pp_resource.h>
+
+// every check of the loader state by the waiting thread is counted. Blocking wait checks it once
+// before sleeping and once after being woken up, polling would check it on every iteration
+static __thread int acquire_calls;
+#define pp_resource_acquire(resource, type) (acquire_calls ++, pp_resource_acquire(resource, type))
+
+#include <src/ppb_url_loader.c>
+
+
+#define FINISH_DELAY_MS         200
+#define MAX_WAKEUP_LATENCY_MS   10
+#define MAX_ACQUIRE_CALLS       2
+
+static struct pp_instance_s instance;
+static int64_t              notified_at_ms;
+
+static
+int64_t
+monotonic_time_ms(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (int64_t)t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+
+static
+void *
+finish_loading_thread(void *param)
+{
+    PP_Resource loader = (PP_Resource)(size_t)param;
+    usleep(FINISH_DELAY_MS * 1000);
+
+    struct pp_url_loader_s *ul = pp_resource_acquire(loader, PP_RESOURCE_URL_LOADER);
+    assert(ul);
+    ul->finished_loading = 1;
+    pp_resource_release(loader);
+    __atomic_store_n(&notified_at_ms, monotonic_time_ms(), __ATOMIC_SEQ_CST);
+    ppb_url_loader_notify_finished_loading();
+    return NULL;
+}
+
+static
+void *
+destroy_loader_thread(void *param)
+{
+    PP_Resource loader = (PP_Resource)(size_t)param;
+    usleep(FINISH_DELAY_MS * 1000);
+    __atomic_store_n(&notified_at_ms, monotonic_time_ms(), __ATOMIC_SEQ_CST);
+    pp_resource_unref(loader);
+    return NULL;
+}
+
+static
+void
+test_wait(void *(*helper)(void *))
+{
+    PP_Resource loader = pp_resource_allocate(PP_RESOURCE_URL_LOADER, &instance);
+    struct pp_url_loader_s *ul = pp_resource_acquire(loader, PP_RESOURCE_URL_LOADER);
+    assert(ul);
+    ul->fd = -1;
+    pp_resource_release(loader);
+
+    pthread_t t;
+    pthread_create(&t, NULL, helper, (void *)(size_t)loader);
+
+    // waiting thread must sleep instead of polling the flag, and wake up right after notification
+    acquire_calls = 0;
+    wait_for_finished_loading(loader);
+    int64_t returned_at = monotonic_time_ms();
+
+    pthread_join(t, NULL);
+    assert(acquire_calls <= MAX_ACQUIRE_CALLS);
+    assert(returned_at - __atomic_load_n(&notified_at_ms, __ATOMIC_SEQ_CST) <=
+           MAX_WAKEUP_LATENCY_MS);
+}
+
+int
+main(void)
+{
+    // already finished, returns immediately
+    PP_Resource loader = pp_resource_allocate(PP_RESOURCE_URL_LOADER, &instance);
+    struct pp_url_loader_s *ul = pp_resource_acquire(loader, PP_RESOURCE_URL_LOADER);
+    ul->fd = -1;
+    ul->finished_loading = 1;
+    pp_resource_release(loader);
+    wait_for_finished_loading(loader);
+    pp_resource_unref(loader);
+
+    // stale resource, returns immediately
+    wait_for_finished_loading(loader);
+
+    test_wait(finish_loading_thread);
+    test_wait(destroy_loader_thread);
+
+    printf("pass\n");
+    return 0;
+}
@@ -0,0 +1,142 @@
+#undef NDEBUG
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <src/spsc_ring.c>
+
+
+#define TOTAL_WORDS     2000000
+#define RING_SIZE       1000
+
+static struct spsc_ring_s  *ring;
+
+static
+void *
+producer(void *param)
+{
+    uint32_t    buf[97];
+    uint32_t    next = 0;
+
+    while (next < TOTAL_WORDS) {
+        size_t cnt = MIN(sizeof(buf) / sizeof(buf[0]), TOTAL_WORDS - next);
+        for (size_t k = 0; k < cnt; k ++)
+            buf[k] = next + k;
+
+        size_t written = 0;
+        while (written < cnt * sizeof(uint32_t)) {
+            spsc_ring_wait_writable(ring, sizeof(uint32_t), 1000, spsc_ring_wake_count(ring));
+            written += spsc_ring_write(ring, (char *)buf + written,
+                                       cnt * sizeof(uint32_t) - written);
+        }
+        next += cnt;
+    }
+
+    return NULL;
+}
+
+static
+int64_t
+ms_since(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+static
+void *
+waker(void *param)
+{
+    usleep(50 * 1000);
+    spsc_ring_wake(ring);
+    return NULL;
+}
+
+int
+main(void)
+{
+    char    buf[256];
+
+    // ===
+    // single thread, wrap-around
+    ring = spsc_ring_new(RING_SIZE);
+    assert(spsc_ring_capacity(ring) == 1024);
+    assert(spsc_ring_readable(ring) == 0);
+    assert(spsc_ring_writable(ring) == 1024);
+    assert(spsc_ring_read(ring, buf, sizeof(buf)) == 0);
+
+    for (int k = 0; k < 100; k ++) {
+        for (int j = 0; j < 200; j ++)
+            buf[j] = k + j;
+        assert(spsc_ring_write(ring, buf, 200) == 200);
+        assert(spsc_ring_readable(ring) == 200);
+        memset(buf, 0, sizeof(buf));
+        assert(spsc_ring_read(ring, buf, sizeof(buf)) == 200);
+        for (int j = 0; j < 200; j ++)
+            assert(buf[j] == (char)(k + j));
+    }
+
+    // partial write when full
+    for (int k = 0; k < 4; k ++)
+        assert(spsc_ring_write(ring, buf, 250) == 250);
+    assert(spsc_ring_write(ring, buf, 250) == 24);
+    assert(spsc_ring_writable(ring) == 0);
+    assert(spsc_ring_write(ring, buf, 1) == 0);
+
+    // waiting with timeout
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    assert(spsc_ring_wait_writable(ring, 1, 100, spsc_ring_wake_count(ring)) == 0);
+    assert(ms_since(&start) >= 100);
+
+    // spsc_ring_wake() ends the wait
+    pthread_t t;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_create(&t, NULL, waker, NULL);
+    assert(spsc_ring_wait_writable(ring, 1, 5000, spsc_ring_wake_count(ring)) == 0);
+    assert(ms_since(&start) < 2000);
+    pthread_join(t, NULL);
+
+    // wake issued between taking the count and starting the wait is not lost
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int wake_count = spsc_ring_wake_count(ring);
+    spsc_ring_wake(ring);
+    assert(spsc_ring_wait_writable(ring, 1, 5000, wake_count) == 0);
+    assert(spsc_ring_wait_readable(ring, spsc_ring_capacity(ring) + 1, 5000, wake_count) ==
+           spsc_ring_capacity(ring));
+    assert(ms_since(&start) < 100);
+
+    // while earlier wakes don't cut later waits short
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    assert(spsc_ring_wait_writable(ring, 1, 100, spsc_ring_wake_count(ring)) == 0);
+    assert(ms_since(&start) >= 100);
+    spsc_ring_free(ring);
+
+    // ===
+    // two threads, data must arrive intact and in order
+    ring = spsc_ring_new(RING_SIZE);
+    pthread_create(&t, NULL, producer, NULL);
+
+    uint32_t expected = 0;
+    uint32_t word;
+    size_t   partial = 0;
+    while (expected < TOTAL_WORDS) {
+        spsc_ring_wait_readable(ring, 1, 1000, spsc_ring_wake_count(ring));
+        size_t got = spsc_ring_read(ring, (char *)&word + partial, sizeof(word) - partial);
+        partial += got;
+        if (partial == sizeof(word)) {
+            assert(word == expected);
+            expected ++;
+            partial = 0;
+        }
+    }
+    pthread_join(t, NULL);
+    assert(spsc_ring_readable(ring) == 0);
+    spsc_ring_free(ring);
+
+    printf("pass\n");
+    return 0;
+}
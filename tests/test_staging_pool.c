@@ -0,0 +1,56 @@
+#undef NDEBUG
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <src/staging_pool.c>
+
+int
+main(void)
+{
+    struct staging_pool_s pool;
+    staging_pool_init(&pool);
+
+    // ===
+    char *p1 = staging_pool_alloc(&pool, 100);
+    assert(p1);
+    assert(((uintptr_t)p1 & 15) == 0);
+    memset(p1, 0xaa, 4096);     // whole class is usable
+    staging_pool_free(&pool, p1);
+    assert(pool.cached_bytes == 4096);
+
+    // same class reuses the block
+    char *p2 = staging_pool_alloc(&pool, 4000);
+    assert(p2 == p1);
+    assert(pool.cached_bytes == 0);
+
+    // next class gets another one
+    char *p3 = staging_pool_alloc(&pool, 4097);
+    assert(p3 && p3 != p2);
+    staging_pool_free(&pool, p2);
+    staging_pool_free(&pool, p3);
+    assert(pool.cached_bytes == 4096 + 8192);
+
+    // ===
+    // recently used blocks survive trimming, idle ones don't
+    staging_pool_trim(&pool, 60 * 1000);
+    assert(pool.cached_bytes == 4096 + 8192);
+    staging_pool_trim(&pool, -1);
+    assert(pool.cached_bytes == 0);
+    assert(pool.free_list[0] == NULL);
+    assert(pool.free_list[1] == NULL);
+
+    // ===
+    // blocks larger than largest class are not cached
+    const size_t huge = class_size(STAGING_POOL_CLASS_COUNT - 1) + 1;
+    char *p4 = staging_pool_alloc(&pool, huge);
+    assert(p4);
+    staging_pool_free(&pool, p4);
+    assert(pool.cached_bytes == 0);
+
+    staging_pool_free(&pool, NULL);
+    staging_pool_destroy(&pool);
+
+    printf("pass\n");
+    return 0;
+}
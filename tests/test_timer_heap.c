@@ -0,0 +1,83 @@
+#undef NDEBUG
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <src/timer_heap.c>
+
+
+static
+struct timespec
+ts(time_t sec, long nsec)
+{
+    struct timespec t = { .tv_sec = sec, .tv_nsec = nsec };
+    return t;
+}
+
+int
+main(void)
+{
+    struct timer_heap_s *heap = timer_heap_new();
+    int items[1000];
+
+    assert(timer_heap_peek(heap, NULL) == NULL);
+    assert(timer_heap_pop(heap) == NULL);
+
+    // ===
+    // items come out ordered by deadline
+    timer_heap_push(heap, ts(2, 0), &items[2]);
+    timer_heap_push(heap, ts(1, 500), &items[1]);
+    timer_heap_push(heap, ts(1, 0), &items[0]);
+    timer_heap_push(heap, ts(3, 0), &items[3]);
+    assert(timer_heap_size(heap) == 4);
+
+    struct timespec when;
+    assert(timer_heap_peek(heap, &when) == &items[0]);
+    assert(when.tv_sec == 1 && when.tv_nsec == 0);
+    for (int k = 0; k < 4; k ++)
+        assert(timer_heap_pop(heap) == &items[k]);
+    assert(timer_heap_size(heap) == 0);
+
+    // ===
+    // equal deadlines keep push order
+    for (int k = 0; k < 100; k ++)
+        timer_heap_push(heap, ts(5, 5), &items[k]);
+    timer_heap_push(heap, ts(4, 0), &items[100]);
+    assert(timer_heap_pop(heap) == &items[100]);
+    for (int k = 0; k < 50; k ++)
+        assert(timer_heap_pop(heap) == &items[k]);
+    // pushed later, but with the same deadline, goes after the rest
+    timer_heap_push(heap, ts(5, 5), &items[101]);
+    for (int k = 50; k < 100; k ++)
+        assert(timer_heap_pop(heap) == &items[k]);
+    assert(timer_heap_pop(heap) == &items[101]);
+    assert(timer_heap_pop(heap) == NULL);
+
+    // ===
+    // random deadlines, interleaved pushes and pops
+    srand(42);
+    struct timespec last = ts(0, 0);
+    int pushed = 0, popped = 0;
+    while (popped < 1000) {
+        if (pushed < 1000 && (rand() % 3 != 0 || timer_heap_size(heap) == 0)) {
+            // deadlines never go before last popped one, as in a real loop
+            const long nsec = last.tv_nsec + rand() % 3 * 300 * 1000 * 1000;
+            struct timespec t = ts(last.tv_sec + rand() % 2 + nsec / 1000000000,
+                                   nsec % 1000000000);
+            timer_heap_push(heap, t, &items[pushed ++]);
+        } else {
+            assert(timer_heap_peek(heap, &when) != NULL);
+            assert(when.tv_sec > last.tv_sec ||
+                   (when.tv_sec == last.tv_sec && when.tv_nsec >= last.tv_nsec));
+            last = when;
+            assert(timer_heap_pop(heap) != NULL);
+            popped ++;
+        }
+    }
+    assert(timer_heap_size(heap) == 0);
+
+    timer_heap_free(heap);
+
+    printf("pass\n");
+    return 0;
+}
@@ -0,0 +1,129 @@
+#undef NDEBUG
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <src/worker_pool.c>
+#include <src/pp_resource.h>
+#include <src/tables.h>
+
+
+#define INSTANCE_ID         42
+#define THREAD_LIMIT        2
+#define JOB_COUNT           8
+#define JOB_DURATION_MS     20
+#define TEST_TIMEOUT_SEC    5
+
+static struct pp_instance_s instance;
+static PP_Resource          loop;
+static pthread_t            loop_thread;
+static int                  running;
+static int                  max_running;
+static int                  completed;
+static int                  results[JOB_COUNT];
+
+static
+int32_t
+job_func(void *user_data)
+{
+    int now_running = __sync_add_and_fetch(&running, 1);
+    int prev_max;
+    while ((prev_max = max_running) < now_running)
+        __sync_bool_compare_and_swap(&max_running, prev_max, now_running);
+
+    // jobs must not run on the submitting thread
+    assert(!pthread_equal(pthread_self(), loop_thread));
+
+    usleep(JOB_DURATION_MS * 1000);
+    __sync_sub_and_fetch(&running, 1);
+    return (int32_t)(size_t)user_data;
+}
+
+static
+int32_t
+inline_job_func(void *user_data)
+{
+    return pthread_equal(pthread_self(), loop_thread) ? (int32_t)(size_t)user_data : -1;
+}
+
+static
+void
+completion_cb(void *user_data, int32_t result)
+{
+    // delivered to the loop of the submitter, with job's return value
+    assert(ppb_message_loop_get_current() == loop);
+    assert(result == (int32_t)(size_t)user_data);
+    results[result] ++;
+
+    if (++ completed == JOB_COUNT)
+        ppb_message_loop_post_quit(loop, PP_FALSE);
+}
+
+static
+void
+submit_jobs_cb(void *user_data, int32_t result)
+{
+    for (int k = 0; k < JOB_COUNT; k ++) {
+        void *idx = (void *)(size_t)k;
+        int32_t ret = worker_pool_submit(WORKER_POOL_FILE, job_func, idx, 0,
+                                         PP_MakeCCB(completion_cb, idx));
+        assert(ret == PP_OK_COMPLETIONPENDING);
+    }
+}
+
+int
+main(void)
+{
+    // hangs are turned into failures
+    alarm(TEST_TIMEOUT_SEC);
+    config.worker_pool_file_threads = THREAD_LIMIT;
+
+    tables_add_pp_instance(INSTANCE_ID, &instance);
+    loop = ppb_message_loop_create(INSTANCE_ID);
+    assert(loop);
+    assert(ppb_message_loop_attach_to_current_thread(loop) == PP_OK);
+    assert(ppb_message_loop_proclaim_this_thread_main() == PP_OK);
+    loop_thread = pthread_self();
+
+    // ===
+    // bad arguments
+    assert(worker_pool_submit(WORKER_POOL_CLASS_COUNT, job_func, NULL, 0,
+                              PP_MakeCCB(completion_cb, NULL)) == PP_ERROR_BADARGUMENT);
+    assert(worker_pool_submit(WORKER_POOL_FILE, NULL, NULL, 0,
+                              PP_MakeCCB(completion_cb, NULL)) == PP_ERROR_BADARGUMENT);
+
+    // ===
+    // blocking callback runs job inline
+    struct PP_CompletionCallback blocking = { .func = NULL };
+    assert(worker_pool_submit(WORKER_POOL_FILE, inline_job_func, (void *)7, 0, blocking) == 7);
+
+    // ===
+    // concurrency is limited, and every completion reaches the loop exactly once
+    ppb_message_loop_post_work(loop, PP_MakeCCB(submit_jobs_cb, NULL), 0);
+    ppb_message_loop_run(loop);
+
+    assert(completed == JOB_COUNT);
+    for (int k = 0; k < JOB_COUNT; k ++)
+        assert(results[k] == 1);
+    assert(max_running == THREAD_LIMIT);
+
+    // ===
+    // stats
+    struct worker_pool_stats_s st;
+    worker_pool_get_stats(WORKER_POOL_FILE, &st);
+    assert(st.max_threads == THREAD_LIMIT);
+    assert(st.threads == THREAD_LIMIT);
+    assert(st.completed == JOB_COUNT);
+    assert(st.queued == 0);
+
+    // jobs beyond the limit had to wait for at least one other job
+    assert(st.max_wait_ns >= (JOB_DURATION_MS - 1) * 1000000ULL);
+    assert(st.total_wait_ns >= st.max_wait_ns);
+
+    pp_resource_unref(loop);
+    tables_remove_pp_instance(INSTANCE_ID);
+
+    printf("pass\n");
+    return 0;
+}